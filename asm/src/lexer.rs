@@ -0,0 +1,222 @@
+//! ShyISA 汇编的字节级词法分析。
+//!
+//! 直接在输入缓冲区（通常是 `shyfile` mmap 出来的整个源文件）上切 token，
+//! token 只借用输入里的字节，不复制源码。汇编语法以行为单位，所以 lexer
+//! 每次产出一行的 token；注释和空行在这里就被跳过。
+//!
+//! - `//` 到行尾、`/* ... */` 都是注释；跨行的块注释相当于一次换行。
+//! - `"..."` 是字符串，内容原样保留（包括转义序列），转义的 `\"` 不结束字符串。
+//! - 以 `{` 或 `[` 开头的 token 一直延伸到对应的 `}` / `]`，内容原样保留。
+//! - 其他 token 是连续的非空白字节，遇到字符串或注释开头时结束。
+
+use anyhow::{Context, Result, bail};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Tok<'a> {
+    /// 普通 token：助记符、寄存器、数字、symbol、`name(addend)`、指令等。
+    Word(&'a str),
+    /// 字符串字面量引号之间的原始字节。
+    Str(&'a [u8]),
+    /// `{...}` 或 `[...]`：开括号和括号之间的原始内容。
+    List(u8, &'a str),
+}
+
+pub struct Lexer<'a> {
+    src: &'a [u8],
+    pos: usize,
+    /// 当前所在的源码行号，从 1 开始。
+    line: usize,
+}
+
+fn is_space(c: u8) -> bool {
+    matches!(c, b' ' | b'\t' | b'\r' | b'\x0b' | b'\x0c')
+}
+
+impl<'a> Lexer<'a> {
+    pub fn new(src: &'a [u8]) -> Self {
+        Lexer {
+            src,
+            pos: 0,
+            line: 1,
+        }
+    }
+
+    /// 已经读到的源码行号，报错时用来定位。
+    pub fn line(&self) -> usize {
+        self.line
+    }
+
+    fn peek(&self, off: usize) -> Option<u8> {
+        self.src.get(self.pos + off).copied()
+    }
+
+    fn str_at(&self, start: usize, end: usize) -> Result<&'a str> {
+        std::str::from_utf8(&self.src[start..end])
+            .with_context(|| format!("第 {} 行包含无效的 UTF-8", self.line))
+    }
+
+    /// 跳过块注释。返回注释里是否有换行。
+    fn skip_block_comment(&mut self) -> Result<bool> {
+        let start_line = self.line;
+        self.pos += 2;
+        let mut newline = false;
+        loop {
+            match self.peek(0) {
+                None => bail!("第 {start_line} 行的块注释没有结束"),
+                Some(b'*') if self.peek(1) == Some(b'/') => {
+                    self.pos += 2;
+                    return Ok(newline);
+                }
+                Some(b'\n') => {
+                    self.line += 1;
+                    newline = true;
+                }
+                _ => {}
+            }
+            self.pos += 1;
+        }
+    }
+
+    /// 读取下一个非空源码行的 token，放进 `out`（先清空）。输入结束时返回 `false`。
+    pub fn next_line(&mut self, out: &mut Vec<Tok<'a>>) -> Result<bool> {
+        out.clear();
+        loop {
+            let Some(c) = self.peek(0) else {
+                return Ok(!out.is_empty());
+            };
+            match c {
+                b'\n' => {
+                    self.pos += 1;
+                    self.line += 1;
+                    if !out.is_empty() {
+                        return Ok(true);
+                    }
+                }
+                _ if is_space(c) => self.pos += 1,
+                b'/' if self.peek(1) == Some(b'/') => {
+                    while self.peek(0).is_some_and(|c| c != b'\n') {
+                        self.pos += 1;
+                    }
+                }
+                b'/' if self.peek(1) == Some(b'*') => {
+                    if self.skip_block_comment()? && !out.is_empty() {
+                        return Ok(true);
+                    }
+                }
+                b'"' => out.push(self.string()?),
+                b'{' | b'[' => out.push(self.list(c)?),
+                _ => out.push(self.word()?),
+            }
+        }
+    }
+
+    fn string(&mut self) -> Result<Tok<'a>> {
+        self.pos += 1;
+        let start = self.pos;
+        loop {
+            match self.peek(0) {
+                None | Some(b'\n') => bail!("第 {} 行的字符串没有结束", self.line),
+                Some(b'\\') if self.peek(1).is_some_and(|c| c != b'\n') => self.pos += 2,
+                Some(b'"') => break,
+                _ => self.pos += 1,
+            }
+        }
+        let s = &self.src[start..self.pos];
+        self.pos += 1;
+        Ok(Tok::Str(s))
+    }
+
+    fn list(&mut self, open: u8) -> Result<Tok<'a>> {
+        let close = if open == b'{' { b'}' } else { b']' };
+        self.pos += 1;
+        let start = self.pos;
+        loop {
+            match self.peek(0) {
+                None | Some(b'\n') => {
+                    bail!("第 {} 行缺少 `{}`", self.line, close as char)
+                }
+                Some(c) if c == close => break,
+                _ => self.pos += 1,
+            }
+        }
+        let s = self.str_at(start, self.pos)?;
+        self.pos += 1;
+        Ok(Tok::List(open, s))
+    }
+
+    fn word(&mut self) -> Result<Tok<'a>> {
+        let start = self.pos;
+        while let Some(c) = self.peek(0) {
+            if c == b'\n' || is_space(c) || c == b'"' {
+                break;
+            }
+            if c == b'/' && matches!(self.peek(1), Some(b'/' | b'*')) {
+                break;
+            }
+            self.pos += 1;
+        }
+        Ok(Tok::Word(self.str_at(start, self.pos)?))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{Lexer, Tok};
+
+    fn lines(src: &str) -> Vec<Vec<Tok<'_>>> {
+        let mut lexer = Lexer::new(src.as_bytes());
+        let mut out = Vec::new();
+        let mut line = Vec::new();
+        while lexer.next_line(&mut line).unwrap() {
+            out.push(line.clone());
+        }
+        out
+    }
+
+    #[test]
+    fn splits_lines_into_tokens() {
+        assert_eq!(
+            lines("  setn sp 0x10\n\n\tjmpn loop(12)\nloop:"),
+            vec![
+                vec![Tok::Word("setn"), Tok::Word("sp"), Tok::Word("0x10")],
+                vec![Tok::Word("jmpn"), Tok::Word("loop(12)")],
+                vec![Tok::Word("loop:")],
+            ]
+        );
+    }
+
+    #[test]
+    fn skips_comments_and_keeps_strings_and_lists() {
+        let src = "a 1 // x\n/* one\n two */ b\nmsg \"x // y \\\" z\" /* c */ {1, 2} [3]\nc/*x*/d";
+        assert_eq!(
+            lines(src),
+            vec![
+                vec![Tok::Word("a"), Tok::Word("1")],
+                vec![Tok::Word("b")],
+                vec![
+                    Tok::Word("msg"),
+                    Tok::Str(br#"x // y \" z"#),
+                    Tok::List(b'{', "1, 2"),
+                    Tok::List(b'[', "3"),
+                ],
+                vec![Tok::Word("c"), Tok::Word("d")],
+            ]
+        );
+    }
+
+    #[test]
+    fn multiline_block_comment_ends_the_line() {
+        assert_eq!(
+            lines("a /* x\n y */ b"),
+            vec![vec![Tok::Word("a")], vec![Tok::Word("b")]]
+        );
+    }
+
+    #[test]
+    fn reports_unterminated_tokens() {
+        let mut line = Vec::new();
+        assert!(Lexer::new(b"\"abc\n").next_line(&mut line).is_err());
+        assert!(Lexer::new(b"x {1, 2\n").next_line(&mut line).is_err());
+        assert!(Lexer::new(b"/* abc").next_line(&mut line).is_err());
+    }
+}
@@ -0,0 +1,4 @@
+//! ShyISA 汇编器。`shyasm` 可执行文件和 `shycc` 驱动共用这里的实现。
+
+pub mod lexer;
+pub mod parser;
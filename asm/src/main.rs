@@ -1,34 +1,47 @@
-mod parser;
-use std::{env, fs, path::Path};
+use std::{env, path::Path, time::Instant};
 
-use anyhow::bail;
-use parser::ParsedSource;
+use anyhow::{Context, bail};
 use shy_isa_lib::file::shyfile::File;
 
-use crate::parser::Obj;
+use asm::parser::Assembler;
 
 fn main() -> anyhow::Result<()> {
     let args: Vec<String> = env::args().collect();
-    if args.len() != 2 && args.len() != 4 {
-        bail!("usage:{} <filename> (-o <output_file>)", args[0]);
-    }
+    let usage = || format!("usage:{} <filename> (-o <output_file>) (--stats)", args[0]);
 
-    let file_name = &args[1];
+    let mut file_name: Option<&String> = None;
+    let mut output: Option<String> = None;
+    let mut stats = false;
+    let mut i = 1;
+    while i < args.len() {
+        match args[i].as_str() {
+            "-o" => {
+                i += 1;
+                let Some(v) = args.get(i) else {
+                    bail!("{}", usage());
+                };
+                output = Some(v.clone());
+            }
+            "--stats" => stats = true,
+            s if s.starts_with('-') => bail!("{}", usage()),
+            _ if file_name.is_some() => bail!("{}", usage()),
+            _ => file_name = Some(&args[i]),
+        }
+        i += 1;
+    }
+    let Some(file_name) = file_name else {
+        bail!("{}", usage());
+    };
 
     // 没有指定 -o 时，把输入文件后缀替换成 .sobj。
-    let output_file_name = if args.len() == 2 {
+    let output_file_name = output.unwrap_or_else(|| {
         let mut name = file_name.to_string();
         if let Some(index) = name.rfind('.') {
             name.truncate(index);
         }
         name.push_str(".sobj");
         name
-    } else {
-        if args[2] != "-o" {
-            bail!("usage:{} <filename> (-o <output_file>)", args[0]);
-        }
-        args[3].clone()
-    };
+    });
 
     if !Path::new(file_name).exists() {
         bail!("input file does not exist: {file_name}");
@@ -38,26 +51,32 @@ fn main() -> anyhow::Result<()> {
         bail!("output file must not be the same as input file");
     }
 
-    // shyfile 只能追加写入，所以这里先删掉旧输出文件。
-    if Path::new(&output_file_name).exists() {
-        fs::remove_file(&output_file_name)?;
-    }
-
     let Ok(file) = File::open(file_name) else {
         bail!("failed to open file: {file_name}");
     };
 
-    let src = String::from_utf8_lossy(file.as_slice());
-
-    // 先解析源码生成内存中的 Obj，再按 .sobj 格式写出。
-    let mut source = ParsedSource::new(src.to_string());
-    source.impl_defines();
-    let obj = Obj::from(source)?;
+    // lexer 直接在 mmap 的输入上切 token，边读边编码成内存中的 Obj，再按 .sobj 格式写出。
+    let start = Instant::now();
+    let src = file.as_slice();
+    let asm = Assembler::run(src).with_context(|| format!("failed to assemble {file_name}"))?;
+    let lines = asm.lines;
+    let obj = asm.finish();
+    let elapsed = start.elapsed();
 
-    let Ok(output_file) = File::open(&output_file_name) else {
+    let Ok(output_file) = File::create(&output_file_name) else {
         bail!("failed to open output file: {output_file_name}");
     };
     obj.to_file(output_file)?;
 
+    if stats {
+        let secs = elapsed.as_secs_f64();
+        eprintln!(
+            "assembled {} bytes, {lines} lines in {:.3} ms ({:.1} MB/s)",
+            src.len(),
+            secs * 1000.0,
+            src.len() as f64 / secs.max(1e-9) / 1e6
+        );
+    }
+
     Ok(())
 }
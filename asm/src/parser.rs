@@ -1,32 +1,8 @@
 pub use anyhow::{Context, Result, bail};
 use shy_isa_lib::{file::shyfile, op, reg};
-use std::{collections::HashMap, vec};
-/// 解析后的 ShyISA 汇编源码。
-///
-/// 当前阶段负责：
-/// - 把源码行分到 `___DEFINE___`、`___DATA___` 和 `___CODE___` 三个段中
-/// - 将 DEFINE 段解析为 `name → value` 的常量映射表
-#[derive(Debug)]
-pub struct ParsedSource {
-    /// 显式 `#![mem(...)]` 声明的内存需求，单位字节。
-    pub mem_hint: Option<u32>,
-    /// 显式 `#![stack(...)]` 声明的栈需求，单位字节。
-    pub stack_hint: Option<u32>,
-    /// `___DEFINE___` 段的解析结果：名字 → 32 位值。
-    pub defines: HashMap<String, u32>,
-    /// 删除注释后，`___DATA___` 段中的非空源码行。
-    pub data: Vec<String>,
-    /// 删除注释后，`___CODE___` 段中的非空源码行。
-    pub code: Vec<String>,
-}
+use std::collections::HashMap;
 
-#[derive(Clone, Copy)]
-enum SectionState {
-    Start,
-    Define,
-    Data,
-    Code,
-}
+use crate::lexer::{Lexer, Tok};
 
 /// 解析 ShyISA 汇编中的 u32 数字字面量。
 ///
@@ -131,646 +107,660 @@ fn is_register_name(name: &str) -> bool {
     )
 }
 
-impl ParsedSource {
-    /// 将汇编源码切分为 ShyISA 的三个顶层段，并解析 DEFINE 常量。
-    ///
-    /// 解析器会取得 `src` 的所有权，先删除注释，再忽略空行，并保存去掉首尾空白后的
-    /// 源码行，供后续解析阶段继续处理。
-    pub fn new(mut src: String) -> ParsedSource {
-        // 先统一删除注释，后面的段切分就只需要处理有效源码行。
-        ParsedSource::remove_comment(&mut src);
-        let mut state = SectionState::Start;
-
-        let mut defines_raw: Vec<String> = Vec::new();
-        let mut data: Vec<String> = Vec::new();
-        let mut code: Vec<String> = Vec::new();
-        let mut mem_hint = None;
-        let mut stack_hint = None;
-
-        // ShyISA 汇编文件按 DEFINE -> DATA -> CODE 的顺序组织。
-        // 这里用一个小状态机记录当前所在段，并把普通源码行放入对应 Vec。
-        for l in src.lines().map(str::trim).filter(|l| !l.is_empty()) {
-            if let Some((name, value)) =
-                parse_metadata_directive(l).unwrap_or_else(|err| panic!("{err}"))
-            {
-                match name {
-                    "mem" => {
-                        if mem_hint.replace(value).is_some() {
-                            panic!("mem 元数据重复声明");
-                        }
-                    }
-                    "stack" => {
-                        if stack_hint.replace(value).is_some() {
-                            panic!("stack 元数据重复声明");
-                        }
-                    }
-                    _ => unreachable!(),
-                }
-                continue;
-            }
-            match state {
-                SectionState::Start => {
-                    if ParsedSource::is_section_marker(l, "___DEFINE___") {
-                        state = SectionState::Define;
-                    }
-                }
-                SectionState::Define => {
-                    if ParsedSource::is_section_marker(l, "___DATA___") {
-                        state = SectionState::Data;
-                    } else {
-                        defines_raw.push(l.to_owned());
-                    }
-                }
-                SectionState::Data => {
-                    if ParsedSource::is_section_marker(l, "___CODE___") {
-                        state = SectionState::Code;
-                    } else {
-                        data.push(l.to_owned());
-                    }
-                }
-                SectionState::Code => {
-                    code.push(l.to_owned());
-                }
-            }
-        }
+/// 汇编器所处的顶层段。ShyISA 汇编文件按 DEFINE -> DATA -> CODE 的顺序组织。
+#[derive(Clone, Copy)]
+enum SectionState {
+    Start,
+    Define,
+    Data,
+    Code,
+}
 
-        ParsedSource {
-            mem_hint,
-            stack_hint,
-            defines: ParsedSource::parse_defines(defines_raw),
-            data,
-            code,
-        }
+/// 一组 section（CODE 段或 DATA 段）的汇编结果。名字都借用输入源码。
+#[derive(Default)]
+struct Unit<'a> {
+    /// section 名和已经生成的字节。
+    sections: Vec<(&'a str, Vec<u8>)>,
+    /// symbol 名、所在 section 下标、偏移。
+    symbols: Vec<(&'a str, usize, u32)>,
+    /// symbol 名 -> 在 `symbols` 中第一次出现的下标。
+    symbol_index: HashMap<&'a str, usize>,
+    /// 所在 section 下标、偏移、目标 symbol、addend。
+    relocs: Vec<(usize, u32, &'a str, u32)>,
+}
+
+impl<'a> Unit<'a> {
+    fn open_section(&mut self, name: &'a str) {
+        self.sections.push((name, Vec::new()));
+        self.add_symbol(name, self.sections.len() - 1, 0);
     }
 
-    fn parse_defines(lines: Vec<String>) -> HashMap<String, u32> {
-        let mut map: HashMap<String, u32> = HashMap::new();
-        for line in lines {
-            let mut parts = line.split_whitespace();
-            let name = match parts.next() {
-                Some(n) => n.to_owned(),
-                None => continue,
-            };
-            let name_lower = name.to_lowercase();
-            let value_str = match parts.next() {
-                Some(v) => v,
-                None => panic!("DEFINE 行缺少 value: {line}"),
-            };
-            if parts.next().is_some() {
-                panic!("DEFINE 行多余内容: {line}");
-            }
+    fn add_symbol(&mut self, name: &'a str, section: usize, offset: u32) {
+        self.symbol_index.entry(name).or_insert(self.symbols.len());
+        self.symbols.push((name, section, offset));
+    }
 
-            // 不允许 DEFINE 名字与寄存器名冲突
-            if is_register_name(&name_lower) {
-                panic!("DEFINE 名字与寄存器名冲突: {name}");
-            }
+    /// 当前 section；一条 `.section` 都还没有时先打开默认 section。
+    fn current(&mut self, default: &'static str) -> usize {
+        if self.sections.is_empty() {
+            self.open_section(default);
+        }
+        self.sections.len() - 1
+    }
+}
+
+/// 单遍汇编器：lexer 每产出一行就立即编码，不保存中间的源码行。
+///
+/// - `#![mem(...)]` / `#![stack(...)]` 元数据可以出现在任意位置
+/// - DEFINE 段解析为 `name → value` 常量表，DATA/CODE 段中整个 token（或
+///   `name(addend)` 的两部分）是 DEFINE 名时替换为对应的值
+/// - DATA 段和 CODE 段分别编码，输出时 CODE 段的 section 在前
+/// - 最后把能在本文件内解析的 label/section/symbol 引用改成 `SectionOffset`
+pub struct Assembler<'a> {
+    /// 显式 `#![mem(...)]` 声明的内存需求，单位字节。
+    pub mem_hint: Option<u32>,
+    /// 显式 `#![stack(...)]` 声明的栈需求，单位字节。
+    pub stack_hint: Option<u32>,
+    /// `___DEFINE___` 段的解析结果：名字 → 32 位值。
+    pub defines: HashMap<&'a str, u32>,
+    /// 已经处理的非空源码行数。
+    pub lines: usize,
+    state: SectionState,
+    code: Unit<'a>,
+    data: Unit<'a>,
+    /// CODE 段中的局部 label：名字、所在 section 下标、偏移。
+    labels: Vec<(&'a str, usize, u32)>,
+    /// 已经解析过的助记符，避免每行都做一次大小写转换。
+    opcodes: HashMap<&'a str, u32>,
+}
 
-            let resolved = resolve_define_value(value_str);
+/// 把 `name(addend)` 拆成 `name` 和 `addend` 两部分。
+fn split_addend(token: &str) -> Option<(&str, &str)> {
+    token.strip_suffix(")").and_then(|s| s.split_once("("))
+}
 
-            if map.contains_key(&name) {
-                panic!("DEFINE 中名字重复定义: {name}");
-            }
-            map.insert(name, resolved);
-        }
-        map
+/// 数字字面量或 DEFINE 常量。
+fn number(defines: &HashMap<&str, u32>, token: &str) -> Option<u32> {
+    match defines.get(token.trim()) {
+        Some(&v) => Some(v),
+        None => parse_u32_literal(token).ok(),
     }
+}
 
-    fn is_section_marker(line: &str, marker: &str) -> bool {
-        // 允许段标记内部夹杂空白，例如 `___ DEFINE ___`。
-        line.chars()
-            .filter(|c| !c.is_whitespace())
-            .eq(marker.chars())
+/// 必须是数字的位置（addend、数组元素），解析失败时报告原因。
+fn number_or_err(defines: &HashMap<&str, u32>, raw: &str) -> Result<u32> {
+    match number(defines, raw) {
+        Some(v) => Ok(v),
+        None => parse_u32_literal(raw),
     }
+}
 
-    /// 删除 `//` 与 `/* ... */` 注释，但不把字符串字面量内部的注释标记当作注释。
-    ///
-    /// 转义序列会原样保留给后续数据段解析。本阶段处理转义的目的，只是避免把
-    /// `"hello \" world"` 这类字符串中的转义双引号误判为字符串结束。
-    fn remove_comment(src: &mut String) {
-        let mut out = String::with_capacity(src.len());
-        let mut chars = src.chars().peekable();
-
-        let mut in_block_comment = false;
-        let mut in_string = false;
-        let mut escaped = false;
-
-        while let Some(c) = chars.next() {
-            if in_block_comment {
-                // 块注释内容全部丢弃，但保留换行，方便以后做行号诊断。
-                if c == '*' && chars.peek() == Some(&'/') {
-                    chars.next();
-                    in_block_comment = false;
-                } else if c == '\n' {
-                    out.push('\n');
-                }
-                continue;
+impl<'a> Assembler<'a> {
+    /// 汇编整个源文件。
+    pub fn run(src: &'a [u8]) -> Result<Self> {
+        let mut asm = Assembler {
+            mem_hint: None,
+            stack_hint: None,
+            defines: HashMap::new(),
+            lines: 0,
+            state: SectionState::Start,
+            code: Unit::default(),
+            data: Unit::default(),
+            labels: Vec::new(),
+            opcodes: HashMap::new(),
+        };
+        let mut lexer = Lexer::new(src);
+        let mut line = Vec::new();
+        loop {
+            let line_no = lexer.line();
+            if !lexer.next_line(&mut line)? {
+                break;
             }
+            asm.lines += 1;
+            asm.line(&line)
+                .with_context(|| format!("第 {line_no} 行附近汇编失败"))?;
+        }
+        Ok(asm)
+    }
 
-            if in_string {
-                // 字符串中的内容原样保留，注释标记不会在这里生效。
-                out.push(c);
-
-                if escaped {
-                    escaped = false;
-                    continue;
+    fn line(&mut self, line: &[Tok<'a>]) -> Result<()> {
+        if let [Tok::Word(first), ..] = line
+            && first.starts_with("#![")
+            && let Some((name, value)) =
+                parse_metadata_directive(&line_text(line)).unwrap_or_else(|err| panic!("{err}"))
+        {
+            match name {
+                "mem" => {
+                    if self.mem_hint.replace(value).is_some() {
+                        panic!("mem 元数据重复声明");
+                    }
                 }
-
-                if c == '\\' {
-                    escaped = true;
-                    continue;
+                "stack" => {
+                    if self.stack_hint.replace(value).is_some() {
+                        panic!("stack 元数据重复声明");
+                    }
                 }
-
-                if c == '"' {
-                    in_string = false;
+                _ => unreachable!(),
+            }
+            return Ok(());
+        }
+        match self.state {
+            SectionState::Start => {
+                if is_section_marker(line, "___DEFINE___") {
+                    self.state = SectionState::Define;
                 }
-
-                continue;
             }
-
-            if c == '"' {
-                // 进入字符串后交给 in_string 分支处理，直到遇到未转义的双引号。
-                in_string = true;
-                out.push(c);
-                continue;
+            SectionState::Define => {
+                if is_section_marker(line, "___DATA___") {
+                    self.state = SectionState::Data;
+                } else {
+                    self.define(line);
+                }
             }
-
-            if c == '/' && chars.peek() == Some(&'/') {
-                // 行注释从 `//` 持续到换行；换行保留下来维持源码行结构。
-                chars.next();
-
-                for next in chars.by_ref() {
-                    if next == '\n' {
-                        out.push('\n');
-                        break;
-                    }
+            SectionState::Data => {
+                if is_section_marker(line, "___CODE___") {
+                    self.state = SectionState::Code;
+                } else {
+                    self.data_line(line)?;
                 }
-                continue;
             }
+            SectionState::Code => self.code_line(line)?,
+        }
+        Ok(())
+    }
 
-            if c == '/' && chars.peek() == Some(&'*') {
-                // 块注释可以跨行，退出条件在 in_block_comment 分支中处理。
-                chars.next();
-                in_block_comment = true;
-                continue;
-            }
+    fn define(&mut self, line: &[Tok<'a>]) {
+        let (name, value) = match line {
+            [Tok::Word(name), value] => (*name, *value),
+            [Tok::Word(_)] => panic!("DEFINE 行缺少 value: {}", line_text(line)),
+            _ => panic!("DEFINE 行多余内容: {}", line_text(line)),
+        };
+        let value_str = match value {
+            Tok::Word(w) => w.to_string(),
+            _ => line_text(&[value]),
+        };
 
-            out.push(c);
+        // 不允许 DEFINE 名字与寄存器名冲突
+        if is_register_name(&name.to_lowercase()) {
+            panic!("DEFINE 名字与寄存器名冲突: {name}");
         }
 
-        *src = out;
+        let resolved = resolve_define_value(&value_str);
+
+        if self.defines.insert(name, resolved).is_some() {
+            panic!("DEFINE 中名字重复定义: {name}");
+        }
     }
-    pub fn impl_defines(&mut self) {
-        // 分别替换data和code段
-        for i in self.defines.iter() {
-            for s in &mut self.data {
-                if s.contains(i.0) {
-                    *s = s.replace(i.0, &i.1.to_string());
-                }
+
+    fn code_line(&mut self, line: &[Tok<'a>]) -> Result<()> {
+        let words = |n: usize| -> Result<&'a str> {
+            match line.get(n) {
+                Some(Tok::Word(w)) if line.len() == n + 1 => Ok(*w),
+                _ => bail!("无效的代码行: {}", line_text(line)),
             }
-            for s in &mut self.code {
-                if s.contains(i.0) {
-                    *s = s.replace(i.0, &i.1.to_string());
-                }
+        };
+        let Tok::Word(head) = line[0] else {
+            bail!("无效的代码行: {}", line_text(line));
+        };
+        match head {
+            ".section" => {
+                let name = words(1)?;
+                self.code.open_section(name);
+                return Ok(());
             }
+            ".symbol" => {
+                let name = words(1)?;
+                let section = self.code.current(".text");
+                let offset = self.code.sections[section].1.len() as u32;
+                self.code.add_symbol(name, section, offset);
+                return Ok(());
+            }
+            _ => {}
         }
-    }
-}
-impl Obj {
-    pub fn from(source: ParsedSource) -> Result<Self> {
-        let mut labels: Vec<ObjSymbol> = vec![];
-        let mut sections: Vec<ObjSection> = vec![];
-        let mut symbols: Vec<ObjSymbol> = vec![];
-        let mut reloc: Vec<ObjRelocation> = vec![];
-
-        // 创建初始section
-        let mut start = 0usize;
-        let first_section = source
-            .code
-            .first()
-            .and_then(|line| line.strip_prefix(".section "));
-
-        // 根据前面的结果 决定是否跳过初始section定义
-        if let Some(section_name) = first_section {
-            sections.push(ObjSection {
-                name: section_name.to_string(),
-                bytes: vec![],
-            });
-            symbols.push(ObjSymbol {
-                name: section_name.to_string(),
-                section: section_name.to_string(),
-                offset: 0,
-            });
-            start = 1;
-        } else {
-            sections.push(ObjSection {
-                name: ".text".to_string(),
-                bytes: vec![],
-            });
-            symbols.push(ObjSymbol {
-                name: ".text".to_string(),
-                section: ".text".to_string(),
-                offset: 0,
-            });
+        let section = self.code.current(".text");
+        let offset = self.code.sections[section].1.len() as u32;
+        if line.len() == 1 {
+            if let Some(label) = head.strip_suffix(":") {
+                self.labels.push((label, section, offset));
+                return Ok(());
+            }
         }
-        //code生成
-        for i in start..source.code.len() {
-            if let Some(section_name) = source.code[i].strip_prefix(".section ") {
-                // 新section
-                sections.push(ObjSection {
-                    name: section_name.to_string(),
-                    bytes: vec![],
-                });
-                symbols.push(ObjSymbol {
-                    name: section_name.to_string(),
-                    section: section_name.to_string(),
-                    offset: 0,
-                });
-            } else if let Some(symbol_name) = source.code[i].strip_prefix(".symbol ") {
-                // 新symbol
-                let section = sections
-                    .last()
-                    .ok_or_else(|| anyhow::anyhow!("没有初始section!"))?;
-                symbols.push(ObjSymbol {
-                    name: symbol_name.to_string(),
-                    section: section.name.clone(),
-                    offset: section.bytes.len() as u32,
-                });
-            } else if let Some(label_name) = source.code[i].strip_suffix(":") {
-                // 新label
-                let section = sections
-                    .last()
-                    .ok_or_else(|| anyhow::anyhow!("没有初始section!"))?;
-                labels.push(ObjSymbol {
-                    name: label_name.to_string(),
-                    section: section.name.clone(),
-                    offset: section.bytes.len() as u32,
-                });
-            } else {
-                // 应当是正常语句
-                let section = sections
-                    .last_mut()
-                    .ok_or_else(|| anyhow::anyhow!("没有初始section!"))?;
-                // pc
-                let offset = section.bytes.len() as u32;
-
-                // 分token
-                let tokens: Vec<&str> = source.code[i].split_whitespace().collect();
-                // command
-                let command = op::OpType::from_str(tokens[0])?.to_u32();
-                // 其他token
-                let mut res: [u32; 2] = [0; 2];
-
-                for arg_i in 0..2 {
-                    let Some(token) = tokens.get(arg_i + 1) else {
-                        continue;
-                    };
-                    if is_register_name(token) {
-                        // 是寄存器
-                        res[arg_i] = reg::RegType::from_str(token)?.to_u32();
-                    } else if let Ok(num) = parse_u32_literal(token) {
-                        // 字面值
-                        res[arg_i] = num;
-                    }
-                    // label之类的 先统一解析为symbol
-                    else if let Some((base, addend)) =
-                        token.strip_suffix(")").and_then(|s| s.split_once("("))
-                    {
-                        reloc.push(ObjRelocation {
-                            section: section.name.clone(),
-                            offset: offset + 4 * (arg_i as u32 + 1),
-                            target: RelocTarget::Symbol(base.to_string()),
-                            addend: parse_u32_literal(addend)?,
-                        });
-                    } else {
-                        reloc.push(ObjRelocation {
-                            section: section.name.clone(),
-                            offset: offset + 4 * (arg_i as u32 + 1),
-                            target: RelocTarget::Symbol(token.to_string()),
-                            addend: 0,
-                        });
-                    }
-                }
 
-                section.bytes.extend_from_slice(&command.to_be_bytes());
-                section.bytes.extend_from_slice(&res[0].to_be_bytes());
-                section.bytes.extend_from_slice(&res[1].to_be_bytes());
+        // 正常语句：助记符加至多两个操作数。
+        let command = match self.opcodes.get(head) {
+            Some(&op) => op,
+            None => {
+                let op = op::OpType::from_str(head)?.to_u32();
+                self.opcodes.insert(head, op);
+                op
+            }
+        };
+        let mut res: [u32; 2] = [0; 2];
+        for (arg_i, tok) in line[1..].iter().take(2).enumerate() {
+            let Tok::Word(token) = *tok else {
+                bail!("无效的操作数: {}", line_text(line));
+            };
+            let field = offset + 4 * (arg_i as u32 + 1);
+            if is_register_name(token) {
+                res[arg_i] = reg::RegType::from_str(token)?.to_u32();
+            } else if let Some(num) = number(&self.defines, token) {
+                res[arg_i] = num;
+            } else if let Some((base, addend)) = split_addend(token) {
+                let addend = number_or_err(&self.defines, addend)?;
+                match number(&self.defines, base) {
+                    Some(num) => res[arg_i] = num.wrapping_add(addend),
+                    None => self.code.relocs.push((section, field, base, addend)),
+                }
+            } else {
+                // label 之类的先统一记为 symbol，最后再尝试本地解析。
+                self.code.relocs.push((section, field, token, 0));
             }
         }
-        //data生成
-        let mut data_start = 0usize;
-        let first_data_section = source
-            .data
-            .first()
-            .and_then(|line| line.strip_prefix(".section "));
-
-        if let Some(section_name) = first_data_section {
-            sections.push(ObjSection {
-                name: section_name.to_string(),
-                bytes: vec![],
-            });
-            symbols.push(ObjSymbol {
-                name: section_name.to_string(),
-                section: section_name.to_string(),
-                offset: 0,
-            });
-            data_start = 1;
-        } else if !source.data.is_empty() {
-            sections.push(ObjSection {
-                name: "data".to_string(),
-                bytes: vec![],
-            });
-            symbols.push(ObjSymbol {
-                name: "data".to_string(),
-                section: "data".to_string(),
-                offset: 0,
-            });
+
+        let bytes = &mut self.code.sections[section].1;
+        bytes.extend_from_slice(&command.to_be_bytes());
+        bytes.extend_from_slice(&res[0].to_be_bytes());
+        bytes.extend_from_slice(&res[1].to_be_bytes());
+        Ok(())
+    }
+
+    fn data_line(&mut self, line: &[Tok<'a>]) -> Result<()> {
+        let Tok::Word(head) = line[0] else {
+            bail!("data 行缺少写入位置: {}", line_text(line));
+        };
+        match (head, line) {
+            (".section", [_, Tok::Word(name)]) => {
+                self.data.open_section(name);
+                return Ok(());
+            }
+            (".symbol", [_, Tok::Word(name)]) => {
+                let section = self.data.current("data");
+                let offset = self.data.sections[section].1.len() as u32;
+                self.data.add_symbol(name, section, offset);
+                return Ok(());
+            }
+            _ => {}
         }
+        let section = self.data.current("data");
+        let value = match line {
+            [_, value] => *value,
+            [_] => bail!("data 行缺少写入内容: {}", line_text(line)),
+            _ => bail!("data 行多余内容: {}", line_text(line)),
+        };
 
-        for i in data_start..source.data.len() {
-            if let Some(section_name) = source.data[i].strip_prefix(".section ") {
-                // 新data section
-                sections.push(ObjSection {
-                    name: section_name.to_string(),
-                    bytes: vec![],
-                });
-                symbols.push(ObjSymbol {
-                    name: section_name.to_string(),
-                    section: section_name.to_string(),
-                    offset: 0,
-                });
-            } else if let Some(symbol_name) = source.data[i].strip_prefix(".symbol ") {
-                // 新data symbol
-                let section = sections
-                    .last()
-                    .ok_or_else(|| anyhow::anyhow!("没有初始data section!"))?;
-                symbols.push(ObjSymbol {
-                    name: symbol_name.to_string(),
-                    section: section.name.clone(),
-                    offset: section.bytes.len() as u32,
-                });
-            } else {
-                // 应当是正常data语句
-                let section = sections
-                    .last_mut()
-                    .ok_or_else(|| anyhow::anyhow!("没有初始data section!"))?;
-
-                // 分成写入位置和写入内容
-                let mut tokens = source.data[i].splitn(2, char::is_whitespace);
-                let addr = tokens
-                    .next()
-                    .ok_or_else(|| anyhow::anyhow!("data 行缺少写入位置!"))?;
-                let value = tokens
-                    .next()
-                    .ok_or_else(|| anyhow::anyhow!("data 行缺少写入内容: {}", source.data[i]))?
-                    .trim();
-
-                // 解析data写入位置
-                let (base, addend) = match addr.strip_suffix(")").and_then(|s| s.split_once("(")) {
-                    Some((base, addend)) => (base, parse_u32_literal(addend)?),
-                    None => (addr, 0),
-                };
-                let write_offset = if let Ok(num) = parse_u32_literal(base) {
-                    num + addend
-                } else if section.name == base {
-                    addend
-                } else if let Some(label) = labels.iter().find(|label| label.name == base) {
-                    if label.section != section.name {
-                        bail!("data 写入位置不在当前section: {addr}");
-                    }
-                    label.offset + addend
-                } else if let Some(symbol) = symbols.iter().find(|symbol| symbol.name == base) {
-                    if symbol.section != section.name {
-                        bail!("data 写入位置不在当前section: {addr}");
-                    }
-                    symbol.offset + addend
-                } else {
-                    bail!("无法解析data写入位置: {addr}");
-                } as usize;
+        // 解析data写入位置
+        let (base, addend) = match split_addend(head) {
+            Some((base, addend)) => (base, number_or_err(&self.defines, addend)?),
+            None => (head, 0),
+        };
+        let write_offset = if let Some(num) = number(&self.defines, base) {
+            num + addend
+        } else if self.data.sections[section].0 == base {
+            addend
+        } else if let Some(&(_, sec, offset)) =
+            self.data.symbol_index.get(base).map(|&i| &self.data.symbols[i])
+        {
+            if sec != section {
+                bail!("data 写入位置不在当前section: {head}");
+            }
+            offset + addend
+        } else {
+            bail!("无法解析data写入位置: {head}");
+        } as usize;
 
-                if section.bytes.len() < write_offset {
-                    section.bytes.resize(write_offset, 0);
-                }
+        let defines = &self.defines;
+        let bytes = &mut self.data.sections[section].1;
+        if bytes.len() < write_offset {
+            bytes.resize(write_offset, 0);
+        }
+        let mut put = |at: usize, src: &[u8]| {
+            if bytes.len() < at + src.len() {
+                bytes.resize(at + src.len(), 0);
+            }
+            bytes[at..at + src.len()].copy_from_slice(src);
+        };
 
-                // 写入字符串
-                if let Some(s) = value.strip_prefix("\"").and_then(|s| s.strip_suffix("\"")) {
-                    if section.bytes.len() == write_offset {
-                        section.bytes.extend_from_slice(s.as_bytes());
-                        section.bytes.push(0);
-                    } else {
-                        let end = write_offset + s.len() + 1;
-                        if section.bytes.len() < end {
-                            section.bytes.resize(end, 0);
-                        }
-                        section.bytes[write_offset..write_offset + s.len()]
-                            .copy_from_slice(s.as_bytes());
-                        section.bytes[end - 1] = 0;
-                    }
-                }
-                // 写入数组
-                else if let Some(array) =
-                    value.strip_prefix("{").and_then(|s| s.strip_suffix("}"))
-                {
-                    let mut offset = write_offset;
-                    for item in array.split(",").map(str::trim).filter(|s| !s.is_empty()) {
-                        let num = parse_u32_literal(item)?;
-                        if section.bytes.len() < offset + 4 {
-                            section.bytes.resize(offset + 4, 0);
-                        }
-                        section.bytes[offset..offset + 4].copy_from_slice(&num.to_be_bytes());
-                        offset += 4;
-                    }
-                }
-                // 写入字节数组
-                else if let Some(array) =
-                    value.strip_prefix("[").and_then(|s| s.strip_suffix("]"))
-                {
-                    let mut offset = write_offset;
-                    for item in array.split(",").map(str::trim).filter(|s| !s.is_empty()) {
-                        let num = parse_u32_literal(item)?;
-                        if num > u8::MAX as u32 {
-                            bail!("byte array item out of range: {item}");
-                        }
-                        if section.bytes.len() < offset + 1 {
-                            section.bytes.resize(offset + 1, 0);
-                        }
-                        section.bytes[offset] = num as u8;
-                        offset += 1;
-                    }
+        match value {
+            // 写入字符串，内容原样写入并补一个结尾 0
+            Tok::Str(s) => {
+                put(write_offset, s);
+                put(write_offset + s.len(), &[0]);
+            }
+            // 写入数组
+            Tok::List(b'{', array) => {
+                let mut offset = write_offset;
+                for item in array.split(",").map(str::trim).filter(|s| !s.is_empty()) {
+                    let num = number_or_err(defines, item)?;
+                    put(offset, &num.to_be_bytes());
+                    offset += 4;
                 }
-                // 写入数字
-                else if let Ok(num) = parse_u32_literal(value) {
-                    if section.bytes.len() < write_offset + 4 {
-                        section.bytes.resize(write_offset + 4, 0);
+            }
+            // 写入字节数组
+            Tok::List(_, array) => {
+                let mut offset = write_offset;
+                for item in array.split(",").map(str::trim).filter(|s| !s.is_empty()) {
+                    let num = number_or_err(defines, item)?;
+                    if num > u8::MAX as u32 {
+                        bail!("byte array item out of range: {item}");
                     }
-                    section.bytes[write_offset..write_offset + 4]
-                        .copy_from_slice(&num.to_be_bytes());
+                    put(offset, &[num as u8]);
+                    offset += 1;
                 }
-                // 写入symbol占位
-                else {
-                    let (base, addend) =
-                        match value.strip_suffix(")").and_then(|s| s.split_once("(")) {
-                            Some((base, addend)) => (base, parse_u32_literal(addend)?),
-                            None => (value, 0),
-                        };
-                    if section.bytes.len() < write_offset + 4 {
-                        section.bytes.resize(write_offset + 4, 0);
+            }
+            Tok::Word(value) => {
+                // 写入数字；否则写入 symbol 占位，由 relocation 补齐
+                let (base, addend) = match split_addend(value) {
+                    Some((base, addend)) => (base, number_or_err(defines, addend)?),
+                    None => (value, 0),
+                };
+                match number(defines, base) {
+                    Some(num) => put(write_offset, &num.wrapping_add(addend).to_be_bytes()),
+                    None => {
+                        put(write_offset, &[0; 4]);
+                        self.data
+                            .relocs
+                            .push((section, write_offset as u32, base, addend));
                     }
-                    reloc.push(ObjRelocation {
-                        section: section.name.clone(),
-                        offset: write_offset as u32,
-                        target: RelocTarget::Symbol(base.to_string()),
-                        addend,
-                    });
                 }
             }
         }
+        Ok(())
+    }
 
-        // 尝试解析本地可解析的label/section/symbol
-        for r in &mut reloc {
-            let RelocTarget::Symbol(name) = &r.target else {
-                continue;
-            };
-            if let Some(label) = labels.iter().find(|label| label.name == *name) {
-                r.target = RelocTarget::SectionOffset {
-                    section: label.section.clone(),
-                    offset: label.offset,
-                };
-            } else if let Some(symbol) = symbols.iter().find(|symbol| symbol.name == *name) {
-                r.target = RelocTarget::SectionOffset {
-                    section: symbol.section.clone(),
-                    offset: symbol.offset,
-                };
+    /// 合并 CODE 段和 DATA 段的结果，并尝试在本文件内解析 relocation。
+    pub fn finish(mut self) -> Obj {
+        // 没有任何代码时也保留一个空的默认代码 section。
+        self.code.current(".text");
+        let base = self.code.sections.len();
+
+        // 先找 label，再按 symbol 的定义顺序找，同名时第一个生效。
+        let mut local: HashMap<&str, (usize, u32)> = HashMap::new();
+        for &(name, sec, offset) in &self.labels {
+            local.entry(name).or_insert((sec, offset));
+        }
+        for &(name, sec, offset) in &self.code.symbols {
+            local.entry(name).or_insert((sec, offset));
+        }
+        for &(name, sec, offset) in &self.data.symbols {
+            local.entry(name).or_insert((base + sec, offset));
+        }
+
+        let names: Vec<&str> = self
+            .code
+            .sections
+            .iter()
+            .chain(&self.data.sections)
+            .map(|(name, _)| *name)
+            .collect();
+        let relocation = self
+            .code
+            .relocs
+            .iter()
+            .copied()
+            .chain(
+                self.data
+                    .relocs
+                    .iter()
+                    .map(|&(sec, off, target, addend)| (base + sec, off, target, addend)),
+            )
+            .map(|(sec, offset, target, addend)| ObjRelocation {
+                section: names[sec].to_string(),
+                offset,
+                target: match local.get(target) {
+                    Some(&(target_sec, target_off)) => RelocTarget::SectionOffset {
+                        section: names[target_sec].to_string(),
+                        offset: target_off,
+                    },
+                    None => RelocTarget::Symbol(target.to_string()),
+                },
+                addend,
+            })
+            .collect();
+        let symbol = self
+            .code
+            .symbols
+            .iter()
+            .copied()
+            .chain(
+                self.data
+                    .symbols
+                    .iter()
+                    .map(|&(name, sec, offset)| (name, base + sec, offset)),
+            )
+            .map(|(name, sec, offset)| ObjSymbol {
+                name: name.to_string(),
+                section: names[sec].to_string(),
+                offset,
+            })
+            .collect();
+        let section = self
+            .code
+            .sections
+            .into_iter()
+            .chain(self.data.sections)
+            .map(|(name, bytes)| ObjSection {
+                name: name.to_string(),
+                bytes,
+            })
+            .collect();
+
+        Obj {
+            mem_hint: self.mem_hint,
+            stack_hint: self.stack_hint,
+            section,
+            symbol,
+            relocation,
+        }
+    }
+}
+
+/// 把一行 token 还原成以空格分隔的文本，只用于报错和元数据声明。
+fn line_text(line: &[Tok]) -> String {
+    let mut out = String::new();
+    for (i, tok) in line.iter().enumerate() {
+        if i > 0 {
+            out.push(' ');
+        }
+        match tok {
+            Tok::Word(w) => out.push_str(w),
+            Tok::Str(s) => {
+                out.push('"');
+                out.push_str(&String::from_utf8_lossy(s));
+                out.push('"');
+            }
+            Tok::List(open, s) => {
+                out.push(*open as char);
+                out.push_str(s);
+                out.push(if *open == b'{' { '}' } else { ']' });
             }
         }
+    }
+    out
+}
 
-        Ok(Self {
-            mem_hint: source.mem_hint,
-            stack_hint: source.stack_hint,
-            section: sections,
-            symbol: symbols,
-            relocation: reloc,
-        })
+/// 段标记内部允许夹杂空白，例如 `___ DEFINE ___`，所以按 token 拼接后比较。
+fn is_section_marker(line: &[Tok], marker: &str) -> bool {
+    let mut rest = marker;
+    for tok in line {
+        let Tok::Word(w) = tok else {
+            return false;
+        };
+        let Some(r) = rest.strip_prefix(w) else {
+            return false;
+        };
+        rest = r;
     }
-    /*AIGC:codex*/
-    pub fn to_file(self, mut f: shyfile::File) -> Result<()> {
-        const MAGIC: u32 = 0x66CCFF00;
-        const HEADER_SIZE: usize = 24;
+    rest.is_empty()
+}
+
+impl Obj {
 
+    /// 按 `ObjFormat.md` 第 13 节的 v2 格式写出 object 文件。
+    pub fn to_file(self, mut f: shyfile::File) -> Result<()> {
         if !f.is_empty() {
             bail!("output object file must be empty");
         }
+        let buf = self.to_bytes()?;
+        f.push_back_slice(&buf)?;
+        f.close()?;
+        Ok(())
+    }
 
-        fn push_u32(buf: &mut Vec<u8>, value: u32) {
-            buf.extend_from_slice(&value.to_be_bytes());
+    /// 把 object 序列化成 v2 格式的字节。
+    /*AIGC:codex*/
+    pub fn to_bytes(&self) -> Result<Vec<u8>> {
+        const MAGIC: u32 = 0x66CCFF02;
+        const HEADER_SIZE: usize = 48;
+        const SECTION_RECORD: usize = 20;
+        const SYMBOL_RECORD: usize = 12;
+
+        fn put_u32(buf: &mut [u8], off: usize, value: u32) {
+            buf[off..off + 4].copy_from_slice(&value.to_be_bytes());
         }
 
-        fn push_c_str(buf: &mut Vec<u8>, value: &str) -> Result<()> {
-            if value.as_bytes().contains(&0) {
-                bail!("object string contains NUL byte: {value:?}");
+        fn push_varint(buf: &mut Vec<u8>, mut value: u64) {
+            while value >= 0x80 {
+                buf.push(value as u8 | 0x80);
+                value >>= 7;
             }
-            buf.extend_from_slice(value.as_bytes());
-            buf.push(0);
-            Ok(())
+            buf.push(value as u8);
         }
 
         fn file_offset(value: usize) -> Result<u32> {
             u32::try_from(value).context("object file offset exceeds u32::MAX")
         }
 
-        fn next_offset(buf_len: usize, node_len: usize, has_next: bool) -> Result<u32> {
-            if has_next {
-                file_offset(
-                    buf_len
-                        .checked_add(node_len)
-                        .context("object file offset overflow")?,
-                )
-            } else {
-                Ok(0)
+        /// 去重的字符串表：同一个名字只存一次，记录引用它的偏移。
+        struct StrTab<'s> {
+            bytes: Vec<u8>,
+            index: HashMap<&'s str, u32>,
+        }
+        impl<'s> StrTab<'s> {
+            fn intern(&mut self, value: &'s str) -> Result<u32> {
+                if let Some(&off) = self.index.get(value) {
+                    return Ok(off);
+                }
+                if value.as_bytes().contains(&0) {
+                    bail!("object string contains NUL byte: {value:?}");
+                }
+                let off = file_offset(self.bytes.len())?;
+                self.bytes.extend_from_slice(value.as_bytes());
+                self.bytes.push(0);
+                self.index.insert(value, off);
+                Ok(off)
             }
         }
 
-        let section_start = if self.section.is_empty() {
-            0
-        } else {
-            HEADER_SIZE as u32
+        let mut strtab = StrTab {
+            bytes: Vec::new(),
+            index: HashMap::new(),
         };
-
-        let mut buf = Vec::new();
-        push_u32(&mut buf, MAGIC);
-        push_u32(&mut buf, section_start);
-        push_u32(&mut buf, 0);
-        push_u32(&mut buf, 0);
-        push_u32(&mut buf, self.mem_hint.unwrap_or(0));
-        push_u32(&mut buf, self.stack_hint.unwrap_or(0));
-
+        let mut section_index: HashMap<&str, u32> = HashMap::new();
         for (index, section) in self.section.iter().enumerate() {
-            let node_len = 4 + section.name.len() + 1 + 4 + section.bytes.len();
-            let next_section = next_offset(buf.len(), node_len, index + 1 < self.section.len())?;
-
-            push_u32(&mut buf, next_section);
-            push_c_str(&mut buf, &section.name)?;
-            push_u32(
-                &mut buf,
-                u32::try_from(section.bytes.len()).context("section byte_size exceeds u32::MAX")?,
-            );
-            buf.extend_from_slice(&section.bytes);
+            section_index.entry(&section.name).or_insert(index as u32);
         }
-
-        let symbol_start = if self.symbol.is_empty() {
-            0
-        } else {
-            file_offset(buf.len())?
-        };
-
-        for (index, symbol) in self.symbol.iter().enumerate() {
-            let node_len = 4 + 4 + symbol.section.len() + 1 + symbol.name.len() + 1;
-            let next_symbol = next_offset(buf.len(), node_len, index + 1 < self.symbol.len())?;
-
-            push_u32(&mut buf, next_symbol);
-            push_u32(&mut buf, symbol.offset);
-            push_c_str(&mut buf, &symbol.section)?;
-            push_c_str(&mut buf, &symbol.name)?;
-        }
-
-        let relocation_start = if self.relocation.is_empty() {
-            0
-        } else {
-            file_offset(buf.len())?
+        let find_section = |name: &str| -> Result<u32> {
+            section_index
+                .get(name)
+                .copied()
+                .with_context(|| format!("reference to unknown section: {name}"))
         };
 
+        // relocation 按所在 section 分组，组内按 offset 排序，这样 offset 可以存成差值。
+        let mut order: Vec<(u32, u32, usize)> = Vec::with_capacity(self.relocation.len());
         for (index, relocation) in self.relocation.iter().enumerate() {
-            let target_len = match &relocation.target {
-                RelocTarget::Symbol(name) => name.len() + 1,
-                RelocTarget::SectionOffset { section, .. } => 4 + section.len() + 1,
-            };
-            let node_len = 4 + 4 + 4 + 4 + relocation.section.len() + 1 + target_len;
-            let next_relocation =
-                next_offset(buf.len(), node_len, index + 1 < self.relocation.len())?;
+            order.push((find_section(&relocation.section)?, relocation.offset, index));
+        }
+        order.sort_unstable();
+
+        let mut relocs = Vec::new();
+        let mut groups = vec![(0u32, 0u32); self.section.len()];
+        let mut prev = (u32::MAX, 0u32);
+        for &(sec, offset, index) in &order {
+            if prev.0 != sec {
+                groups[sec as usize].0 = file_offset(relocs.len())?;
+                prev = (sec, 0);
+            }
+            groups[sec as usize].1 += 1;
+            push_varint(&mut relocs, u64::from(offset - prev.1));
+            prev.1 = offset;
 
-            push_u32(&mut buf, next_relocation);
-            push_u32(&mut buf, relocation.offset);
-            push_u32(&mut buf, relocation.addend);
+            let relocation = &self.relocation[index];
             match &relocation.target {
                 RelocTarget::Symbol(name) => {
-                    push_u32(&mut buf, 1);
-                    push_c_str(&mut buf, &relocation.section)?;
-                    push_c_str(&mut buf, name)?;
+                    push_varint(&mut relocs, u64::from(strtab.intern(name)?) << 2 | 1);
+                }
+                // 指向自身 section 的引用（函数内的局部 label）不再重复 section 下标。
+                RelocTarget::SectionOffset { section, offset } if *section == relocation.section => {
+                    push_varint(&mut relocs, 2);
+                    push_varint(&mut relocs, u64::from(*offset));
                 }
                 RelocTarget::SectionOffset { section, offset } => {
-                    push_u32(&mut buf, 0);
-                    push_c_str(&mut buf, &relocation.section)?;
-                    push_u32(&mut buf, *offset);
-                    push_c_str(&mut buf, section)?;
+                    push_varint(&mut relocs, u64::from(find_section(section)?) << 2);
+                    push_varint(&mut relocs, u64::from(*offset));
                 }
             }
+            push_varint(&mut relocs, u64::from(relocation.addend));
         }
 
-        buf[8..12].copy_from_slice(&symbol_start.to_be_bytes());
-        buf[12..16].copy_from_slice(&relocation_start.to_be_bytes());
-
-        f.push_back_slice(&buf)?;
-        f.flush()?;
-        Ok(())
+        let section_names = self
+            .section
+            .iter()
+            .map(|section| strtab.intern(&section.name))
+            .collect::<Result<Vec<_>>>()?;
+        let symbol_names = self
+            .symbol
+            .iter()
+            .map(|symbol| strtab.intern(&symbol.name))
+            .collect::<Result<Vec<_>>>()?;
+
+        let symbol_table = HEADER_SIZE + self.section.len() * SECTION_RECORD;
+        let strtab_start = symbol_table + self.symbol.len() * SYMBOL_RECORD;
+        let data_start = strtab_start + strtab.bytes.len();
+        let mut tables = vec![0u8; strtab_start - HEADER_SIZE];
+        let mut data_size = 0usize;
+        for (index, section) in self.section.iter().enumerate() {
+            let rec = index * SECTION_RECORD;
+            let size =
+                u32::try_from(section.bytes.len()).context("section byte_size exceeds u32::MAX")?;
+            put_u32(&mut tables, rec, section_names[index]);
+            put_u32(&mut tables, rec + 4, file_offset(data_start + data_size)?);
+            put_u32(&mut tables, rec + 8, size);
+            put_u32(&mut tables, rec + 12, groups[index].0);
+            put_u32(&mut tables, rec + 16, groups[index].1);
+            data_size += section.bytes.len();
+        }
+        for (index, symbol) in self.symbol.iter().enumerate() {
+            let rec = symbol_table - HEADER_SIZE + index * SYMBOL_RECORD;
+            put_u32(&mut tables, rec, symbol_names[index]);
+            put_u32(&mut tables, rec + 4, find_section(&symbol.section)?);
+            put_u32(&mut tables, rec + 8, symbol.offset);
+        }
+        let reloc_start = data_start + data_size;
+
+        let mut buf = vec![0u8; HEADER_SIZE];
+        put_u32(&mut buf, 0, MAGIC);
+        put_u32(&mut buf, 4, self.mem_hint.unwrap_or(0));
+        put_u32(&mut buf, 8, self.stack_hint.unwrap_or(0));
+        put_u32(&mut buf, 12, file_offset(self.section.len())?);
+        put_u32(&mut buf, 16, file_offset(HEADER_SIZE)?);
+        put_u32(&mut buf, 20, file_offset(self.symbol.len())?);
+        put_u32(&mut buf, 24, file_offset(symbol_table)?);
+        put_u32(&mut buf, 28, file_offset(self.relocation.len())?);
+        put_u32(&mut buf, 32, file_offset(reloc_start)?);
+        put_u32(&mut buf, 36, file_offset(relocs.len())?);
+        put_u32(&mut buf, 40, file_offset(strtab_start)?);
+        put_u32(&mut buf, 44, file_offset(strtab.bytes.len())?);
+
+        buf.reserve(tables.len() + strtab.bytes.len() + data_size + relocs.len());
+        buf.extend_from_slice(&tables);
+        buf.extend_from_slice(&strtab.bytes);
+        for section in &self.section {
+            buf.extend_from_slice(&section.bytes);
+        }
+        buf.extend_from_slice(&relocs);
+        file_offset(buf.len())?;
+        Ok(buf)
     }
 }
 #[derive(Debug, Clone, PartialEq, Eq)]
@@ -808,10 +798,26 @@ pub enum RelocTarget {
 #[cfg(test)]
 mod tests {
     use super::{
-        Obj, ObjRelocation, ObjSection, ObjSymbol, ParsedSource, RelocTarget, parse_size_literal,
+        Assembler, Obj, ObjRelocation, ObjSection, ObjSymbol, RelocTarget, parse_size_literal,
         parse_u32_literal,
     };
-    use shy_isa_lib::file::shyfile;
+    use shy_isa_lib::{file::shyfile, op};
+
+    fn assemble(src: &str) -> Assembler<'_> {
+        Assembler::run(src.as_bytes()).unwrap()
+    }
+
+    fn section<'o>(obj: &'o Obj, name: &str) -> &'o [u8] {
+        &obj.section.iter().find(|s| s.name == name).unwrap().bytes
+    }
+
+    /// 单条指令的编码。
+    fn insn(mnemonic: &str, a1: u32, a2: u32) -> Vec<u8> {
+        let mut out = op::OpType::from_str(mnemonic).unwrap().to_u32().to_be_bytes().to_vec();
+        out.extend_from_slice(&a1.to_be_bytes());
+        out.extend_from_slice(&a2.to_be_bytes());
+        out
+    }
 
     #[test]
     fn parses_u32_literals_with_supported_radices() {
@@ -875,31 +881,70 @@ mod tests {
         let bytes = std::fs::read(&path).unwrap();
         let _ = std::fs::remove_file(&path);
 
-        assert_eq!(&bytes[0..4], &0x66CCFF00u32.to_be_bytes());
-        assert_eq!(&bytes[4..8], &24u32.to_be_bytes());
-        assert_eq!(&bytes[16..20], &(10 * 1024 * 1024u32).to_be_bytes());
-        assert_eq!(&bytes[20..24], &(4 * 1024u32).to_be_bytes());
-
-        let symbol_start = u32::from_be_bytes(bytes[8..12].try_into().unwrap()) as usize;
-        let relocation_start = u32::from_be_bytes(bytes[12..16].try_into().unwrap()) as usize;
-        assert!(symbol_start > 16);
-        assert!(relocation_start > symbol_start);
+        let word = |off: usize| u32::from_be_bytes(bytes[off..off + 4].try_into().unwrap());
+        assert_eq!(word(0), 0x66CCFF02);
+        assert_eq!(word(4), 10 * 1024 * 1024);
+        assert_eq!(word(8), 4 * 1024);
+        // section_count / section_table, symbol_count / symbol_table
+        assert_eq!((word(12), word(16)), (1, 48));
+        assert_eq!((word(20), word(24)), (1, 68));
+        // relocation_count / relocation_start / relocation_size, strtab_start / strtab_size
+        assert_eq!((word(28), word(32), word(36)), (1, 109, 3));
+        assert_eq!((word(40), word(44)), (80, 25));
+        assert_eq!(&bytes[80..105], b"print\0text._start\0_start\0");
+
+        // SectionRecord: name、data 偏移、大小、relocation 起点、relocation 个数
+        assert_eq!(
+            (word(48), word(52), word(56), word(60), word(64)),
+            (6, 105, 4, 0, 1)
+        );
+        assert_eq!(&bytes[105..109], &[0xAA, 0xBB, 0xCC, 0xDD]);
+        // SymbolRecord: name、section 下标、偏移
+        assert_eq!((word(68), word(72), word(76)), (18, 0, 0));
+        // offset 差值 4，Symbol(strtab 偏移 0)，addend 8
+        assert_eq!(&bytes[109..], &[4, 0 << 2 | 1, 8]);
+    }
 
-        assert_eq!(&bytes[24..28], &0u32.to_be_bytes());
-        assert_eq!(&bytes[28..40], b"text._start\0");
-        assert_eq!(&bytes[40..44], &4u32.to_be_bytes());
-        assert_eq!(&bytes[44..48], &[0xAA, 0xBB, 0xCC, 0xDD]);
+    #[test]
+    fn writes_local_label_reference_without_section_name() {
+        let path = format!(
+            "target/test-{}-{}.sobj",
+            std::process::id(),
+            "writes_local_label_reference_without_section_name"
+        );
+        std::fs::create_dir_all("target").unwrap();
+        let _ = std::fs::remove_file(&path);
 
-        assert_eq!(&bytes[symbol_start..symbol_start + 4], &0u32.to_be_bytes());
+        let obj = assemble(
+            r#"
+            ___DEFINE___
+            ___DATA___
+            ___CODE___
+            .section text.f
+            loop:
+            ujmpn loop
+            "#,
+        )
+        .finish();
         assert_eq!(
-            &bytes[relocation_start + 12..relocation_start + 16],
-            &1u32.to_be_bytes()
+            obj.relocation[0].target,
+            RelocTarget::SectionOffset {
+                section: "text.f".to_string(),
+                offset: 0
+            }
         );
+        obj.to_file(shyfile::File::open(&path).unwrap()).unwrap();
+
+        let bytes = std::fs::read(&path).unwrap();
+        let _ = std::fs::remove_file(&path);
+        let start = u32::from_be_bytes(bytes[32..36].try_into().unwrap()) as usize;
+        // offset 差值 4，target_kind 2（本 section），目标偏移 0，addend 0
+        assert_eq!(&bytes[start..], &[4, 2, 0, 0]);
     }
 
     #[test]
     fn builds_obj_sections_symbols_and_relocations() {
-        let source = ParsedSource::new(
+        let source = assemble(
             r#"
             ___DEFINE___
             ___DATA___
@@ -912,11 +957,10 @@ mod tests {
             .section text.print
             .symbol print
             ret
-            "#
-            .to_owned(),
+            "#,
         );
 
-        let obj = Obj::from(source).unwrap();
+        let obj = source.finish();
 
         assert_eq!(obj.section.len(), 2);
         assert_eq!(obj.section[0].name, "text._start");
@@ -964,7 +1008,7 @@ mod tests {
 
     #[test]
     fn parses_metadata_directives() {
-        let source = ParsedSource::new(
+        let source = assemble(
             r#"
             #![mem(10M)]
             #![stack(4K)]
@@ -974,8 +1018,7 @@ mod tests {
             .section text._start
             .symbol _start
             setn exit 0
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(source.mem_hint, Some(10 * 1024 * 1024));
@@ -985,21 +1028,20 @@ mod tests {
     #[test]
     #[should_panic(expected = "mem 元数据重复声明")]
     fn duplicate_mem_metadata_panics() {
-        ParsedSource::new(
+        assemble(
             r#"
             #![mem(10M)]
             #![mem(2M)]
             ___DEFINE___
             ___DATA___
             ___CODE___
-            "#
-            .to_owned(),
+            "#,
         );
     }
 
     #[test]
     fn writes_byte_array_data() {
-        let source = ParsedSource::new(
+        let source = assemble(
             r#"
             ___DEFINE___
             ___DATA___
@@ -1010,11 +1052,10 @@ mod tests {
             .section text._start
             .symbol _start
             setn exit 0
-            "#
-            .to_owned(),
+            "#,
         );
 
-        let obj = Obj::from(source).unwrap();
+        let obj = source.finish();
         let section = obj
             .section
             .iter()
@@ -1025,7 +1066,7 @@ mod tests {
 
     #[test]
     fn parses_define_constants() {
-        let sections = ParsedSource::new(
+        let sections = assemble(
             r#"
             ___DEFINE___
             PI 314159
@@ -1037,58 +1078,55 @@ mod tests {
 
             ___CODE___
             outn PI
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(sections.defines["PI"], 314159);
         assert_eq!(sections.defines["STACK_INIT"], 0xEFFFFFFC);
         assert_eq!(sections.defines["FLAG"], 12);
         assert_eq!(sections.defines.len(), 3);
-        assert_eq!(sections.data, [r#"0x100 "hello""#]);
-        assert_eq!(sections.code, ["outn PI"]);
+        let obj = sections.finish();
+        assert_eq!(&section(&obj, "data")[0x100..], b"hello\0");
+        assert_eq!(section(&obj, ".text"), insn("outn", 314159, 0));
     }
 
     #[test]
     #[should_panic(expected = "DEFINE 名字与寄存器名冲突")]
     fn define_name_cannot_be_register() {
-        ParsedSource::new(
+        assemble(
             r#"
             ___DEFINE___
             SP 12345
             ___DATA___
             ___CODE___
-            "#
-            .to_owned(),
+            "#,
         );
     }
 
     #[test]
     #[should_panic(expected = "DEFINE 中名字重复定义")]
     fn define_duplicate_name_panics() {
-        ParsedSource::new(
+        assemble(
             r#"
             ___DEFINE___
             A 1
             A 2
             ___DATA___
             ___CODE___
-            "#
-            .to_owned(),
+            "#,
         );
     }
 
     #[test]
     fn define_names_are_case_sensitive() {
-        let sections = ParsedSource::new(
+        let sections = assemble(
             r#"
             ___DEFINE___
             A 1
             a 2
             ___DATA___
             ___CODE___
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(sections.defines["A"], 1);
@@ -1098,20 +1136,19 @@ mod tests {
     #[test]
     #[should_panic(expected = "无效的十六进制常量")]
     fn define_invalid_hex_panics() {
-        ParsedSource::new(
+        assemble(
             r#"
             ___DEFINE___
             BAD 0xGGGG
             ___DATA___
             ___CODE___
-            "#
-            .to_owned(),
+            "#,
         );
     }
 
     #[test]
     fn ignores_whitespace_inside_section_markers() {
-        let sections = ParsedSource::new(
+        let sections = assemble(
             r#"
             ___ DEFINE ___
             X 42
@@ -1119,18 +1156,18 @@ mod tests {
             0x100 2
             ___ CODE ___
             outn X
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(sections.defines["X"], 42);
-        assert_eq!(sections.data, ["0x100 2"]);
-        assert_eq!(sections.code, ["outn X"]);
+        let obj = sections.finish();
+        assert_eq!(&section(&obj, "data")[0x100..], &2u32.to_be_bytes());
+        assert_eq!(section(&obj, ".text"), insn("outn", 42, 0));
     }
 
     #[test]
     fn removes_line_and_block_comments() {
-        let sections = ParsedSource::new(
+        let sections = assemble(
             r#"
             ___DEFINE___
             A 1 // line comment
@@ -1143,20 +1180,21 @@ mod tests {
 
             ___CODE___
             outn A // trailing comment
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(sections.defines["A"], 1);
         assert_eq!(sections.defines["B"], 2);
         assert_eq!(sections.defines.len(), 2);
-        assert_eq!(sections.data, ["0x100 3"]);
-        assert_eq!(sections.code, ["outn A"]);
+        let obj = sections.finish();
+        assert_eq!(section(&obj, "data").len(), 0x104);
+        assert_eq!(&section(&obj, "data")[0x100..], &3u32.to_be_bytes());
+        assert_eq!(section(&obj, ".text"), insn("outn", 1, 0));
     }
 
     #[test]
     fn keeps_comment_markers_inside_strings() {
-        let sections = ParsedSource::new(
+        let sections = assemble(
             r#"
             ___DEFINE___
             URL 1
@@ -1164,20 +1202,20 @@ mod tests {
             0x100 "http://example.test/*not-comment*/"
             ___CODE___
             oututfn URL
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(sections.defines["URL"], 1);
+        let obj = sections.finish();
         assert_eq!(
-            sections.data,
-            [r#"0x100 "http://example.test/*not-comment*/""#]
+            &section(&obj, "data")[0x100..],
+            b"http://example.test/*not-comment*/\0"
         );
     }
 
     #[test]
     fn escaped_quote_does_not_end_string_during_comment_removal() {
-        let sections = ParsedSource::new(
+        let sections = assemble(
             r#"
             ___DEFINE___
             V 5
@@ -1185,11 +1223,47 @@ mod tests {
             0x100 "hello \" // still string"
             ___CODE___
             oututfn V
-            "#
-            .to_owned(),
+            "#,
         );
 
         assert_eq!(sections.defines["V"], 5);
-        assert_eq!(sections.data, [r#"0x100 "hello \" // still string""#]);
+        let obj = sections.finish();
+        assert_eq!(
+            &section(&obj, "data")[0x100..],
+            b"hello \\\" // still string\0"
+        );
+    }
+
+    #[test]
+    fn defines_replace_whole_tokens_only() {
+        let obj = assemble(
+            r#"
+            ___DEFINE___
+            N 7
+            ___DATA___
+            .section data.table
+            .symbol table
+            table {N, 1}
+            table(8) N
+            ___CODE___
+            .section text._start
+            .symbol _start
+            setn 1x N
+            calln N_helper
+            addn 1x table(N)
+            "#,
+        )
+        .finish();
+
+        assert_eq!(
+            section(&obj, "data.table"),
+            [7u32, 1, 7].iter().flat_map(|v| v.to_be_bytes()).collect::<Vec<_>>()
+        );
+        assert_eq!(&section(&obj, "text._start")[..12], insn("setn", 1, 7));
+        assert_eq!(
+            obj.relocation[0].target,
+            RelocTarget::Symbol("N_helper".to_string())
+        );
+        assert_eq!(obj.relocation[1].addend, 7);
     }
 }
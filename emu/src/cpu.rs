@@ -14,8 +14,11 @@ use std::io::{stdin, stdout, BufRead, BufReader, Read, Stdout, Write};
 use std::time::{Duration, Instant};
 
 use shy_isa_lib::address::Address;
+use shy_isa_lib::file::shyfile::PrivateMap;
 use shy_isa_lib::op::OpType;
 
+use crate::profile::Profile;
+
 /// 普通内存大小：16MiB。
 const MEM_SIZE: usize = 0x0100_0000;
 /// 翻译缓存容量。直接映射，条目数保持 2 的幂，便于快速取模。
@@ -74,7 +77,7 @@ pub struct Emu {
     cause: u32,
     ksp: u32,
     sege: u32,
-    mem: Vec<u8>,
+    mem: PrivateMap,
     instr_cache: Vec<Option<CachedInstr>>,
     trap_stack: Vec<u32>,
     timer_pending: bool,
@@ -84,11 +87,28 @@ pub struct Emu {
     input_chars: VecDeque<char>,
     output: Stdout,
     debug: bool,
+    profile: Option<Profile>,
 }
 
 impl Emu {
     /// 创建一个空白 CPU，内存清零，PC 指向入口，处于内核态、中断关闭。
+    #[cfg(test)]
     pub fn new(debug: bool) -> Self {
+        let mem = PrivateMap::zeroed(MEM_SIZE).expect("failed to allocate emulator memory");
+        Self::with_memory(mem, debug)
+    }
+
+    /// 以 `.sfs` raw 内存镜像创建 CPU：字节偏移即地址。文件以写时复制方式直接
+    /// 映射成内存，不复制镜像。
+    pub fn from_image(path: &str, debug: bool) -> anyhow::Result<Self> {
+        let len = std::fs::metadata(path)?.len();
+        if len > MEM_SIZE as u64 {
+            anyhow::bail!("image size {len} exceeds memory size {MEM_SIZE}");
+        }
+        Ok(Self::with_memory(PrivateMap::with_file(path, MEM_SIZE)?, debug))
+    }
+
+    fn with_memory(mem: PrivateMap, debug: bool) -> Self {
         Self {
             regs: [0; 16],
             pc: ENTRY,
@@ -103,7 +123,7 @@ impl Emu {
             cause: 0,
             ksp: 0,
             sege: MEM_SIZE as u32,
-            mem: vec![0; MEM_SIZE],
+            mem,
             instr_cache: vec![None; INSTR_CACHE_ENTRIES],
             trap_stack: Vec::new(),
             timer_pending: false,
@@ -113,21 +133,22 @@ impl Emu {
             input_chars: VecDeque::new(),
             output: stdout(),
             debug,
+            profile: None,
         }
     }
 
-    /// 加载 `.sfs` raw 内存镜像：字节偏移即地址。
-    pub fn load_image(&mut self, image: &[u8]) -> anyhow::Result<()> {
-        if image.len() > MEM_SIZE {
-            anyhow::bail!(
-                "image size {} exceeds memory size {}",
-                image.len(),
-                MEM_SIZE
-            );
-        }
-        self.mem[..image.len()].copy_from_slice(image);
-        self.clear_instr_cache();
-        Ok(())
+    /// 映射进来的镜像长度；空白 CPU 为 0。
+    pub fn image_len(&self) -> usize {
+        self.mem.image_len()
+    }
+
+    /// 开启执行剖析，统计范围覆盖前 `image_len` 字节。
+    pub fn enable_profile(&mut self, image_len: usize) {
+        self.profile = Some(Profile::new(image_len));
+    }
+
+    pub fn profile(&self) -> Option<&Profile> {
+        self.profile.as_ref()
     }
 
     fn is_user(&self) -> bool {
@@ -740,6 +761,9 @@ impl Emu {
                 let ret = cur.wrapping_add(12);
                 return match self.push(ret, cur) {
                     Flow::Continue => {
+                        if let Some(p) = self.profile.as_mut() {
+                            p.record_call(cur, target);
+                        }
                         self.pc = target;
                         Flow::Continue
                     }
@@ -750,6 +774,9 @@ impl Emu {
                 let ret = cur.wrapping_add(12);
                 return match self.push(ret, cur) {
                     Flow::Continue => {
+                        if let Some(p) = self.profile.as_mut() {
+                            p.record_call(cur, a1);
+                        }
                         self.pc = a1;
                         Flow::Continue
                     }
@@ -935,6 +962,10 @@ impl Emu {
                 }
             };
 
+            if let Some(p) = self.profile.as_mut() {
+                p.record(self.pc);
+            }
+
             match self.execute(op, a1, a2) {
                 Flow::Continue => {
                     if let Some(code) = self.exit_code {
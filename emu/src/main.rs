@@ -1,4 +1,5 @@
 mod cpu;
+mod profile;
 
 use std::env;
 use std::path::Path;
@@ -11,14 +12,27 @@ use crate::cpu::Emu;
 fn main() -> Result<()> {
     let args: Vec<String> = env::args().collect();
 
-    // usage: emu <input.sfs> [--debug]
+    // usage: emu <input.sfs> [--debug] [--profile <out.json> --sym <symfile>]
     let mut input: Option<String> = None;
     let mut debug = false;
+    let mut profile: Option<String> = None;
+    let mut sym: Option<String> = None;
 
     let mut i = 1;
     while i < args.len() {
         match args[i].as_str() {
             "--debug" => debug = true,
+            "--profile" | "--sym" => {
+                let Some(v) = args.get(i + 1) else {
+                    bail!("option `{}` requires an argument", args[i]);
+                };
+                if args[i] == "--profile" {
+                    profile = Some(v.clone());
+                } else {
+                    sym = Some(v.clone());
+                }
+                i += 1;
+            }
             s if s.starts_with('-') => bail!("unknown option: {s}"),
             s => {
                 if input.is_none() {
@@ -32,23 +46,42 @@ fn main() -> Result<()> {
     }
 
     let Some(input) = input else {
-        bail!("usage:{} <input.sfs> [--debug]", args[0]);
+        bail!(
+            "usage:{} <input.sfs> [--debug] [--profile <out.json> --sym <symfile>]",
+            args[0]
+        );
+    };
+
+    // 剖析结果按函数汇总，需要链接器 `--sym` 给出的 section 地址。
+    let symbols = match (&profile, &sym) {
+        (Some(_), Some(sym)) => {
+            let text = std::fs::read_to_string(sym)
+                .with_context(|| format!("failed to read symbol file: {sym}"))?;
+            profile::parse_sym(&text).with_context(|| format!("invalid symbol file: {sym}"))?
+        }
+        (Some(_), None) => bail!("`--profile` requires `--sym <symfile>`"),
+        _ => Vec::new(),
     };
 
     if !Path::new(&input).exists() {
         bail!("input file does not exist: {input}");
     }
 
-    // 读取 .sfs raw 内存镜像。
-    let Ok(file) = File::open(&input) else {
-        bail!("failed to open input file: {input}");
-    };
-    let image = file.as_slice().to_vec();
-
-    let mut emu = Emu::new(debug);
-    emu.load_image(&image)
-        .with_context(|| format!("failed to load image: {input}"))?;
+    // .sfs raw 内存镜像直接映射成模拟器内存。
+    let mut emu =
+        Emu::from_image(&input, debug).with_context(|| format!("failed to load image: {input}"))?;
+    if profile.is_some() {
+        emu.enable_profile(emu.image_len());
+    }
 
     let code = emu.run();
+    if let (Some(path), Some(p)) = (&profile, emu.profile()) {
+        File::create(path)
+            .and_then(|mut out| {
+                out.push_back_slice(p.to_json(&symbols).as_bytes())?;
+                out.close()
+            })
+            .with_context(|| format!("failed to write profile: {path}"))?;
+    }
     std::process::exit(code as i32 & 0xFF);
 }
@@ -0,0 +1,200 @@
+//! `--profile` 执行剖析：按 PC 统计每条指令的执行次数，并记录 `calln`/`calla`
+//! 调用边。退出时借助链接器写出的 `.sym` 把 PC 归到 `text.<函数>` section，
+//! 按函数汇总成 JSON，供 `shycc -fprofile-use=<file>` 回灌给 Shy 后端。
+//!
+//! 输出格式：
+//!
+//! ```json
+//! {
+//!   "functions": [
+//!     {"name": "main", "entries": 1, "insns": 42}
+//!   ],
+//!   "edges": [
+//!     {"caller": "main", "callee": "f", "count": 3}
+//!   ]
+//! }
+//! ```
+//!
+//! `entries` 是函数首条指令的执行次数（包含尾调用跳入），`insns` 是函数内
+//! 全部指令的执行次数之和。
+
+use std::collections::BTreeMap;
+use std::collections::HashMap;
+
+use anyhow::{Context, Result, bail};
+
+pub struct Profile {
+    /// 以 `pc / 4` 为下标的执行计数，只覆盖加载的镜像。
+    counts: Vec<u64>,
+    /// (调用指令 PC, 目标地址) -> 次数。
+    edges: HashMap<(u32, u32), u64>,
+}
+
+/// 一个 `text.<name>` section 覆盖的地址区间 `[start, end)`。
+struct FnRange {
+    name: String,
+    start: u32,
+    end: u32,
+}
+
+impl Profile {
+    pub fn new(image_len: usize) -> Self {
+        Self {
+            counts: vec![0; image_len.div_ceil(4)],
+            edges: HashMap::new(),
+        }
+    }
+
+    #[inline]
+    pub fn record(&mut self, pc: u32) {
+        if let Some(c) = self.counts.get_mut((pc / 4) as usize) {
+            *c += 1;
+        }
+    }
+
+    pub fn record_call(&mut self, pc: u32, target: u32) {
+        *self.edges.entry((pc, target)).or_insert(0) += 1;
+    }
+
+    fn count(&self, pc: u32) -> u64 {
+        self.counts.get((pc / 4) as usize).copied().unwrap_or(0)
+    }
+
+    /// 按 `.sym` 中的 section 起始地址切出每个函数的地址区间。函数一直延伸到
+    /// 下一个 `text.*`/`data*` section 的起点，最后一个延伸到镜像末尾。
+    fn fn_ranges(&self, symbols: &[(String, u32)]) -> Vec<FnRange> {
+        let mut bounds: Vec<(u32, Option<&str>)> = symbols
+            .iter()
+            .filter_map(|(name, addr)| {
+                if let Some(f) = name.strip_prefix("text.") {
+                    Some((*addr, Some(f)))
+                } else if name == "data" || name.starts_with("data.") {
+                    Some((*addr, None))
+                } else {
+                    None
+                }
+            })
+            .collect();
+        bounds.sort_by_key(|(addr, _)| *addr);
+
+        let image_end = (self.counts.len() * 4) as u32;
+        let mut ranges = Vec::new();
+        for (i, (start, name)) in bounds.iter().enumerate() {
+            let Some(name) = name else {
+                continue;
+            };
+            let end = bounds.get(i + 1).map_or(image_end, |(addr, _)| *addr);
+            ranges.push(FnRange {
+                name: name.to_string(),
+                start: *start,
+                end,
+            });
+        }
+        ranges
+    }
+
+    pub fn to_json(&self, symbols: &[(String, u32)]) -> String {
+        let ranges = self.fn_ranges(symbols);
+        let find = |pc: u32| {
+            let i = ranges.partition_point(|r| r.start <= pc);
+            ranges[..i].last().filter(|r| pc < r.end)
+        };
+
+        let mut out = String::from("{\n  \"functions\": [");
+        for (i, r) in ranges.iter().enumerate() {
+            let insns: u64 = (r.start..r.end).step_by(12).map(|pc| self.count(pc)).sum();
+            out.push_str(if i == 0 { "\n" } else { ",\n" });
+            out.push_str(&format!(
+                "    {{\"name\": {}, \"entries\": {}, \"insns\": {insns}}}",
+                json_string(&r.name),
+                self.count(r.start)
+            ));
+        }
+        out.push_str("\n  ],\n  \"edges\": [");
+
+        let mut edges: BTreeMap<(&str, &str), u64> = BTreeMap::new();
+        for (&(pc, target), &n) in &self.edges {
+            if let (Some(caller), Some(callee)) = (find(pc), find(target)) {
+                *edges.entry((&caller.name, &callee.name)).or_insert(0) += n;
+            }
+        }
+        for (i, ((caller, callee), n)) in edges.iter().enumerate() {
+            out.push_str(if i == 0 { "\n" } else { ",\n" });
+            out.push_str(&format!(
+                "    {{\"caller\": {}, \"callee\": {}, \"count\": {n}}}",
+                json_string(caller),
+                json_string(callee)
+            ));
+        }
+        out.push_str("\n  ]\n}\n");
+        out
+    }
+}
+
+fn json_string(s: &str) -> String {
+    let mut out = String::from("\"");
+    for c in s.chars() {
+        match c {
+            '"' => out.push_str("\\\""),
+            '\\' => out.push_str("\\\\"),
+            c if (c as u32) < 0x20 => out.push_str(&format!("\\u{:04x}", c as u32)),
+            c => out.push(c),
+        }
+    }
+    out.push('"');
+    out
+}
+
+/// 解析链接器 `--sym` 输出：每行 `<name> 0x<addr>`。
+pub fn parse_sym(text: &str) -> Result<Vec<(String, u32)>> {
+    let mut symbols = Vec::new();
+    for (lineno, line) in text.lines().enumerate() {
+        let line = line.trim();
+        if line.is_empty() {
+            continue;
+        }
+        let Some((name, addr)) = line.split_once(' ') else {
+            bail!("line {}: expected `<name> 0x<addr>`", lineno + 1);
+        };
+        let addr = addr.trim();
+        let hex = addr.strip_prefix("0x").unwrap_or(addr);
+        let addr = u32::from_str_radix(hex, 16)
+            .with_context(|| format!("line {}: bad address `{addr}`", lineno + 1))?;
+        symbols.push((name.to_string(), addr));
+    }
+    Ok(symbols)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parse_sym_reads_linker_output() {
+        let syms = parse_sym("_start 0x00000100\ntext.main 0x0000010c\n").unwrap();
+        assert_eq!(syms, vec![("_start".to_string(), 0x100), ("text.main".to_string(), 0x10c)]);
+        assert!(parse_sym("main\n").is_err());
+    }
+
+    #[test]
+    fn json_groups_counts_and_edges_by_function() {
+        let mut p = Profile::new(0x200);
+        // text._start: 0x100..0x118, text.f: 0x118..0x130, data: 0x130
+        for pc in [0x100, 0x10c, 0x118, 0x124, 0x118, 0x124] {
+            p.record(pc);
+        }
+        p.record_call(0x10c, 0x118);
+        p.record_call(0x10c, 0x118);
+        let syms = vec![
+            ("text._start".to_string(), 0x100),
+            ("_start".to_string(), 0x100),
+            ("text.f".to_string(), 0x118),
+            ("f".to_string(), 0x118),
+            ("data".to_string(), 0x130),
+        ];
+        let json = p.to_json(&syms);
+        assert!(json.contains("{\"name\": \"_start\", \"entries\": 1, \"insns\": 2}"));
+        assert!(json.contains("{\"name\": \"f\", \"entries\": 2, \"insns\": 4}"));
+        assert!(json.contains("{\"caller\": \"_start\", \"callee\": \"f\", \"count\": 2}"));
+    }
+}
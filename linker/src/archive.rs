@@ -0,0 +1,436 @@
+//! `.sa` 静态库：若干 `.sobj` 成员加一张按名字排序的 symbol 索引。
+//!
+//! 格式定义见 `ObjFormat.md` 第 14 节。建库时每个输入 object 按 section 拆成
+//! 独立的成员，链接时只取出能解析当前未定义 symbol 的成员，重复直到不动点。
+//!
+//! v2 object 只能用下标引用本 object 内的 section，所以拆分时把跨 section 的
+//! `SectionOffset` relocation 改写成对目标 section 起点 symbol 的引用：symbol
+//! 名就是 section 名（section 名在整个链接中唯一），offset 并入 addend。
+
+use std::collections::{HashMap, HashSet};
+
+use anyhow::{Context, Result, bail};
+
+use crate::obj::{ObjRelocation, ObjSymbol, ObjectFile, RelocTarget};
+
+/// `.sa` 文件头 magic。
+pub const ARCHIVE_MAGIC: u32 = 0x66CCFFA0;
+
+const HEADER_SIZE: usize = 28;
+const MEMBER_RECORD: usize = 12;
+const SYMBOL_RECORD: usize = 8;
+
+fn read_u32(buf: &[u8], off: usize) -> Result<u32> {
+    let s = buf.get(off..off + 4).context("archive truncated")?;
+    Ok(u32::from_be_bytes([s[0], s[1], s[2], s[3]]))
+}
+
+/// 判断字节流是不是 `.sa` 静态库。
+pub fn is_archive(buf: &[u8]) -> bool {
+    buf.len() >= 4 && read_u32(buf, 0).ok() == Some(ARCHIVE_MAGIC)
+}
+
+/// `.sa` 文件的只读视图，成员和名字都借用输入字节。
+#[derive(Clone, Copy)]
+pub struct Archive<'a> {
+    buf: &'a [u8],
+    member_count: usize,
+    members: &'a [u8],
+    symbol_count: usize,
+    symbols: &'a [u8],
+    strtab: &'a [u8],
+}
+
+impl<'a> Archive<'a> {
+    pub fn parse(buf: &'a [u8]) -> Result<Self> {
+        if buf.len() < HEADER_SIZE {
+            bail!("archive too small for header: {} bytes", buf.len());
+        }
+        let magic = read_u32(buf, 0)?;
+        if magic != ARCHIVE_MAGIC {
+            bail!("bad archive magic: 0x{magic:08X}, expected 0x{ARCHIVE_MAGIC:08X}");
+        }
+        let word = |off: usize| read_u32(buf, off).map(|v| v as usize);
+        let area = |start: usize, len: usize, what: &str| -> Result<&'a [u8]> {
+            start
+                .checked_add(len)
+                .and_then(|end| buf.get(start..end))
+                .with_context(|| format!("archive {what} out of bounds"))
+        };
+        let member_count = word(4)?;
+        let symbol_count = word(12)?;
+        Ok(Self {
+            buf,
+            member_count,
+            members: area(word(8)?, member_count * MEMBER_RECORD, "member table")?,
+            symbol_count,
+            symbols: area(word(16)?, symbol_count * SYMBOL_RECORD, "symbol index")?,
+            strtab: area(word(20)?, word(24)?, "string table")?,
+        })
+    }
+
+    pub fn member_count(&self) -> usize {
+        self.member_count
+    }
+
+    fn name(&self, off: u32) -> Result<&'a str> {
+        let rest = self
+            .strtab
+            .get(off as usize..)
+            .with_context(|| format!("archive string offset out of bounds: {off}"))?;
+        let end = rest
+            .iter()
+            .position(|&b| b == 0)
+            .context("unterminated string in archive")?;
+        std::str::from_utf8(&rest[..end]).context("non-utf8 string in archive")
+    }
+
+    /// 第 `index` 个成员的名字和 `.sobj` 字节。
+    pub fn member(&self, index: usize) -> Result<(&'a str, &'a [u8])> {
+        if index >= self.member_count {
+            bail!("archive member index out of range: {index}");
+        }
+        let rec = index * MEMBER_RECORD;
+        let name = self.name(read_u32(self.members, rec)?)?;
+        let start = read_u32(self.members, rec + 4)? as usize;
+        let size = read_u32(self.members, rec + 8)? as usize;
+        let bytes = self
+            .buf
+            .get(start..start + size)
+            .with_context(|| format!("archive member truncated: {name}"))?;
+        Ok((name, bytes))
+    }
+
+    /// 在 symbol 索引里二分查找定义 `symbol` 的成员。
+    pub fn find(&self, symbol: &str) -> Result<Option<usize>> {
+        let (mut lo, mut hi) = (0, self.symbol_count);
+        while lo < hi {
+            let mid = (lo + hi) / 2;
+            let rec = mid * SYMBOL_RECORD;
+            let name = self.name(read_u32(self.symbols, rec)?)?;
+            match name.cmp(symbol) {
+                std::cmp::Ordering::Less => lo = mid + 1,
+                std::cmp::Ordering::Greater => hi = mid,
+                std::cmp::Ordering::Equal => {
+                    let member = read_u32(self.symbols, rec + 4)? as usize;
+                    if member >= self.member_count {
+                        bail!("archive symbol {symbol} refers to member {member} out of range");
+                    }
+                    return Ok(Some(member));
+                }
+            }
+        }
+        Ok(None)
+    }
+}
+
+/// 把一个 object 按 section 拆成单 section 的成员，见模块说明。
+fn split_sections(obj: ObjectFile) -> Result<Vec<ObjectFile>> {
+    let mut index: HashMap<String, usize> = HashMap::new();
+    let mut members: Vec<ObjectFile> = Vec::with_capacity(obj.sections.len());
+    for section in obj.sections {
+        if index.insert(section.name.clone(), members.len()).is_some() {
+            bail!("duplicate section `{}`", section.name);
+        }
+        members.push(ObjectFile {
+            mem_hint: obj.mem_hint,
+            stack_hint: obj.stack_hint,
+            sections: vec![section],
+            symbols: Vec::new(),
+            relocations: Vec::new(),
+        });
+    }
+
+    let mut referenced = HashSet::new();
+    for symbol in obj.symbols {
+        let Some(&m) = index.get(&symbol.section) else {
+            bail!(
+                "symbol `{}` refers to missing section `{}`",
+                symbol.name,
+                symbol.section
+            );
+        };
+        members[m].symbols.push(symbol);
+    }
+    for r in obj.relocations {
+        let Some(&m) = index.get(&r.section) else {
+            bail!("relocation refers to missing section `{}`", r.section);
+        };
+        let r = match r.target {
+            RelocTarget::SectionOffset { section, offset } if section != r.section => {
+                referenced.insert(section.clone());
+                ObjRelocation {
+                    section: r.section,
+                    offset: r.offset,
+                    addend: r.addend.wrapping_add(offset),
+                    target: RelocTarget::Symbol(section),
+                }
+            }
+            _ => r,
+        };
+        members[m].relocations.push(r);
+    }
+
+    // 被其他 section 引用的 section 需要一个同名的起点 symbol。
+    for name in referenced {
+        let Some(&m) = index.get(&name) else {
+            bail!("relocation refers to missing section `{name}`");
+        };
+        match members[m].symbols.iter().find(|s| s.name == name) {
+            Some(s) if s.offset == 0 => {}
+            Some(_) => bail!("symbol `{name}` must mark the start of its section"),
+            None => members[m].symbols.push(ObjSymbol {
+                name: name.clone(),
+                section: name,
+                offset: 0,
+            }),
+        }
+    }
+    Ok(members)
+}
+
+/// 用若干 object 建一个 `.sa`。`inputs` 是 (诊断用名字, object)。
+pub fn build_archive(inputs: Vec<(String, ObjectFile)>) -> Result<Vec<u8>> {
+    fn put_u32(buf: &mut Vec<u8>, value: usize) -> Result<()> {
+        let v = u32::try_from(value).context("archive offset exceeds u32::MAX")?;
+        buf.extend_from_slice(&v.to_be_bytes());
+        Ok(())
+    }
+
+    let mut members: Vec<(String, Vec<u8>)> = Vec::new();
+    let mut index: Vec<(String, usize)> = Vec::new();
+    let mut defined: HashMap<String, String> = HashMap::new();
+    for (input, obj) in inputs {
+        let parts = split_sections(obj).with_context(|| format!("failed to split {input}"))?;
+        // section 名在一次链接中唯一，直接用作成员名。
+        for member in parts {
+            let name = member.sections[0].name.clone();
+            for symbol in &member.symbols {
+                if let Some(prev) = defined.insert(symbol.name.clone(), name.clone()) {
+                    bail!("duplicate symbol `{}` in {prev} and {name}", symbol.name);
+                }
+                index.push((symbol.name.clone(), members.len()));
+            }
+            let bytes = member
+                .to_bytes()
+                .with_context(|| format!("failed to encode {name}"))?;
+            members.push((name, bytes));
+        }
+    }
+    index.sort_unstable();
+
+    let mut strtab = Vec::new();
+    let mut intern = |s: &str| {
+        let off = strtab.len();
+        strtab.extend_from_slice(s.as_bytes());
+        strtab.push(0);
+        off
+    };
+    let member_names: Vec<usize> = members.iter().map(|(name, _)| intern(name)).collect();
+    let symbol_names: Vec<usize> = index.iter().map(|(name, _)| intern(name)).collect();
+
+    let member_table = HEADER_SIZE;
+    let symbol_table = member_table + members.len() * MEMBER_RECORD;
+    let strtab_start = symbol_table + index.len() * SYMBOL_RECORD;
+    let mut data = strtab_start + strtab.len();
+
+    let mut buf = Vec::new();
+    put_u32(&mut buf, ARCHIVE_MAGIC as usize)?;
+    put_u32(&mut buf, members.len())?;
+    put_u32(&mut buf, member_table)?;
+    put_u32(&mut buf, index.len())?;
+    put_u32(&mut buf, symbol_table)?;
+    put_u32(&mut buf, strtab_start)?;
+    put_u32(&mut buf, strtab.len())?;
+    for (i, (_, bytes)) in members.iter().enumerate() {
+        put_u32(&mut buf, member_names[i])?;
+        put_u32(&mut buf, data)?;
+        put_u32(&mut buf, bytes.len())?;
+        data += bytes.len();
+    }
+    for (i, (_, member)) in index.iter().enumerate() {
+        put_u32(&mut buf, symbol_names[i])?;
+        put_u32(&mut buf, *member)?;
+    }
+    buf.extend_from_slice(&strtab);
+    for (_, bytes) in &members {
+        buf.extend_from_slice(bytes);
+    }
+    Ok(buf)
+}
+
+/// 从 `archives` 里取出解析 `objects` 未定义 symbol 所需的成员，直到不动点。
+///
+/// 返回 (archive 下标, 成员下标, 成员 object)，按 archive 和成员在库中的顺序
+/// 排列，这样链接布局不依赖查找顺序。已经有定义的 symbol 不会再从库里取成员。
+pub fn extract_members<'a>(
+    objects: &[ObjectFile],
+    archives: &[Archive<'a>],
+) -> Result<Vec<(usize, usize, ObjectFile<'a>)>> {
+    fn note(obj: &ObjectFile, defined: &mut HashSet<String>, undefined: &mut Vec<String>) {
+        defined.extend(obj.symbols.iter().map(|s| s.name.clone()));
+        for r in &obj.relocations {
+            if let RelocTarget::Symbol(name) = &r.target {
+                undefined.push(name.clone());
+            }
+        }
+    }
+
+    let mut defined: HashSet<String> = HashSet::new();
+    let mut undefined: Vec<String> = Vec::new();
+    for obj in objects {
+        note(obj, &mut defined, &mut undefined);
+    }
+
+    let mut taken: HashSet<(usize, usize)> = HashSet::new();
+    let mut out = Vec::new();
+    while let Some(name) = undefined.pop() {
+        if defined.contains(&name) {
+            continue;
+        }
+        for (a, archive) in archives.iter().enumerate() {
+            let Some(m) = archive.find(&name)? else {
+                continue;
+            };
+            if taken.insert((a, m)) {
+                let (member, bytes) = archive.member(m)?;
+                let obj = ObjectFile::from_bytes(bytes)
+                    .with_context(|| format!("failed to parse archive member {member}"))?;
+                note(&obj, &mut defined, &mut undefined);
+                out.push((a, m, obj));
+            }
+            break;
+        }
+        // 没有成员定义它时保留为未定义，由链接阶段报错。
+        defined.insert(name);
+    }
+    out.sort_by_key(|&(a, m, _)| (a, m));
+    Ok(out)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::obj::ObjSection;
+
+    fn sym(name: &str, section: &str, offset: u32) -> ObjSymbol {
+        ObjSymbol {
+            name: name.to_string(),
+            section: section.to_string(),
+            offset,
+        }
+    }
+
+    fn reloc(section: &str, offset: u32, target: RelocTarget) -> ObjRelocation {
+        ObjRelocation {
+            section: section.to_string(),
+            offset,
+            target,
+            addend: 0,
+        }
+    }
+
+    fn lib() -> ObjectFile<'static> {
+        ObjectFile {
+            mem_hint: None,
+            stack_hint: None,
+            sections: ["text.puts", "text.putc", "text.unused", "data.msg"]
+                .iter()
+                .map(|name| ObjSection {
+                    name: name.to_string(),
+                    bytes: vec![0; 12].into(),
+                })
+                .collect(),
+            symbols: vec![
+                sym("puts", "text.puts", 0),
+                sym("putc", "text.putc", 0),
+                sym("unused", "text.unused", 0),
+            ],
+            relocations: vec![
+                reloc("text.puts", 4, RelocTarget::Symbol("putc".to_string())),
+                reloc(
+                    "text.puts",
+                    8,
+                    RelocTarget::SectionOffset {
+                        section: "data.msg".to_string(),
+                        offset: 4,
+                    },
+                ),
+            ],
+        }
+    }
+
+    fn user(target: &str) -> ObjectFile<'static> {
+        ObjectFile {
+            mem_hint: None,
+            stack_hint: None,
+            sections: vec![ObjSection {
+                name: "text._start".to_string(),
+                bytes: vec![0; 12].into(),
+            }],
+            symbols: vec![sym("_start", "text._start", 0)],
+            relocations: vec![reloc(
+                "text._start",
+                4,
+                RelocTarget::Symbol(target.to_string()),
+            )],
+        }
+    }
+
+    #[test]
+    fn builds_index_and_splits_per_section() {
+        let buf = build_archive(vec![("lib.sobj".to_string(), lib())]).unwrap();
+        assert!(is_archive(&buf));
+        let archive = Archive::parse(&buf).unwrap();
+        assert_eq!(archive.member_count(), 4);
+        assert_eq!(archive.member(1).unwrap().0, "text.putc");
+        assert_eq!(archive.find("putc").unwrap(), Some(1));
+        assert_eq!(archive.find("data.msg").unwrap(), Some(3));
+        assert_eq!(archive.find("missing").unwrap(), None);
+
+        // 跨 section 引用改写成对 section 起点 symbol 的引用，offset 并入 addend。
+        let puts = ObjectFile::from_bytes(archive.member(0).unwrap().1).unwrap();
+        assert_eq!(
+            puts.relocations[1],
+            ObjRelocation {
+                section: "text.puts".to_string(),
+                offset: 8,
+                target: RelocTarget::Symbol("data.msg".to_string()),
+                addend: 4,
+            }
+        );
+    }
+
+    #[test]
+    fn extracts_only_needed_members_to_fixpoint() {
+        let buf = build_archive(vec![("lib.sobj".to_string(), lib())]).unwrap();
+        let archive = Archive::parse(&buf).unwrap();
+        let got = extract_members(&[user("puts")], &[archive]).unwrap();
+        let names: Vec<_> = got
+            .iter()
+            .map(|(_, _, o)| o.sections[0].name.as_str())
+            .collect();
+        assert_eq!(names, ["text.puts", "text.putc", "data.msg"]);
+
+        // 用户自己定义的 symbol 不会从库里再取一份。
+        let mut own = user("puts");
+        own.sections.push(ObjSection {
+            name: "text.myputc".to_string(),
+            bytes: vec![0; 12].into(),
+        });
+        own.symbols.push(sym("putc", "text.myputc", 0));
+        let got = extract_members(&[own], &[archive]).unwrap();
+        let names: Vec<_> = got
+            .iter()
+            .map(|(_, _, o)| o.sections[0].name.as_str())
+            .collect();
+        assert_eq!(names, ["text.puts", "data.msg"]);
+    }
+
+    #[test]
+    fn rejects_duplicate_symbols_across_members() {
+        let mut a = lib();
+        a.symbols.push(sym("puts", "text.putc", 4));
+        assert!(build_archive(vec![("a".to_string(), a)]).is_err());
+    }
+}
@@ -0,0 +1,372 @@
+//! `shyld` 命令行：解析参数、读取输入、链接并写出镜像。
+//!
+//! `shycc` 在进程内调用 [`run`]，把刚汇编好的 object 字节直接作为 [`Input::Memory`]
+//! 传进来，不经过临时文件。
+
+use std::path::Path;
+use std::time::{Duration, Instant};
+
+use anyhow::{Context, Result, bail};
+use shy_isa_lib::file::shyfile::File;
+
+use crate::archive::{Archive, build_archive, extract_members, is_archive};
+use crate::incremental::{Pending, Relink, State, content_hash};
+use crate::link::{LinkOptions, link_with, raii_drop_warnings};
+use crate::obj::ObjectFile;
+use crate::order::{CallGraphProfile, SectionOrder, parse_call_graph_profile, parse_ordering_file};
+
+/// 一个链接输入。
+pub enum Input {
+    /// 磁盘上的 `.sobj` 或 `.sa` 文件，mmap 后解析。
+    Path(String),
+    /// 已经在内存中的 `.sobj` 字节；`name` 只用于诊断信息。
+    Memory { name: String, bytes: Vec<u8> },
+}
+
+/// 按 `args`（`args[0]` 是程序名）执行一次链接。`inputs` 排在命令行给出的输入文件之前。
+pub fn run(args: &[String], mut inputs: Vec<Input>) -> Result<()> {
+    // usage: linker <input.sobj>... [-o <output.sfs>] [--sym <symfile>]
+    //        [--gc-sections] [--print-gc-sections] [--icf] [--print-icf-sections]
+    //        [--symbol-ordering-file <file>] [--call-graph-profile <prof.json>]
+    //        [--print-layout] [--stats] [--incremental]
+    //        linker --archive <input.sobj>... -o <output.sa>
+    let mut output: Option<String> = None;
+    let mut sym: Option<String> = None;
+    let mut opts = LinkOptions::default();
+    let mut print_gc = false;
+    let mut print_icf = false;
+    let mut print_layout = false;
+    let mut print_stats = false;
+    let mut build_archive_mode = false;
+    let mut incremental = false;
+    let mut ordering_file: Option<String> = None;
+    let mut profile_file: Option<String> = None;
+
+    let mut i = 1;
+    while i < args.len() {
+        match args[i].as_str() {
+            "-o" => {
+                i += 1;
+                let Some(v) = args.get(i) else {
+                    bail!("option `-o` requires an argument");
+                };
+                output = Some(v.clone());
+            }
+            "--sym" => {
+                i += 1;
+                let Some(v) = args.get(i) else {
+                    bail!("option `--sym` requires an argument");
+                };
+                sym = Some(v.clone());
+            }
+            "--gc-sections" => opts.gc_sections = true,
+            "--print-gc-sections" => print_gc = true,
+            "--icf" => opts.icf = true,
+            "--print-icf-sections" => print_icf = true,
+            "--print-layout" => print_layout = true,
+            "--stats" => print_stats = true,
+            "--archive" => build_archive_mode = true,
+            "--incremental" => incremental = true,
+            "--symbol-ordering-file" | "--call-graph-profile" => {
+                let flag = args[i].clone();
+                i += 1;
+                let Some(v) = args.get(i) else {
+                    bail!("option `{flag}` requires an argument");
+                };
+                if flag == "--symbol-ordering-file" {
+                    ordering_file = Some(v.clone());
+                } else {
+                    profile_file = Some(v.clone());
+                }
+            }
+            s if s.starts_with("--symbol-ordering-file=") => {
+                ordering_file = Some(s["--symbol-ordering-file=".len()..].to_string());
+            }
+            s if s.starts_with("--call-graph-profile=") => {
+                profile_file = Some(s["--call-graph-profile=".len()..].to_string());
+            }
+            s if s.starts_with('-') => bail!("unknown option: {s}"),
+            s => inputs.push(Input::Path(s.to_string())),
+        }
+        i += 1;
+    }
+
+    if inputs.is_empty() {
+        bail!(
+            "usage:{} <input.sobj>... [-o <output.sfs>] [--sym <symfile>] [--gc-sections] [--print-gc-sections] [--icf] [--print-icf-sections] [--symbol-ordering-file <file>] [--call-graph-profile <prof.json>] [--print-layout] [--stats] [--incremental]\n      {} --archive <input.sobj>... [-o <output.sa>]",
+            args[0],
+            args[0]
+        );
+    }
+
+    let profile = match &profile_file {
+        Some(path) => {
+            let text = std::fs::read_to_string(path)
+                .with_context(|| format!("failed to read call graph profile: {path}"))?;
+            let prof = parse_call_graph_profile(&text)
+                .with_context(|| format!("invalid call graph profile: {path}"))?;
+            Some(prof)
+        }
+        None => None,
+    };
+    opts.order = match (&ordering_file, &profile) {
+        (Some(_), Some(_)) => {
+            bail!("`--symbol-ordering-file` and `--call-graph-profile` are mutually exclusive")
+        }
+        (Some(path), None) => {
+            let text = std::fs::read_to_string(path)
+                .with_context(|| format!("failed to read symbol ordering file: {path}"))?;
+            Some(SectionOrder::List(parse_ordering_file(&text)))
+        }
+        (None, Some(prof)) => Some(SectionOrder::Profile(prof.clone())),
+        (None, None) => None,
+    };
+
+    // 1. 读取所有输入：`.sobj` 直接解析，`.sa` 静态库只按需取出成员。
+    let read_start = Instant::now();
+    let mut files = Vec::with_capacity(inputs.len());
+    for input in &inputs {
+        files.push(match input {
+            Input::Path(path) => {
+                if !Path::new(path).exists() {
+                    bail!("input file does not exist: {path}");
+                }
+                let Ok(file) = File::open(path) else {
+                    bail!("failed to open input file: {path}");
+                };
+                Some(file)
+            }
+            Input::Memory { .. } => None,
+        });
+    }
+
+    let raw: Vec<(&str, &[u8])> = inputs
+        .iter()
+        .zip(&files)
+        .map(|(input, file)| match (input, file) {
+            (Input::Memory { name, bytes }, _) => (name.as_str(), bytes.as_slice()),
+            (Input::Path(path), Some(file)) => (path.as_str(), file.as_slice()),
+            (Input::Path(_), None) => unreachable!(),
+        })
+        .collect();
+
+    // 增量链接：能原地更新上一次的输出时直接返回，否则做一次带槽位的完整链接。
+    let output_path = output.clone().unwrap_or_else(|| "a.sfs".to_string());
+    let state_path = format!("{output_path}.ilk");
+    let fingerprint = content_hash(format!("{:?}", opts.order).as_bytes());
+    if incremental {
+        if opts.gc_sections || opts.icf {
+            bail!("`--incremental` cannot be combined with `--gc-sections` or `--icf`");
+        }
+        opts.pad_sections = true;
+        let state = std::fs::read(&state_path)
+            .ok()
+            .and_then(|buf| State::from_bytes(&buf).ok());
+        let reason = match (state, std::fs::read(&output_path)) {
+            (Some(mut state), Ok(mut image)) => {
+                let read_time = read_start.elapsed();
+                let relink_start = Instant::now();
+                match state.relink(fingerprint, &raw, &mut image)? {
+                    Relink::Updated(updated) => {
+                        let relink_time = relink_start.elapsed();
+                        let write_start = Instant::now();
+                        write_output(&output_path, &image)?;
+                        write_state(&state_path, &state)?;
+                        if let Some(sym_path) = &sym {
+                            write_symbols(sym_path, &state.symbols())?;
+                        }
+                        if print_layout {
+                            print_layout_lines(&state.layout(), profile.as_ref());
+                        }
+                        if print_stats {
+                            eprintln!(
+                                "incremental: relinked {updated} of {} objects in place, {} bytes",
+                                state.unit_count(),
+                                image.len()
+                            );
+                            let phases = [
+                                ("read", read_time),
+                                ("relink", relink_time),
+                                ("write", write_start.elapsed()),
+                            ];
+                            print_phases(&phases);
+                        }
+                        return Ok(());
+                    }
+                    Relink::Full(reason) => reason,
+                }
+            }
+            _ => "no previous incremental link".to_string(),
+        };
+        if print_stats {
+            eprintln!("incremental: full link: {reason}");
+        }
+    }
+
+    let mut names = Vec::with_capacity(inputs.len());
+    let mut origins = Vec::with_capacity(inputs.len());
+    let mut objects = Vec::with_capacity(inputs.len());
+    let mut archives = Vec::new();
+    for (i, &(name, bytes)) in raw.iter().enumerate() {
+        if is_archive(bytes) {
+            let archive = Archive::parse(bytes)
+                .with_context(|| format!("failed to parse archive: {name}"))?;
+            archives.push((i, name, archive));
+            continue;
+        }
+        let obj = ObjectFile::from_bytes(bytes)
+            .with_context(|| format!("failed to parse object file: {name}"))?;
+        names.push(name.to_string());
+        origins.push(i);
+        objects.push(obj);
+    }
+
+    if build_archive_mode {
+        if !archives.is_empty() {
+            bail!("`--archive` inputs must be object files");
+        }
+        let output = output.unwrap_or_else(|| "a.sa".to_string());
+        let buf = build_archive(names.into_iter().zip(objects).collect())?;
+        return write_output(&output, &buf);
+    }
+
+    let views: Vec<_> = archives.iter().map(|(_, _, a)| *a).collect();
+    let members = extract_members(&objects, &views)?;
+    let total_members: usize = views.iter().map(Archive::member_count).sum();
+    let extracted = members.len();
+    for (a, m, obj) in members {
+        let (input, archive, _) = archives[a];
+        let (member, _) = views[a].member(m)?;
+        names.push(format!("{archive}({member})"));
+        origins.push(input);
+        objects.push(obj);
+    }
+
+    let named_objects: Vec<_> = names
+        .iter()
+        .zip(objects.iter())
+        .map(|(name, obj)| (name.as_str(), obj))
+        .collect();
+    for warning in raii_drop_warnings(&named_objects) {
+        eprintln!("warning: {warning}");
+    }
+
+    let read_time = read_start.elapsed();
+
+    // 2. 链接。
+    let output = output_path;
+    let mut pending = incremental.then(Pending::default);
+    if let Some(pending) = &mut pending {
+        for (input, obj) in origins.iter().zip(&objects) {
+            pending.add(*input, obj);
+        }
+    }
+    let linked = link_with(objects, &opts)?;
+    if print_gc {
+        let mut total = 0u32;
+        for (name, size) in &linked.removed {
+            eprintln!("removed unused section `{name}` ({size} bytes)");
+            total += size;
+        }
+        eprintln!(
+            "removed {} unused sections ({total} bytes)",
+            linked.removed.len()
+        );
+    }
+    if print_icf {
+        let mut total = 0u32;
+        for f in &linked.folded {
+            eprintln!(
+                "folded section `{}` into `{}` ({} bytes): {}",
+                f.name,
+                f.into,
+                f.size,
+                f.symbols.join(", ")
+            );
+            total += f.size;
+        }
+        eprintln!("folded {} sections ({total} bytes)", linked.folded.len());
+    }
+
+    if print_layout {
+        print_layout_lines(&linked.layout, profile.as_ref());
+    }
+
+    // 3. 写出 .sfs raw 内存镜像；增量链接时同时写出状态文件。
+    let write_start = Instant::now();
+    write_output(&output, &linked.image)?;
+    if let Some(pending) = pending {
+        let state = pending.finish(fingerprint, &raw, &linked.layout, &linked.image)?;
+        write_state(&state_path, &state)?;
+    }
+
+    // 4. 可选：写出 .sym 符号表文本文件。
+    if let Some(sym_path) = &sym {
+        write_symbols(sym_path, &linked.symbols)?;
+    }
+
+    if print_stats {
+        let stats = &linked.stats;
+        eprintln!(
+            "{} inputs, {} sections, {} symbols, {} relocations, {} bytes, {} relocation threads",
+            inputs.len(),
+            stats.sections,
+            stats.symbols,
+            stats.relocations,
+            linked.image.len(),
+            stats.threads
+        );
+        if !archives.is_empty() {
+            eprintln!(
+                "{extracted} of {total_members} archive members extracted from {} archives",
+                archives.len()
+            );
+        }
+        let mut phases = vec![("read", read_time)];
+        phases.extend(stats.phases.iter().copied());
+        phases.push(("write", write_start.elapsed()));
+        print_phases(&phases);
+    }
+
+    Ok(())
+}
+
+fn write_output(output: &str, bytes: &[u8]) -> Result<()> {
+    let Ok(mut out) = File::create(output) else {
+        bail!("failed to open output file: {output}");
+    };
+    out.push_back_slice(bytes)
+        .and_then(|()| out.close())
+        .with_context(|| format!("failed to write output file: {output}"))
+}
+
+fn write_state(path: &str, state: &State) -> Result<()> {
+    std::fs::write(path, state.to_bytes())
+        .with_context(|| format!("failed to write incremental state: {path}"))
+}
+
+fn write_symbols(path: &str, symbols: &[(String, u32)]) -> Result<()> {
+    let mut text = String::new();
+    for (name, addr) in symbols {
+        text.push_str(&format!("{name} 0x{addr:08x}\n"));
+    }
+    std::fs::write(path, text).with_context(|| format!("failed to write symbol file: {path}"))
+}
+
+fn print_layout_lines(layout: &[(String, u32, u32)], profile: Option<&CallGraphProfile>) {
+    for (name, addr, size) in layout {
+        let heat = profile
+            .and_then(|p| p.insns(name))
+            .map(|n| format!(" {n} insns"))
+            .unwrap_or_default();
+        eprintln!("0x{addr:08x} {size:>8} {name}{heat}");
+    }
+}
+
+fn print_phases(phases: &[(&str, Duration)]) {
+    let total: f64 = phases.iter().map(|(_, d)| d.as_secs_f64()).sum();
+    for (name, d) in phases {
+        eprintln!("{name:>12} {:>10.3} ms", d.as_secs_f64() * 1000.0);
+    }
+    eprintln!("{:>12} {:>10.3} ms", "total", total * 1000.0);
+}
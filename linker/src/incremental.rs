@@ -0,0 +1,699 @@
+//! `shyld --incremental`：只有少数 object 改变时，原地更新上一次的链接结果。
+//!
+//! 完整链接时每个 section 占一个留有空余的槽位（[`slot_size`]），并在输出文件旁边写一份
+//! `<output>.ilk` 状态文件：各输入的内容 hash、每个 section 的地址和槽位大小、每个
+//! symbol 的位置，以及按 symbol 排序的 relocation 回填点（symbol 到回填点的反向索引）。
+//!
+//! 再次链接时只解析内容变了的 object。它的 section 和 symbol 名字集合、资源提示都没变，
+//! 每个 section 仍放得进原来的槽位，引用的 symbol 和 section 也都存在时，只重写这些
+//! section、回填它们自己的 relocation，再按反向索引修补引用了地址变化的 symbol 的回填点。
+//! 输入列表、链接选项或静态库变了，输出文件被改过，或者上面的条件不满足时，回退到
+//! 完整链接。
+
+use std::collections::{HashMap, HashSet};
+
+use anyhow::{Context, Result, bail};
+
+use crate::archive::is_archive;
+use crate::link::slot_size;
+use crate::obj::{ObjectFile, RelocTarget};
+
+/// `.ilk` 文件头 magic。
+const STATE_MAGIC: u32 = 0x66CCFFB0;
+
+/// 64 位 FNV-1a，用来判断输入和输出镜像是否变化。
+pub fn content_hash(data: &[u8]) -> u64 {
+    let mut h: u64 = 0xcbf29ce484222325;
+    for &b in data {
+        h ^= u64::from(b);
+        h = h.wrapping_mul(0x100000001b3);
+    }
+    h
+}
+
+/// 一个 section 在镜像中的槽位。
+struct Slot {
+    name: String,
+    base: u32,
+    /// 槽位大小，section 原地增长不能超过它。
+    cap: u32,
+    size: u32,
+}
+
+/// 一个参与链接的 object：命令行上的 `.sobj`，或者从静态库取出的成员。
+struct Unit {
+    /// 来自哪个输入；静态库成员记为所在的库。
+    input: u32,
+    mem_hint: Option<u32>,
+    stack_hint: Option<u32>,
+    slots: Vec<Slot>,
+    /// (名字, 所在槽位在 `slots` 中的下标, section 内偏移)。
+    symbols: Vec<(String, u32, u32)>,
+}
+
+/// 一个以 symbol 为目标的 relocation 回填点。
+#[derive(Clone, Copy)]
+struct Site {
+    /// 按所有 unit 的 symbol 依次编号的全局下标。
+    symbol: u32,
+    unit: u32,
+    addr: u32,
+    addend: u32,
+}
+
+/// [`State::relink`] 的结果。
+pub enum Relink {
+    /// 原地更新了这么多 object。
+    Updated(usize),
+    /// 需要完整链接，附带原因。
+    Full(String),
+}
+
+/// relocation 目标：symbol 的全局下标，或者 (unit, 槽位, section 内偏移)。
+#[derive(Clone, Copy)]
+enum Target {
+    Symbol(u32),
+    Section(usize, usize, u32),
+}
+
+/// 一个变化的 object 原地替换旧内容的计划，名字都已解析成下标。
+struct Plan<'a> {
+    unit: usize,
+    /// (槽位, 新内容)。
+    sections: Vec<(usize, &'a [u8])>,
+    /// (在 unit 内的下标, 全局下标, 槽位, section 内偏移)。
+    symbols: Vec<(usize, u32, u32, u32)>,
+    /// (所在槽位, section 内偏移, 目标, addend)。
+    relocations: Vec<(usize, u32, Target, u32)>,
+}
+
+/// 上一次链接的状态，见模块说明。
+pub struct State {
+    fingerprint: u64,
+    image_hash: u64,
+    inputs: Vec<(String, u64)>,
+    units: Vec<Unit>,
+    /// 按 (symbol, addr) 排序。
+    sites: Vec<Site>,
+}
+
+/// 完整链接前从各个 object 收集的信息，链接完成后补上地址得到 [`State`]。
+#[derive(Default)]
+pub struct Pending {
+    units: Vec<Unit>,
+    /// (unit, 目标 symbol, 所在 section, section 内偏移, addend)。
+    relocs: Vec<(u32, String, String, u32, u32)>,
+}
+
+impl Pending {
+    /// 记下来自第 `input` 个输入的 object。
+    pub fn add(&mut self, input: usize, obj: &ObjectFile) {
+        let unit = self.units.len() as u32;
+        let slot_of: HashMap<&str, u32> = obj
+            .sections
+            .iter()
+            .enumerate()
+            .map(|(i, s)| (s.name.as_str(), i as u32))
+            .collect();
+        let symbols = obj
+            .symbols
+            .iter()
+            .filter_map(|s| Some((s.name.clone(), *slot_of.get(s.section.as_str())?, s.offset)))
+            .collect();
+        for r in &obj.relocations {
+            if let RelocTarget::Symbol(name) = &r.target {
+                self.relocs
+                    .push((unit, name.clone(), r.section.clone(), r.offset, r.addend));
+            }
+        }
+        self.units.push(Unit {
+            input: input as u32,
+            mem_hint: obj.mem_hint,
+            stack_hint: obj.stack_hint,
+            slots: obj
+                .sections
+                .iter()
+                .map(|s| Slot {
+                    name: s.name.clone(),
+                    base: 0,
+                    cap: 0,
+                    size: s.bytes.len() as u32,
+                })
+                .collect(),
+            symbols,
+        });
+    }
+
+    /// 用完整链接的布局补全状态。`layout` 是 [`crate::link::LinkedOutput::layout`]。
+    pub fn finish(
+        mut self,
+        fingerprint: u64,
+        inputs: &[(&str, &[u8])],
+        layout: &[(String, u32, u32)],
+        image: &[u8],
+    ) -> Result<State> {
+        let base_of: HashMap<&str, u32> = layout
+            .iter()
+            .map(|(name, addr, _)| (name.as_str(), *addr))
+            .collect();
+        for unit in &mut self.units {
+            for slot in &mut unit.slots {
+                slot.base = *base_of
+                    .get(slot.name.as_str())
+                    .with_context(|| format!("section `{}` missing from layout", slot.name))?;
+                slot.cap = slot_size(slot.size);
+            }
+        }
+
+        let mut symbol_of: HashMap<&str, u32> = HashMap::new();
+        for unit in &self.units {
+            for (name, _, _) in &unit.symbols {
+                symbol_of.insert(name, symbol_of.len() as u32);
+            }
+        }
+        let mut sites = Vec::with_capacity(self.relocs.len());
+        for (unit, target, section, offset, addend) in &self.relocs {
+            let symbol = *symbol_of
+                .get(target.as_str())
+                .with_context(|| format!("undefined symbol: {target}"))?;
+            sites.push(Site {
+                symbol,
+                unit: *unit,
+                addr: base_of[section.as_str()] + offset,
+                addend: *addend,
+            });
+        }
+        sites.sort_unstable_by_key(|s| (s.symbol, s.addr));
+
+        Ok(State {
+            fingerprint,
+            image_hash: content_hash(image),
+            inputs: inputs
+                .iter()
+                .map(|(name, bytes)| (name.to_string(), content_hash(bytes)))
+                .collect(),
+            units: self.units,
+            sites,
+        })
+    }
+}
+
+struct Reader<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl Reader<'_> {
+    fn bytes(&mut self, n: usize) -> Result<&[u8]> {
+        let s = self
+            .buf
+            .get(self.pos..self.pos + n)
+            .context("incremental state truncated")?;
+        self.pos += n;
+        Ok(s)
+    }
+
+    fn u32(&mut self) -> Result<u32> {
+        Ok(u32::from_be_bytes(self.bytes(4)?.try_into().unwrap()))
+    }
+
+    fn u64(&mut self) -> Result<u64> {
+        Ok(u64::from_be_bytes(self.bytes(8)?.try_into().unwrap()))
+    }
+
+    fn str(&mut self) -> Result<String> {
+        let len = self.u32()? as usize;
+        let s = self.bytes(len)?;
+        String::from_utf8(s.to_vec()).context("non-utf8 string in incremental state")
+    }
+
+    fn hint(&mut self) -> Result<Option<u32>> {
+        Ok(Some(self.u32()?).filter(|&v| v != 0))
+    }
+}
+
+fn put_str(buf: &mut Vec<u8>, s: &str) {
+    buf.extend_from_slice(&(s.len() as u32).to_be_bytes());
+    buf.extend_from_slice(s.as_bytes());
+}
+
+impl State {
+    /// 所有 u32/u64 使用大端序，字符串是 u32 长度加 UTF-8 字节，资源提示 0 表示没有。
+    pub fn to_bytes(&self) -> Vec<u8> {
+        let mut buf = Vec::new();
+        let put = |buf: &mut Vec<u8>, v: u32| buf.extend_from_slice(&v.to_be_bytes());
+        put(&mut buf, STATE_MAGIC);
+        buf.extend_from_slice(&self.fingerprint.to_be_bytes());
+        buf.extend_from_slice(&self.image_hash.to_be_bytes());
+        put(&mut buf, self.inputs.len() as u32);
+        for (name, hash) in &self.inputs {
+            put_str(&mut buf, name);
+            buf.extend_from_slice(&hash.to_be_bytes());
+        }
+        put(&mut buf, self.units.len() as u32);
+        for unit in &self.units {
+            put(&mut buf, unit.input);
+            put(&mut buf, unit.mem_hint.unwrap_or(0));
+            put(&mut buf, unit.stack_hint.unwrap_or(0));
+            put(&mut buf, unit.slots.len() as u32);
+            for slot in &unit.slots {
+                put_str(&mut buf, &slot.name);
+                put(&mut buf, slot.base);
+                put(&mut buf, slot.cap);
+                put(&mut buf, slot.size);
+            }
+            put(&mut buf, unit.symbols.len() as u32);
+            for (name, slot, offset) in &unit.symbols {
+                put_str(&mut buf, name);
+                put(&mut buf, *slot);
+                put(&mut buf, *offset);
+            }
+        }
+        put(&mut buf, self.sites.len() as u32);
+        for site in &self.sites {
+            put(&mut buf, site.symbol);
+            put(&mut buf, site.unit);
+            put(&mut buf, site.addr);
+            put(&mut buf, site.addend);
+        }
+        buf
+    }
+
+    pub fn from_bytes(buf: &[u8]) -> Result<Self> {
+        let mut r = Reader { buf, pos: 0 };
+        let magic = r.u32()?;
+        if magic != STATE_MAGIC {
+            bail!("bad incremental state magic: 0x{magic:08X}");
+        }
+        let fingerprint = r.u64()?;
+        let image_hash = r.u64()?;
+        let mut inputs = Vec::new();
+        for _ in 0..r.u32()? {
+            inputs.push((r.str()?, r.u64()?));
+        }
+        let mut units = Vec::new();
+        let mut symbol_count = 0u32;
+        for _ in 0..r.u32()? {
+            let input = r.u32()?;
+            let mem_hint = r.hint()?;
+            let stack_hint = r.hint()?;
+            let mut slots = Vec::new();
+            for _ in 0..r.u32()? {
+                slots.push(Slot {
+                    name: r.str()?,
+                    base: r.u32()?,
+                    cap: r.u32()?,
+                    size: r.u32()?,
+                });
+            }
+            let mut symbols = Vec::new();
+            for _ in 0..r.u32()? {
+                let (name, slot, offset) = (r.str()?, r.u32()?, r.u32()?);
+                if slot as usize >= slots.len() {
+                    bail!("incremental state symbol {name} refers to slot {slot} out of range");
+                }
+                symbols.push((name, slot, offset));
+            }
+            if input as usize >= inputs.len() {
+                bail!("incremental state unit refers to input {input} out of range");
+            }
+            symbol_count += symbols.len() as u32;
+            units.push(Unit {
+                input,
+                mem_hint,
+                stack_hint,
+                slots,
+                symbols,
+            });
+        }
+        let mut sites = Vec::new();
+        for _ in 0..r.u32()? {
+            let site = Site {
+                symbol: r.u32()?,
+                unit: r.u32()?,
+                addr: r.u32()?,
+                addend: r.u32()?,
+            };
+            if site.symbol >= symbol_count || site.unit as usize >= units.len() {
+                bail!("incremental state relocation site out of range");
+            }
+            sites.push(site);
+        }
+        Ok(Self {
+            fingerprint,
+            image_hash,
+            inputs,
+            units,
+            sites,
+        })
+    }
+
+    /// 每个 symbol 的绝对地址，按地址升序排列，与完整链接输出的 `symbols` 相同。
+    pub fn symbols(&self) -> Vec<(String, u32)> {
+        let mut out: Vec<(String, u32)> = self
+            .units
+            .iter()
+            .flat_map(|unit| {
+                unit.symbols.iter().map(|(name, slot, offset)| {
+                    (name.clone(), unit.slots[*slot as usize].base + offset)
+                })
+            })
+            .collect();
+        out.sort_by(|a, b| a.1.cmp(&b.1).then(a.0.cmp(&b.0)));
+        out
+    }
+
+    /// 所有 section 的名字、起始地址和字节数，按地址升序排列。
+    pub fn layout(&self) -> Vec<(String, u32, u32)> {
+        let mut out: Vec<(String, u32, u32)> = self
+            .units
+            .iter()
+            .flat_map(|unit| unit.slots.iter())
+            .map(|slot| (slot.name.clone(), slot.base, slot.size))
+            .collect();
+        out.sort_by_key(|(_, addr, _)| *addr);
+        out
+    }
+
+    pub fn unit_count(&self) -> usize {
+        self.units.len()
+    }
+
+    /// 尝试原地更新 `image`（上一次的输出镜像）。需要回退到完整链接时 `self` 和
+    /// `image` 都没有被修改。
+    pub fn relink(
+        &mut self,
+        fingerprint: u64,
+        inputs: &[(&str, &[u8])],
+        image: &mut [u8],
+    ) -> Result<Relink> {
+        let full = |reason: String| Ok(Relink::Full(reason));
+        if fingerprint != self.fingerprint {
+            return full("link options changed".to_string());
+        }
+        if inputs.len() != self.inputs.len()
+            || inputs
+                .iter()
+                .zip(&self.inputs)
+                .any(|((name, _), (old, _))| name != old)
+        {
+            return full("input list changed".to_string());
+        }
+        if content_hash(image) != self.image_hash {
+            return full("output was modified since the last link".to_string());
+        }
+
+        // 1. 找出变化的输入并解析。静态库变化时取出的成员可能不同，只能完整链接。
+        let mut hashes = Vec::with_capacity(inputs.len());
+        let mut changed: Vec<(usize, ObjectFile)> = Vec::new();
+        for (i, (name, bytes)) in inputs.iter().enumerate() {
+            let hash = content_hash(bytes);
+            hashes.push(hash);
+            if hash == self.inputs[i].1 {
+                continue;
+            }
+            if is_archive(bytes) {
+                return full(format!("archive {name} changed"));
+            }
+            let Some(unit) = self.units.iter().position(|u| u.input as usize == i) else {
+                return full(format!("{name} was not linked before"));
+            };
+            let obj = ObjectFile::from_bytes(bytes)
+                .with_context(|| format!("failed to parse object file: {name}"))?;
+            changed.push((unit, obj));
+        }
+
+        if changed.is_empty() {
+            for (i, hash) in hashes.into_iter().enumerate() {
+                self.inputs[i].1 = hash;
+            }
+            return Ok(Relink::Updated(0));
+        }
+
+        // 2. 检查新 object 能否原地替换旧的，并把其中的名字都解析成下标。
+        //    这一步不修改任何状态。
+        let mut first_symbol = Vec::with_capacity(self.units.len());
+        let mut symbol_of: HashMap<&str, u32> = HashMap::new();
+        let mut slot_of: HashMap<&str, (usize, usize)> = HashMap::new();
+        for (u, unit) in self.units.iter().enumerate() {
+            first_symbol.push(symbol_of.len() as u32);
+            for (name, _, _) in &unit.symbols {
+                symbol_of.insert(name, symbol_of.len() as u32);
+            }
+            for (s, slot) in unit.slots.iter().enumerate() {
+                slot_of.insert(&slot.name, (u, s));
+            }
+        }
+        let mut plans = Vec::with_capacity(changed.len());
+        for (u, obj) in &changed {
+            let u = *u;
+            let unit = &self.units[u];
+            let name = inputs[unit.input as usize].0;
+            if obj.mem_hint != unit.mem_hint || obj.stack_hint != unit.stack_hint {
+                return full(format!("{name}: resource hints changed"));
+            }
+            if obj.sections.len() != unit.slots.len() || obj.symbols.len() != unit.symbols.len() {
+                return full(format!("{name}: sections or symbols added or removed"));
+            }
+            let own_slot = |name: &str| match slot_of.get(name) {
+                Some(&(owner, s)) if owner == u => Some(s),
+                _ => None,
+            };
+            let mut plan = Plan {
+                unit: u,
+                sections: Vec::with_capacity(obj.sections.len()),
+                symbols: Vec::with_capacity(obj.symbols.len()),
+                relocations: Vec::with_capacity(obj.relocations.len()),
+            };
+            let mut size = vec![0; unit.slots.len()];
+            for section in &obj.sections {
+                let Some(s) = own_slot(&section.name) else {
+                    return full(format!("{name}: new section `{}`", section.name));
+                };
+                if section.bytes.len() as u32 > unit.slots[s].cap {
+                    return full(format!("{name}: `{}` outgrew its slot", section.name));
+                }
+                size[s] = section.bytes.len();
+                plan.sections.push((s, &*section.bytes));
+            }
+            for sym in &obj.symbols {
+                let g = symbol_of.get(sym.name.as_str()).copied();
+                match (g, own_slot(&sym.section)) {
+                    (Some(g), Some(s)) if g >= first_symbol[u] => {
+                        let k = (g - first_symbol[u]) as usize;
+                        if k >= unit.symbols.len() {
+                            return full(format!("{name}: symbol `{}` moved", sym.name));
+                        }
+                        plan.symbols.push((k, g, s as u32, sym.offset));
+                    }
+                    _ => return full(format!("{name}: symbol `{}` moved", sym.name)),
+                }
+            }
+            for r in &obj.relocations {
+                // 越界和未定义的引用交给完整链接报告。
+                let Some(s) = own_slot(&r.section) else {
+                    return full(format!("{name}: bad relocation in `{}`", r.section));
+                };
+                if r.offset as usize + 4 > size[s] {
+                    return full(format!("{name}: bad relocation in `{}`", r.section));
+                }
+                let target = match &r.target {
+                    RelocTarget::Symbol(target) => match symbol_of.get(target.as_str()) {
+                        Some(&g) => Target::Symbol(g),
+                        None => return full(format!("{name}: new reference to `{target}`")),
+                    },
+                    RelocTarget::SectionOffset { section, offset } => {
+                        match slot_of.get(section.as_str()) {
+                            Some(&(tu, ts)) => Target::Section(tu, ts, *offset),
+                            None => return full(format!("{name}: new reference to `{section}`")),
+                        }
+                    }
+                };
+                plan.relocations.push((s, r.offset, target, r.addend));
+            }
+            plans.push(plan);
+        }
+
+        // 3. 写入新的 section 内容，更新 symbol 位置，记下地址变化的 symbol。
+        let mut moved = Vec::new();
+        for plan in &plans {
+            let unit = &mut self.units[plan.unit];
+            for &(s, bytes) in &plan.sections {
+                let slot = &mut unit.slots[s];
+                let base = slot.base as usize;
+                image[base..base + slot.cap as usize].fill(0);
+                image[base..base + bytes.len()].copy_from_slice(bytes);
+                slot.size = bytes.len() as u32;
+            }
+            for &(k, g, s, offset) in &plan.symbols {
+                let (_, old_slot, old_offset) = unit.symbols[k];
+                let old_addr = unit.slots[old_slot as usize].base + old_offset;
+                unit.symbols[k].1 = s;
+                unit.symbols[k].2 = offset;
+                if unit.slots[s as usize].base + offset != old_addr {
+                    moved.push(g);
+                }
+            }
+        }
+
+        let addr_of_symbol = |units: &[Unit], g: u32| {
+            let u = first_symbol.partition_point(|&f| f <= g) - 1;
+            let (_, slot, offset) = units[u].symbols[(g - first_symbol[u]) as usize];
+            units[u].slots[slot as usize].base + offset
+        };
+
+        // 4. 回填变化 section 自己的 relocation，并替换它们在反向索引里的回填点。
+        let changed_units: HashSet<u32> = plans.iter().map(|p| p.unit as u32).collect();
+        self.sites
+            .retain(|site| !changed_units.contains(&site.unit));
+        for plan in &plans {
+            for &(s, offset, target, addend) in &plan.relocations {
+                let site = self.units[plan.unit].slots[s].base + offset;
+                let target = match target {
+                    Target::Symbol(g) => {
+                        self.sites.push(Site {
+                            symbol: g,
+                            unit: plan.unit as u32,
+                            addr: site,
+                            addend,
+                        });
+                        addr_of_symbol(&self.units, g)
+                    }
+                    Target::Section(tu, ts, offset) => self.units[tu].slots[ts].base + offset,
+                };
+                let at = site as usize;
+                image[at..at + 4].copy_from_slice(&target.wrapping_add(addend).to_be_bytes());
+            }
+        }
+        self.sites.sort_unstable_by_key(|s| (s.symbol, s.addr));
+
+        // 5. 按反向索引修补其他 object 里引用了地址变化的 symbol 的回填点。
+        for g in moved {
+            let addr = addr_of_symbol(&self.units, g);
+            let start = self.sites.partition_point(|s| s.symbol < g);
+            for site in self.sites[start..].iter().take_while(|s| s.symbol == g) {
+                let at = site.addr as usize;
+                image[at..at + 4].copy_from_slice(&addr.wrapping_add(site.addend).to_be_bytes());
+            }
+        }
+
+        for (i, hash) in hashes.into_iter().enumerate() {
+            self.inputs[i].1 = hash;
+        }
+        self.image_hash = content_hash(image);
+        Ok(Relink::Updated(plans.len()))
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::link::{LinkOptions, link_with};
+    use crate::obj::{ObjRelocation, ObjSection, ObjSymbol};
+
+    fn start() -> ObjectFile<'static> {
+        ObjectFile {
+            mem_hint: None,
+            stack_hint: None,
+            sections: vec![ObjSection {
+                name: "text._start".to_string(),
+                bytes: vec![0; 12].into(),
+            }],
+            symbols: vec![ObjSymbol {
+                name: "_start".to_string(),
+                section: "text._start".to_string(),
+                offset: 0,
+            }],
+            relocations: vec![ObjRelocation {
+                section: "text._start".to_string(),
+                offset: 4,
+                target: RelocTarget::Symbol("f".to_string()),
+                addend: 0,
+            }],
+        }
+    }
+
+    /// `text.f` 里 `f` 前面有 `pad` 字节。
+    fn callee(pad: usize, len: usize) -> ObjectFile<'static> {
+        ObjectFile {
+            mem_hint: None,
+            stack_hint: None,
+            sections: vec![ObjSection {
+                name: "text.f".to_string(),
+                bytes: vec![0x11; len].into(),
+            }],
+            symbols: vec![ObjSymbol {
+                name: "f".to_string(),
+                section: "text.f".to_string(),
+                offset: pad as u32,
+            }],
+            relocations: Vec::new(),
+        }
+    }
+
+    fn full(objs: Vec<ObjectFile>, bytes: &[Vec<u8>]) -> (Vec<u8>, State) {
+        let mut pending = Pending::default();
+        for (i, obj) in objs.iter().enumerate() {
+            pending.add(i, obj);
+        }
+        let opts = LinkOptions {
+            pad_sections: true,
+            ..LinkOptions::default()
+        };
+        let out = link_with(objs, &opts).unwrap();
+        let inputs: Vec<(&str, &[u8])> = bytes
+            .iter()
+            .enumerate()
+            .map(|(i, b)| (["a", "b"][i], b.as_slice()))
+            .collect();
+        let state = pending.finish(7, &inputs, &out.layout, &out.image).unwrap();
+        (out.image, state)
+    }
+
+    #[test]
+    fn relinks_changed_object_in_place_and_patches_callers() {
+        let a = vec![1];
+        let (mut image, state) = full(vec![start(), callee(0, 24)], &[a.clone(), vec![2]]);
+        let f = state.symbols().iter().find(|(n, _)| n == "f").unwrap().1;
+        assert_eq!(&image[0x104..0x108], &f.to_be_bytes());
+
+        // 状态文件往返后再原地更新：`f` 后移 12 字节，调用点随之修补。
+        let mut state = State::from_bytes(&state.to_bytes()).unwrap();
+        let new = callee(12, 28);
+        let new_bytes = new.to_bytes().unwrap();
+        let inputs: Vec<(&str, &[u8])> = vec![("a", &a), ("b", &new_bytes)];
+        assert!(matches!(
+            state.relink(7, &inputs, &mut image).unwrap(),
+            Relink::Updated(1)
+        ));
+        assert_eq!(&image[0x104..0x108], &(f + 12).to_be_bytes());
+        assert_eq!(image[f as usize + 27], 0x11);
+        assert_eq!(image[f as usize + 28], 0);
+
+        // 与重新完整链接的结果一致（完整链接按新的大小分配槽位，镜像可能更长）。
+        let (expect, _) = full(vec![start(), callee(12, 28)], &[a, new_bytes.clone()]);
+        assert_eq!(&expect[..image.len()], &image[..]);
+    }
+
+    #[test]
+    fn falls_back_when_section_outgrows_its_slot() {
+        let a = vec![1];
+        let (mut image, mut state) = full(vec![start(), callee(0, 24)], &[a.clone(), vec![2]]);
+        let before = image.clone();
+        let big = callee(0, 240).to_bytes().unwrap();
+        let inputs: Vec<(&str, &[u8])> = vec![("a", &a), ("b", &big)];
+        let Relink::Full(reason) = state.relink(7, &inputs, &mut image).unwrap() else {
+            panic!("expected a full link");
+        };
+        assert_eq!(reason, "b: `text.f` outgrew its slot");
+        assert_eq!(image, before);
+
+        // 链接选项变化也回退。
+        let same = vec![2];
+        let inputs: Vec<(&str, &[u8])> = vec![("a", &a), ("b", &same)];
+        assert!(matches!(
+            state.relink(8, &inputs, &mut image).unwrap(),
+            Relink::Full(_)
+        ));
+    }
+}
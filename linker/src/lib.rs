@@ -0,0 +1,10 @@
+//! ShyISA 链接器。`shyld` 可执行文件和 `shycc` 驱动共用这里的实现。
+
+pub mod archive;
+mod driver;
+pub mod incremental;
+pub mod link;
+pub mod obj;
+pub mod order;
+
+pub use driver::{Input, run};
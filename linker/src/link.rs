@@ -3,16 +3,34 @@
 //!
 //! 默认布局规则：
 //! - `text._start` 必须存在，放到程序入口地址 `0x00000100`。
-//! - 其他 `text.*` section 接在 `text._start` 后面，按输入顺序依次放置。
+//! - 其他 `text.*` section 接在 `text._start` 后面，按输入顺序依次放置；给出
+//!   排序文件或调用图 profile 时按 `order` 模块计算的顺序放置。
 //! - `data` 和 `data.*` section 接在所有 `text.*` section 后面，按输入顺序依次放置。
 //! - 其他 section 名暂不定义默认布局，链接器报错。
 //! - section 起始地址按 4 字节对齐。
+//! - `--incremental` 时每个 section 占一个留有空余的槽位（[`slot_size`]），见
+//!   `incremental` 模块。
+//!
+//! `--gc-sections` 时只保留从 `text._start` 出发、沿 relocation 可达的
+//! section，其余 section 连同其中的 symbol 和 relocation 一起丢弃。
+//!
+//! `--icf` 时把内容和 relocation 完全相同的 section 折叠成一份：地址只被
+//! `calln`/`ujmpn`/`jmpn` 使用的 `text.*` section，以及只读的 `data.rodata.*`
+//! section。被折叠 section 里的 symbol 成为保留 section 的别名。
+//!
+//! 合并后的 section、symbol 和 relocation 从输入中移出而不是复制，索引表借用
+//! 其中的名字。relocation 按所在 section 分组，直接回填到镜像里该 section 对应的
+//! 切片；数量较多时分给多个线程并行处理。
 
 use std::collections::{HashMap, HashSet};
+use std::time::{Duration, Instant};
 
 use anyhow::{Context, Result, bail};
+use shy_isa_lib::address::Address;
+use shy_isa_lib::op::OpType;
 
-use crate::obj::{ObjectFile, RelocTarget};
+use crate::obj::{ObjRelocation, ObjSection, ObjSymbol, ObjectFile, RelocTarget};
+use crate::order::{SectionOrder, order_text_sections};
 
 /// 程序入口地址，`text._start` 必须放到这里。
 pub const ENTRY: u32 = 0x00000100;
@@ -20,6 +38,32 @@ pub const ENTRY: u32 = 0x00000100;
 pub const DEFAULT_MEM_HINT: u32 = 32 * 1024 * 1024;
 /// 没有任何 object 声明 `#![stack(...)]` 时写入 `.sfs` 的默认栈提示。
 pub const DEFAULT_STACK_HINT: u32 = 4 * 1024;
+/// relocation 少于这个数时在当前线程回填，开线程不划算。
+const PARALLEL_RELOCATIONS: usize = 16 * 1024;
+
+/// 链接选项。
+#[derive(Debug, Default, Clone)]
+pub struct LinkOptions {
+    /// 丢弃从 `text._start` 不可达的 section。
+    pub gc_sections: bool,
+    /// 折叠相同的 `text.*` 和 `data.rodata.*` section。
+    pub icf: bool,
+    /// `text.*` section 的排布顺序，`None` 时按输入顺序。
+    pub order: Option<SectionOrder>,
+    /// 每个 section 占用 [`slot_size`] 大小的槽位，给 `--incremental` 留出原地增长的空间。
+    pub pad_sections: bool,
+}
+
+/// `--icf` 折叠掉的一个 section。
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct FoldedSection {
+    pub name: String,
+    /// 保留下来的等价 section。
+    pub into: String,
+    /// 原本定义在被折叠 section 里、现在成为别名的 symbol。
+    pub symbols: Vec<String>,
+    pub size: u32,
+}
 
 /// 链接输出。
 pub struct LinkedOutput {
@@ -27,6 +71,35 @@ pub struct LinkedOutput {
     pub image: Vec<u8>,
     /// symbol 名 -> 最终绝对地址，按地址升序排列。
     pub symbols: Vec<(String, u32)>,
+    /// `--gc-sections` 丢弃的 section 名及字节数，按输入顺序排列。
+    pub removed: Vec<(String, u32)>,
+    /// `--icf` 折叠掉的 section，按输入顺序排列。
+    pub folded: Vec<FoldedSection>,
+    /// 所有 section 的名字、起始地址和字节数，按地址升序排列。
+    pub layout: Vec<(String, u32, u32)>,
+    pub stats: LinkStats,
+}
+
+/// `--stats` 输出的链接规模和各阶段耗时。
+#[derive(Debug, Default, Clone)]
+pub struct LinkStats {
+    /// gc 和 icf 之后参与布局的 section、symbol、relocation 数。
+    pub sections: usize,
+    pub symbols: usize,
+    pub relocations: usize,
+    /// 回填 relocation 用的线程数。
+    pub threads: usize,
+    /// 按执行顺序排列的阶段名和耗时。
+    pub phases: Vec<(&'static str, Duration)>,
+}
+
+impl LinkStats {
+    /// 记下从 `timer` 到现在的耗时，并把 `timer` 重置到现在。
+    pub fn lap(&mut self, phase: &'static str, timer: &mut Instant) {
+        let now = Instant::now();
+        self.phases.push((phase, now - *timer));
+        *timer = now;
+    }
 }
 
 fn parse_shy_method_symbol(name: &str) -> Option<(&str, &str)> {
@@ -104,6 +177,11 @@ pub fn raii_drop_warnings(files: &[(&str, &ObjectFile)]) -> Vec<String> {
     warnings
 }
 
+/// `pad_sections` 时一个 section 占用的槽位：多留四分之一、至少一条指令的空间。
+pub fn slot_size(len: u32) -> u32 {
+    align4(len + (len / 4).max(12))
+}
+
 fn align4(v: u32) -> u32 {
     (v + 3) & !3
 }
@@ -116,20 +194,247 @@ fn is_data(name: &str) -> bool {
     name == "data" || name.starts_with("data.")
 }
 
+/// 从 `text._start` 出发沿 relocation 标记可达的 section。引用未定义 symbol
+/// 的 relocation 在这里忽略，留给回填阶段报错。
+fn live_sections(
+    symbols: &[ObjSymbol],
+    relocations: &[ObjRelocation],
+) -> HashSet<String> {
+    let sym_section: HashMap<&str, &str> = symbols
+        .iter()
+        .map(|s| (s.name.as_str(), s.section.as_str()))
+        .collect();
+    let mut refs: HashMap<&str, Vec<&str>> = HashMap::new();
+    for r in relocations {
+        let target = match &r.target {
+            RelocTarget::Symbol(name) => match sym_section.get(name.as_str()) {
+                Some(section) => *section,
+                None => continue,
+            },
+            RelocTarget::SectionOffset { section, .. } => section.as_str(),
+        };
+        refs.entry(r.section.as_str()).or_default().push(target);
+    }
+
+    let mut live = HashSet::new();
+    let mut work = vec!["text._start"];
+    while let Some(name) = work.pop() {
+        if !live.insert(name.to_string()) {
+            continue;
+        }
+        if let Some(targets) = refs.get(name) {
+            work.extend(targets.iter().filter(|t| !live.contains(**t)));
+        }
+    }
+    live
+}
+
+/// 丢弃不可达 section，返回被丢弃的 section 名及字节数。
+fn gc_sections(
+    sections: &mut Vec<ObjSection>,
+    symbols: &mut Vec<ObjSymbol>,
+    relocations: &mut Vec<ObjRelocation>,
+) -> Vec<(String, u32)> {
+    let live = live_sections(symbols, relocations);
+    let removed = sections
+        .iter()
+        .filter(|s| !live.contains(&s.name))
+        .map(|s| (s.name.clone(), s.bytes.len() as u32))
+        .collect();
+    sections.retain(|s| live.contains(&s.name));
+    symbols.retain(|s| live.contains(&s.section));
+    relocations.retain(|r| live.contains(&r.section));
+    removed
+}
+
+fn is_rodata(name: &str) -> bool {
+    name.starts_with("data.rodata.")
+}
+
+/// relocation 回填的是 `calln`/`ujmpn`/`jmpn` 的跳转目标时返回 true。
+fn is_branch_target(section: &ObjSection, offset: u32) -> bool {
+    let off = offset as usize;
+    if !is_text(&section.name) || off % 12 != 4 || off + 8 > section.bytes.len() {
+        return false;
+    }
+    let word = u32::from_be_bytes(section.bytes[off - 4..off].try_into().unwrap());
+    matches!(
+        Address::from_u32(word),
+        Address::Opcode(OpType::Calln | OpType::Ujmpn | OpType::Jmpn)
+    )
+}
+
+/// relocation 目标在折叠比较中的形式。指向自身的引用记为相对位置，这样
+/// 两个相同的递归函数也能折叠。
+#[derive(Clone, PartialEq, Eq, Hash)]
+enum FoldTarget {
+    SelfOffset(u32),
+    Section(String, u32),
+    Undefined(String),
+}
+
+/// 沿折叠关系找到 `name` 最终并入的 section；没有折叠时就是它自己。
+fn canon_root<'a>(canon: &'a HashMap<String, String>, mut name: &'a str) -> &'a str {
+    while let Some(into) = canon.get(name) {
+        name = into;
+    }
+    name
+}
+
+/// 折叠内容和 relocation 完全相同的 section，直到不再变化：一对函数折叠后，
+/// 只在调用目标上不同的调用者也会变得相同。
+fn fold_sections(
+    sections: &mut Vec<ObjSection>,
+    symbols: &mut [ObjSymbol],
+    relocations: &mut Vec<ObjRelocation>,
+) -> Vec<FoldedSection> {
+    let sym_loc: HashMap<&str, (&str, u32)> = symbols
+        .iter()
+        .map(|s| (s.name.as_str(), (s.section.as_str(), s.offset)))
+        .collect();
+    let sec_index: HashMap<&str, usize> = sections
+        .iter()
+        .enumerate()
+        .map(|(i, s)| (s.name.as_str(), i))
+        .collect();
+
+    // 地址被拿去当数据用的函数不能和别的函数共享地址。同一文件内的引用已被
+    // 汇编器改写成 SectionOffset，也要算在内。
+    let mut addr_taken: HashSet<&str> = HashSet::new();
+    for r in relocations.iter() {
+        let section = match &r.target {
+            RelocTarget::Symbol(name) => match sym_loc.get(name.as_str()) {
+                Some(&(section, _)) => section,
+                None => continue,
+            },
+            RelocTarget::SectionOffset { section, .. } => section.as_str(),
+        };
+        if !is_text(section) {
+            continue;
+        }
+        let from = sec_index.get(r.section.as_str()).map(|&i| &sections[i]);
+        if !from.is_some_and(|from| is_branch_target(from, r.offset)) {
+            addr_taken.insert(section);
+        }
+    }
+
+    let candidates: Vec<usize> = sections
+        .iter()
+        .enumerate()
+        .filter(|(_, s)| {
+            s.name != "text._start"
+                && (is_rodata(&s.name) || (is_text(&s.name) && !addr_taken.contains(s.name.as_str())))
+        })
+        .map(|(i, _)| i)
+        .collect();
+
+    let mut relocs_of: HashMap<&str, Vec<&ObjRelocation>> = HashMap::new();
+    for r in relocations.iter() {
+        relocs_of.entry(r.section.as_str()).or_default().push(r);
+    }
+    for list in relocs_of.values_mut() {
+        list.sort_by_key(|r| r.offset);
+    }
+
+    let mut canon: HashMap<String, String> = HashMap::new();
+    loop {
+        let resolve = |name: &str| canon_root(&canon, name).to_string();
+        let mut groups: HashMap<(bool, &[u8], Vec<(u32, FoldTarget, u32)>), usize> = HashMap::new();
+        let mut new_folds = Vec::new();
+        for &i in &candidates {
+            let sec = &sections[i];
+            if canon.contains_key(&sec.name) {
+                continue;
+            }
+            let relocs = relocs_of.get(sec.name.as_str()).map_or(&[][..], |v| v.as_slice());
+            let key_relocs = relocs
+                .iter()
+                .map(|r| {
+                    let target = match &r.target {
+                        RelocTarget::Symbol(name) => match sym_loc.get(name.as_str()) {
+                            Some((section, offset)) => (resolve(section), *offset),
+                            None => return (r.offset, FoldTarget::Undefined(name.clone()), r.addend),
+                        },
+                        RelocTarget::SectionOffset { section, offset } => (resolve(section), *offset),
+                    };
+                    let target = if target.0 == sec.name {
+                        FoldTarget::SelfOffset(target.1)
+                    } else {
+                        FoldTarget::Section(target.0, target.1)
+                    };
+                    (r.offset, target, r.addend)
+                })
+                .collect();
+            let key = (is_text(&sec.name), &*sec.bytes, key_relocs);
+            match groups.get(&key) {
+                Some(&keep) => new_folds.push((sec.name.clone(), sections[keep].name.clone())),
+                None => {
+                    groups.insert(key, i);
+                }
+            }
+        }
+        if new_folds.is_empty() {
+            break;
+        }
+        canon.extend(new_folds);
+    }
+    // 保留下来的 section 在之后的轮次里还可能折叠进别的 section，这里把每个
+    // 折叠目标都解析到最终留下的那个。
+    let canon: HashMap<String, String> = canon
+        .keys()
+        .map(|name| (name.clone(), canon_root(&canon, name).to_string()))
+        .collect();
+
+    let folded = sections
+        .iter()
+        .filter_map(|s| {
+            let into = canon.get(&s.name)?;
+            Some(FoldedSection {
+                name: s.name.clone(),
+                into: into.clone(),
+                symbols: symbols
+                    .iter()
+                    .filter(|sym| sym.section == s.name && sym.name != s.name)
+                    .map(|sym| sym.name.clone())
+                    .collect(),
+                size: s.bytes.len() as u32,
+            })
+        })
+        .collect();
+
+    sections.retain(|s| !canon.contains_key(&s.name));
+    relocations.retain(|r| !canon.contains_key(&r.section));
+    for sym in symbols.iter_mut() {
+        if let Some(into) = canon.get(&sym.section) {
+            sym.section = into.clone();
+        }
+    }
+    for r in relocations.iter_mut() {
+        if let RelocTarget::SectionOffset { section, .. } = &mut r.target {
+            if let Some(into) = canon.get(section) {
+                *section = into.clone();
+            }
+        }
+    }
+    folded
+}
+
 /// 链接一个或多个 object 文件，生成 `.sfs` 内存镜像和符号表。
-pub fn link(files: Vec<ObjectFile>) -> Result<LinkedOutput> {
-    // 1. 合并所有 object 文件，检测重名 section 和重名 symbol。
+pub fn link_with(files: Vec<ObjectFile>, opts: &LinkOptions) -> Result<LinkedOutput> {
+    let mut stats = LinkStats::default();
+    let mut timer = Instant::now();
+
+    // 1. 合并所有 object 文件。section、symbol 和 relocation 直接从输入里移出，
+    //    之后的各种索引表都借用这里的名字，不再复制字符串。
     let mut sections = Vec::new();
     let mut symbols = Vec::new();
     let mut relocations = Vec::new();
-    let mut seen_section: HashMap<String, ()> = HashMap::new();
-    let mut seen_symbol: HashMap<String, ()> = HashMap::new();
     let mut mem_hint_sum = 0u32;
     let mut stack_hint_sum = 0u32;
     let mut has_mem_hint = false;
     let mut has_stack_hint = false;
 
-    for file in &files {
+    for file in files {
         if let Some(v) = file.mem_hint {
             has_mem_hint = true;
             mem_hint_sum = mem_hint_sum
@@ -142,41 +447,53 @@ pub fn link(files: Vec<ObjectFile>) -> Result<LinkedOutput> {
                 .checked_add(v)
                 .context("combined stack hint exceeds u32::MAX")?;
         }
-        for s in &file.sections {
-            if seen_section.insert(s.name.clone(), ()).is_some() {
+        sections.extend(file.sections);
+        symbols.extend(file.symbols);
+        relocations.extend(file.relocations);
+    }
+
+    // 检测重名 section 和重名 symbol。
+    {
+        let mut seen: HashSet<&str> = HashSet::with_capacity(sections.len());
+        for s in &sections {
+            if !seen.insert(&s.name) {
                 bail!("duplicate section: {}", s.name);
             }
-            sections.push(s.clone());
         }
-        for sym in &file.symbols {
-            if seen_symbol.insert(sym.name.clone(), ()).is_some() {
+        let mut seen: HashSet<&str> = HashSet::with_capacity(symbols.len());
+        for sym in &symbols {
+            if !seen.insert(&sym.name) {
                 bail!("duplicate symbol: {}", sym.name);
             }
-            symbols.push(sym.clone());
-        }
-        for r in &file.relocations {
-            relocations.push(r.clone());
         }
     }
 
-    // 2. 按默认规则为每个 section 分配最终地址。
-    let mut bases: HashMap<String, u32> = HashMap::new();
-    let mut text_cur: u32;
-
     // text._start 必须存在并放到入口地址。
     let has_start = sections.iter().any(|s| s.name == "text._start");
     if !has_start {
         bail!("missing entry section `text._start`");
     }
-    bases.insert("text._start".to_string(), ENTRY);
-    {
-        let start = sections
-            .iter()
-            .find(|s| s.name == "text._start")
-            .expect("checked above");
-        text_cur = align4(ENTRY + start.bytes.len() as u32);
-    }
+    stats.lap("merge", &mut timer);
+
+    let removed = if opts.gc_sections {
+        let removed = gc_sections(&mut sections, &mut symbols, &mut relocations);
+        stats.lap("gc-sections", &mut timer);
+        removed
+    } else {
+        Vec::new()
+    };
+    let folded = if opts.icf {
+        let folded = fold_sections(&mut sections, &mut symbols, &mut relocations);
+        stats.lap("icf", &mut timer);
+        folded
+    } else {
+        Vec::new()
+    };
+    stats.sections = sections.len();
+    stats.symbols = symbols.len();
+    stats.relocations = relocations.len();
 
+    // 2. 按默认规则为每个 section 分配最终地址，`bases[i]` 是 `sections[i]` 的地址。
     for s in &sections {
         if s.name != "text._start" && !is_text(&s.name) && !is_data(&s.name) {
             bail!(
@@ -185,77 +502,66 @@ pub fn link(files: Vec<ObjectFile>) -> Result<LinkedOutput> {
             );
         }
     }
-
-    for s in &sections {
-        if s.name == "text._start" {
-            continue;
+    let sec_index: HashMap<&str, usize> = sections
+        .iter()
+        .enumerate()
+        .map(|(i, s)| (s.name.as_str(), i))
+        .collect();
+    let mut bases = vec![0u32; sections.len()];
+    let stride = |s: &ObjSection| {
+        let len = s.bytes.len() as u32;
+        if opts.pad_sections {
+            slot_size(len)
+        } else {
+            align4(len)
         }
-        if is_text(&s.name) {
-            bases.insert(s.name.clone(), text_cur);
-            text_cur = align4(text_cur + s.bytes.len() as u32);
+    };
+
+    let start = sec_index["text._start"];
+    bases[start] = ENTRY;
+    let mut text_cur = ENTRY + stride(&sections[start]);
+
+    let texts: Vec<usize> = (0..sections.len())
+        .filter(|&i| i != start && is_text(&sections[i].name))
+        .collect();
+    let text_order: Vec<usize> = match &opts.order {
+        Some(order) => {
+            let names: Vec<&str> = texts.iter().map(|&i| sections[i].name.as_str()).collect();
+            order_text_sections(&names, order)
         }
+        None => (0..texts.len()).collect(),
+    };
+    for k in text_order {
+        let i = texts[k];
+        bases[i] = text_cur;
+        text_cur += stride(&sections[i]);
     }
 
     let mut data_cur = text_cur;
-    for s in &sections {
+    for (i, s) in sections.iter().enumerate() {
         if is_data(&s.name) {
-            bases.insert(s.name.clone(), data_cur);
-            data_cur = align4(data_cur + s.bytes.len() as u32);
+            bases[i] = data_cur;
+            data_cur += stride(s);
         }
     }
+    stats.lap("layout", &mut timer);
 
     // 3. 计算所有 symbol 的最终绝对地址。
-    let mut sym_addr: HashMap<String, u32> = HashMap::new();
+    let mut sym_addr: HashMap<&str, u32> = HashMap::with_capacity(symbols.len());
     for sym in &symbols {
-        let base = *bases
-            .get(&sym.section)
+        let i = *sec_index
+            .get(sym.section.as_str())
             .with_context(|| format!("symbol `{}` references unknown section `{}`", sym.name, sym.section))?;
-        sym_addr.insert(sym.name.clone(), base + sym.offset);
+        sym_addr.insert(&sym.name, bases[i] + sym.offset);
     }
+    stats.lap("symbols", &mut timer);
 
-    // 4. 处理所有 relocation，回填 32 位大端序字段。
-    let mut sec_index: HashMap<String, usize> = HashMap::new();
+    // 4. 把 section bytes 写入 `.sfs` raw 内存镜像对应地址。
+    //    镜像长度至少覆盖最高已写入 section 字节的后一字节，且不小于入口地址；
+    //    留有槽位时覆盖最后一个槽位，原地增长不改变镜像长度。
+    let mut max_end: u32 = if opts.pad_sections { data_cur } else { ENTRY };
     for (i, s) in sections.iter().enumerate() {
-        sec_index.insert(s.name.clone(), i);
-    }
-
-    for r in &relocations {
-        let target_addr = match &r.target {
-            RelocTarget::Symbol(name) => *sym_addr
-                .get(name)
-                .with_context(|| format!("undefined symbol: {name}"))?,
-            RelocTarget::SectionOffset { section, offset } => {
-                let base = *bases.get(section).with_context(|| {
-                    format!("relocation references unknown section: {section}")
-                })?;
-                base + offset
-            }
-        };
-        let final_addr = target_addr.wrapping_add(r.addend);
-
-        let idx = *sec_index.get(&r.section).with_context(|| {
-            format!("relocation references unknown section: {}", r.section)
-        })?;
-        let sec = &mut sections[idx];
-        let off = r.offset as usize;
-        if off + 4 > sec.bytes.len() {
-            bail!(
-                "relocation offset {off} out of range in section `{}` (len {})",
-                sec.name,
-                sec.bytes.len()
-            );
-        }
-        sec.bytes[off..off + 4].copy_from_slice(&final_addr.to_be_bytes());
-    }
-
-    // 5. 把 section bytes 写入 `.sfs` raw 内存镜像对应地址。
-    //    镜像长度至少覆盖最高已写入 section 字节的后一字节，且不小于入口地址。
-    let mut max_end: u32 = ENTRY;
-    for s in &sections {
-        let base = *bases
-            .get(&s.name)
-            .expect("every section has a base address");
-        let end = base + s.bytes.len() as u32;
+        let end = bases[i] + s.bytes.len() as u32;
         if end > max_end {
             max_end = end;
         }
@@ -273,19 +579,137 @@ pub fn link(files: Vec<ObjectFile>) -> Result<LinkedOutput> {
     };
     image[4..8].copy_from_slice(&mem_hint.to_be_bytes());
     image[8..12].copy_from_slice(&stack_hint.to_be_bytes());
-    for s in &sections {
-        let base = *bases.get(&s.name).expect("every section has a base address") as usize;
+    for (i, s) in sections.iter().enumerate() {
+        let base = bases[i] as usize;
         image[base..base + s.bytes.len()].copy_from_slice(&s.bytes);
     }
+    stats.lap("image", &mut timer);
+
+    // 5. 处理所有 relocation，直接回填镜像中的 32 位大端序字段。
+    let mut relocs_of: Vec<Vec<&ObjRelocation>> = vec![Vec::new(); sections.len()];
+    for r in &relocations {
+        let i = *sec_index.get(r.section.as_str()).with_context(|| {
+            format!("relocation references unknown section: {}", r.section)
+        })?;
+        relocs_of[i].push(r);
+    }
+
+    // 各 section 在镜像中互不重叠，按地址顺序切成独立的可变切片，分给多个线程回填。
+    // 空 section 和紧随其后的 section 地址相同，要排在前面。
+    let mut by_addr: Vec<usize> = (0..sections.len()).collect();
+    by_addr.sort_by_key(|&i| (bases[i], sections[i].bytes.len()));
+    let mut jobs: Vec<(usize, &mut [u8])> = Vec::new();
+    let mut rest: &mut [u8] = &mut image;
+    let mut rest_base = 0usize;
+    for i in by_addr {
+        let base = bases[i] as usize;
+        let (_, tail) = std::mem::take(&mut rest).split_at_mut(base - rest_base);
+        let (slot, tail) = tail.split_at_mut(sections[i].bytes.len());
+        rest = tail;
+        rest_base = base + slot.len();
+        if !relocs_of[i].is_empty() {
+            jobs.push((i, slot));
+        }
+    }
+
+    let apply = |i: usize, slot: &mut [u8]| -> Result<()> {
+        for r in &relocs_of[i] {
+            let target_addr = match &r.target {
+                RelocTarget::Symbol(name) => *sym_addr
+                    .get(name.as_str())
+                    .with_context(|| format!("undefined symbol: {name}"))?,
+                RelocTarget::SectionOffset { section, offset } => {
+                    let j = *sec_index.get(section.as_str()).with_context(|| {
+                        format!("relocation references unknown section: {section}")
+                    })?;
+                    bases[j] + offset
+                }
+            };
+            let final_addr = target_addr.wrapping_add(r.addend);
+            let off = r.offset as usize;
+            if off + 4 > slot.len() {
+                bail!(
+                    "relocation offset {off} out of range in section `{}` (len {})",
+                    r.section,
+                    slot.len()
+                );
+            }
+            slot[off..off + 4].copy_from_slice(&final_addr.to_be_bytes());
+        }
+        Ok(())
+    };
+
+    let threads = if relocations.len() < PARALLEL_RELOCATIONS {
+        1
+    } else {
+        std::thread::available_parallelism().map_or(1, |n| n.get())
+    }
+    .min(jobs.len())
+    .max(1);
+    stats.threads = threads;
+    if threads == 1 {
+        for (i, slot) in jobs {
+            apply(i, slot)?;
+        }
+    } else {
+        // 按 relocation 数量把连续的 section 均分给各线程；出错时报告地址最低的那个。
+        let per_thread = relocations.len().div_ceil(threads);
+        let mut chunks: Vec<Vec<(usize, &mut [u8])>> = vec![Vec::new()];
+        let mut load = 0;
+        for (i, slot) in jobs {
+            if load >= per_thread {
+                chunks.push(Vec::new());
+                load = 0;
+            }
+            load += relocs_of[i].len();
+            chunks.last_mut().expect("at least one chunk").push((i, slot));
+        }
+        let apply = &apply;
+        let results: Vec<Result<()>> = std::thread::scope(|scope| {
+            let handles: Vec<_> = chunks
+                .into_iter()
+                .map(|chunk| {
+                    scope.spawn(move || {
+                        for (i, slot) in chunk {
+                            apply(i, slot)?;
+                        }
+                        Ok(())
+                    })
+                })
+                .collect();
+            handles
+                .into_iter()
+                .map(|h| h.join().expect("relocation thread panicked"))
+                .collect()
+        });
+        for r in results {
+            r?;
+        }
+    }
+    stats.lap("relocate", &mut timer);
 
     // 6. 整理符号表，按地址升序输出。
-    let mut sym_out: Vec<(String, u32)> = sym_addr.into_iter().collect();
-    sym_out.sort_by_key(|(_, addr)| *addr);
+    let mut sym_out: Vec<(String, u32)> = sym_addr
+        .into_iter()
+        .map(|(name, addr)| (name.to_string(), addr))
+        .collect();
     sym_out.sort_by(|a, b| a.1.cmp(&b.1).then(a.0.cmp(&b.0)));
 
+    let mut layout: Vec<(String, u32, u32)> = sections
+        .iter()
+        .enumerate()
+        .map(|(i, s)| (s.name.clone(), bases[i], s.bytes.len() as u32))
+        .collect();
+    layout.sort_by_key(|(_, addr, _)| *addr);
+    stats.lap("output", &mut timer);
+
     Ok(LinkedOutput {
         image,
         symbols: sym_out,
+        removed,
+        folded,
+        layout,
+        stats,
     })
 }
 
@@ -294,10 +718,14 @@ mod tests {
     use super::*;
     use crate::obj::{ObjRelocation, ObjSection, ObjSymbol, RelocTarget};
 
-    fn sec(name: &str, bytes: &[u8]) -> ObjSection {
+    fn link(files: Vec<ObjectFile>) -> Result<LinkedOutput> {
+        link_with(files, &LinkOptions::default())
+    }
+
+    fn sec(name: &str, bytes: &[u8]) -> ObjSection<'static> {
         ObjSection {
             name: name.to_string(),
-            bytes: bytes.to_vec(),
+            bytes: bytes.to_vec().into(),
         }
     }
 
@@ -505,6 +933,22 @@ mod tests {
         assert!(out.symbols.iter().any(|(n, a)| n == "text.main" && *a == 0x10C));
     }
 
+    #[test]
+    fn empty_section_may_share_address_with_earlier_data() {
+        // 空的 text section 排在最后，和排在它前面的 data section 地址相同。
+        let s = obj(
+            vec![
+                sec("data.ptr", &[0; 4]),
+                sec("text._start", &[0; 12]),
+                sec("text.empty", &[]),
+            ],
+            vec![sym("_start", "text._start", 0)],
+            vec![reloc_symbol("data.ptr", 0, "_start", 0)],
+        );
+        let out = link(vec![s]).unwrap();
+        assert_eq!(&out.image[0x10C..0x110], &0x100u32.to_be_bytes());
+    }
+
     #[test]
     fn data_sections_follow_all_text_sections() {
         let s = obj(
@@ -576,6 +1020,276 @@ mod tests {
         assert!(out.image.len() >= 0x100);
     }
 
+    #[test]
+    fn gc_sections_keeps_only_sections_reachable_from_start() {
+        let s = obj(
+            vec![
+                sec("text._start", &[0; 12]),
+                sec("text.main", &[0; 12]),
+                sec("text.unused", &[0; 24]),
+                sec("data.table", &[0; 4]),
+                sec("data.unused", &[0; 8]),
+            ],
+            vec![
+                sym("text._start", "text._start", 0),
+                sym("main", "text.main", 0),
+                sym("unused", "text.unused", 0),
+            ],
+            vec![
+                reloc_symbol("text._start", 4, "main", 0),
+                reloc_sec("text.main", 4, "data.table", 0, 0),
+                reloc_symbol("text.unused", 4, "missing", 0),
+                reloc_sec("text.unused", 8, "data.unused", 0, 0),
+            ],
+        );
+        let opts = LinkOptions {
+            gc_sections: true,
+            ..Default::default()
+        };
+        let out = link_with(vec![s], &opts).unwrap();
+        assert_eq!(
+            out.removed,
+            vec![("text.unused".to_string(), 24), ("data.unused".to_string(), 8)]
+        );
+        assert!(out.symbols.iter().any(|(n, a)| n == "main" && *a == 0x10C));
+        assert!(!out.symbols.iter().any(|(n, _)| n == "unused"));
+        // data.table 紧跟在 text.main 之后。
+        assert_eq!(&out.image[0x110..0x114], &0x00000118u32.to_be_bytes());
+        assert_eq!(out.image.len(), 0x11C);
+    }
+
+    #[test]
+    fn gc_sections_still_reports_undefined_symbols_in_live_sections() {
+        let s = obj(
+            vec![sec("text._start", &[0; 12])],
+            vec![sym("text._start", "text._start", 0)],
+            vec![reloc_symbol("text._start", 4, "missing", 0)],
+        );
+        let opts = LinkOptions {
+            gc_sections: true,
+            ..Default::default()
+        };
+        assert!(link_with(vec![s], &opts).is_err());
+    }
+
+    fn icf() -> LinkOptions {
+        LinkOptions {
+            icf: true,
+            ..Default::default()
+        }
+    }
+
+    // calln <target>; ret
+    fn call_ret() -> Vec<u8> {
+        let mut b = vec![0, 0, 0, 0x4C, 0, 0, 0, 0, 0, 0, 0, 0];
+        b.extend_from_slice(&[0, 0, 0, 0x4D, 0, 0, 0, 0, 0, 0, 0, 0]);
+        b
+    }
+
+    #[test]
+    fn icf_folds_identical_functions_and_their_callers() {
+        let mut start = call_ret();
+        start[15] = 0x4C;
+        let s = obj(
+            vec![
+                sec("text._start", &start),
+                sec("text.a", &[1; 12]),
+                sec("text.b", &[1; 12]),
+                sec("text.call_a", &call_ret()),
+                sec("text.call_b", &call_ret()),
+            ],
+            vec![
+                sym("text._start", "text._start", 0),
+                sym("text.a", "text.a", 0),
+                sym("a", "text.a", 0),
+                sym("text.b", "text.b", 0),
+                sym("b", "text.b", 0),
+                sym("call_a", "text.call_a", 0),
+                sym("call_b", "text.call_b", 0),
+            ],
+            vec![
+                reloc_symbol("text._start", 4, "call_a", 0),
+                reloc_symbol("text._start", 16, "call_b", 0),
+                reloc_symbol("text.call_a", 4, "a", 0),
+                reloc_symbol("text.call_b", 4, "b", 0),
+            ],
+        );
+        let out = link_with(vec![s], &icf()).unwrap();
+        assert_eq!(out.folded.len(), 2);
+        assert_eq!(out.folded[0].name, "text.b");
+        assert_eq!(out.folded[0].into, "text.a");
+        assert_eq!(out.folded[0].symbols, vec!["b".to_string()]);
+        assert_eq!(out.folded[1].name, "text.call_b");
+        let addr = |name: &str| out.symbols.iter().find(|(n, _)| n == name).unwrap().1;
+        assert_eq!(addr("a"), addr("b"));
+        assert_eq!(addr("call_a"), addr("call_b"));
+        assert_eq!(out.image.len() as u32, addr("call_a") + 24);
+    }
+
+    #[test]
+    fn icf_resolves_chained_folds() {
+        // 第一轮 x2 并入 x1、v 并入 w；第二轮 z 的调用目标也变成 x1，w 再并入 z。
+        let s = obj(
+            vec![
+                sec("text._start", &call_ret()),
+                sec("text.x1", &[1; 12]),
+                sec("text.x2", &[1; 12]),
+                sec("text.z", &call_ret()),
+                sec("text.w", &call_ret()),
+                sec("text.v", &call_ret()),
+            ],
+            vec![
+                sym("text._start", "text._start", 0),
+                sym("x1", "text.x1", 0),
+                sym("x2", "text.x2", 0),
+                sym("z", "text.z", 0),
+                sym("w", "text.w", 0),
+                sym("v", "text.v", 0),
+            ],
+            vec![
+                reloc_symbol("text._start", 4, "v", 0),
+                reloc_symbol("text.z", 4, "x2", 0),
+                reloc_symbol("text.w", 4, "x1", 0),
+                reloc_symbol("text.v", 4, "x1", 0),
+            ],
+        );
+        let out = link_with(vec![s], &icf()).unwrap();
+        let into = |name: &str| out.folded.iter().find(|f| f.name == name).unwrap().into.clone();
+        assert_eq!(into("text.x2"), "text.x1");
+        assert_eq!(into("text.w"), "text.z");
+        assert_eq!(into("text.v"), "text.z");
+        let addr = |name: &str| out.symbols.iter().find(|(n, _)| n == name).unwrap().1;
+        assert_eq!(addr("v"), addr("z"));
+        assert_eq!(addr("w"), addr("z"));
+    }
+
+    #[test]
+    fn icf_keeps_functions_whose_address_is_taken() {
+        let s = obj(
+            vec![
+                sec("text._start", &call_ret()),
+                sec("text.a", &[1; 12]),
+                sec("text.b", &[1; 12]),
+                sec("data.ptr", &[0; 4]),
+            ],
+            vec![
+                sym("text._start", "text._start", 0),
+                sym("a", "text.a", 0),
+                sym("b", "text.b", 0),
+                sym("ptr", "data.ptr", 0),
+            ],
+            vec![
+                reloc_symbol("text._start", 4, "a", 0),
+                reloc_symbol("data.ptr", 0, "b", 0),
+            ],
+        );
+        let out = link_with(vec![s], &icf()).unwrap();
+        assert!(out.folded.is_empty());
+    }
+
+    #[test]
+    fn icf_keeps_functions_whose_address_is_taken_in_the_same_file() {
+        // 汇编器把同一文件内的 `setn 1x b` 写成 SectionOffset。
+        let s = obj(
+            vec![
+                sec("text._start", &call_ret()),
+                sec("text.a", &[1; 12]),
+                sec("text.b", &[1; 12]),
+                sec("data.ptr", &[0; 4]),
+            ],
+            vec![
+                sym("text._start", "text._start", 0),
+                sym("a", "text.a", 0),
+                sym("b", "text.b", 0),
+                sym("ptr", "data.ptr", 0),
+            ],
+            vec![
+                reloc_symbol("text._start", 4, "a", 0),
+                reloc_sec("data.ptr", 0, "text.b", 0, 0),
+            ],
+        );
+        let out = link_with(vec![s], &icf()).unwrap();
+        assert!(out.folded.is_empty());
+    }
+
+    #[test]
+    fn icf_merges_rodata_but_not_writable_data() {
+        let s = obj(
+            vec![
+                sec("text._start", &[0; 12]),
+                sec("data.rodata.s1", b"hi\0"),
+                sec("data.rodata.s2", b"hi\0"),
+                sec("data.x", b"hi\0"),
+                sec("data.y", b"hi\0"),
+            ],
+            vec![
+                sym("text._start", "text._start", 0),
+                sym("s1", "data.rodata.s1", 0),
+                sym("s2", "data.rodata.s2", 0),
+            ],
+            vec![],
+        );
+        let out = link_with(vec![s], &icf()).unwrap();
+        assert_eq!(out.folded.len(), 1);
+        assert_eq!(out.folded[0].name, "data.rodata.s2");
+        assert_eq!(out.folded[0].into, "data.rodata.s1");
+    }
+
+    #[test]
+    fn many_relocations_are_applied_per_section() {
+        // 足够多的 relocation 走多线程回填路径，结果必须和逐条回填一致。
+        let n = 8;
+        let per = PARALLEL_RELOCATIONS / n + 1;
+        let mut sections = vec![sec("text._start", &[0; 12])];
+        let mut symbols = vec![sym("text._start", "text._start", 0)];
+        let mut relocations = Vec::new();
+        for k in 0..n {
+            let name = format!("data.t{k}");
+            sections.push(sec(&name, &vec![0; per * 4]));
+            symbols.push(sym(&format!("t{k}"), &name, 0));
+            for j in 0..per {
+                relocations.push(reloc_symbol(&name, (j * 4) as u32, "text._start", j as u32));
+            }
+        }
+        let out = link(vec![obj(sections, symbols, relocations)]).unwrap();
+        assert_eq!(out.stats.relocations, n * per);
+        for k in 0..n {
+            let base = out.symbols.iter().find(|(s, _)| *s == format!("t{k}")).unwrap().1 as usize;
+            for j in [0, per / 2, per - 1] {
+                let at = base + j * 4;
+                assert_eq!(&out.image[at..at + 4], &(ENTRY + j as u32).to_be_bytes());
+            }
+        }
+    }
+
+    #[test]
+    fn section_order_places_text_sections_and_reports_layout() {
+        let s = obj(
+            vec![
+                sec("text._start", &[0; 12]),
+                sec("text.a", &[0; 8]),
+                sec("text.b", &[0; 4]),
+                sec("data", &[0; 4]),
+            ],
+            vec![sym("text._start", "text._start", 0)],
+            vec![],
+        );
+        let opts = LinkOptions {
+            order: Some(SectionOrder::List(vec!["text.b".to_string()])),
+            ..Default::default()
+        };
+        let out = link_with(vec![s], &opts).unwrap();
+        assert_eq!(
+            out.layout,
+            vec![
+                ("text._start".to_string(), 0x100, 12),
+                ("text.b".to_string(), 0x10C, 4),
+                ("text.a".to_string(), 0x110, 8),
+                ("data".to_string(), 0x118, 4),
+            ]
+        );
+    }
+
     #[test]
     fn warns_when_object_references_method_but_not_known_drop() {
         let main = obj(
@@ -1,17 +1,27 @@
 //! ShyISA `.sobj` object 文件二进制格式解析。
 //!
-//! 格式定义见 `ObjFormat.md` 第 12 节。所有 `u32` 使用大端序，所有链表指针都是
+//! v1 格式定义见 `ObjFormat.md` 第 12 节。所有 `u32` 使用大端序，所有链表指针都是
 //! 文件内绝对偏移，`0` 表示 `NULL`，`*_c_str` 是以 `0x00` 结尾的 UTF-8 字节串。
+//!
+//! v2 格式定义见第 13 节：定长的 section/symbol 表、去重的字符串表和按 section
+//! 分组的 varint relocation 流。[`ObjView`] 直接在文件字节（通常是 mmap）上按下标
+//! 读取记录，不为单条记录分配内存。
+
+use std::borrow::Cow;
+use std::collections::HashMap;
 
 use anyhow::{Context, Result, bail};
 
-/// `.sobj` 文件头 magic。
+/// `.sobj` v1 文件头 magic。
 pub const MAGIC: u32 = 0x66CCFF00;
+/// `.sobj` v2 文件头 magic，低字节是格式版本。
+pub const MAGIC_V2: u32 = 0x66CCFF02;
 
+/// section 内容直接借用输入文件（通常是 mmap）的字节，只有需要改写时才复制。
 #[derive(Debug, Clone, PartialEq, Eq)]
-pub struct ObjSection {
+pub struct ObjSection<'a> {
     pub name: String,
-    pub bytes: Vec<u8>,
+    pub bytes: Cow<'a, [u8]>,
 }
 
 #[derive(Debug, Clone, PartialEq, Eq)]
@@ -37,10 +47,10 @@ pub struct ObjRelocation {
 
 /// 解析后的 object 文件，对应 `ObjFormat.md` 中的 `ObjectFile`。
 #[derive(Debug, Clone)]
-pub struct ObjectFile {
+pub struct ObjectFile<'a> {
     pub mem_hint: Option<u32>,
     pub stack_hint: Option<u32>,
-    pub sections: Vec<ObjSection>,
+    pub sections: Vec<ObjSection<'a>>,
     pub symbols: Vec<ObjSymbol>,
     pub relocations: Vec<ObjRelocation>,
 }
@@ -63,9 +73,230 @@ fn read_cstr(buf: &[u8], off: usize) -> Result<(String, usize)> {
     Ok((s, off + end + 1))
 }
 
-impl ObjectFile {
-    /// 从 `.sobj` 二进制字节流解析出 `ObjectFile`。
-    pub fn from_bytes(buf: &[u8]) -> Result<Self> {
+/// v2 文件头大小。
+const V2_HEADER_SIZE: usize = 48;
+const V2_SECTION_RECORD: usize = 20;
+const V2_SYMBOL_RECORD: usize = 12;
+
+/// v2 relocation 的目标。section 用 section 表下标表示。
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ViewTarget<'a> {
+    Symbol(&'a str),
+    SectionOffset { section: usize, offset: u32 },
+}
+
+/// v2 object 文件的只读视图，所有名字和段数据都借用输入字节。
+#[derive(Debug, Clone, Copy)]
+pub struct ObjView<'a> {
+    pub mem_hint: Option<u32>,
+    pub stack_hint: Option<u32>,
+    section_count: usize,
+    symbol_count: usize,
+    relocation_count: usize,
+    sections: &'a [u8],
+    symbols: &'a [u8],
+    relocations: &'a [u8],
+    strtab: &'a [u8],
+    buf: &'a [u8],
+}
+
+/// 某个 section 的 relocation 迭代器，边读边解码 varint。
+pub struct ViewRelocations<'a> {
+    view: ObjView<'a>,
+    section: usize,
+    rest: &'a [u8],
+    remaining: u32,
+    offset: u32,
+}
+
+fn read_varint(rest: &mut &[u8]) -> Result<u64> {
+    let mut value = 0u64;
+    for shift in (0..64).step_by(7) {
+        let (&b, tail) = rest.split_first().context("relocation stream truncated")?;
+        *rest = tail;
+        value |= u64::from(b & 0x7F) << shift;
+        if b & 0x80 == 0 {
+            return Ok(value);
+        }
+    }
+    bail!("relocation varint too long")
+}
+
+fn varint_u32(rest: &mut &[u8]) -> Result<u32> {
+    let v = read_varint(rest)?;
+    u32::try_from(v).with_context(|| format!("relocation field out of range: {v}"))
+}
+
+impl<'a> ObjView<'a> {
+    /// 校验 v2 文件头和各个表的范围。记录本身在访问时才解析。
+    pub fn parse(buf: &'a [u8]) -> Result<Self> {
+        if buf.len() < V2_HEADER_SIZE {
+            bail!("object file too small for v2 header: {} bytes", buf.len());
+        }
+        let magic = read_u32(buf, 0)?;
+        if magic != MAGIC_V2 {
+            bail!("bad object magic: 0x{magic:08X}, expected 0x{MAGIC_V2:08X}");
+        }
+        let word = |off: usize| read_u32(buf, off).map(|v| v as usize);
+        let area = |start: usize, len: usize, what: &str| -> Result<&'a [u8]> {
+            start
+                .checked_add(len)
+                .and_then(|end| buf.get(start..end))
+                .with_context(|| format!("{what} out of bounds"))
+        };
+        let hint = |v: u32| if v == 0 { None } else { Some(v) };
+
+        let section_count = word(12)?;
+        let symbol_count = word(20)?;
+        Ok(Self {
+            mem_hint: hint(read_u32(buf, 4)?),
+            stack_hint: hint(read_u32(buf, 8)?),
+            section_count,
+            symbol_count,
+            relocation_count: word(28)?,
+            sections: area(
+                word(16)?,
+                section_count * V2_SECTION_RECORD,
+                "section table",
+            )?,
+            symbols: area(word(24)?, symbol_count * V2_SYMBOL_RECORD, "symbol table")?,
+            relocations: area(word(32)?, word(36)?, "relocation stream")?,
+            strtab: area(word(40)?, word(44)?, "string table")?,
+            buf,
+        })
+    }
+
+    pub fn section_count(&self) -> usize {
+        self.section_count
+    }
+
+    pub fn symbol_count(&self) -> usize {
+        self.symbol_count
+    }
+
+    pub fn relocation_count(&self) -> usize {
+        self.relocation_count
+    }
+
+    /// 字符串表中 `off` 处的名字。
+    fn name(&self, off: u32) -> Result<&'a str> {
+        let rest = self
+            .strtab
+            .get(off as usize..)
+            .with_context(|| format!("string offset out of bounds: {off}"))?;
+        let end = rest
+            .iter()
+            .position(|&b| b == 0)
+            .context("unterminated string in object file")?;
+        std::str::from_utf8(&rest[..end]).context("non-utf8 string in object file")
+    }
+
+    /// 第 `index` 个 section 的名字和字节内容。
+    pub fn section(&self, index: usize) -> Result<(&'a str, &'a [u8])> {
+        if index >= self.section_count {
+            bail!("section index out of range: {index}");
+        }
+        let rec = index * V2_SECTION_RECORD;
+        let name = self.name(read_u32(self.sections, rec)?)?;
+        let start = read_u32(self.sections, rec + 4)? as usize;
+        let size = read_u32(self.sections, rec + 8)? as usize;
+        let bytes = self
+            .buf
+            .get(start..start + size)
+            .with_context(|| format!("section bytes truncated: {name}"))?;
+        Ok((name, bytes))
+    }
+
+    /// 第 `index` 个 symbol：名字、section 下标、偏移。
+    pub fn symbol(&self, index: usize) -> Result<(&'a str, usize, u32)> {
+        if index >= self.symbol_count {
+            bail!("symbol index out of range: {index}");
+        }
+        let rec = index * V2_SYMBOL_RECORD;
+        let name = self.name(read_u32(self.symbols, rec)?)?;
+        let section = read_u32(self.symbols, rec + 4)? as usize;
+        if section >= self.section_count {
+            bail!("symbol {name} refers to section index {section} out of range");
+        }
+        Ok((name, section, read_u32(self.symbols, rec + 8)?))
+    }
+
+    /// 修改第 `index` 个 section 的 relocation，按 offset 升序。
+    pub fn relocations(&self, index: usize) -> Result<ViewRelocations<'a>> {
+        if index >= self.section_count {
+            bail!("section index out of range: {index}");
+        }
+        let rec = index * V2_SECTION_RECORD;
+        let start = read_u32(self.sections, rec + 12)? as usize;
+        Ok(ViewRelocations {
+            view: *self,
+            section: index,
+            rest: self
+                .relocations
+                .get(start..)
+                .context("relocation stream truncated")?,
+            remaining: read_u32(self.sections, rec + 16)?,
+            offset: 0,
+        })
+    }
+}
+
+impl<'a> ViewRelocations<'a> {
+    fn decode(&mut self) -> Result<(u32, ViewTarget<'a>, u32)> {
+        let delta = varint_u32(&mut self.rest)?;
+        self.offset = self
+            .offset
+            .checked_add(delta)
+            .context("relocation offset overflow")?;
+        let tag = read_varint(&mut self.rest)?;
+        let index = u32::try_from(tag >> 2).context("relocation target out of range")?;
+        let target = match tag & 3 {
+            1 => ViewTarget::Symbol(self.view.name(index)?),
+            0 | 2 => {
+                let section = if tag & 3 == 2 {
+                    self.section
+                } else {
+                    index as usize
+                };
+                if section >= self.view.section_count {
+                    bail!("relocation target section index {section} out of range");
+                }
+                ViewTarget::SectionOffset {
+                    section,
+                    offset: varint_u32(&mut self.rest)?,
+                }
+            }
+            other => bail!("invalid target_kind: {other}, expected 0, 1 or 2"),
+        };
+        let addend = varint_u32(&mut self.rest)?;
+        Ok((self.offset, target, addend))
+    }
+}
+
+impl<'a> Iterator for ViewRelocations<'a> {
+    /// `(offset, target, addend)`
+    type Item = Result<(u32, ViewTarget<'a>, u32)>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.remaining == 0 {
+            return None;
+        }
+        self.remaining -= 1;
+        let item = self.decode();
+        if item.is_err() {
+            self.remaining = 0;
+        }
+        Some(item)
+    }
+}
+
+impl<'a> ObjectFile<'a> {
+    /// 从 `.sobj` 二进制字节流解析出 `ObjectFile`，按 magic 区分 v1 和 v2。
+    /// section 内容借用 `buf`，不复制。
+    pub fn from_bytes(buf: &'a [u8]) -> Result<Self> {
+        if buf.len() >= 4 && read_u32(buf, 0)? == MAGIC_V2 {
+            return Self::from_view(&ObjView::parse(buf)?);
+        }
         if buf.len() < 16 {
             bail!("object file too small for header: {} bytes", buf.len());
         }
@@ -103,9 +334,11 @@ impl ObjectFile {
             let byte_size = read_u32(buf, p)? as usize;
             let bytes = buf
                 .get(p + 4..p + 4 + byte_size)
-                .context("section bytes truncated")?
-                .to_vec();
-            sections.push(ObjSection { name, bytes });
+                .context("section bytes truncated")?;
+            sections.push(ObjSection {
+                name,
+                bytes: Cow::Borrowed(bytes),
+            });
             cur = next;
         }
 
@@ -147,7 +380,12 @@ impl ObjectFile {
                         offset: target_offset,
                     }
                 }
-                other => bail!("invalid target_kind: {other}, expected 0 or 1"),
+                // 目标在被修改的 section 自身内，省略 section 名。
+                2 => RelocTarget::SectionOffset {
+                    section: section.clone(),
+                    offset: read_u32(buf, p)?,
+                },
+                other => bail!("invalid target_kind: {other}, expected 0, 1 or 2"),
             };
             relocations.push(ObjRelocation {
                 section,
@@ -166,6 +404,209 @@ impl ObjectFile {
             relocations,
         })
     }
+
+    /// 按 v2 格式序列化，与汇编器 `Obj::to_bytes` 的输出一致。
+    ///
+    /// v2 用 section 下标表示 `SectionOffset` 的目标，所以目标 section 必须在同一个
+    /// object 里。
+    pub fn to_bytes(&self) -> Result<Vec<u8>> {
+        fn put_u32(buf: &mut [u8], off: usize, value: u32) {
+            buf[off..off + 4].copy_from_slice(&value.to_be_bytes());
+        }
+        fn push_varint(buf: &mut Vec<u8>, mut value: u64) {
+            while value >= 0x80 {
+                buf.push(value as u8 | 0x80);
+                value >>= 7;
+            }
+            buf.push(value as u8);
+        }
+        fn file_offset(value: usize) -> Result<u32> {
+            u32::try_from(value).context("object file offset exceeds u32::MAX")
+        }
+
+        /// 去重的字符串表。
+        struct StrTab<'s> {
+            bytes: Vec<u8>,
+            index: HashMap<&'s str, u32>,
+        }
+        impl<'s> StrTab<'s> {
+            fn intern(&mut self, value: &'s str) -> Result<u32> {
+                if let Some(&off) = self.index.get(value) {
+                    return Ok(off);
+                }
+                if value.as_bytes().contains(&0) {
+                    bail!("object string contains NUL byte: {value:?}");
+                }
+                let off = file_offset(self.bytes.len())?;
+                self.bytes.extend_from_slice(value.as_bytes());
+                self.bytes.push(0);
+                self.index.insert(value, off);
+                Ok(off)
+            }
+        }
+
+        let mut strtab = StrTab {
+            bytes: Vec::new(),
+            index: HashMap::new(),
+        };
+        let mut section_index: HashMap<&str, u32> = HashMap::new();
+        for (index, section) in self.sections.iter().enumerate() {
+            section_index.entry(&section.name).or_insert(index as u32);
+        }
+        let find_section = |name: &str| -> Result<u32> {
+            section_index
+                .get(name)
+                .copied()
+                .with_context(|| format!("reference to section outside this object: {name}"))
+        };
+
+        let mut order: Vec<(u32, u32, usize)> = Vec::with_capacity(self.relocations.len());
+        for (index, r) in self.relocations.iter().enumerate() {
+            order.push((find_section(&r.section)?, r.offset, index));
+        }
+        order.sort_unstable();
+
+        let mut relocs = Vec::new();
+        let mut groups = vec![(0u32, 0u32); self.sections.len()];
+        let mut prev = (u32::MAX, 0u32);
+        for &(sec, offset, index) in &order {
+            if prev.0 != sec {
+                groups[sec as usize].0 = file_offset(relocs.len())?;
+                prev = (sec, 0);
+            }
+            groups[sec as usize].1 += 1;
+            push_varint(&mut relocs, u64::from(offset - prev.1));
+            prev.1 = offset;
+
+            let r = &self.relocations[index];
+            match &r.target {
+                RelocTarget::Symbol(name) => {
+                    push_varint(&mut relocs, u64::from(strtab.intern(name)?) << 2 | 1);
+                }
+                RelocTarget::SectionOffset { section, offset } if *section == r.section => {
+                    push_varint(&mut relocs, 2);
+                    push_varint(&mut relocs, u64::from(*offset));
+                }
+                RelocTarget::SectionOffset { section, offset } => {
+                    push_varint(&mut relocs, u64::from(find_section(section)?) << 2);
+                    push_varint(&mut relocs, u64::from(*offset));
+                }
+            }
+            push_varint(&mut relocs, u64::from(r.addend));
+        }
+
+        let section_names = self
+            .sections
+            .iter()
+            .map(|s| strtab.intern(&s.name))
+            .collect::<Result<Vec<_>>>()?;
+        let symbol_names = self
+            .symbols
+            .iter()
+            .map(|s| strtab.intern(&s.name))
+            .collect::<Result<Vec<_>>>()?;
+
+        let symbol_table = V2_HEADER_SIZE + self.sections.len() * V2_SECTION_RECORD;
+        let strtab_start = symbol_table + self.symbols.len() * V2_SYMBOL_RECORD;
+        let data_start = strtab_start + strtab.bytes.len();
+        let mut buf = vec![0u8; strtab_start];
+        let mut data_size = 0usize;
+        for (index, section) in self.sections.iter().enumerate() {
+            let rec = V2_HEADER_SIZE + index * V2_SECTION_RECORD;
+            let size =
+                u32::try_from(section.bytes.len()).context("section byte_size exceeds u32::MAX")?;
+            put_u32(&mut buf, rec, section_names[index]);
+            put_u32(&mut buf, rec + 4, file_offset(data_start + data_size)?);
+            put_u32(&mut buf, rec + 8, size);
+            put_u32(&mut buf, rec + 12, groups[index].0);
+            put_u32(&mut buf, rec + 16, groups[index].1);
+            data_size += section.bytes.len();
+        }
+        for (index, symbol) in self.symbols.iter().enumerate() {
+            let rec = symbol_table + index * V2_SYMBOL_RECORD;
+            put_u32(&mut buf, rec, symbol_names[index]);
+            put_u32(&mut buf, rec + 4, find_section(&symbol.section)?);
+            put_u32(&mut buf, rec + 8, symbol.offset);
+        }
+        let reloc_start = data_start + data_size;
+
+        put_u32(&mut buf, 0, MAGIC_V2);
+        put_u32(&mut buf, 4, self.mem_hint.unwrap_or(0));
+        put_u32(&mut buf, 8, self.stack_hint.unwrap_or(0));
+        put_u32(&mut buf, 12, file_offset(self.sections.len())?);
+        put_u32(&mut buf, 16, file_offset(V2_HEADER_SIZE)?);
+        put_u32(&mut buf, 20, file_offset(self.symbols.len())?);
+        put_u32(&mut buf, 24, file_offset(symbol_table)?);
+        put_u32(&mut buf, 28, file_offset(self.relocations.len())?);
+        put_u32(&mut buf, 32, file_offset(reloc_start)?);
+        put_u32(&mut buf, 36, file_offset(relocs.len())?);
+        put_u32(&mut buf, 40, file_offset(strtab_start)?);
+        put_u32(&mut buf, 44, file_offset(strtab.bytes.len())?);
+
+        buf.reserve(strtab.bytes.len() + data_size + relocs.len());
+        buf.extend_from_slice(&strtab.bytes);
+        for section in &self.sections {
+            buf.extend_from_slice(&section.bytes);
+        }
+        buf.extend_from_slice(&relocs);
+        file_offset(buf.len())?;
+        Ok(buf)
+    }
+
+    /// 把 v2 视图转换成 `ObjectFile`。
+    pub fn from_view(view: &ObjView<'a>) -> Result<Self> {
+        let mut sections = Vec::with_capacity(view.section_count());
+        for i in 0..view.section_count() {
+            let (name, bytes) = view.section(i)?;
+            sections.push(ObjSection {
+                name: name.to_string(),
+                bytes: Cow::Borrowed(bytes),
+            });
+        }
+        let mut symbols = Vec::with_capacity(view.symbol_count());
+        for i in 0..view.symbol_count() {
+            let (name, section, offset) = view.symbol(i)?;
+            symbols.push(ObjSymbol {
+                name: name.to_string(),
+                section: sections[section].name.clone(),
+                offset,
+            });
+        }
+        let mut relocations = Vec::with_capacity(view.relocation_count());
+        for i in 0..view.section_count() {
+            for reloc in view.relocations(i)? {
+                let (offset, target, addend) = reloc?;
+                relocations.push(ObjRelocation {
+                    section: sections[i].name.clone(),
+                    offset,
+                    target: match target {
+                        ViewTarget::Symbol(name) => RelocTarget::Symbol(name.to_string()),
+                        ViewTarget::SectionOffset { section, offset } => {
+                            RelocTarget::SectionOffset {
+                                section: sections[section].name.clone(),
+                                offset,
+                            }
+                        }
+                    },
+                    addend,
+                });
+            }
+        }
+        if relocations.len() != view.relocation_count() {
+            bail!(
+                "relocation_count mismatch: header says {}, sections hold {}",
+                view.relocation_count(),
+                relocations.len()
+            );
+        }
+        Ok(Self {
+            mem_hint: view.mem_hint,
+            stack_hint: view.stack_hint,
+            sections,
+            symbols,
+            relocations,
+        })
+    }
 }
 
 #[cfg(test)]
@@ -196,7 +637,11 @@ mod tests {
         push_u32(&mut buf, mem_hint.unwrap_or(0));
         push_u32(&mut buf, stack_hint.unwrap_or(0));
 
-        let section_start = if sections.is_empty() { 0 } else { buf.len() as u32 };
+        let section_start = if sections.is_empty() {
+            0
+        } else {
+            buf.len() as u32
+        };
         for (i, s) in sections.iter().enumerate() {
             let node_len = 4 + s.name.len() + 1 + 4 + s.bytes.len();
             let next = if i + 1 < sections.len() {
@@ -210,7 +655,11 @@ mod tests {
             buf.extend_from_slice(&s.bytes);
         }
 
-        let symbol_start = if symbols.is_empty() { 0 } else { buf.len() as u32 };
+        let symbol_start = if symbols.is_empty() {
+            0
+        } else {
+            buf.len() as u32
+        };
         for (i, sym) in symbols.iter().enumerate() {
             let node_len = 4 + 4 + sym.section.len() + 1 + sym.name.len() + 1;
             let next = if i + 1 < symbols.len() {
@@ -232,6 +681,7 @@ mod tests {
         for (i, r) in relocations.iter().enumerate() {
             let target_len = match &r.target {
                 RelocTarget::Symbol(name) => name.len() + 1,
+                RelocTarget::SectionOffset { section, .. } if *section == r.section => 4,
                 RelocTarget::SectionOffset { section, .. } => 4 + section.len() + 1,
             };
             let node_len = 4 + 4 + 4 + 4 + r.section.len() + 1 + target_len;
@@ -249,6 +699,11 @@ mod tests {
                     push_cstr(&mut buf, &r.section);
                     push_cstr(&mut buf, name);
                 }
+                RelocTarget::SectionOffset { section, offset } if *section == r.section => {
+                    push_u32(&mut buf, 2);
+                    push_cstr(&mut buf, &r.section);
+                    push_u32(&mut buf, *offset);
+                }
                 RelocTarget::SectionOffset { section, offset } => {
                     push_u32(&mut buf, 0);
                     push_cstr(&mut buf, &r.section);
@@ -265,6 +720,25 @@ mod tests {
         buf
     }
 
+    /// 测试辅助：按 v2 格式序列化。
+    fn build_sobj_v2(
+        mem_hint: Option<u32>,
+        stack_hint: Option<u32>,
+        sections: &[ObjSection],
+        symbols: &[ObjSymbol],
+        relocations: &[ObjRelocation],
+    ) -> Vec<u8> {
+        ObjectFile {
+            mem_hint,
+            stack_hint,
+            sections: sections.to_vec(),
+            symbols: symbols.to_vec(),
+            relocations: relocations.to_vec(),
+        }
+        .to_bytes()
+        .unwrap()
+    }
+
     #[test]
     fn parses_empty_object() {
         let buf = build_sobj(None, None, &[], &[], &[]);
@@ -283,16 +757,17 @@ mod tests {
         assert!(ObjectFile::from_bytes(&buf).is_err());
     }
 
-    #[test]
-    fn parses_sections_symbols_relocations() {
+    fn sample() -> (Vec<ObjSection<'static>>, Vec<ObjSymbol>, Vec<ObjRelocation>) {
         let sections = vec![
             ObjSection {
                 name: "text._start".to_string(),
-                bytes: vec![0x20, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00],
+                bytes: vec![
+                    0x20, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                ].into(),
             },
             ObjSection {
                 name: "data.message".to_string(),
-                bytes: b"Hello!\0".to_vec(),
+                bytes: b"Hello!\0".to_vec().into(),
             },
         ];
         let symbols = vec![
@@ -328,9 +803,30 @@ mod tests {
                 },
                 addend: 12,
             },
+            ObjRelocation {
+                section: "data.message".to_string(),
+                offset: 0,
+                target: RelocTarget::SectionOffset {
+                    section: "text._start".to_string(),
+                    offset: 0,
+                },
+                addend: 0,
+            },
         ];
 
-        let buf = build_sobj(Some(10 * 1024 * 1024), Some(4 * 1024), &sections, &symbols, &relocations);
+        (sections, symbols, relocations)
+    }
+
+    #[test]
+    fn parses_sections_symbols_relocations() {
+        let (sections, symbols, relocations) = sample();
+        let buf = build_sobj(
+            Some(10 * 1024 * 1024),
+            Some(4 * 1024),
+            &sections,
+            &symbols,
+            &relocations,
+        );
         let obj = ObjectFile::from_bytes(&buf).unwrap();
 
         assert_eq!(obj.mem_hint, Some(10 * 1024 * 1024));
@@ -339,4 +835,114 @@ mod tests {
         assert_eq!(obj.symbols, symbols);
         assert_eq!(obj.relocations, relocations);
     }
+
+    #[test]
+    fn same_section_relocation_omits_target_section_name() {
+        let sections = vec![ObjSection {
+            name: "text.f".to_string(),
+            bytes: vec![0; 24].into(),
+        }];
+        let relocations = vec![ObjRelocation {
+            section: "text.f".to_string(),
+            offset: 4,
+            target: RelocTarget::SectionOffset {
+                section: "text.f".to_string(),
+                offset: 12,
+            },
+            addend: 0,
+        }];
+        let buf = build_sobj(None, None, &sections, &[], &relocations);
+        let start = u32::from_be_bytes(buf[12..16].try_into().unwrap()) as usize;
+        assert_eq!(&buf[start + 12..start + 16], &2u32.to_be_bytes());
+        assert_eq!(buf.len(), start + 16 + "text.f\0".len() + 4);
+        let obj = ObjectFile::from_bytes(&buf).unwrap();
+        assert_eq!(obj.relocations, relocations);
+    }
+
+    #[test]
+    fn parses_v2_object() {
+        let (sections, symbols, relocations) = sample();
+        let buf = build_sobj_v2(
+            Some(10 * 1024 * 1024),
+            Some(4 * 1024),
+            &sections,
+            &symbols,
+            &relocations,
+        );
+        let obj = ObjectFile::from_bytes(&buf).unwrap();
+
+        assert_eq!(obj.mem_hint, Some(10 * 1024 * 1024));
+        assert_eq!(obj.stack_hint, Some(4 * 1024));
+        assert_eq!(obj.sections, sections);
+        assert_eq!(obj.symbols, symbols);
+        assert_eq!(obj.relocations, relocations);
+        // section 内容直接借用输入缓冲区。
+        let range = buf.as_ptr_range();
+        assert!(obj.sections.iter().all(|s| match &s.bytes {
+            Cow::Borrowed(b) => range.contains(&b.as_ptr()),
+            Cow::Owned(_) => false,
+        }));
+
+        let empty = build_sobj_v2(None, None, &[], &[], &[]);
+        let obj = ObjectFile::from_bytes(&empty).unwrap();
+        assert_eq!(obj.mem_hint, None);
+        assert!(obj.sections.is_empty() && obj.symbols.is_empty() && obj.relocations.is_empty());
+    }
+
+    #[test]
+    fn v2_view_borrows_names_and_bytes_from_input() {
+        let (sections, symbols, relocations) = sample();
+        let buf = build_sobj_v2(None, None, &sections, &symbols, &relocations);
+        // "text._start" 被 section、symbol 和 relocation 共用，字符串表里只有一份。
+        assert_eq!(
+            buf.windows(12).filter(|w| *w == b"text._start\0").count(),
+            1
+        );
+
+        let view = ObjView::parse(&buf).unwrap();
+        let range = buf.as_ptr_range();
+        let (name, bytes) = view.section(1).unwrap();
+        assert_eq!((name, bytes), ("data.message", &b"Hello!\0"[..]));
+        assert!(range.contains(&name.as_ptr()) && range.contains(&bytes.as_ptr()));
+        assert_eq!(view.symbol(2).unwrap(), ("message", 1, 0));
+
+        let relocs: Vec<_> = view.relocations(0).unwrap().map(Result::unwrap).collect();
+        assert_eq!(
+            relocs,
+            vec![
+                (4, ViewTarget::Symbol("message"), 0),
+                (
+                    8,
+                    ViewTarget::SectionOffset {
+                        section: 0,
+                        offset: 0
+                    },
+                    12
+                ),
+            ]
+        );
+        assert!(view.section(2).is_err());
+        assert!(view.symbol(3).is_err());
+    }
+
+    #[test]
+    fn rejects_malformed_v2_object() {
+        let (sections, symbols, relocations) = sample();
+        let buf = build_sobj_v2(None, None, &sections, &symbols, &relocations);
+
+        let mut bad = buf.clone();
+        // symbol 0 的 section 下标越界
+        let symbol_table = u32::from_be_bytes(buf[24..28].try_into().unwrap()) as usize;
+        bad[symbol_table + 4..symbol_table + 8].copy_from_slice(&9u32.to_be_bytes());
+        assert!(ObjectFile::from_bytes(&bad).is_err());
+
+        let mut bad = buf.clone();
+        // 第一条 relocation 的 target_kind 改成 3
+        let start = u32::from_be_bytes(buf[32..36].try_into().unwrap()) as usize;
+        bad[start + 1] = bad[start + 1] | 3;
+        assert!(ObjectFile::from_bytes(&bad).is_err());
+
+        assert!(ObjectFile::from_bytes(&buf[..buf.len() - 1]).is_err());
+        assert!(ObjectFile::from_bytes(&buf[..40]).is_err());
+    }
 }
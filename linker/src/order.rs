@@ -0,0 +1,447 @@
+//! `text.*` section 排布顺序：`--symbol-ordering-file` 和 `--call-graph-profile`。
+//!
+//! 模拟器的指令缓存按 `pc / 4` 直接映射，section 放在哪里决定了冲突缺失。
+//! 默认按输入顺序排布；给出排序文件时，文件里列出的 section 依次排在
+//! `text._start` 之后，其余保持输入顺序。给出 `shyemu --profile` 写出的调用图
+//! profile 时，按 Pettis-Hansen 的做法聚类：
+//!
+//! 1. 每个 section 自成一条链；调用边按两个方向的次数之和合并成无向边。
+//! 2. 按权重从大到小处理每条边，两端不在同一条链时把两条链拼起来，并在
+//!    四种拼接方向里挑两端距离最近的一种。
+//! 3. 链按执行指令数之和从大到小排列；profile 没提到的 section 接在后面，
+//!    执行过但不在任何边上的 section 也算热的；profile 里从未进入的 section
+//!    放在最后。
+//!
+//! 所有并列都按输入顺序打破，同样的输入和 profile 总是得到同样的布局。
+
+use std::collections::HashMap;
+
+use anyhow::{Context, Result, bail};
+
+/// `shyemu --profile` 的调用图，见 `emu/src/profile.rs`。
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct CallGraphProfile {
+    /// 函数名 -> (进入次数, 执行指令数)。
+    pub functions: HashMap<String, (u64, u64)>,
+    /// (调用者, 被调用者, 次数)。
+    pub edges: Vec<(String, String, u64)>,
+}
+
+/// `text.*` section 的排布方式。
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum SectionOrder {
+    /// 按列出的顺序排在最前面的 section 名。
+    List(Vec<String>),
+    Profile(CallGraphProfile),
+}
+
+/// 把排序文件里的一个名字转成 section 名：`text.` 开头的原样使用，其他的
+/// 当作函数名。
+fn section_name(name: &str) -> String {
+    if name.starts_with("text.") {
+        name.to_string()
+    } else {
+        format!("text.{name}")
+    }
+}
+
+/// 解析排序文件：每行一个函数名或 `text.*` section 名，`#` 之后是注释。
+pub fn parse_ordering_file(text: &str) -> Vec<String> {
+    text.lines()
+        .map(|line| line.split('#').next().unwrap_or("").trim())
+        .filter(|line| !line.is_empty())
+        .map(section_name)
+        .collect()
+}
+
+/// 只够读 profile 的 JSON 读取器：对象、数组、字符串和非负整数，其他值跳过。
+struct Json<'a> {
+    src: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Json<'a> {
+    fn skip_ws(&mut self) {
+        while self.pos < self.src.len() && self.src[self.pos].is_ascii_whitespace() {
+            self.pos += 1;
+        }
+    }
+
+    fn consume(&mut self, c: u8) -> bool {
+        self.skip_ws();
+        if self.src.get(self.pos) == Some(&c) {
+            self.pos += 1;
+            true
+        } else {
+            false
+        }
+    }
+
+    fn expect(&mut self, c: u8) -> Result<()> {
+        if !self.consume(c) {
+            bail!("expected `{}` at byte {}", c as char, self.pos);
+        }
+        Ok(())
+    }
+
+    fn string(&mut self) -> Result<String> {
+        self.expect(b'"')?;
+        let mut out = Vec::new();
+        loop {
+            let Some(&c) = self.src.get(self.pos) else {
+                bail!("unterminated string");
+            };
+            self.pos += 1;
+            match c {
+                b'"' => break,
+                b'\\' => {
+                    let Some(&e) = self.src.get(self.pos) else {
+                        bail!("unterminated string");
+                    };
+                    self.pos += 1;
+                    out.push(e);
+                }
+                _ => out.push(c),
+            }
+        }
+        String::from_utf8(out).context("invalid UTF-8 in string")
+    }
+
+    fn count(&mut self) -> Result<u64> {
+        self.skip_ws();
+        let start = self.pos;
+        while self.pos < self.src.len() && self.src[self.pos].is_ascii_digit() {
+            self.pos += 1;
+        }
+        if start == self.pos {
+            bail!("expected a count at byte {start}");
+        }
+        let s = std::str::from_utf8(&self.src[start..self.pos]).expect("ascii digits");
+        s.parse()
+            .with_context(|| format!("count out of range: {s}"))
+    }
+
+    fn skip_value(&mut self) -> Result<()> {
+        self.skip_ws();
+        match self.src.get(self.pos) {
+            Some(b'"') => {
+                self.string()?;
+            }
+            Some(b'{') => self.object(|j, _| j.skip_value())?,
+            Some(b'[') => self.list(|j| j.skip_value())?,
+            _ => {
+                while self.pos < self.src.len() && !b",}] \t\r\n".contains(&self.src[self.pos]) {
+                    self.pos += 1;
+                }
+            }
+        }
+        Ok(())
+    }
+
+    /// 读取一个对象，每个键调用一次 `f`，`f` 负责读掉对应的值。
+    fn object(&mut self, mut f: impl FnMut(&mut Self, &str) -> Result<()>) -> Result<()> {
+        self.expect(b'{')?;
+        if self.consume(b'}') {
+            return Ok(());
+        }
+        loop {
+            let key = self.string()?;
+            self.expect(b':')?;
+            f(self, &key)?;
+            if !self.consume(b',') {
+                break;
+            }
+        }
+        self.expect(b'}')
+    }
+
+    fn list(&mut self, mut f: impl FnMut(&mut Self) -> Result<()>) -> Result<()> {
+        self.expect(b'[')?;
+        if self.consume(b']') {
+            return Ok(());
+        }
+        loop {
+            f(self)?;
+            if !self.consume(b',') {
+                break;
+            }
+        }
+        self.expect(b']')
+    }
+}
+
+/// 解析 `shyemu --profile` 写出的 JSON。
+pub fn parse_call_graph_profile(text: &str) -> Result<CallGraphProfile> {
+    let mut prof = CallGraphProfile::default();
+    let mut j = Json {
+        src: text.as_bytes(),
+        pos: 0,
+    };
+    j.object(|j, key| match key {
+        "functions" => j.list(|j| {
+            let (mut name, mut entries, mut insns) = (None, 0, 0);
+            j.object(|j, key| {
+                match key {
+                    "name" => name = Some(j.string()?),
+                    "entries" => entries = j.count()?,
+                    "insns" => insns = j.count()?,
+                    _ => j.skip_value()?,
+                }
+                Ok(())
+            })?;
+            let name = name.context("function without a name")?;
+            prof.functions.insert(name, (entries, insns));
+            Ok(())
+        }),
+        "edges" => j.list(|j| {
+            let (mut caller, mut callee, mut count) = (None, None, 0);
+            j.object(|j, key| {
+                match key {
+                    "caller" => caller = Some(j.string()?),
+                    "callee" => callee = Some(j.string()?),
+                    "count" => count = j.count()?,
+                    _ => j.skip_value()?,
+                }
+                Ok(())
+            })?;
+            let caller = caller.context("edge without a caller")?;
+            let callee = callee.context("edge without a callee")?;
+            prof.edges.push((caller, callee, count));
+            Ok(())
+        }),
+        _ => j.skip_value(),
+    })?;
+    Ok(prof)
+}
+
+impl CallGraphProfile {
+    /// `text.<name>` section 的执行指令数；profile 没提到时为 `None`。
+    pub fn insns(&self, section: &str) -> Option<u64> {
+        let name = section.strip_prefix("text.")?;
+        self.functions.get(name).map(|&(_, insns)| insns)
+    }
+}
+
+/// 计算 `text.*` section 的排布顺序。`names` 是除 `text._start` 以外的
+/// `text.*` section，按输入顺序排列；返回它们在 `names` 中的下标。
+pub fn order_text_sections(names: &[&str], order: &SectionOrder) -> Vec<usize> {
+    match order {
+        SectionOrder::List(list) => order_by_list(names, list),
+        SectionOrder::Profile(prof) => order_by_profile(names, prof),
+    }
+}
+
+fn order_by_list(names: &[&str], list: &[String]) -> Vec<usize> {
+    let index: HashMap<&str, usize> = names.iter().enumerate().map(|(i, n)| (*n, i)).collect();
+    let mut placed = vec![false; names.len()];
+    let mut out = Vec::with_capacity(names.len());
+    for name in list {
+        if let Some(&i) = index.get(name.as_str()) {
+            if !placed[i] {
+                placed[i] = true;
+                out.push(i);
+            }
+        }
+    }
+    out.extend((0..names.len()).filter(|&i| !placed[i]));
+    out
+}
+
+fn order_by_profile(names: &[&str], prof: &CallGraphProfile) -> Vec<usize> {
+    let index: HashMap<&str, usize> = names.iter().enumerate().map(|(i, n)| (*n, i)).collect();
+    let lookup = |f: &str| index.get(format!("text.{f}").as_str()).copied();
+
+    // 无向边权重，键为 (小下标, 大下标)。自调用和 text._start 上的边不参与聚类。
+    let mut weights: HashMap<(usize, usize), u64> = HashMap::new();
+    for (caller, callee, count) in &prof.edges {
+        let (Some(a), Some(b)) = (lookup(caller), lookup(callee)) else {
+            continue;
+        };
+        if a != b && *count > 0 {
+            *weights.entry((a.min(b), a.max(b))).or_insert(0) += count;
+        }
+    }
+    let mut edges: Vec<((usize, usize), u64)> = weights.into_iter().collect();
+    edges.sort_by(|x, y| y.1.cmp(&x.1).then(x.0.cmp(&y.0)));
+
+    // chain_of[i] 是 section i 所在链的编号，chains[c] 是链上的 section。
+    let mut chain_of: Vec<usize> = (0..names.len()).collect();
+    let mut chains: Vec<Vec<usize>> = (0..names.len()).map(|i| vec![i]).collect();
+    for ((a, b), _) in edges {
+        let (ca, cb) = (chain_of[a], chain_of[b]);
+        if ca == cb {
+            continue;
+        }
+        let left = std::mem::take(&mut chains[ca]);
+        let right = std::mem::take(&mut chains[cb]);
+        let merged = merge_chains(left, right, a, b);
+        for &i in &merged {
+            chain_of[i] = ca;
+        }
+        chains[ca] = merged;
+    }
+
+    let insns = |i: usize| prof.insns(names[i]);
+    let mut hot = Vec::new();
+    let mut unknown = Vec::new();
+    let mut cold = Vec::new();
+    for chain in chains.into_iter().filter(|c| !c.is_empty()) {
+        let known: Vec<u64> = chain.iter().filter_map(|&i| insns(i)).collect();
+        let heat: u64 = known.iter().sum();
+        if heat > 0 {
+            hot.push((heat, chain));
+        } else if known.is_empty() {
+            unknown.extend(chain);
+        } else {
+            cold.extend(chain);
+        }
+    }
+    // 热链按执行指令数降序，并列时按链首的输入顺序。
+    hot.sort_by(|x, y| y.0.cmp(&x.0).then(x.1.iter().min().cmp(&y.1.iter().min())));
+    unknown.sort_unstable();
+    cold.sort_unstable();
+
+    let mut out: Vec<usize> = hot.into_iter().flat_map(|(_, c)| c).collect();
+    out.extend(unknown);
+    out.extend(cold);
+    out
+}
+
+/// 拼接 `a` 所在的链 `left` 和 `b` 所在的链 `right`，在 `l+r`、`l+rev(r)`、
+/// `rev(l)+r`、`rev(l)+rev(r)` 中选 `a` 和 `b` 相距最近的一种；距离相同时取
+/// 靠前的候选。
+fn merge_chains(left: Vec<usize>, right: Vec<usize>, a: usize, b: usize) -> Vec<usize> {
+    let pa = left.iter().position(|&i| i == a).expect("a is in left");
+    let pb = right.iter().position(|&i| i == b).expect("b is in right");
+    // a 到 left 尾部的距离 + b 到 right 头部的距离。
+    let tail_a = left.len() - 1 - pa;
+    let head_b = pb;
+    let candidates = [
+        (tail_a + head_b, false, false),
+        (tail_a + (right.len() - 1 - pb), false, true),
+        (pa + head_b, true, false),
+        (pa + (right.len() - 1 - pb), true, true),
+    ];
+    let (_, rev_l, rev_r) = candidates
+        .iter()
+        .copied()
+        .min_by_key(|c| c.0)
+        .expect("four candidates");
+    let mut out = left;
+    if rev_l {
+        out.reverse();
+    }
+    let mut right = right;
+    if rev_r {
+        right.reverse();
+    }
+    out.extend(right);
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn ordering_file_accepts_functions_sections_and_comments() {
+        let list = parse_ordering_file("# hot path\nmain\n  text.f  # called from main\n\n");
+        assert_eq!(list, vec!["text.main".to_string(), "text.f".to_string()]);
+    }
+
+    #[test]
+    fn list_order_puts_listed_sections_first() {
+        let names = ["text.a", "text.b", "text.c", "text.d"];
+        let list = vec![
+            "text.c".to_string(),
+            "text.missing".to_string(),
+            "text.a".to_string(),
+        ];
+        assert_eq!(order_by_list(&names, &list), vec![2, 0, 1, 3]);
+    }
+
+    #[test]
+    fn parses_emu_profile_json() {
+        let prof = parse_call_graph_profile(
+            r#"{
+  "functions": [
+    {"name": "main", "entries": 1, "insns": 42},
+    {"name": "f", "entries": 3, "insns": 9, "extra": [1, {"x": "y"}]}
+  ],
+  "edges": [
+    {"caller": "main", "callee": "f", "count": 3}
+  ]
+}"#,
+        )
+        .unwrap();
+        assert_eq!(prof.functions["main"], (1, 42));
+        assert_eq!(prof.functions["f"], (3, 9));
+        assert_eq!(prof.edges, vec![("main".into(), "f".into(), 3)]);
+        assert!(parse_call_graph_profile("{\"functions\": [{\"entries\": 1}]}").is_err());
+    }
+
+    fn profile(functions: &[(&str, u64, u64)], edges: &[(&str, &str, u64)]) -> CallGraphProfile {
+        CallGraphProfile {
+            functions: functions
+                .iter()
+                .map(|&(n, e, i)| (n.to_string(), (e, i)))
+                .collect(),
+            edges: edges
+                .iter()
+                .map(|&(a, b, c)| (a.to_string(), b.to_string(), c))
+                .collect(),
+        }
+    }
+
+    #[test]
+    fn profile_clusters_hot_call_chains_and_sinks_cold_sections() {
+        // main -> hot_a（1000 次）-> hot_b（500 次）；cold 从未进入；other 不在
+        // profile 里；lonely 执行过但没有调用边。
+        let names = [
+            "text.cold",
+            "text.hot_b",
+            "text.other",
+            "text.main",
+            "text.lonely",
+            "text.hot_a",
+        ];
+        let prof = profile(
+            &[
+                ("main", 1, 100),
+                ("hot_a", 1000, 5000),
+                ("hot_b", 500, 2000),
+                ("cold", 0, 0),
+                ("lonely", 1, 10),
+            ],
+            &[
+                ("main", "hot_a", 1000),
+                ("hot_a", "hot_b", 500),
+                ("main", "cold", 0),
+                ("_start", "main", 1),
+            ],
+        );
+        let order = order_by_profile(&names, &prof);
+        let placed: Vec<&str> = order.iter().map(|&i| names[i]).collect();
+        assert_eq!(
+            placed,
+            vec![
+                "text.hot_b",
+                "text.hot_a",
+                "text.main",
+                "text.lonely",
+                "text.other",
+                "text.cold"
+            ]
+        );
+        // 同样的输入总是得到同样的顺序。
+        assert_eq!(order_by_profile(&names, &prof), order);
+    }
+
+    #[test]
+    fn merge_puts_edge_endpoints_next_to_each_other() {
+        // left = [0, 1]，right = [2, 3]，边 (0, 3)：rev(left) + rev(right)。
+        assert_eq!(merge_chains(vec![0, 1], vec![2, 3], 0, 3), vec![1, 0, 3, 2]);
+        // 边 (1, 2)：直接拼接。
+        assert_eq!(merge_chains(vec![0, 1], vec![2, 3], 1, 2), vec![0, 1, 2, 3]);
+    }
+}
@@ -8,21 +8,32 @@ extern "C" {
 #endif
 
 #define SHY_FILE_NAME_MAX 256
+#define SHY_FILE_MIN_CAP 4096
 
+// len 是有效内容长度，cap 是文件和映射的实际长度；追加时 cap 按倍数预留，
+// shy_flush / shy_close 时截回 len。
 typedef struct ShyFile {
     i32 len;
+    i32 cap;
     char filename[SHY_FILE_NAME_MAX];
     u8 *content;
 } ShyFile;
 
 ShyFile *shy_open(const char *filename);
+ShyFile *shy_create(const char *filename);
 i32 shy_close(ShyFile *file);
 i32 shy_flush(ShyFile *file);
 i32 shy_rename(ShyFile *file, const char *new_name);
 i32 shy_push_back(ShyFile *file, u8 byte);
 i32 shy_push_back_slice(ShyFile *file, const u8 *data, i32 len);
+i32 shy_reserve(ShyFile *file, i32 additional);
 i32 shy_len(ShyFile *file);
 
+// 把 filename 以写时复制方式映射到一块 size 字节的私有内存开头，其余部分为零；
+// filename 为 NULL 时只分配零内存。对映射的写入不会影响文件。
+u8 *shy_map_private(const char *filename, usize size, i32 *image_len);
+i32 shy_unmap(u8 *mapping, usize size);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
 
 #include "shy_file.h"
 
@@ -43,20 +44,75 @@ static i32 validate_filename(const char *filename) {
     return 0;
 }
 
-static bool slice_overlaps_mapping(const u8 *data, i32 len, const u8 *mapping, i32 mapping_len) {
-    if (data == NULL || len <= 0 || mapping == NULL || mapping_len <= 0) {
-        return false;
+static i32 map_file(ShyFile *file, int fd) {
+    file->content = NULL;
+    if (file->cap == 0) {
+        return 0;
+    }
+
+    void *mapped = mmap(NULL, (usize)file->cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+    file->content = mapped;
+    return 0;
+}
+
+// 把文件和映射都扩到至少 min_cap 字节。映射是 MAP_SHARED 的，旧映射里的数据已经在
+// page cache 里，新映射直接能看到，不需要先 msync。
+static i32 grow_to(ShyFile *file, i32 min_cap) {
+    if (min_cap <= file->cap) {
+        return 0;
+    }
+
+    int fd = open(file->filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)min_cap) != 0) {
+        close(fd);
+        return -1;
     }
 
-    usize data_start = (usize)data;
-    usize data_end = data_start + (usize)len;
-    usize mapping_start = (usize)mapping;
-    usize mapping_end = mapping_start + (usize)mapping_len;
+    void *mapped = mmap(NULL, (usize)min_cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
 
-    return data_start < mapping_end && mapping_start < data_end;
+    if (file->content != NULL) {
+        munmap(file->content, (usize)file->cap);
+    }
+    file->content = mapped;
+    file->cap = min_cap;
+    return 0;
 }
 
-ShyFile *shy_open(const char *filename) {
+// 追加时按倍数预留的空间在这里截掉，让磁盘上的文件长度回到 len。
+static i32 trim_to_len(ShyFile *file) {
+    if (file->cap == file->len) {
+        return 0;
+    }
+
+    int fd = open(file->filename, O_RDWR);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)file->len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    if (file->content != NULL) {
+        munmap(file->content, (usize)file->cap);
+    }
+    file->cap = file->len;
+    i32 result = map_file(file, fd);
+    close(fd);
+    return result;
+}
+
+static ShyFile *open_with(const char *filename, int flags) {
     ShyFile *file = calloc(1, sizeof(*file));
     if (file == NULL) {
         return NULL;
@@ -67,7 +123,7 @@ ShyFile *shy_open(const char *filename) {
         return NULL;
     }
 
-    int fd = open(filename, O_RDWR | O_CREAT, 0644);
+    int fd = open(filename, flags, 0644);
     if (fd < 0) {
         free(file);
         return NULL;
@@ -81,25 +137,39 @@ ShyFile *shy_open(const char *filename) {
     }
 
     file->len = (i32)st.st_size;
-    if (file->len > 0) {
-        void *mapped = mmap(NULL, (usize)file->len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (mapped == MAP_FAILED) {
-            close(fd);
-            free(file);
-            return NULL;
-        }
-        file->content = mapped;
+    file->cap = file->len;
+    if (map_file(file, fd) != 0) {
+        close(fd);
+        free(file);
+        return NULL;
     }
 
     close(fd);
     return file;
 }
 
+ShyFile *shy_open(const char *filename) {
+    return open_with(filename, O_RDWR | O_CREAT);
+}
+
+// 先删掉旧文件再新建，而不是截断旧 inode：shyemu 等进程以 MAP_PRIVATE 映射着
+// 旧文件时，没写过的页仍直接读文件，原地改写会改掉它们看到的内容，截断会让它们
+// 收到 SIGBUS。
+ShyFile *shy_create(const char *filename) {
+    if (filename != NULL && unlink(filename) != 0 && errno != ENOENT) {
+        return NULL;
+    }
+    return open_with(filename, O_RDWR | O_CREAT | O_TRUNC);
+}
+
 i32 shy_flush(ShyFile *file) {
     if (file == NULL) {
         errno = EINVAL;
         return -1;
     }
+    if (trim_to_len(file) != 0) {
+        return -1;
+    }
     if (file->content == NULL || file->len == 0) {
         return 0;
     }
@@ -113,11 +183,20 @@ i32 shy_close(ShyFile *file) {
         return -1;
     }
 
-    i32 result = shy_flush(file);
-    if (file->content != NULL && file->len > 0) {
-        if (munmap(file->content, (usize)file->len) != 0) {
+    // 关闭时只截掉预留空间，不等待落盘；需要持久化的调用方先 shy_flush。
+    i32 result = 0;
+    if (file->content != NULL && munmap(file->content, (usize)file->cap) != 0) {
+        result = -1;
+    }
+    file->content = NULL;
+    if (file->cap != file->len) {
+        int fd = open(file->filename, O_RDWR);
+        if (fd < 0 || ftruncate(fd, (off_t)file->len) != 0) {
             result = -1;
         }
+        if (fd >= 0) {
+            close(fd);
+        }
     }
 
     free(file);
@@ -152,6 +231,15 @@ i32 shy_push_back(ShyFile *file, u8 byte) {
     return shy_push_back_slice(file, &byte, 1);
 }
 
+i32 shy_reserve(ShyFile *file, i32 additional) {
+    if (file == NULL || additional < 0 || additional > INT_MAX - file->len) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return grow_to(file, file->len + additional);
+}
+
 i32 shy_push_back_slice(ShyFile *file, const u8 *data, i32 len) {
     if (file == NULL || data == NULL || len < 0 || len > INT_MAX - file->len) {
         errno = EINVAL;
@@ -161,70 +249,103 @@ i32 shy_push_back_slice(ShyFile *file, const u8 *data, i32 len) {
         return 0;
     }
 
-    i32 old_len = file->len;
-    i32 new_len = old_len + len;
-    const u8 *append_data = data;
-    u8 *owned_append_data = NULL;
+    i32 new_len = file->len + len;
+    if (new_len > file->cap) {
+        // 容量按倍数增长，n 次追加只需要 O(log n) 次 ftruncate + mmap。
+        i32 new_cap = file->cap < SHY_FILE_MIN_CAP ? SHY_FILE_MIN_CAP : file->cap;
+        while (new_cap < new_len) {
+            new_cap = new_cap > INT_MAX / 2 ? INT_MAX : new_cap * 2;
+        }
 
-    if (slice_overlaps_mapping(data, len, file->content, old_len)) {
-        owned_append_data = malloc((usize)len);
-        if (owned_append_data == NULL) {
-            return -1;
+        // data 可能指向旧映射；先把它复制出来，旧映射在 grow_to 里会被 munmap。
+        u8 *owned = NULL;
+        if (file->content != NULL && data >= file->content && data < file->content + file->cap) {
+            owned = malloc((usize)len);
+            if (owned == NULL) {
+                return -1;
+            }
+            memcpy(owned, data, (usize)len);
+            data = owned;
         }
-        memcpy(owned_append_data, data, (usize)len);
-        append_data = owned_append_data;
-    }
 
-    int fd = open(file->filename, O_RDWR | O_CREAT, 0644);
-    if (fd < 0) {
-        free(owned_append_data);
-        return -1;
+        i32 result = grow_to(file, new_cap);
+        if (result == 0) {
+            memcpy(file->content + file->len, data, (usize)len);
+            file->len = new_len;
+        }
+        free(owned);
+        return result;
     }
 
-    if (file->content != NULL && old_len > 0 && msync(file->content, (usize)old_len, MS_SYNC) != 0) {
-        free(owned_append_data);
-        close(fd);
+    memmove(file->content + file->len, data, (usize)len);
+    file->len = new_len;
+    return 0;
+}
+
+i32 shy_len(ShyFile *file) {
+    if (file == NULL) {
+        errno = EINVAL;
         return -1;
     }
 
-    if (ftruncate(fd, (off_t)new_len) != 0) {
-        free(owned_append_data);
-        close(fd);
-        return -1;
+    return file->len;
+}
+
+u8 *shy_map_private(const char *filename, usize size, i32 *image_len) {
+    if (size == 0 || image_len == NULL) {
+        errno = EINVAL;
+        return NULL;
     }
+    *image_len = 0;
 
-    void *mapped = mmap(NULL, (usize)new_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (mapped == MAP_FAILED) {
-        ftruncate(fd, (off_t)old_len);
-        free(owned_append_data);
+        return NULL;
+    }
+    if (filename == NULL) {
+        return mapped;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        munmap(mapped, size);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
         close(fd);
-        return -1;
+        munmap(mapped, size);
+        return NULL;
+    }
+    if (st.st_size < 0 || st.st_size > INT_MAX || (usize)st.st_size > size) {
+        close(fd);
+        munmap(mapped, size);
+        errno = EFBIG;
+        return NULL;
     }
 
-    if (file->content != NULL && old_len > 0) {
-        if (munmap(file->content, (usize)old_len) != 0) {
-            munmap(mapped, (usize)new_len);
-            ftruncate(fd, (off_t)old_len);
-            free(owned_append_data);
+    // 文件以写时复制方式覆盖在匿名映射的开头：读直接命中 page cache，
+    // 写只复制被改动的页，不会写回文件。最后一页超出文件的部分内核会补零。
+    if (st.st_size > 0) {
+        void *image = mmap(mapped, (usize)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (image == MAP_FAILED) {
             close(fd);
-            return -1;
+            munmap(mapped, size);
+            return NULL;
         }
     }
 
     close(fd);
-
-    file->content = mapped;
-    file->len = new_len;
-    memcpy(file->content + old_len, append_data, (usize)len);
-    free(owned_append_data);
-    return 0;
+    *image_len = (i32)st.st_size;
+    return mapped;
 }
 
-i32 shy_len(ShyFile *file) {
-    if (file == NULL) {
+i32 shy_unmap(u8 *mapping, usize size) {
+    if (mapping == NULL) {
         errno = EINVAL;
         return -1;
     }
 
-    return file->len;
+    return munmap(mapping, size) == 0 ? 0 : -1;
 }
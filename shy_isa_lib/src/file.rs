@@ -11,19 +11,28 @@ pub mod shyfile {
     #[repr(C)]
     struct RawFile {
         len: i32,
+        cap: i32,
         filename: [c_char; SHY_FILE_NAME_MAX],
         content: *mut u8,
     }
 
     unsafe extern "C" {
         fn shy_open(filename: *const c_char) -> *mut RawFile;
+        fn shy_create(filename: *const c_char) -> *mut RawFile;
         fn shy_close(file: *mut RawFile) -> i32;
         fn shy_flush(file: *mut RawFile) -> i32;
         fn shy_rename(file: *mut RawFile, new_name: *const c_char) -> i32;
         fn shy_push_back(file: *mut RawFile, byte: u8) -> i32;
         fn shy_push_back_slice(file: *mut RawFile, data: *const u8, len: i32) -> i32;
+        fn shy_reserve(file: *mut RawFile, additional: i32) -> i32;
+        fn shy_map_private(filename: *const c_char, size: usize, image_len: *mut i32) -> *mut u8;
+        fn shy_unmap(mapping: *mut u8, size: usize) -> i32;
     }
 
+    /// mmap 出来的整个文件，只能在末尾追加。
+    ///
+    /// 追加时文件按倍数预留空间，`flush` / `close` / drop 时截回实际长度。
+    /// 默认不等待落盘，需要持久化时显式调用 `flush`。
     pub struct File {
         ptr: NonNull<RawFile>,
     }
@@ -31,7 +40,16 @@ pub mod shyfile {
     impl File {
         pub fn open(filename: &str) -> io::Result<Self> {
             let filename = c_string(filename)?;
-            let ptr = unsafe { shy_open(filename.as_ptr()) };
+            Self::from_raw(unsafe { shy_open(filename.as_ptr()) })
+        }
+
+        /// 创建输出文件。已有文件先被删除，正在映射它的进程仍看到旧内容。
+        pub fn create(filename: &str) -> io::Result<Self> {
+            let filename = c_string(filename)?;
+            Self::from_raw(unsafe { shy_create(filename.as_ptr()) })
+        }
+
+        fn from_raw(ptr: *mut RawFile) -> io::Result<Self> {
             NonNull::new(ptr)
                 .map(|ptr| Self { ptr })
                 .ok_or_else(io::Error::last_os_error)
@@ -63,10 +81,18 @@ pub mod shyfile {
             unsafe { std::slice::from_raw_parts_mut(self.ptr.as_ref().content, len) }
         }
 
-        pub fn flush(&self) -> io::Result<()> {
+        /// 截掉预留空间并 `msync(MS_SYNC)`，返回时内容已经落盘。
+        pub fn flush(&mut self) -> io::Result<()> {
             check(unsafe { shy_flush(self.ptr.as_ptr()) })
         }
 
+        /// 关闭文件并截回实际长度，和 drop 一样不等待落盘，但会报告错误。
+        pub fn close(self) -> io::Result<()> {
+            let ptr = self.ptr.as_ptr();
+            std::mem::forget(self);
+            check(unsafe { shy_close(ptr) })
+        }
+
         pub fn rename(&mut self, name: &str) -> io::Result<()> {
             let name = c_string(name)?;
             check(unsafe { shy_rename(self.ptr.as_ptr(), name.as_ptr()) })
@@ -82,6 +108,31 @@ pub mod shyfile {
             })?;
             check(unsafe { shy_push_back_slice(self.ptr.as_ptr(), bytes.as_ptr(), len) })
         }
+
+        /// 预留至少 `additional` 字节，已知输出大小时可以省掉中间的扩容。
+        pub fn reserve(&mut self, additional: usize) -> io::Result<()> {
+            let additional = i32::try_from(additional).map_err(|_| {
+                io::Error::new(io::ErrorKind::InvalidInput, "reserve size exceeds i32::MAX")
+            })?;
+            check(unsafe { shy_reserve(self.ptr.as_ptr(), additional) })
+        }
+    }
+
+    /// 让 `write!` 之类的格式化输出直接写进映射。`io::Write::flush`
+    /// 不做任何事：写入的内容已经在 page cache 里，持久化请用 `File::flush`。
+    impl io::Write for File {
+        fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+            self.push_back_slice(buf)?;
+            Ok(buf.len())
+        }
+
+        fn write_all(&mut self, buf: &[u8]) -> io::Result<()> {
+            self.push_back_slice(buf)
+        }
+
+        fn flush(&mut self) -> io::Result<()> {
+            Ok(())
+        }
     }
 
     impl Drop for File {
@@ -90,6 +141,65 @@ pub mod shyfile {
         }
     }
 
+    /// 一块 `size` 字节的私有可写内存，开头可以是以写时复制方式映射的文件。
+    ///
+    /// 读取直接命中 page cache，写入只复制被改动的页，不会写回文件。
+    pub struct PrivateMap {
+        ptr: NonNull<u8>,
+        size: usize,
+        image_len: usize,
+    }
+
+    impl PrivateMap {
+        /// 分配 `size` 字节的零内存。
+        pub fn zeroed(size: usize) -> io::Result<Self> {
+            Self::map_raw(std::ptr::null(), size)
+        }
+
+        /// 把 `filename` 映射到 `size` 字节私有内存的开头，文件比 `size` 大时报错。
+        pub fn with_file(filename: &str, size: usize) -> io::Result<Self> {
+            let filename = c_string(filename)?;
+            Self::map_raw(filename.as_ptr(), size)
+        }
+
+        fn map_raw(filename: *const c_char, size: usize) -> io::Result<Self> {
+            let mut image_len = 0;
+            let ptr = unsafe { shy_map_private(filename, size, &mut image_len) };
+            NonNull::new(ptr)
+                .map(|ptr| Self {
+                    ptr,
+                    size,
+                    image_len: image_len as usize,
+                })
+                .ok_or_else(io::Error::last_os_error)
+        }
+
+        /// 映射进来的文件长度。
+        pub fn image_len(&self) -> usize {
+            self.image_len
+        }
+    }
+
+    impl std::ops::Deref for PrivateMap {
+        type Target = [u8];
+
+        fn deref(&self) -> &[u8] {
+            unsafe { std::slice::from_raw_parts(self.ptr.as_ptr(), self.size) }
+        }
+    }
+
+    impl std::ops::DerefMut for PrivateMap {
+        fn deref_mut(&mut self) -> &mut [u8] {
+            unsafe { std::slice::from_raw_parts_mut(self.ptr.as_ptr(), self.size) }
+        }
+    }
+
+    impl Drop for PrivateMap {
+        fn drop(&mut self) {
+            let _ = unsafe { shy_unmap(self.ptr.as_ptr(), self.size) };
+        }
+    }
+
     fn c_string(value: &str) -> io::Result<CString> {
         CString::new(value).map_err(|_| {
             io::Error::new(
@@ -106,4 +216,90 @@ pub mod shyfile {
             Err(io::Error::last_os_error())
         }
     }
+
+    #[cfg(test)]
+    mod tests {
+        use super::{File, PrivateMap};
+        use std::io::Write;
+
+        fn temp_path(name: &str) -> String {
+            std::fs::create_dir_all("target").unwrap();
+            format!("target/test-{}-{}.bin", std::process::id(), name)
+        }
+
+        #[test]
+        fn byte_appends_grow_by_doubling_and_close_trims_capacity() {
+            let path = temp_path("byte_appends");
+            let mut f = File::create(&path).unwrap();
+            for i in 0..10_000u32 {
+                f.push_back(i as u8).unwrap();
+            }
+            // 追加的切片指向自己的映射时，扩容前要先复制出来。
+            let head = f.as_slice()[..5000].to_vec();
+            let (ptr, len) = (f.as_slice().as_ptr(), 5000);
+            f.push_back_slice(unsafe { std::slice::from_raw_parts(ptr, len) }).unwrap();
+            assert_eq!(f.len(), 15_000);
+            f.close().unwrap();
+
+            let bytes = std::fs::read(&path).unwrap();
+            let _ = std::fs::remove_file(&path);
+            assert_eq!(bytes.len(), 15_000);
+            assert!(bytes[..10_000].iter().enumerate().all(|(i, &b)| b == i as u8));
+            assert_eq!(&bytes[10_000..], &head[..]);
+        }
+
+        #[test]
+        fn create_truncates_and_flush_is_exact() {
+            let path = temp_path("create_flush");
+            std::fs::write(&path, vec![0xAA; 100_000]).unwrap();
+            let mut f = File::create(&path).unwrap();
+            assert!(f.is_empty());
+            f.reserve(64).unwrap();
+            write!(f, "hello {}", 42).unwrap();
+            f.flush().unwrap();
+            assert_eq!(std::fs::read(&path).unwrap(), b"hello 42");
+
+            // flush 之后还能继续追加。
+            f.write_all(b"!").unwrap();
+            drop(f);
+            let bytes = std::fs::read(&path).unwrap();
+            let _ = std::fs::remove_file(&path);
+            assert_eq!(bytes, b"hello 42!");
+        }
+
+        #[test]
+        fn private_map_is_copy_on_write() {
+            let path = temp_path("private_map");
+            std::fs::write(&path, [1, 2, 3, 4, 5]).unwrap();
+            let mut mem = PrivateMap::with_file(&path, 3 * 4096).unwrap();
+            assert_eq!(mem.image_len(), 5);
+            assert_eq!(mem.len(), 3 * 4096);
+            assert_eq!(&mem[..6], &[1, 2, 3, 4, 5, 0]);
+            assert!(mem[4096..].iter().all(|&b| b == 0));
+
+            mem[0] = 9;
+            mem[3 * 4096 - 1] = 7;
+            assert_eq!((mem[0], mem[3 * 4096 - 1]), (9, 7));
+            drop(mem);
+            assert_eq!(std::fs::read(&path).unwrap(), [1, 2, 3, 4, 5]);
+
+            assert!(PrivateMap::with_file(&path, 4).is_err());
+            let _ = std::fs::remove_file(&path);
+            assert!(PrivateMap::zeroed(4096).unwrap().iter().all(|&b| b == 0));
+        }
+
+        #[test]
+        fn create_leaves_running_mappings_alone() {
+            let path = temp_path("create_mapped");
+            std::fs::write(&path, vec![1; 8192]).unwrap();
+            let mem = PrivateMap::with_file(&path, 4 * 4096).unwrap();
+
+            let mut f = File::create(&path).unwrap();
+            f.push_back_slice(&[2; 100]).unwrap();
+            f.close().unwrap();
+            assert!(mem[..8192].iter().all(|&b| b == 1));
+            assert_eq!(mem.image_len(), 8192);
+            let _ = std::fs::remove_file(&path);
+        }
+    }
 }
@@ -0,0 +1,424 @@
+//! 编译缓存，思路与 ccache 相同。
+//!
+//! 编译结果以 hash(预处理后的源码, 输入路径, 编译选项, 工具版本) 为 key 保存在缓存
+//! 目录中：`<key>.shy` 是 chibicc 的输出，`<key>.sobj` 是汇编结果。
+//!
+//! 预处理本身也要启动一次 chibicc，所以每个输入另有一份 manifest，key 是
+//! hash(源文件内容, 输入路径, 工作目录, 编译选项, 工具版本)，内容是上次预处理时读到的
+//! 所有文件及其内容 hash。这些文件都没变时直接命中，不启动任何子进程。
+//!
+//! 缓存目录默认是 `target/shycc-cache`，可以用 `SHYCC_CACHE_DIR` 指定，
+//! `SHYCC_CACHE=0` 关闭缓存。写缓存失败不影响编译。
+//!
+//! `shycc --server` 常驻时调用 [`keep_warm`]，依赖文件的 hash 和读到的编译结果留在
+//! 内存里：依赖文件的长度和修改时间都没变时不再重新读取、hash。
+
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Mutex, OnceLock};
+use std::time::{Duration, SystemTime};
+
+use anyhow::{Context, Result};
+
+static TMP_COUNTER: AtomicUsize = AtomicUsize::new(0);
+
+/// 128 位 FNV-1a。每个字段先写长度，避免不同字段拼接后产生相同的输入。
+#[derive(Clone, Copy)]
+struct Hasher(u128);
+
+impl Hasher {
+    const OFFSET: u128 = 0x6c62272e07bb014262b821756295c58d;
+    const PRIME: u128 = 0x0000000001000000000000000000013b;
+
+    fn new() -> Self {
+        Self(Self::OFFSET)
+    }
+
+    fn bytes(&mut self, data: &[u8]) {
+        for &b in data {
+            self.0 ^= u128::from(b);
+            self.0 = self.0.wrapping_mul(Self::PRIME);
+        }
+    }
+
+    fn field(&mut self, data: &[u8]) -> &mut Self {
+        self.bytes(&(data.len() as u64).to_le_bytes());
+        self.bytes(data);
+        self
+    }
+
+    fn hex(&self) -> String {
+        format!("{:032x}", self.0)
+    }
+}
+
+/// 数据内容的 128 位 hash，十六进制表示。
+pub fn hash_hex(data: &[u8]) -> String {
+    let mut h = Hasher::new();
+    h.field(data);
+    h.hex()
+}
+
+/// 一组可执行文件的版本标识，见 [`tool_identity`]。
+pub fn tool_hash(tools: &[PathBuf]) -> String {
+    let mut h = Hasher::new();
+    for tool in tools {
+        tool_identity(&mut h, tool);
+    }
+    h.hex()
+}
+
+/// 常驻进程保留在内存里的缓存状态。
+#[derive(Default)]
+struct Warm {
+    /// 文件路径 -> (长度, 修改时间, 内容 hash)。
+    files: HashMap<PathBuf, (u64, SystemTime, String)>,
+    /// 结果 key -> (.shy, .sobj)，和磁盘上的缓存文件一一对应。
+    entries: HashMap<String, (Option<Vec<u8>>, Vec<u8>)>,
+}
+
+static WARM: OnceLock<Mutex<Warm>> = OnceLock::new();
+
+/// 修改时间离现在太近的文件可能在同一个时间戳内再次被改写，不记住它的 hash。
+const RACY_WINDOW: Duration = Duration::from_secs(2);
+
+/// 让本进程之后的缓存查找都经过内存中的状态，供 `shycc --server` 使用。
+pub fn keep_warm() {
+    let _ = WARM.set(Mutex::new(Warm::default()));
+}
+
+/// 文件内容 hash。常驻时长度和修改时间都没变的文件直接用上次的结果。
+fn file_hash(path: &Path) -> Option<String> {
+    let Some(warm) = WARM.get() else {
+        return fs::read(path).ok().map(|data| hash_hex(&data));
+    };
+    // 依赖路径可能是相对路径，而服务端处理每个请求时的工作目录不同。
+    let path = &std::path::absolute(path).ok()?;
+    let meta = fs::metadata(path).ok()?;
+    let (len, mtime) = (meta.len(), meta.modified().ok()?);
+    if let Some((l, m, hash)) = warm.lock().unwrap().files.get(path) {
+        if (*l, *m) == (len, mtime) {
+            return Some(hash.clone());
+        }
+    }
+    let hash = hash_hex(&fs::read(path).ok()?);
+    if mtime.elapsed().is_ok_and(|age| age >= RACY_WINDOW) {
+        let entry = (len, mtime, hash.clone());
+        warm.lock().unwrap().files.insert(path.to_path_buf(), entry);
+    }
+    Some(hash)
+}
+
+/// 缓存统计，按 `stats` 文件累计。
+#[derive(Default)]
+struct Stats {
+    direct_hits: AtomicUsize,
+    preprocessed_hits: AtomicUsize,
+    misses: AtomicUsize,
+}
+
+const STAT_NAMES: [&str; 3] = ["direct_hits", "preprocessed_hits", "misses"];
+
+impl Stats {
+    fn counters(&self) -> [&AtomicUsize; 3] {
+        [&self.direct_hits, &self.preprocessed_hits, &self.misses]
+    }
+}
+
+/// 一次命中或新编译得到的结果。
+pub struct Entry {
+    /// 只有调用方要求时才读取 `.shy`。
+    pub shy: Option<Vec<u8>>,
+    pub sobj: Vec<u8>,
+}
+
+pub struct Cache {
+    dir: PathBuf,
+    /// 已经写入工具版本和编译选项的 hash 状态。
+    base: Hasher,
+    stats: Stats,
+}
+
+/// 缓存目录：`SHYCC_CACHE_DIR`，否则 `<repo>/target/shycc-cache`。
+pub fn cache_dir(repo: &Path) -> PathBuf {
+    match env::var_os("SHYCC_CACHE_DIR") {
+        Some(dir) if !dir.is_empty() => PathBuf::from(dir),
+        _ => repo.join("target/shycc-cache"),
+    }
+}
+
+/// 工具版本用可执行文件的大小和修改时间表示，重新构建工具后旧结果自然失效。
+fn tool_identity(h: &mut Hasher, path: &Path) {
+    h.field(path.as_os_str().as_encoded_bytes());
+    if let Ok(meta) = fs::metadata(path) {
+        h.field(&meta.len().to_le_bytes());
+        if let Ok(mtime) = meta.modified() {
+            let nanos = mtime
+                .duration_since(std::time::UNIX_EPOCH)
+                .map(|d| d.as_nanos())
+                .unwrap_or(0);
+            h.field(&nanos.to_le_bytes());
+        }
+    }
+}
+
+impl Cache {
+    /// `tools` 是参与编译的可执行文件，`flags` 是传给 chibicc 的选项。
+    /// 关闭缓存或缓存目录不可用时返回 `None`。
+    pub fn open(repo: &Path, tools: &[PathBuf], flags: &[String]) -> Option<Self> {
+        if env::var_os("SHYCC_CACHE").is_some_and(|v| v == "0") {
+            return None;
+        }
+        let dir = cache_dir(repo);
+        fs::create_dir_all(&dir).ok()?;
+
+        let mut base = Hasher::new();
+        base.field(b"shycc-cache-v1");
+        for tool in tools {
+            tool_identity(&mut base, tool);
+        }
+        for flag in flags {
+            base.field(flag.as_bytes());
+            // profile 文件的内容也影响生成的代码。
+            if let Some(path) = flag.strip_prefix("-fprofile-use=") {
+                base.field(&fs::read(path).ok()?);
+            }
+        }
+        Some(Self {
+            dir,
+            base,
+            stats: Stats::default(),
+        })
+    }
+
+    fn path(&self, key: &str, ext: &str) -> PathBuf {
+        self.dir.join(format!("{key}{ext}"))
+    }
+
+    /// 先写临时文件再 rename，并发的 shycc 进程不会读到写了一半的结果。
+    fn store(&self, key: &str, ext: &str, data: &[u8]) -> io::Result<()> {
+        let idx = TMP_COUNTER.fetch_add(1, Ordering::Relaxed);
+        let tmp = self.path(&format!("tmp-{}-{idx}", std::process::id()), ext);
+        fs::write(&tmp, data)?;
+        fs::rename(&tmp, self.path(key, ext))
+    }
+
+    fn load(&self, key: &str, need_shy: bool) -> Option<Entry> {
+        if let Some(warm) = WARM.get() {
+            if let Some((shy, sobj)) = warm.lock().unwrap().entries.get(key) {
+                if shy.is_some() || !need_shy {
+                    let shy = if need_shy { shy.clone() } else { None };
+                    return Some(Entry {
+                        shy,
+                        sobj: sobj.clone(),
+                    });
+                }
+            }
+        }
+        let sobj = fs::read(self.path(key, ".sobj")).ok()?;
+        let shy = if need_shy {
+            Some(fs::read(self.path(key, ".shy")).ok()?)
+        } else {
+            None
+        };
+        remember(key, shy.as_deref(), &sobj);
+        Some(Entry { shy, sobj })
+    }
+
+    /// 读取 manifest：所有依赖文件的内容都没变时返回结果 key。
+    fn check_manifest(&self, direct: &str) -> Option<String> {
+        let text = fs::read_to_string(self.path(direct, ".manifest")).ok()?;
+        let mut lines = text.lines();
+        let result = lines.next()?.to_string();
+        for line in lines {
+            let (hash, path) = line.split_once(' ')?;
+            if file_hash(Path::new(path))? != hash {
+                return None;
+            }
+        }
+        Some(result)
+    }
+
+    fn write_manifest(&self, direct: &str, result: &str, deps: &[String]) -> io::Result<()> {
+        let mut text = format!("{result}\n");
+        for dep in deps {
+            let hash = file_hash(Path::new(dep))
+                .ok_or_else(|| io::Error::new(io::ErrorKind::NotFound, dep.clone()))?;
+            text.push_str(&format!("{hash} {dep}\n"));
+        }
+        self.store(direct, ".manifest", text.as_bytes())
+    }
+
+    /// 查找 `input` 的编译结果，没有时调用 `compile` 并写入缓存。
+    ///
+    /// `preprocess` 收到一个依赖文件路径，应运行 `chibicc -E -MD -MF <path>` 并返回
+    /// 预处理结果；`compile` 返回 `(.shy, .sobj)`。
+    pub fn get_or_compile(
+        &self,
+        input: &str,
+        extra: &[&str],
+        need_shy: bool,
+        preprocess: impl FnOnce(&Path) -> Result<Vec<u8>>,
+        compile: impl FnOnce() -> Result<(Vec<u8>, Vec<u8>)>,
+    ) -> Result<Entry> {
+        let src = fs::read(input).with_context(|| format!("failed to read {input}"))?;
+        let mut direct = self.base;
+        direct.field(b"direct").field(input.as_bytes());
+        for e in extra {
+            direct.field(e.as_bytes());
+        }
+        if let Ok(cwd) = env::current_dir() {
+            direct.field(cwd.as_os_str().as_encoded_bytes());
+        }
+        let direct = direct.field(&src).hex();
+
+        if let Some(entry) = self
+            .check_manifest(&direct)
+            .and_then(|key| self.load(&key, need_shy))
+        {
+            self.stats.direct_hits.fetch_add(1, Ordering::Relaxed);
+            return Ok(entry);
+        }
+
+        let idx = TMP_COUNTER.fetch_add(1, Ordering::Relaxed);
+        let dep_file = self.path(&format!("tmp-{}-{idx}", std::process::id()), ".d");
+        let pre = preprocess(&dep_file);
+        let deps = fs::read_to_string(&dep_file).unwrap_or_default();
+        let _ = fs::remove_file(&dep_file);
+        let pre = pre?;
+
+        let mut key = self.base;
+        key.field(b"preprocessed").field(input.as_bytes());
+        for e in extra {
+            key.field(e.as_bytes());
+        }
+        let key = key.field(&pre).hex();
+
+        let entry = match self.load(&key, need_shy) {
+            Some(entry) => {
+                self.stats.preprocessed_hits.fetch_add(1, Ordering::Relaxed);
+                entry
+            }
+            None => {
+                let (shy, sobj) = compile()?;
+                self.stats.misses.fetch_add(1, Ordering::Relaxed);
+                let _ = self
+                    .store(&key, ".shy", &shy)
+                    .and_then(|()| self.store(&key, ".sobj", &sobj));
+                remember(&key, Some(&shy), &sobj);
+                Entry {
+                    shy: need_shy.then_some(shy),
+                    sobj,
+                }
+            }
+        };
+        let _ = self.write_manifest(&direct, &key, &parse_deps(&deps));
+        Ok(entry)
+    }
+
+    /// 把本次的命中统计累加到缓存目录的 `stats` 文件。
+    pub fn save_stats(&self) {
+        let path = self.dir.join("stats");
+        let mut totals = read_stats(&path);
+        for (total, counter) in totals.iter_mut().zip(self.stats.counters()) {
+            *total += counter.load(Ordering::Relaxed);
+        }
+        let _ = self.store("stats", "", format_stats(&totals).as_bytes());
+    }
+}
+
+/// 常驻时记住一份编译结果。
+fn remember(key: &str, shy: Option<&[u8]>, sobj: &[u8]) {
+    if let Some(warm) = WARM.get() {
+        let mut warm = warm.lock().unwrap();
+        let slot = warm.entries.entry(key.to_string()).or_default();
+        if let Some(shy) = shy {
+            slot.0 = Some(shy.to_vec());
+        }
+        slot.1 = sobj.to_vec();
+    }
+}
+
+/// 解析 `chibicc -MD` 生成的依赖文件：`target: \ dep1 \ dep2 ...`。
+fn parse_deps(text: &str) -> Vec<String> {
+    text.split_whitespace()
+        .skip(1)
+        .filter(|w| *w != "\\")
+        .map(str::to_string)
+        .collect()
+}
+
+fn read_stats(path: &Path) -> [usize; 3] {
+    let mut totals = [0; 3];
+    let text = fs::read_to_string(path).unwrap_or_default();
+    for line in text.lines() {
+        let Some((name, value)) = line.split_once(' ') else {
+            continue;
+        };
+        if let Some(i) = STAT_NAMES.iter().position(|n| *n == name) {
+            totals[i] = value.trim().parse().unwrap_or(0);
+        }
+    }
+    totals
+}
+
+fn format_stats(totals: &[usize; 3]) -> String {
+    STAT_NAMES
+        .iter()
+        .zip(totals)
+        .map(|(name, n)| format!("{name} {n}\n"))
+        .collect()
+}
+
+/// `shycc --cache-stats` 的输出。
+pub fn print_stats(repo: &Path) {
+    let dir = cache_dir(repo);
+    let [direct, pre, misses] = read_stats(&dir.join("stats"));
+    let total = direct + pre + misses;
+    let rate = if total == 0 {
+        0.0
+    } else {
+        (direct + pre) as f64 * 100.0 / total as f64
+    };
+    eprintln!("cache directory    {}", dir.display());
+    eprintln!("direct hits        {direct}");
+    eprintln!("preprocessed hits  {pre}");
+    eprintln!("misses             {misses}");
+    eprintln!("hit rate           {rate:.1}%");
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_dependency_file() {
+        let text = "main.o: \\\n  main.c \\\n  /repo/libshy/include/shy.h\n\n";
+        assert_eq!(parse_deps(text), vec!["main.c", "/repo/libshy/include/shy.h"]);
+    }
+
+    #[test]
+    fn hash_separates_fields() {
+        let mut a = Hasher::new();
+        a.field(b"ab").field(b"c");
+        let mut b = Hasher::new();
+        b.field(b"a").field(b"bc");
+        assert_ne!(a.hex(), b.hex());
+        assert_eq!(hash_hex(b"x"), hash_hex(b"x"));
+    }
+
+    #[test]
+    fn stats_roundtrip() {
+        let text = format_stats(&[3, 1, 2]);
+        let dir = env::temp_dir().join(format!("shycc-cache-test-{}", std::process::id()));
+        fs::create_dir_all(&dir).unwrap();
+        let path = dir.join("stats");
+        fs::write(&path, text).unwrap();
+        assert_eq!(read_stats(&path), [3, 1, 2]);
+        let _ = fs::remove_dir_all(&dir);
+    }
+}
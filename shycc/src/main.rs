@@ -1,12 +1,17 @@
+mod cache;
+mod server;
+
 use std::env;
 use std::fs;
 use std::path::{Path, PathBuf};
-use std::process::{Command, ExitStatus};
-use std::sync::atomic::{AtomicUsize, Ordering};
+use std::process::{Command, ExitStatus, Stdio};
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::thread;
 
 use anyhow::{bail, Context, Result};
 
-static TMP_COUNTER: AtomicUsize = AtomicUsize::new(0);
+use crate::cache::Cache;
 
 #[derive(Debug, Clone, Copy, PartialEq, Eq)]
 enum Stage {
@@ -23,65 +28,85 @@ enum InputKind {
     Obj,
 }
 
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum OptLevel {
+    O0,
+    O1,
+    O2,
+    Size,
+}
+
+impl OptLevel {
+    fn parse(arg: &str) -> Result<Self> {
+        match &arg[2..] {
+            "0" => Ok(Self::O0),
+            "" | "1" | "g" => Ok(Self::O1),
+            "2" | "3" | "fast" => Ok(Self::O2),
+            "s" | "z" => Ok(Self::Size),
+            _ => bail!("unknown optimization level: {arg}"),
+        }
+    }
+
+    fn flag(self) -> &'static str {
+        match self {
+            Self::O0 => "-O0",
+            Self::O1 => "-O1",
+            Self::O2 => "-O2",
+            Self::Size => "-Os",
+        }
+    }
+}
+
 #[derive(Debug)]
 struct Options {
     stage: Stage,
+    opt_level: Option<OptLevel>,
     output: Option<PathBuf>,
     sym: Option<PathBuf>,
     save_temps: bool,
     print_only: bool,
+    jobs: usize,
     compile_args: Vec<String>,
+    link_args: Vec<String>,
     inputs: Vec<String>,
     libs: Vec<String>,
 }
 
-#[derive(Debug)]
-struct TempFiles {
-    keep: bool,
-    paths: Vec<PathBuf>,
-}
-
-impl TempFiles {
-    fn new(keep: bool) -> Self {
-        Self {
-            keep,
-            paths: Vec::new(),
+fn main() -> Result<()> {
+    let args: Vec<String> = env::args().skip(1).collect();
+    if args.first().is_some_and(|arg| arg == "--server") {
+        if args.len() > 1 {
+            bail!("`--server` takes no other arguments");
         }
+        return server::serve(&repo_root());
     }
-
-    fn temp_path(&mut self, ext: &str) -> PathBuf {
-        let idx = TMP_COUNTER.fetch_add(1, Ordering::SeqCst);
-        let pid = std::process::id();
-        let path = env::temp_dir().join(format!("shycc-{pid}-{idx}{ext}"));
-        self.paths.push(path.clone());
-        path
+    // 有常驻的 `shycc --server` 时把这次调用交给它。
+    if let Some(code) = server::forward(&repo_root(), &args) {
+        std::process::exit(code);
     }
+    run_args(args)
 }
 
-impl Drop for TempFiles {
-    fn drop(&mut self) {
-        if self.keep {
-            return;
-        }
-        for path in &self.paths {
-            let _ = fs::remove_file(path);
-        }
+/// 解析参数并执行一次调用；`shycc --server` 也用它处理客户端转发的调用。
+fn run_args(args: Vec<String>) -> Result<()> {
+    match parse_args(args)? {
+        Some(opts) => run(opts),
+        None => Ok(()),
     }
 }
 
-fn main() -> Result<()> {
-    let opts = parse_args(env::args().skip(1).collect())?;
-    run(opts)
-}
-
-fn parse_args(args: Vec<String>) -> Result<Options> {
+/// 解析命令行。`--help`、`--cache-stats` 这类处理完就结束的选项返回 `None`。
+fn parse_args(args: Vec<String>) -> Result<Option<Options>> {
     let mut opts = Options {
         stage: Stage::Link,
+        opt_level: None,
         output: None,
         sym: None,
         save_temps: false,
         print_only: false,
+        jobs: 1,
         compile_args: Vec::new(),
+        link_args: Vec::new(),
         inputs: Vec::new(),
         libs: Vec::new(),
     };
@@ -92,7 +117,11 @@ fn parse_args(args: Vec<String>) -> Result<Options> {
         match arg.as_str() {
             "--help" => {
                 print_usage();
-                std::process::exit(0);
+                return Ok(None);
+            }
+            "--cache-stats" => {
+                cache::print_stats(&repo_root());
+                return Ok(None);
             }
             "-###" => opts.print_only = true,
             "-save-temps" | "--save-temps" => opts.save_temps = true,
@@ -106,6 +135,13 @@ fn parse_args(args: Vec<String>) -> Result<Options> {
                 };
                 opts.output = Some(PathBuf::from(v));
             }
+            "-j" => {
+                i += 1;
+                let Some(v) = args.get(i) else {
+                    bail!("option `-j` requires an argument");
+                };
+                opts.jobs = parse_jobs(v)?;
+            }
             "--sym" => {
                 i += 1;
                 let Some(v) = args.get(i) else {
@@ -124,6 +160,8 @@ fn parse_args(args: Vec<String>) -> Result<Options> {
                         bail!("linker option `--sym` requires an argument");
                     };
                     opts.sym = Some(PathBuf::from(sym));
+                } else if is_linker_flag(v) {
+                    opts.link_args.push(v.clone());
                 } else {
                     bail!("unsupported linker option for Shy linker: {v}");
                 }
@@ -136,6 +174,14 @@ fn parse_args(args: Vec<String>) -> Result<Options> {
                 };
                 opts.compile_args.push(v.clone());
             }
+            _ if arg.starts_with("-O") => opts.opt_level = Some(OptLevel::parse(arg)?),
+            _ if arg.starts_with("-fprofile-use=") => {
+                if arg.len() == "-fprofile-use=".len() {
+                    bail!("option `-fprofile-use=` requires a profile file");
+                }
+                opts.compile_args.push(arg.clone())
+            }
+            _ if arg.starts_with("-j") && arg.len() > 2 => opts.jobs = parse_jobs(&arg[2..])?,
             _ if arg.starts_with("-o") && arg.len() > 2 => {
                 opts.output = Some(PathBuf::from(&arg[2..]));
             }
@@ -148,12 +194,16 @@ fn parse_args(args: Vec<String>) -> Result<Options> {
                         opts.sym = Some(PathBuf::from(value));
                     } else if item == "--sym" {
                         bail!("use `--sym <file>` or `-Wl,--sym=<file>`");
+                    } else if is_linker_flag(item) {
+                        opts.link_args.push(item.to_string());
                     } else {
                         bail!("unsupported linker option for Shy linker: {item}");
                     }
                 }
             }
-            "--shy-emit-source-lines" => opts.compile_args.push(arg.clone()),
+            "--shy-emit-source-lines" | "--shy-peephole-stats" => {
+                opts.compile_args.push(arg.clone())
+            }
             _ if is_compile_option(arg) => opts.compile_args.push(arg.clone()),
             _ if arg.starts_with('-') => bail!("unknown option: {arg}"),
             _ => opts.inputs.push(arg.clone()),
@@ -173,18 +223,43 @@ fn parse_args(args: Vec<String>) -> Result<Options> {
         bail!("cannot specify `-o` with `-E`, `-S` or `-c` and multiple input files");
     }
 
+    if opts.stage != Stage::Link && !opts.link_args.is_empty() {
+        bail!("linker options are only valid when linking");
+    }
+
     if opts.stage != Stage::Link && !opts.libs.is_empty() {
         bail!("`-l...` libraries are only valid when linking");
     }
 
-    Ok(opts)
+    Ok(Some(opts))
+}
+
+fn parse_jobs(value: &str) -> Result<usize> {
+    match value.parse::<usize>() {
+        Ok(n) if n > 0 => Ok(n),
+        _ => bail!("invalid job count for `-j`: {value}"),
+    }
+}
+
+fn is_linker_flag(arg: &str) -> bool {
+    matches!(
+        arg,
+        "--gc-sections"
+            | "--print-gc-sections"
+            | "--icf"
+            | "--print-icf-sections"
+            | "--print-layout"
+            | "--stats"
+            | "--incremental"
+    ) || ["--symbol-ordering-file=", "--call-graph-profile="]
+        .iter()
+        .any(|p| arg.len() > p.len() && arg.starts_with(p))
 }
 
 fn is_compile_option(arg: &str) -> bool {
     arg.starts_with("-I")
         || arg.starts_with("-D")
         || arg.starts_with("-U")
-        || arg.starts_with("-O")
         || arg.starts_with("-W")
         || arg.starts_with("-g")
         || arg.starts_with("-std=")
@@ -204,9 +279,25 @@ fn is_compile_option(arg: &str) -> bool {
         )
 }
 
+/// 一个编译任务：把 C 或汇编输入编译、汇编成内存中的 `.sobj` 字节。
+struct Job {
+    input: String,
+    kind: InputKind,
+    link_runtime: bool,
+    /// chibicc 输出的 `.shy` 写到哪里；`None` 表示直接从 chibicc 的 stdout 读取。
+    asm: Option<PathBuf>,
+    /// 需要落盘的 `.sobj` 路径（`-c` 或 `-save-temps`）。
+    obj: Option<PathBuf>,
+}
+
+/// 链接输入：命令行给出的 `.sobj` 文件，或者某个编译任务的结果。
+enum LinkInput {
+    File(String),
+    Job(usize),
+}
+
 fn run(opts: Options) -> Result<()> {
     let repo = repo_root();
-    let mut temps = TempFiles::new(opts.save_temps || opts.print_only);
 
     if opts.stage == Stage::Preprocess {
         for input in &opts.inputs {
@@ -217,96 +308,274 @@ fn run(opts: Options) -> Result<()> {
         return Ok(());
     }
 
-    let mut objects = Vec::new();
+    let mut jobs = Vec::new();
+    let mut link_inputs = Vec::new();
     for input in &opts.inputs {
-        match input_kind(input)? {
-            InputKind::C => {
-                let asm = if opts.stage == Stage::Asm {
-                    opts.output
-                        .clone()
-                        .unwrap_or_else(|| replace_ext(input, ".shy"))
-                } else if opts.save_temps {
-                    replace_ext(input, ".shy")
-                } else {
-                    temps.temp_path(".shy")
-                };
-                run_chibicc(&repo, &opts, input, Some(&asm), false, false)?;
-                if opts.stage == Stage::Asm {
-                    continue;
-                }
-
-                let obj = if opts.stage == Stage::Object {
-                    opts.output
-                        .clone()
-                        .unwrap_or_else(|| replace_ext(input, ".sobj"))
-                } else if opts.save_temps {
-                    replace_ext(input, ".sobj")
-                } else {
-                    temps.temp_path(".sobj")
-                };
-                run_asm(&repo, &opts, &asm, &obj)?;
-                objects.push(obj);
+        let kind = input_kind(input)?;
+        if kind == InputKind::Obj {
+            link_inputs.push(LinkInput::File(input.clone()));
+            continue;
+        }
+        if opts.stage == Stage::Asm && kind == InputKind::Asm {
+            let output = opts
+                .output
+                .clone()
+                .unwrap_or_else(|| replace_ext(input, ".shy"));
+            if Path::new(input) != output {
+                copy_file(input, &output)?;
             }
-            InputKind::Asm => {
-                if opts.stage == Stage::Asm {
-                    let output = opts
-                        .output
-                        .clone()
-                        .unwrap_or_else(|| replace_ext(input, ".shy"));
-                    if Path::new(input) != output {
-                        copy_file(input, &output)?;
-                    }
-                    continue;
-                }
+            continue;
+        }
 
-                let obj = if opts.stage == Stage::Object {
-                    opts.output
-                        .clone()
-                        .unwrap_or_else(|| replace_ext(input, ".sobj"))
-                } else if opts.save_temps {
-                    replace_ext(input, ".sobj")
-                } else {
-                    temps.temp_path(".sobj")
-                };
-                run_asm(&repo, &opts, Path::new(input), &obj)?;
-                objects.push(obj);
+        let asm = if kind == InputKind::Asm {
+            None
+        } else if opts.stage == Stage::Asm {
+            Some(
+                opts.output
+                    .clone()
+                    .unwrap_or_else(|| replace_ext(input, ".shy")),
+            )
+        } else if opts.save_temps {
+            Some(replace_ext(input, ".shy"))
+        } else {
+            None
+        };
+        let obj = if opts.stage == Stage::Object {
+            Some(
+                opts.output
+                    .clone()
+                    .unwrap_or_else(|| replace_ext(input, ".sobj")),
+            )
+        } else if opts.save_temps {
+            Some(replace_ext(input, ".sobj"))
+        } else {
+            None
+        };
+        link_inputs.push(LinkInput::Job(jobs.len()));
+        jobs.push(Job {
+            input: input.clone(),
+            kind,
+            link_runtime: false,
+            asm,
+            obj,
+        });
+    }
+
+    if opts.stage == Stage::Link {
+        for lib in &opts.libs {
+            if let Some(archive) = prebuilt_library(&repo, &opts, lib) {
+                link_inputs.push(LinkInput::File(archive));
+                continue;
             }
-            InputKind::Obj => objects.push(PathBuf::from(input)),
+            let job = match lib.as_str() {
+                "libshy" => libshy_job(&repo, &opts)?,
+                "float" => float_lib_job(&repo, &opts)?,
+                _ => bail!("unknown internal Shy library: -l{lib}"),
+            };
+            link_inputs.push(LinkInput::Job(jobs.len()));
+            jobs.push(job);
         }
     }
 
-    if opts.stage == Stage::Asm {
-        return Ok(());
-    }
+    let cache = if jobs.iter().any(|job| job.kind == InputKind::C) {
+        open_cache(&repo, &opts)?
+    } else {
+        None
+    };
 
-    if opts.stage == Stage::Object {
+    // 各个输入互不依赖，按 `-j` 并行编译；chibicc 仍是子进程，汇编在本进程内完成。
+    let objects = parallel_map(opts.jobs, &jobs, |job| {
+        compile(&repo, &opts, cache.as_ref(), job)
+    });
+    if let Some(cache) = &cache {
+        cache.save_stats();
+    }
+    let mut objects = objects?;
+    if opts.stage != Stage::Link || opts.print_only {
         return Ok(());
     }
 
-    for lib in &opts.libs {
-        match lib.as_str() {
-            "libshy" => objects.push(build_libshy(&repo, &opts, &mut temps)?),
-            "float" => objects.push(build_float_lib(&repo, &opts, &mut temps)?),
-            _ => bail!("unknown internal Shy library: -l{lib}"),
-        }
-    }
+    let inputs = link_inputs
+        .into_iter()
+        .map(|input| match input {
+            LinkInput::File(path) => linker::Input::Path(path),
+            LinkInput::Job(index) => linker::Input::Memory {
+                name: jobs[index].input.clone(),
+                bytes: objects[index].take().unwrap_or_default(),
+            },
+        })
+        .collect();
 
     let output = opts
         .output
         .clone()
         .unwrap_or_else(|| PathBuf::from("a.sfs"));
-    run_linker(&repo, &opts, &objects, &output, opts.sym.as_deref())?;
-    Ok(())
+    let mut args = vec!["shyld".to_string(), "-o".to_string()];
+    args.push(output.to_string_lossy().into_owned());
+    args.extend(opts.link_args.iter().cloned());
+    if let Some(sym) = &opts.sym {
+        args.push("--sym".to_string());
+        args.push(sym.to_string_lossy().into_owned());
+    }
+    linker::run(&args, inputs)
 }
 
-fn run_chibicc(
+/// 编译缓存。只打印命令，或者带有会产生额外输出的调试、依赖选项时不使用缓存。
+fn open_cache(repo: &Path, opts: &Options) -> Result<Option<Cache>> {
+    let uncacheable = opts.compile_args.iter().any(|arg| {
+        arg.starts_with("-M") || arg == "--shy-emit-source-lines" || arg == "--shy-peephole-stats"
+    });
+    if opts.print_only || uncacheable {
+        return Ok(None);
+    }
+
+    let mut tools = vec![chibicc_path(repo, false)?];
+    tools.extend(env::current_exe().ok());
+    let mut flags = vec![format!("-I{}", repo.join("libshy/include").display())];
+    flags.extend(opts.opt_level.map(|level| level.flag().to_string()));
+    flags.extend(opts.compile_args.iter().cloned());
+    Ok(Cache::open(repo, &tools, &flags))
+}
+
+/// 编译一个输入并在进程内汇编。只做到 `-S` 或只打印命令时返回 `None`。
+fn compile(
+    repo: &Path,
+    opts: &Options,
+    cache: Option<&Cache>,
+    job: &Job,
+) -> Result<Option<Vec<u8>>> {
+    if let (InputKind::C, Some(cache)) = (job.kind, cache) {
+        return compile_cached(repo, opts, cache, job);
+    }
+
+    let src = match (job.kind, &job.asm) {
+        (InputKind::C, Some(asm)) => {
+            run_chibicc(repo, opts, &job.input, Some(asm), false, job.link_runtime)?;
+            if opts.stage == Stage::Asm || opts.print_only {
+                return Ok(None);
+            }
+            fs::read(asm).with_context(|| format!("failed to read {}", asm.display()))?
+        }
+        (InputKind::C, None) => {
+            let stdout = Some(Path::new("-"));
+            let mut cmd =
+                chibicc_command(repo, opts, &job.input, stdout, false, job.link_runtime)?;
+            let out = capture_command(opts, &mut cmd)?;
+            if opts.print_only {
+                return Ok(None);
+            }
+            out
+        }
+        _ if opts.print_only => return Ok(None),
+        _ => fs::read(&job.input).with_context(|| format!("failed to read {}", job.input))?,
+    };
+
+    let obj = assemble(&job.input, &src)?;
+    if let Some(path) = &job.obj {
+        fs::write(path, &obj).with_context(|| format!("failed to write {}", path.display()))?;
+    }
+    Ok(Some(obj))
+}
+
+fn assemble(input: &str, src: &[u8]) -> Result<Vec<u8>> {
+    asm::parser::Assembler::run(src)
+        .with_context(|| format!("failed to assemble {input}"))?
+        .finish()
+        .to_bytes()
+}
+
+/// 通过编译缓存编译一个 C 输入，`.shy`/`.sobj` 输出文件从缓存结果写出。
+fn compile_cached(
+    repo: &Path,
+    opts: &Options,
+    cache: &Cache,
+    job: &Job,
+) -> Result<Option<Vec<u8>>> {
+    let extra: &[&str] = if job.link_runtime {
+        &["--shy-link-runtime"]
+    } else {
+        &[]
+    };
+    let entry = cache.get_or_compile(
+        &job.input,
+        extra,
+        job.asm.is_some(),
+        |deps| {
+            let mut cmd = chibicc_command(repo, opts, &job.input, None, true, job.link_runtime)?;
+            cmd.arg("-MD").arg("-MF").arg(deps);
+            capture_command(opts, &mut cmd)
+        },
+        || {
+            let stdout = Some(Path::new("-"));
+            let mut cmd =
+                chibicc_command(repo, opts, &job.input, stdout, false, job.link_runtime)?;
+            let shy = capture_command(opts, &mut cmd)?;
+            let obj = assemble(&job.input, &shy)?;
+            Ok((shy, obj))
+        },
+    )?;
+
+    if let (Some(path), Some(shy)) = (&job.asm, &entry.shy) {
+        fs::write(path, shy).with_context(|| format!("failed to write {}", path.display()))?;
+    }
+    if opts.stage == Stage::Asm {
+        return Ok(None);
+    }
+    if let Some(path) = &job.obj {
+        fs::write(path, &entry.sobj)
+            .with_context(|| format!("failed to write {}", path.display()))?;
+    }
+    Ok(Some(entry.sobj))
+}
+
+/// 用最多 `jobs` 个线程对每个元素执行 `f`，结果按输入顺序返回。
+///
+/// 某个任务失败后不再开始新的任务，返回输入顺序中第一个错误。
+fn parallel_map<T: Send, U: Sync>(
+    jobs: usize,
+    items: &[U],
+    f: impl Fn(&U) -> Result<T> + Sync,
+) -> Result<Vec<T>> {
+    if jobs <= 1 || items.len() <= 1 {
+        return items.iter().map(f).collect();
+    }
+
+    let next = AtomicUsize::new(0);
+    let failed = AtomicBool::new(false);
+    let slots: Vec<Mutex<Option<Result<T>>>> = items.iter().map(|_| Mutex::new(None)).collect();
+    thread::scope(|s| {
+        for _ in 0..jobs.min(items.len()) {
+            s.spawn(|| {
+                while !failed.load(Ordering::Relaxed) {
+                    let index = next.fetch_add(1, Ordering::Relaxed);
+                    let Some(item) = items.get(index) else {
+                        break;
+                    };
+                    let result = f(item);
+                    if result.is_err() {
+                        failed.store(true, Ordering::Relaxed);
+                    }
+                    *slots[index].lock().unwrap() = Some(result);
+                }
+            });
+        }
+    });
+
+    // 任务按下标顺序领取，没有执行的任务一定排在失败的任务之后。
+    slots
+        .into_iter()
+        .map_while(|slot| slot.into_inner().unwrap())
+        .collect()
+}
+
+fn chibicc_command(
     repo: &Path,
     opts: &Options,
     input: &str,
     output: Option<&Path>,
     preprocess_only: bool,
     link_runtime: bool,
-) -> Result<()> {
+) -> Result<Command> {
     let chibicc = chibicc_path(repo, opts.print_only)?;
     let mut cmd = Command::new(chibicc);
     cmd.arg("--target=shy");
@@ -319,116 +588,113 @@ fn run_chibicc(
         cmd.arg("--shy-link-runtime");
     }
     cmd.arg(format!("-I{}", repo.join("libshy/include").display()));
+    if let Some(level) = opts.opt_level {
+        cmd.arg(level.flag());
+    }
     cmd.args(&opts.compile_args);
     if let Some(output) = output {
         cmd.arg("-o").arg(output);
     }
     cmd.arg(input);
-    run_command(opts, &mut cmd)
-}
-
-fn run_asm(repo: &Path, opts: &Options, input: &Path, output: &Path) -> Result<()> {
-    let mut cmd = tool_command(repo, "asm", "shyasm");
-    cmd.arg(input).arg("-o").arg(output);
-    run_command(opts, &mut cmd)
+    Ok(cmd)
 }
 
-fn run_linker(
+fn run_chibicc(
     repo: &Path,
     opts: &Options,
-    inputs: &[PathBuf],
-    output: &Path,
-    sym: Option<&Path>,
+    input: &str,
+    output: Option<&Path>,
+    preprocess_only: bool,
+    link_runtime: bool,
 ) -> Result<()> {
-    let mut cmd = tool_command(repo, "linker", "shyld");
-    cmd.args(inputs).arg("-o").arg(output);
-    if let Some(sym) = sym {
-        cmd.arg("--sym").arg(sym);
-    }
+    let mut cmd = chibicc_command(repo, opts, input, output, preprocess_only, link_runtime)?;
     run_command(opts, &mut cmd)
 }
 
-fn build_float_lib(repo: &Path, opts: &Options, temps: &mut TempFiles) -> Result<PathBuf> {
+fn float_lib_job(repo: &Path, opts: &Options) -> Result<Job> {
     let src = repo.join("third_party/chibicc/shy_runtime_softfloat.c");
     if !src.exists() {
         bail!("missing internal float library source: {}", src.display());
     }
 
-    let runtime_c = temps.temp_path(".float.c");
     let body = fs::read_to_string(&src)
         .with_context(|| format!("failed to read internal float library: {}", src.display()))?;
-    fs::write(&runtime_c, format!("#![no_main]\n{body}")).with_context(|| {
-        format!(
-            "failed to write temporary float runtime: {}",
-            runtime_c.display()
-        )
-    })?;
-
-    let asm = if opts.save_temps {
-        PathBuf::from("libfloat.shy")
-    } else {
-        temps.temp_path(".float.shy")
-    };
-    let obj = if opts.save_temps {
-        PathBuf::from("libfloat.sobj")
-    } else {
-        temps.temp_path(".float.sobj")
-    };
+    let body = format!("#![no_main]\n{body}");
+    // 生成的源码按内容命名，路径在多次运行之间不变：chibicc 用输入路径生成私有
+    // label 名，编译缓存也把路径算进 key。
+    let name = format!("shycc-float-{}.c", &cache::hash_hex(body.as_bytes())[..16]);
+    let runtime_c = env::temp_dir().join(name);
+    if fs::read(&runtime_c).ok().as_deref() != Some(body.as_bytes()) {
+        let tmp = runtime_c.with_extension(format!("c.{}", std::process::id()));
+        fs::write(&tmp, &body)
+            .and_then(|()| fs::rename(&tmp, &runtime_c))
+            .with_context(|| {
+                format!(
+                    "failed to write temporary float runtime: {}",
+                    runtime_c.display()
+                )
+            })?;
+    }
 
-    let input = runtime_c.to_string_lossy().into_owned();
-    run_chibicc(repo, opts, &input, Some(&asm), false, true)?;
-    run_asm(repo, opts, &asm, &obj)?;
-    Ok(obj)
+    Ok(Job {
+        input: runtime_c.to_string_lossy().into_owned(),
+        kind: InputKind::C,
+        link_runtime: true,
+        asm: opts.save_temps.then(|| PathBuf::from("libfloat.shy")),
+        obj: opts.save_temps.then(|| PathBuf::from("libfloat.sobj")),
+    })
 }
 
-fn build_libshy(repo: &Path, opts: &Options, temps: &mut TempFiles) -> Result<PathBuf> {
+fn libshy_job(repo: &Path, opts: &Options) -> Result<Job> {
     let src = repo.join("libshy/libshy.shyc");
     if !src.exists() {
         bail!("missing libshy source: {}", src.display());
     }
 
-    let asm = if opts.save_temps {
-        PathBuf::from("libshy.shy")
-    } else {
-        temps.temp_path(".libshy.shy")
-    };
-    let obj = if opts.save_temps {
-        PathBuf::from("libshy.sobj")
-    } else {
-        temps.temp_path(".libshy.sobj")
-    };
-
-    let input = src.to_string_lossy().into_owned();
-    run_chibicc(repo, opts, &input, Some(&asm), false, true)?;
-    run_asm(repo, opts, &asm, &obj)?;
-    Ok(obj)
+    Ok(Job {
+        input: src.to_string_lossy().into_owned(),
+        kind: InputKind::C,
+        link_runtime: true,
+        asm: opts.save_temps.then(|| PathBuf::from("libshy.shy")),
+        obj: opts.save_temps.then(|| PathBuf::from("libshy.sobj")),
+    })
 }
 
-fn tool_command(repo: &Path, package: &str, installed_name: &str) -> Command {
-    if let Ok(path) = env::var(format!("SHYCC_{}", installed_name.to_ascii_uppercase())) {
-        return Command::new(path);
+/// `make bin` 在 shycc 旁边预先构建的 `libshy.sa` / `libfloat.sa`。链接器只从中取出
+/// 用到的成员。带有影响代码生成的选项、需要 `-save-temps` 的中间文件，或者静态库比
+/// 源码、chibicc、shyasm、shyld 或 shycc 自己旧时不使用，回退到现场编译。
+fn prebuilt_library(repo: &Path, opts: &Options, lib: &str) -> Option<String> {
+    if opts.opt_level.is_some() || !opts.compile_args.is_empty() || opts.save_temps {
+        return None;
     }
-    if let Ok(path) = env::var(format!("SHYCC_{}", package.to_ascii_uppercase())) {
-        return Command::new(path);
-    }
-
-    if let Ok(current) = env::current_exe() {
-        if let Some(dir) = current.parent() {
-            let sibling = dir.join(installed_name);
-            if sibling.exists() {
-                return Command::new(sibling);
+    let (file, mut sources) = match lib {
+        "libshy" => {
+            let mut sources = vec![repo.join("libshy/libshy.shyc")];
+            if let Ok(dir) = fs::read_dir(repo.join("libshy/include")) {
+                sources.extend(dir.flatten().map(|entry| entry.path()));
             }
+            ("libshy.sa", sources)
         }
-    }
-
-    let mut cmd = Command::new("cargo");
-    cmd.current_dir(repo)
-        .arg("run")
-        .arg("-q")
-        .arg("-p")
-        .arg(package)
-        .arg("--");
-    cmd
+        "float" => (
+            "libfloat.sa",
+            vec![repo.join("third_party/chibicc/shy_runtime_softfloat.c")],
+        ),
+        _ => return None,
+    };
+    let exe = env::current_exe().ok()?;
+    let dir = exe.parent()?;
+    let path = dir.join(file);
+    let built = fs::metadata(&path).and_then(|meta| meta.modified()).ok()?;
+    sources.extend(chibicc_path(repo, true).ok());
+    // object 格式变化时，用旧工具构建的静态库也不能再用。
+    sources.extend([dir.join("shyasm"), dir.join("shyld"), exe.clone()]);
+    // 安装后的 shycc 旁边没有源码，这时直接使用静态库。
+    let stale = sources.iter().any(|src| {
+        fs::metadata(src)
+            .and_then(|meta| meta.modified())
+            .is_ok_and(|mtime| mtime > built)
+    });
+    (!stale).then(|| path.to_string_lossy().into_owned())
 }
 
 fn chibicc_path(repo: &Path, print_only: bool) -> Result<PathBuf> {
@@ -471,6 +737,22 @@ fn run_command(opts: &Options, cmd: &mut Command) -> Result<()> {
     ensure_success(status, &command_line(cmd))
 }
 
+/// 运行命令并返回它的 stdout；stderr 仍然直接输出给用户。
+fn capture_command(opts: &Options, cmd: &mut Command) -> Result<Vec<u8>> {
+    if opts.print_only {
+        eprintln!("{}", command_line(cmd));
+        return Ok(Vec::new());
+    }
+
+    let out = cmd
+        .stdin(Stdio::null())
+        .stderr(Stdio::inherit())
+        .output()
+        .with_context(|| format!("failed to run `{}`", command_line(cmd)))?;
+    ensure_success(out.status, &command_line(cmd))?;
+    Ok(out.stdout)
+}
+
 fn ensure_success(status: ExitStatus, what: &str) -> Result<()> {
     if status.success() {
         Ok(())
@@ -545,7 +827,13 @@ fn print_usage() {
         "usage: shycc [options] file...\n\
          stages: -E, -S, -c, or link to a.sfs by default\n\
          outputs: -o <file>, --sym <file>, -save-temps, -###\n\
-         debug: --shy-emit-source-lines\n\
+         parallel: -j <N> compiles up to N inputs at once\n\
+         cache: --cache-stats, SHYCC_CACHE_DIR=<dir>, SHYCC_CACHE=0 disables\n\
+         server: --server, SHYCC_SERVER=<socket>, SHYCC_SERVER=0 disables\n\
+         optimization: -O0, -O1, -O2 (default), -Os, -fprofile-use=<file>\n\
+         debug: --shy-emit-source-lines, --shy-peephole-stats\n\
+         linker: -Wl,--gc-sections, -Wl,--icf, -Wl,--print-gc-sections, -Wl,--print-icf-sections, -Wl,--stats\n\
+         layout: -Wl,--symbol-ordering-file=<file>, -Wl,--call-graph-profile=<file>, -Wl,--print-layout\n\
          inputs: .shyc/.c, .shy, .sobj\n\
          libraries: -llibshy, -lfloat"
     );
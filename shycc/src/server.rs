@@ -0,0 +1,458 @@
+//! `shycc --server`：常驻的编译服务。
+//!
+//! 服务端在 UNIX socket 上接受请求。客户端 `shycc` 只转发 argv、工作目录和
+//! `SHYCC_*` 环境变量，服务端切换到同样的工作目录和环境后在本进程内走完整的编译
+//! 流程，把 fd 1/2 临时换成管道，按帧把 stdout/stderr 和退出码送回客户端。工作
+//! 目录、环境变量和 fd 1/2 都是进程级状态，所以请求只能一个接一个地执行。
+//!
+//! 进程常驻省掉的是每次启动和读取缓存的开销：编译缓存的依赖 hash 和编译结果留在
+//! 内存里（见 [`cache::keep_warm`]），`libshy/include` 下的头文件没变时不再重新读取。
+//!
+//! socket 默认是 `<repo>/target/shycc-server/shycc.sock`，可以用 `SHYCC_SERVER`
+//! 指定，`SHYCC_SERVER=0` 让客户端总在本地编译。socket 所在目录必须只有当前用户
+//! 能访问，socket 本身的权限是 0600；两端还用 `SO_PEERCRED` 确认对方是同一个用户。
+//! 客户端和服务端的 shycc 可执行文件不同时客户端也在本地编译；服务端发现自己的
+//! 可执行文件已经被重新构建时退出。
+
+use std::env;
+use std::ffi::{OsStr, OsString, c_void};
+use std::fs;
+use std::io::{self, Read, Write};
+use std::os::fd::{AsRawFd, BorrowedFd, OwnedFd};
+use std::os::unix::ffi::{OsStrExt, OsStringExt};
+use std::os::unix::fs::{DirBuilderExt, MetadataExt, PermissionsExt};
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::{Path, PathBuf};
+use std::sync::{Mutex, PoisonError};
+use std::thread;
+use std::time::Duration;
+
+use anyhow::{Context, Result, bail};
+
+use crate::cache;
+
+const MAGIC: &[u8; 8] = b"SHYCCSV1";
+/// 单个字段的长度上限，防止读到损坏的请求时分配过大的内存。
+const FIELD_MAX: usize = 64 << 20;
+/// 读写客户端的超时。编译一个接一个地进行，不读输出的客户端不能一直挡住后面的
+/// 编译；连上却不发请求的客户端也不应让处理它的线程一直留着。
+const CLIENT_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// 响应帧类型。
+const FRAME_STDOUT: u8 = 1;
+const FRAME_STDERR: u8 = 2;
+const FRAME_EXIT: u8 = 3;
+/// 服务端无法处理这次请求，客户端应在本地编译。
+const FRAME_RETRY: u8 = 4;
+
+/// 处理请求时切换的工作目录、环境变量和 fd 1/2 是进程级状态，持有这把锁才能改。
+static PROCESS_STATE: Mutex<()> = Mutex::new(());
+
+const SOL_SOCKET: i32 = 1;
+const SO_PEERCRED: i32 = 17;
+
+/// Linux 的 `struct ucred`。
+#[repr(C)]
+struct Ucred {
+    pid: i32,
+    uid: u32,
+    gid: u32,
+}
+
+unsafe extern "C" {
+    fn dup2(old: i32, new: i32) -> i32;
+    fn getuid() -> u32;
+    fn getsockopt(fd: i32, level: i32, name: i32, value: *mut c_void, len: *mut u32) -> i32;
+}
+
+/// 服务端 socket 路径：`SHYCC_SERVER`，否则 `<repo>/target/shycc-server/shycc.sock`。
+fn socket_path(repo: &Path) -> Option<PathBuf> {
+    match env::var_os("SHYCC_SERVER") {
+        Some(v) if v == "0" => None,
+        Some(v) if !v.is_empty() => Some(PathBuf::from(v)),
+        _ => Some(repo.join("target/shycc-server/shycc.sock")),
+    }
+}
+
+/// 只有 `SHYCC_*` 环境变量在客户端和服务端之间传递。
+fn is_forwarded(key: &OsStr) -> bool {
+    key.as_bytes().starts_with(b"SHYCC_")
+}
+
+/// socket 对端进程的 uid。
+fn peer_uid(stream: &UnixStream) -> io::Result<u32> {
+    let mut cred = Ucred {
+        pid: 0,
+        uid: 0,
+        gid: 0,
+    };
+    let mut len = size_of::<Ucred>() as u32;
+    let value = (&raw mut cred).cast::<c_void>();
+    if unsafe { getsockopt(stream.as_raw_fd(), SOL_SOCKET, SO_PEERCRED, value, &mut len) } < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(cred.uid)
+}
+
+fn is_own_peer(stream: &UnixStream) -> bool {
+    peer_uid(stream).is_ok_and(|uid| uid == unsafe { getuid() })
+}
+
+/// 创建只有当前用户能访问的目录；目录已经存在时确认它属于当前用户且权限不比 0700 宽。
+fn private_dir(dir: &Path) -> Result<()> {
+    if let Some(parent) = dir.parent() {
+        fs::create_dir_all(parent)
+            .with_context(|| format!("failed to create {}", parent.display()))?;
+    }
+    match fs::DirBuilder::new().mode(0o700).create(dir) {
+        Err(e) if e.kind() != io::ErrorKind::AlreadyExists => {
+            return Err(e).with_context(|| format!("failed to create {}", dir.display()));
+        }
+        _ => {}
+    }
+    let meta = fs::symlink_metadata(dir)?;
+    if !meta.is_dir() || meta.uid() != unsafe { getuid() } || meta.mode() & 0o077 != 0 {
+        bail!(
+            "{} must be a directory accessible only by its owner",
+            dir.display()
+        );
+    }
+    Ok(())
+}
+
+/// 当前 shycc 可执行文件的版本标识。
+fn identity() -> String {
+    cache::tool_hash(&env::current_exe().into_iter().collect::<Vec<_>>())
+}
+
+/// 客户端转发的一次调用。
+#[derive(Debug, PartialEq)]
+struct Request {
+    identity: String,
+    cwd: PathBuf,
+    args: Vec<String>,
+    env: Vec<(OsString, OsString)>,
+}
+
+impl Request {
+    fn to_bytes(&self) -> Vec<u8> {
+        let mut buf = MAGIC.to_vec();
+        put_field(&mut buf, self.identity.as_bytes());
+        put_field(&mut buf, self.cwd.as_os_str().as_bytes());
+        buf.extend_from_slice(&(self.args.len() as u32).to_le_bytes());
+        for arg in &self.args {
+            put_field(&mut buf, arg.as_bytes());
+        }
+        buf.extend_from_slice(&(self.env.len() as u32).to_le_bytes());
+        for (key, value) in &self.env {
+            put_field(&mut buf, key.as_bytes());
+            put_field(&mut buf, value.as_bytes());
+        }
+        buf
+    }
+
+    fn read(r: &mut impl Read) -> Result<Self> {
+        let mut magic = [0; 8];
+        r.read_exact(&mut magic)?;
+        if &magic != MAGIC {
+            bail!("bad request magic");
+        }
+        let text = |bytes: Vec<u8>| String::from_utf8(bytes).context("non-utf8 request field");
+        let identity = text(read_field(r)?)?;
+        let cwd = PathBuf::from(OsString::from_vec(read_field(r)?));
+        let mut args = Vec::new();
+        for _ in 0..read_u32(r)? {
+            args.push(text(read_field(r)?)?);
+        }
+        let mut env = Vec::new();
+        for _ in 0..read_u32(r)? {
+            let key = OsString::from_vec(read_field(r)?);
+            env.push((key, OsString::from_vec(read_field(r)?)));
+        }
+        Ok(Self {
+            identity,
+            cwd,
+            args,
+            env,
+        })
+    }
+}
+
+fn put_field(buf: &mut Vec<u8>, data: &[u8]) {
+    buf.extend_from_slice(&(data.len() as u32).to_le_bytes());
+    buf.extend_from_slice(data);
+}
+
+fn read_u32(r: &mut impl Read) -> io::Result<u32> {
+    let mut word = [0; 4];
+    r.read_exact(&mut word)?;
+    Ok(u32::from_le_bytes(word))
+}
+
+fn read_field(r: &mut impl Read) -> io::Result<Vec<u8>> {
+    let len = read_u32(r)? as usize;
+    if len > FIELD_MAX {
+        return Err(io::Error::new(
+            io::ErrorKind::InvalidData,
+            "request field too large",
+        ));
+    }
+    let mut data = vec![0; len];
+    r.read_exact(&mut data)?;
+    Ok(data)
+}
+
+fn write_frame(w: &mut impl Write, tag: u8, data: &[u8]) -> io::Result<()> {
+    let mut buf = Vec::with_capacity(5 + data.len());
+    buf.push(tag);
+    put_field(&mut buf, data);
+    w.write_all(&buf)
+}
+
+fn read_frame(r: &mut impl Read) -> io::Result<(u8, Vec<u8>)> {
+    let mut tag = [0];
+    r.read_exact(&mut tag)?;
+    Ok((tag[0], read_field(r)?))
+}
+
+/// 有服务端时把这次调用转发过去，返回退出码。没有服务端，或者服务端在开始输出之前
+/// 要求重试时返回 `None`，由调用方在本地编译。
+pub fn forward(repo: &Path, args: &[String]) -> Option<i32> {
+    let mut stream = UnixStream::connect(socket_path(repo)?).ok()?;
+    if !is_own_peer(&stream) {
+        return None;
+    }
+    let request = Request {
+        identity: identity(),
+        cwd: env::current_dir().ok()?,
+        args: args.to_vec(),
+        env: env::vars_os().filter(|(key, _)| is_forwarded(key)).collect(),
+    };
+    stream.write_all(&request.to_bytes()).ok()?;
+
+    let mut started = false;
+    loop {
+        let frame = read_frame(&mut stream);
+        let (tag, data) = match frame {
+            Ok(frame) => frame,
+            Err(_) if !started => return None,
+            Err(e) => {
+                eprintln!("shycc: lost connection to compile server: {e}");
+                return Some(1);
+            }
+        };
+        started = true;
+        match tag {
+            FRAME_STDOUT => {
+                let _ = io::stdout().write_all(&data);
+            }
+            FRAME_STDERR => {
+                let _ = io::stderr().write_all(&data);
+            }
+            FRAME_EXIT if data.len() == 4 => {
+                let _ = io::stdout().flush();
+                return Some(i32::from_le_bytes(data.try_into().unwrap()));
+            }
+            FRAME_RETRY if data.is_empty() => return None,
+            _ => {
+                eprintln!("shycc: bad frame from compile server");
+                return Some(1);
+            }
+        }
+    }
+}
+
+/// `shycc --server` 的主循环。
+pub fn serve(repo: &Path) -> Result<()> {
+    let Some(path) = socket_path(repo) else {
+        bail!("`SHYCC_SERVER=0` disables the compile server");
+    };
+    // 处理请求时会切换工作目录。
+    let path = std::path::absolute(&path)?;
+    if UnixStream::connect(&path).is_ok() {
+        bail!(
+            "a compile server is already listening on {}",
+            path.display()
+        );
+    }
+    if let Some(dir) = path.parent() {
+        private_dir(dir)?;
+    }
+    // 上一个服务端异常退出时留下的 socket 文件。
+    let _ = fs::remove_file(&path);
+    let listener = UnixListener::bind(&path)
+        .with_context(|| format!("failed to listen on {}", path.display()))?;
+    fs::set_permissions(&path, fs::Permissions::from_mode(0o600))?;
+
+    cache::keep_warm();
+    let identity = identity();
+    eprintln!("shycc: compile server listening on {}", path.display());
+    for stream in listener.incoming() {
+        let Ok(stream) = stream else {
+            continue;
+        };
+        // 每个连接一个线程，迟迟不发请求的客户端不会挡住别人；编译本身仍由
+        // PROCESS_STATE 串行化。fd 2 可能正被别的请求重定向，日志也要拿着锁写。
+        let (identity, path) = (identity.clone(), path.clone());
+        thread::spawn(move || {
+            let result = handle(stream, &identity);
+            let _state = PROCESS_STATE.lock().unwrap_or_else(PoisonError::into_inner);
+            match result {
+                Ok(true) => {}
+                Ok(false) => {
+                    eprintln!("shycc: executable was rebuilt, compile server exiting");
+                    let _ = fs::remove_file(&path);
+                    std::process::exit(0);
+                }
+                Err(e) => eprintln!("shycc: compile server request failed: {e:#}"),
+            }
+        });
+    }
+    Ok(())
+}
+
+/// 处理一个请求。返回 `false` 表示服务端已经过期，应当退出。
+fn handle(mut stream: UnixStream, identity: &str) -> Result<bool> {
+    if !is_own_peer(&stream) {
+        bail!("rejected a request from another user");
+    }
+    stream.set_read_timeout(Some(CLIENT_TIMEOUT))?;
+    stream.set_write_timeout(Some(CLIENT_TIMEOUT))?;
+    let request = Request::read(&mut stream)?;
+    if request.identity != identity {
+        write_frame(&mut stream, FRAME_RETRY, &[])?;
+        return Ok(self::identity() == identity);
+    }
+    let _state = PROCESS_STATE.lock().unwrap_or_else(PoisonError::into_inner);
+    if env::set_current_dir(&request.cwd).is_err() {
+        write_frame(&mut stream, FRAME_RETRY, &[])?;
+        return Ok(true);
+    }
+    // 持有 PROCESS_STATE 时没有其他请求在运行，也就没有别的线程在读环境变量。
+    for (key, _) in env::vars_os() {
+        if is_forwarded(&key) && !request.env.iter().any(|(k, _)| *k == key) {
+            unsafe { env::remove_var(key) };
+        }
+    }
+    for (key, value) in &request.env {
+        if is_forwarded(key) {
+            unsafe { env::set_var(key, value) };
+        }
+    }
+
+    let (out_read, out_write) = io::pipe()?;
+    let (err_read, err_write) = io::pipe()?;
+    let stream = Mutex::new(stream);
+    let code = thread::scope(|s| -> Result<i32> {
+        s.spawn(|| relay(out_read, FRAME_STDOUT, &stream));
+        s.spawn(|| relay(err_read, FRAME_STDERR, &stream));
+        let redirect = Redirect::new(out_write.as_raw_fd(), err_write.as_raw_fd());
+        // 之后管道的写端只剩 fd 1/2；恢复它们以后 relay 线程读到 EOF 退出。
+        drop((out_write, err_write));
+        let _redirect = redirect?;
+        Ok(run_request(request.args))
+    })?;
+    write_frame(
+        &mut *stream.lock().unwrap(),
+        FRAME_EXIT,
+        &code.to_le_bytes(),
+    )?;
+    Ok(true)
+}
+
+/// 在本进程内执行一次 shycc 调用，返回退出码。
+fn run_request(args: Vec<String>) -> i32 {
+    match std::panic::catch_unwind(|| crate::run_args(args)) {
+        Ok(Ok(())) => 0,
+        Ok(Err(e)) => {
+            eprintln!("Error: {e:?}");
+            1
+        }
+        Err(_) => 101,
+    }
+}
+
+/// 把管道里的输出按帧转发给客户端。客户端断开或写超时后不再转发，但继续读空管道，
+/// 编译不会因此阻塞。
+fn relay(mut pipe: io::PipeReader, tag: u8, stream: &Mutex<UnixStream>) {
+    let mut buf = [0; 8192];
+    let mut connected = true;
+    loop {
+        match pipe.read(&mut buf) {
+            Ok(0) | Err(_) => break,
+            Ok(n) if connected => {
+                connected = write_frame(&mut *stream.lock().unwrap(), tag, &buf[..n]).is_ok();
+            }
+            Ok(_) => {}
+        }
+    }
+}
+
+/// 临时把 fd 1/2 换成给定的 fd，drop 时恢复。chibicc 等子进程也继承换过的 fd。
+struct Redirect {
+    saved: [OwnedFd; 2],
+}
+
+impl Redirect {
+    fn new(stdout: i32, stderr: i32) -> io::Result<Self> {
+        io::stdout().flush()?;
+        let saved = [
+            unsafe { BorrowedFd::borrow_raw(1) }.try_clone_to_owned()?,
+            unsafe { BorrowedFd::borrow_raw(2) }.try_clone_to_owned()?,
+        ];
+        for (fd, target) in [(stdout, 1), (stderr, 2)] {
+            if unsafe { dup2(fd, target) } < 0 {
+                let err = io::Error::last_os_error();
+                drop(Self { saved });
+                return Err(err);
+            }
+        }
+        Ok(Self { saved })
+    }
+}
+
+impl Drop for Redirect {
+    fn drop(&mut self) {
+        let _ = io::stdout().flush();
+        for (fd, target) in self.saved.iter().zip([1, 2]) {
+            unsafe { dup2(fd.as_raw_fd(), target) };
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn request_roundtrip() {
+        let request = Request {
+            identity: "abc".to_string(),
+            cwd: PathBuf::from("/tmp/work"),
+            args: vec!["-c".to_string(), "main.shyc".to_string()],
+            env: vec![(OsString::from("SHYCC_CACHE"), OsString::from("0"))],
+        };
+        let buf = request.to_bytes();
+        assert_eq!(Request::read(&mut &buf[..]).unwrap(), request);
+        assert!(Request::read(&mut &buf[..buf.len() - 1]).is_err());
+
+        let mut frames = Vec::new();
+        write_frame(&mut frames, FRAME_STDERR, b"warning\n").unwrap();
+        write_frame(&mut frames, FRAME_EXIT, &1i32.to_le_bytes()).unwrap();
+        let mut r = &frames[..];
+        assert_eq!(
+            read_frame(&mut r).unwrap(),
+            (FRAME_STDERR, b"warning\n".to_vec())
+        );
+        assert_eq!(read_frame(&mut r).unwrap(), (FRAME_EXIT, vec![1, 0, 0, 0]));
+    }
+
+    #[test]
+    fn only_own_user_and_shycc_env_pass() {
+        let (a, _b) = UnixStream::pair().unwrap();
+        assert!(is_own_peer(&a));
+        assert!(is_forwarded(OsStr::new("SHYCC_CACHE")));
+        assert!(!is_forwarded(OsStr::new("HOME")));
+        assert!(!is_forwarded(OsStr::new("LD_PRELOAD")));
+    }
+}
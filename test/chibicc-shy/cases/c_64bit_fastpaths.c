@@ -0,0 +1,105 @@
+__attribute__((noinline)) static long mul_by(long x, long c) {
+  return x * c;
+}
+
+__attribute__((noinline)) static long div_by(long x, long c) {
+  return x / c;
+}
+
+__attribute__((noinline)) static long mod_by(long x, long c) {
+  return x % c;
+}
+
+__attribute__((noinline)) static unsigned long udiv_by(unsigned long x, unsigned long c) {
+  return x / c;
+}
+
+__attribute__((noinline)) static unsigned long umod_by(unsigned long x, unsigned long c) {
+  return x % c;
+}
+
+__attribute__((noinline)) static long shl_by(long x, int n) {
+  return x << n;
+}
+
+__attribute__((noinline)) static long sar_by(long x, int n) {
+  return x >> n;
+}
+
+__attribute__((noinline)) static unsigned long shr_by(unsigned long x, int n) {
+  return x >> n;
+}
+
+__attribute__((noinline)) static int lt(long a, long b) {
+  return a < b;
+}
+
+__attribute__((noinline)) static int ule(unsigned long a, unsigned long b) {
+  return a <= b;
+}
+
+static long values[] = {
+  0, 1, -1, 7, -7, 12345, -12345, 0x7fffffffL, 0x80000000L, -0x80000000L,
+  0x123456789abL, -0x123456789abL, 0x7fffffffffffffffL, -0x7fffffffffffffffL - 1,
+};
+
+int main(void) {
+  int n = sizeof(values) / sizeof(*values);
+  for (int i = 0; i < n; i++) {
+    long x = values[i];
+    unsigned long u = x;
+
+    if (x * 0 != 0 || x * 1 != x || x * 2 != mul_by(x, 2) || x * 3 != mul_by(x, 3))
+      return 1;
+    if (x * 10 != mul_by(x, 10) || x * 65535 != mul_by(x, 65535) ||
+        x * 65536 != mul_by(x, 65536) || x * 100000 != mul_by(x, 100000))
+      return 2;
+    if (x * -3 != mul_by(x, -3) || x * 0x100000000L != mul_by(x, 0x100000000L))
+      return 3;
+
+    if (x / 2 != div_by(x, 2) || x / 8 != div_by(x, 8) || x / 1 != x ||
+        x / 0x100000000L != div_by(x, 0x100000000L) || x / 3 != div_by(x, 3))
+      return 4;
+    if (x % 2 != mod_by(x, 2) || x % 16 != mod_by(x, 16) || x % 1 != 0 ||
+        x % 0x200000000L != mod_by(x, 0x200000000L))
+      return 5;
+    if (u / 4 != udiv_by(u, 4) || u / 0x100000000UL != udiv_by(u, 0x100000000UL) ||
+        u / 0x8000000000000000UL != udiv_by(u, 0x8000000000000000UL))
+      return 6;
+    if (u % 32 != umod_by(u, 32) || u % 0x100000000UL != umod_by(u, 0x100000000UL) ||
+        u % 0x1000000000UL != umod_by(u, 0x1000000000UL))
+      return 7;
+
+    if (x << 0 != x || x << 1 != shl_by(x, 1) || x << 31 != shl_by(x, 31) ||
+        x << 32 != shl_by(x, 32) || x << 45 != shl_by(x, 45))
+      return 8;
+    if (x >> 1 != sar_by(x, 1) || x >> 31 != sar_by(x, 31) || x >> 32 != sar_by(x, 32) ||
+        x >> 40 != sar_by(x, 40) || x >> 63 != sar_by(x, 63))
+      return 9;
+    if (u >> 1 != shr_by(u, 1) || u >> 31 != shr_by(u, 31) || u >> 32 != shr_by(u, 32) ||
+        u >> 40 != shr_by(u, 40) || u >> 63 != shr_by(u, 63))
+      return 10;
+
+    if ((x < 5) != lt(x, 5) || (x <= -1) != lt(x, 0) || (x < 0x100000000L) != lt(x, 0x100000000L))
+      return 11;
+    if ((x > -0x100000000L) != lt(-0x100000000L, x) || (x >= 7) != !lt(x, 7))
+      return 12;
+    if ((u <= 0x80000000UL) != ule(u, 0x80000000UL) || (u > 1) != !ule(u, 1))
+      return 13;
+  }
+
+  if (lt(-1, 1) != 1 || lt(1, -1) != 0 || lt(-0x100000000L, -1) != 1)
+    return 14;
+  if (ule(-1UL, 1) != 0 || ule(1, -1UL) != 1 || ule(0x100000000UL, 0xffffffffUL) != 0)
+    return 15;
+
+  int a[8] = {10, 11, 12, 13, 14, 15, 16, 17};
+  long li = 5;
+  int *p = &a[4];
+  if (a[li] != 15 || p[-2] != 12 || *(p - li + 3) != 12 || p[li - 2] != 17)
+    return 16;
+  unsigned long ui = 7;
+  if (a[ui] != 17)
+    return 17;
+  return 0;
+}
@@ -0,0 +1,99 @@
+__attribute__((noinline)) static int sdiv(int a, int b) {
+  return a / b;
+}
+
+__attribute__((noinline)) static int smod(int a, int b) {
+  return a % b;
+}
+
+__attribute__((noinline)) static int sshr(int a, int b) {
+  return a >> b;
+}
+
+__attribute__((noinline)) static int sdiv_consts(int a) {
+  return a / 2 + a / 8 * 3 + a / -4 * 5 + a / 10 * 7 + a / 1 + a / -1 + a / 0x40000000;
+}
+
+__attribute__((noinline)) static int smod_consts(int a) {
+  return a % 2 + a % 16 * 3 + a % -8 * 5 + a % 10 * 7 + a % -7 * 11 + a % 1;
+}
+
+__attribute__((noinline)) static unsigned udiv_consts(unsigned a) {
+  return a / 2 + a / 16 + a % 8 + a / 10 + a % 10 + a / 0x80000000u + a % 0x80000000u + a / 1;
+}
+
+__attribute__((noinline)) static int sshr_consts(int a) {
+  return (a >> 1) + (a >> 4) * 3 + (a >> 31) * 5 + (a >> 0);
+}
+
+__attribute__((noinline)) static int shorts(short a, signed char b) {
+  return a / 4 + b % 4 + (b >> 2) + a % -3;
+}
+
+__attribute__((noinline)) static unsigned long u64_divmod(unsigned long a, unsigned long b) {
+  return a / b * 1000 + a % b;
+}
+
+__attribute__((noinline)) static int digits(unsigned long v, char *buf) {
+  int n = 0;
+  do {
+    buf[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  return n;
+}
+
+int main(void) {
+  int vals[] = {0, 1, -1, 7, -7, 9, -9, 100, -100, 0x7fffffff, -0x7fffffff - 1, 123456, -123457};
+  int n = sizeof(vals) / sizeof(*vals);
+  int divs[] = {1, -1, 2, -2, 3, -3, 10, -10, 16, -16};
+  for (int i = 0; i < n; i++) {
+    int a = vals[i];
+    for (int j = 0; j < 10; j++) {
+      int b = divs[j];
+      if (a == -0x7fffffff - 1 && b == -1)
+        continue;
+      if (sdiv(a, b) * b + smod(a, b) != a)
+        return 1;
+      int m = smod(a, b);
+      if (m && (m < 0) != (a < 0))
+        return 2;
+    }
+    if (sshr(a, 3) != (a < 0 ? ~(~a / 8) : a / 8))
+      return 3;
+  }
+
+  if (sdiv(-7, 2) != -3 || smod(-7, 2) != -1 || sdiv(7, -2) != -3 || smod(7, -2) != 1)
+    return 4;
+  if (sshr(-1, 5) != -1 || sshr(-8, 1) != -4 || sshr(0x40000000, 30) != 1)
+    return 5;
+
+  if (sdiv_consts(-1001) != -325)
+    return 6;
+  if (sdiv_consts(0x7fffffff) != 697932182)
+    return 7;
+  if (smod_consts(-1001) != -40)
+    return 8;
+  if (smod_consts(1001) != 40)
+    return 9;
+  if (udiv_consts(0xfffffff7u) != 697932175u)
+    return 10;
+  if (sshr_consts(-100) != -176 || sshr_consts(100) != 168)
+    return 11;
+  if (shorts(-9, -7) != -7 || shorts(10, 7) != 7)
+    return 12;
+
+  if (u64_divmod(1234567, 1000) != 1234 * 1000 + 567)
+    return 13;
+  if (u64_divmod(0x500000000ul, 3) != 0x1aaaaaaaaul * 1000 + 2)
+    return 14;
+  if (u64_divmod(0xfffffffful, 0x10) != 0xffffffful * 1000 + 15)
+    return 15;
+
+  char buf[24];
+  if (digits(9876543210ul, buf) != 10 || buf[0] != '0' || buf[9] != '9')
+    return 16;
+  if (digits(4294967295ul, buf) != 10 || buf[0] != '5' || buf[9] != '4')
+    return 17;
+  return 0;
+}
@@ -0,0 +1,149 @@
+struct Pair {
+  int a;
+  int b;
+};
+
+static int calls;
+
+static inline int classify(int c) {
+  switch (c) {
+  case 0:
+    return 10;
+  case 1:
+  case 2:
+    return 20;
+  default:
+    break;
+  }
+  if (c < 0)
+    return -1;
+  return 30;
+}
+
+static inline char narrow(int x) {
+  return x;
+}
+
+static inline int bump(int x) {
+  x = x + 1;
+  return x * 2;
+}
+
+static inline int through_ptr(int x) {
+  int *p = &x;
+  *p = *p + 3;
+  return x;
+}
+
+static inline void count_call(void) {
+  calls = calls + 1;
+}
+
+static inline int sum_to(int n) {
+  int s = 0;
+  for (int i = 1; i <= n; i = i + 1)
+    s = s + i;
+  return s;
+}
+
+__attribute__((always_inline)) static inline int first_even(int *v, int n) {
+  for (int i = 0; i < n; i = i + 1) {
+    if (v[i] % 2 == 0)
+      goto found;
+    continue;
+  found:
+    return v[i];
+  }
+  return -1;
+}
+
+__attribute__((always_inline)) static int pair_sum(struct Pair *p) {
+  return p->a + p->b;
+}
+
+__attribute__((noinline)) static int keep_call(int x) {
+  return x + 100;
+}
+
+int sum_pair(int n) {
+  return sum_to(n) + sum_to(n + 1);
+}
+
+static int fact(int n) {
+  if (n <= 1)
+    return 1;
+  return n * fact(n - 1);
+}
+
+static int twice(int x) {
+  return x + x;
+}
+
+static int (*twice_ptr)(int) = twice;
+
+static int side;
+
+static int next_side(void) {
+  side = side + 1;
+  return side;
+}
+
+static int sub(int a, int b) {
+  return a - b;
+}
+
+static int add_one(int x) { return x + 1; }
+
+// Every C call to add_one is inlined, but the asm still calls it by its symbol.
+__attribute__((noinline)) static int add_two(int x) {
+  int r = add_one(x);
+  asm!(r) {
+    "seta 4x {r}\n"
+    "calln .L.shy.test_chibicc_shy_cases_c_inline_calls_c.add_one\n"
+    "seta {r} 1x"
+  };
+  return r;
+}
+
+int main(void) {
+  if (classify(0) != 10 || classify(2) != 20 || classify(7) != 30 ||
+      classify(-4) != -1)
+    return 1;
+  if (classify(1) + classify(0) != 30)
+    return 2;
+  if (narrow(0x1ff) != -1)
+    return 3;
+
+  int x = 4;
+  if (bump(x) != 10 || x != 4)
+    return 4;
+  if (through_ptr(x) != 7 || x != 4)
+    return 5;
+
+  count_call();
+  count_call();
+  if (calls != 2)
+    return 6;
+
+  if (sum_to(4) != 10 || sum_to(0) != 0 || sum_pair(3) != 16)
+    return 7;
+
+  int v[4] = {3, 5, 8, 9};
+  if (first_even(v, 4) != 8 || first_even(v, 2) != -1)
+    return 8;
+
+  struct Pair p = {2, 5};
+  if (pair_sum(&p) != 7)
+    return 9;
+  if (keep_call(1) != 101 || fact(5) != 120)
+    return 10;
+  if (twice(21) != 42 || twice_ptr != twice)
+    return 11;
+
+  side = 0;
+  if (sub(next_side(), next_side()) != -1)
+    return 12;
+  if (add_two(5) != 7)
+    return 13;
+  return 0;
+}
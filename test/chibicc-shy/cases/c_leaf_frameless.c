@@ -0,0 +1,61 @@
+__attribute__((noinline)) static int is_digit(int c) {
+  return '0' <= c && c <= '9';
+}
+
+__attribute__((noinline)) static int streq(const char *a, const char *b) {
+  int i = 0;
+  while (a[i] && b[i]) {
+    if (a[i] != b[i])
+      return 0;
+    i = i + 1;
+  }
+  return a[i] == b[i];
+}
+
+__attribute__((noinline)) static long mix64(long a, int b, long c) {
+  long t = a + b;
+  return t + c;
+}
+
+__attribute__((noinline)) static long clamp64(long x, long lo, unsigned long limit) {
+  if (x < lo)
+    return lo;
+  if ((unsigned long)x <= limit)
+    return x;
+  return limit;
+}
+
+__attribute__((noinline)) static int low_byte(char c, short s) {
+  return c + s;
+}
+
+__attribute__((noinline)) static int addr_taken(int x) {
+  int *p = &x;
+  *p = *p + 1;
+  return x;
+}
+
+__attribute__((noinline)) static int too_many(int a, int b, int c, int d, int e, int f, int g) {
+  int h = a + b + c;
+  return h + d + e + f + g;
+}
+
+int main(void) {
+  if (!is_digit('7') || is_digit('x'))
+    return 1;
+  if (!streq("shy", "shy") || streq("shy", "sh"))
+    return 2;
+  if (mix64(0xffffffffL, 1, 0x100000000L) != 0x200000000L)
+    return 3;
+  if (low_byte((char)0x1ff, (short)-2) != -3)
+    return 4;
+  if (addr_taken(41) != 42)
+    return 5;
+  if (too_many(1, 2, 3, 4, 5, 6, 7) != 28)
+    return 6;
+  if (clamp64(-0x100000001L, -0x100000000L, 9) != -0x100000000L ||
+      clamp64(-5, -0x100000000L, 9) != 9 || clamp64(7, 0, 9) != 7 ||
+      clamp64(0x100000000L, 0, 0xffffffffUL) != 0xffffffffL)
+    return 7;
+  return 0;
+}
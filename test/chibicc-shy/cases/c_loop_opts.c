@@ -0,0 +1,93 @@
+struct Point {
+  int x;
+  int y;
+};
+
+__attribute__((noinline)) static void copy_bytes(unsigned char *d, unsigned char *s, unsigned n) {
+  for (unsigned i = 0; i < n; i++)
+    d[i] = s[i];
+}
+
+__attribute__((noinline)) static int sum_words(int *v, int n) {
+  int sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += v[i];
+  return sum;
+}
+
+__attribute__((noinline)) static void scale_points(struct Point *p, int n, int k) {
+  for (int i = n - 1; i >= 0; i--) {
+    p[i].x *= k;
+    p[i].y = p[i].y * k + i;
+  }
+}
+
+__attribute__((noinline)) static int strided(short *v, int n) {
+  int sum = 0;
+  for (int i = 1; i < n; i += 3)
+    sum += v[i] - v[i - 1];
+  return sum;
+}
+
+__attribute__((noinline)) static int unrolled(int *v) {
+  int sum = 0;
+  for (int i = 0; i < 4; i++)
+    sum += v[i] * (i + 1);
+  return sum;
+}
+
+__attribute__((noinline)) static int counter_after(void) {
+  int i;
+  int sum = 0;
+  for (i = 2; i <= 10; i += 4)
+    sum += i;
+  return sum * 100 + i;
+}
+
+__attribute__((noinline)) static unsigned wrap_edge(void) {
+  unsigned n = 0;
+  for (unsigned i = 0xfffffffd; i != 0; i++)
+    n += i & 0xf;
+  return n;
+}
+
+__attribute__((noinline)) static int signed_bounds(int lo, int hi) {
+  int n = 0;
+  for (int i = lo; i < hi; i++)
+    if (i < 0 && i != -2)
+      n++;
+  return n;
+}
+
+int main(void) {
+  unsigned char src[13], dst[13];
+  for (int i = 0; i < 13; i++)
+    src[i] = i * 7;
+  copy_bytes(dst, src, 13);
+  for (int i = 0; i < 13; i++)
+    if (dst[i] != (unsigned char)(i * 7))
+      return 1;
+
+  int words[6] = {1, -2, 30, 400, -5000, 60000};
+  if (sum_words(words, 6) != 55429 || sum_words(words, 0) != 0)
+    return 2;
+
+  struct Point pts[3] = {{1, 2}, {3, 4}, {5, 6}};
+  scale_points(pts, 3, 10);
+  if (pts[0].x != 10 || pts[0].y != 20 || pts[1].y != 41 || pts[2].x != 50 || pts[2].y != 62)
+    return 3;
+
+  short s[8] = {1, 4, 9, 16, 25, 36, 49, 64};
+  if (strided(s, 8) != 3 + 9 + 15)
+    return 4;
+
+  if (unrolled(words) != 1 - 4 + 90 + 1600)
+    return 5;
+  if (counter_after() != 1814)
+    return 6;
+  if (wrap_edge() != 13 + 14 + 15)
+    return 7;
+  if (signed_bounds(-5, 3) != 4 || signed_bounds(2, -2) != 0)
+    return 8;
+  return 0;
+}
@@ -0,0 +1,56 @@
+static int square(int x) {
+  return x * x;
+}
+
+__attribute__((noinline)) static int classify(int c) {
+  switch (c) {
+  case 0: return 10;
+  case 1: return 11;
+  case 2: return 12;
+  case 3: return 13;
+  case 4: return 14;
+  case 5: return 15;
+  default: return -1;
+  }
+}
+
+__attribute__((noinline)) static int sum_to(int n, int acc) {
+  if (n == 0)
+    return acc;
+  return sum_to(n - 1, acc + n);
+}
+
+__attribute__((noinline)) static int sum_array(int *p, int n) {
+  int s = 0;
+  for (int i = 0; i < n; i++)
+    s += p[i];
+  return s;
+}
+
+__attribute__((noinline)) static int unrolled(void) {
+  int s = 0;
+  for (int i = 0; i < 4; i++)
+    s += i * 3;
+  return s;
+}
+
+int main(void) {
+  int a[5] = {1, 2, 3, 4, 5};
+  if (square(7) != 49)
+    return 1;
+  if (classify(3) != 13 || classify(9) != -1)
+    return 2;
+  if (sum_to(50, 0) != 1275)
+    return 3;
+  if (sum_array(a, 5) != 15)
+    return 4;
+  if (unrolled() != 18)
+    return 5;
+  int n = -37;
+  if (n / 8 != -4 || n % 8 != -5 || n >> 2 != -10)
+    return 6;
+  unsigned u = 37;
+  if (u / 8 != 4 || u % 8 != 5)
+    return 7;
+  return 0;
+}
@@ -0,0 +1,67 @@
+__attribute__((noinline)) static int asm_regs(int x) {
+  int y = 0;
+  asm!(x, y) {
+    "seta {y} {x}\n"
+    "addn {y} 5\n"
+    "setn {x} 0"
+  };
+  return x + y;
+}
+
+__attribute__((noinline)) static int asm_label(int n) {
+  int r = n;
+  asm!(r) {
+    "equn {r} 0\n"
+    "jmpn skip_add\n"
+    "addn {r} 100\n"
+    "skip_add:"
+  };
+  return r;
+}
+
+__attribute__((noinline)) static int nested_loops(int n) {
+  int hits = 0;
+  for (int i = 0; i < n; i++) {
+    for (int j = 0; j < n; j++) {
+      if (j == i)
+        continue;
+      if (j > i + 2)
+        break;
+      hits += i * 10 + j;
+    }
+  }
+  return hits;
+}
+
+__attribute__((noinline)) static int args(int a, int b, int c, int d) {
+  return a * 1000 + b * 100 + c * 10 + d;
+}
+
+__attribute__((noinline)) static int shuffled(int a, int b) {
+  return args(b, a, a + b, b - a) + args(a, a, b, b);
+}
+
+__attribute__((noinline)) static int chained(int x) {
+  if (x > 10) {
+    if (x > 20)
+      goto done;
+    x += 1;
+  }
+  x *= 2;
+done:
+  return x;
+}
+
+int main(void) {
+  if (asm_regs(3) != 8)
+    return 1;
+  if (asm_label(0) != 0 || asm_label(1) != 101)
+    return 2;
+  if (nested_loops(5) != 419)
+    return 3;
+  if (shuffled(1, 2) != 2131 + 1122)
+    return 4;
+  if (chained(5) != 10 || chained(15) != 32 || chained(25) != 25)
+    return 5;
+  return 0;
+}
@@ -0,0 +1,32 @@
+static int mix(int x, int i) {
+  int s = x;
+  s = s * 31 + i;
+  s = s ^ (s >> 3);
+  s = s + (x & 7) * i;
+  if (s < 0)
+    s = -s;
+  return s % 1000;
+}
+
+static int rarely(int x) {
+  int s = 0;
+  for (int i = 0; i < 4; i++)
+    s += x * i;
+  return s + mix(x, 1);
+}
+
+int hot_loop(int n) {
+  int t = 0;
+  for (int i = 0; i < n; i++)
+    t = mix(t, i);
+  return t;
+}
+
+int main(void) {
+  int r = hot_loop(200);
+  if (r == -1)
+    return rarely(r);
+  if (r != hot_loop(200))
+    return 1;
+  return r == 0 ? 2 : 0;
+}
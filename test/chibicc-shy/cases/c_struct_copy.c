@@ -0,0 +1,113 @@
+struct B3 {
+  char c[3];
+};
+
+struct B6 {
+  short s[3];
+};
+
+struct W8 {
+  int a;
+  int b;
+};
+
+struct W9 {
+  int v[9];
+};
+
+struct Big {
+  char tag;
+  int v[40];
+  char tail[3];
+};
+
+static int sum_bytes(void *p, int n) {
+  unsigned char *b = p;
+  int sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += b[i] * (i + 1);
+  return sum;
+}
+
+static void fill(void *p, int n, int seed) {
+  unsigned char *b = p;
+  for (int i = 0; i < n; i++)
+    b[i] = seed + i * 7;
+}
+
+static struct Big make_big(int seed) {
+  struct Big b;
+  fill(&b, sizeof(b), seed);
+  return b;
+}
+
+static struct W9 make_w9(int seed) {
+  struct W9 w;
+  for (int i = 0; i < 9; i++)
+    w.v[i] = seed * i;
+  return w;
+}
+
+int main(void) {
+  struct B3 b3, c3;
+  fill(&b3, sizeof(b3), 1);
+  fill(&c3, sizeof(c3), 99);
+  c3 = b3;
+  if (sum_bytes(&c3, sizeof(c3)) != sum_bytes(&b3, sizeof(b3)))
+    return 1;
+
+  struct B6 b6, c6;
+  fill(&b6, sizeof(b6), 5);
+  c6 = b6;
+  if (c6.s[0] != b6.s[0] || c6.s[2] != b6.s[2])
+    return 2;
+
+  struct W8 w8 = {3, 4};
+  struct W8 x8;
+  x8 = w8;
+  if (x8.a != 3 || x8.b != 4)
+    return 3;
+
+  struct W9 w9 = make_w9(3);
+  if (w9.v[0] != 0 || w9.v[8] != 24)
+    return 4;
+  struct W9 y9;
+  y9 = w9;
+  if (y9.v[4] != 12 || y9.v[8] != 24)
+    return 5;
+
+  struct Big big = make_big(11);
+  struct Big other;
+  fill(&other, sizeof(other), 200);
+  other = big;
+  if (sum_bytes(&other, sizeof(other)) != sum_bytes(&big, sizeof(big)))
+    return 6;
+  if (other.tail[2] != big.tail[2] || other.v[39] != big.v[39])
+    return 7;
+
+  struct Big *p = &other;
+  struct Big third = *p;
+  if (sum_bytes(&third, sizeof(third)) != sum_bytes(&big, sizeof(big)))
+    return 8;
+
+  int zeros[40] = {0};
+  for (int i = 0; i < 40; i++)
+    if (zeros[i])
+      return 9;
+
+  char mixed[67] = {1, 2};
+  if (mixed[0] != 1 || mixed[1] != 2)
+    return 10;
+  for (int i = 2; i < 67; i++)
+    if (mixed[i])
+      return 11;
+
+  struct Big zero_big = {};
+  if (sum_bytes(&zero_big, sizeof(zero_big)))
+    return 12;
+
+  struct W9 small_zero = {.v[3] = 7};
+  if (small_zero.v[3] != 7 || small_zero.v[2] || small_zero.v[8])
+    return 13;
+  return 0;
+}
@@ -0,0 +1,194 @@
+__attribute__((noinline)) static int dense(int x) {
+  switch (x) {
+  case -2:
+    return 10;
+  case 0:
+    return 11;
+  case 1:
+    return 12;
+  case 2:
+  case 3:
+    return 13;
+  case 5 ... 7:
+    return 15;
+  default:
+    return 99;
+  }
+}
+
+__attribute__((noinline)) static int sparse(int x) {
+  switch (x) {
+  case -100000:
+    return 1;
+  case -7:
+    return 2;
+  case 3:
+    return 3;
+  case 40:
+    return 4;
+  case 500:
+    return 5;
+  case 6000:
+    return 6;
+  case 70000 ... 70010:
+    return 7;
+  case 2000000000:
+    return 8;
+  }
+  return 0;
+}
+
+__attribute__((noinline)) static int high_unsigned(unsigned x) {
+  switch (x) {
+  case 0xfffffff0u:
+    return 1;
+  case 0xfffffff1u:
+    return 2;
+  case 0xfffffff2u:
+    return 3;
+  case 0xfffffff4u:
+    return 4;
+  case 1:
+    return 5;
+  default:
+    return 0;
+  }
+}
+
+__attribute__((noinline)) static int fall_through(char c) {
+  int n = 0;
+  switch (c) {
+  case 'a':
+    n += 1;
+  case 'b':
+    n += 2;
+  case 'c':
+    n += 4;
+    break;
+  case 'd':
+  case 'e':
+    n += 8;
+  }
+  return n;
+}
+
+__attribute__((noinline)) static int wide(long x) {
+  switch (x) {
+  case 0:
+    return 1;
+  case 1:
+    return 2;
+  case 2:
+    return 3;
+  case 3:
+    return 4;
+  default:
+    return 5;
+  }
+}
+
+__attribute__((noinline)) static int wide_cases(long x) {
+  switch (x) {
+  case 0:
+    return 1;
+  case 0x100000000:
+    return 2;
+  case -1:
+    return 3;
+  case 0x1fffffff0 ... 0x200000010:
+    return 4;
+  case -0x100000000:
+    return 5;
+  default:
+    return 6;
+  }
+}
+
+__attribute__((noinline)) static int wide_unsigned(unsigned long x) {
+  switch (x) {
+  case 7:
+    return 1;
+  case 0xffffffffffffffff:
+    return 2;
+  case 0x8000000000000000 ... 0x8000000100000000:
+    return 3;
+  default:
+    return 4;
+  }
+}
+
+__attribute__((noinline)) static int count_kinds(char *s) {
+  int n = 0;
+  for (; *s; s++) {
+    switch (*s) {
+    case '0' ... '9':
+      n += 1;
+      continue;
+    case '+':
+    case '-':
+    case '*':
+    case '/':
+      n += 10;
+      break;
+    case ' ':
+      continue;
+    default:
+      n += 100;
+    }
+  }
+  return n;
+}
+
+int main(void) {
+  if (dense(-2) != 10 || dense(-1) != 99 || dense(0) != 11 || dense(1) != 12)
+    return 1;
+  if (dense(3) != 13 || dense(4) != 99 || dense(6) != 15 || dense(8) != 99)
+    return 2;
+  if (dense(-3) != 99 || dense(-2147483647 - 1) != 99 || dense(2147483647) != 99)
+    return 3;
+
+  if (sparse(-100000) != 1 || sparse(-7) != 2 || sparse(3) != 3 || sparse(40) != 4)
+    return 4;
+  if (sparse(500) != 5 || sparse(6000) != 6 || sparse(70005) != 7 ||
+      sparse(2000000000) != 8)
+    return 5;
+  if (sparse(-8) != 0 || sparse(4) != 0 || sparse(70011) != 0 || sparse(0) != 0)
+    return 6;
+
+  if (high_unsigned(0xfffffff0u) != 1 || high_unsigned(0xfffffff2u) != 3 ||
+      high_unsigned(0xfffffff3u) != 0 || high_unsigned(0xfffffff4u) != 4)
+    return 7;
+  if (high_unsigned(1) != 5 || high_unsigned(0) != 0 || high_unsigned(0xffffffffu) != 0)
+    return 8;
+
+  if (fall_through('a') != 7 || fall_through('b') != 6 || fall_through('c') != 4)
+    return 9;
+  if (fall_through('e') != 8 || fall_through('z') != 0)
+    return 10;
+
+  if (wide(0) != 1 || wide(3) != 4 || wide(4) != 5 || wide(-1) != 5)
+    return 11;
+
+  if (wide(0x100000000) != 5 || wide(0x100000003) != 5)
+    return 12;
+
+  if (wide_cases(0) != 1 || wide_cases(0x100000000) != 2 || wide_cases(-1) != 3)
+    return 13;
+  if (wide_cases(0x1ffffffff) != 4 || wide_cases(0x200000010) != 4 ||
+      wide_cases(0x200000011) != 6 || wide_cases(0x1ffffffef) != 6)
+    return 14;
+  if (wide_cases(-0x100000000) != 5 || wide_cases(0xffffffff00000000) != 5 ||
+      wide_cases(1) != 6 || wide_cases(-0x7fffffffffffffff - 1) != 6)
+    return 15;
+
+  if (wide_unsigned(7) != 1 || wide_unsigned(0x100000007) != 4 ||
+      wide_unsigned(0xffffffffffffffff) != 2 || wide_unsigned(0xffffffff) != 4)
+    return 16;
+  if (wide_unsigned(0x8000000080000000) != 3 || wide_unsigned(0x8000000100000001) != 4 ||
+      wide_unsigned(0x7fffffffffffffff) != 4)
+    return 17;
+
+  if (count_kinds("12 + 3 * x") != 123)
+    return 18;
+  return 0;
+}
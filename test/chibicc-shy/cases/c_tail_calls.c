@@ -0,0 +1,76 @@
+static int is_odd(unsigned n);
+
+__attribute__((noinline)) static int count_down(int n, int acc) {
+  if (n == 0)
+    return acc;
+  return count_down(n - 1, acc + 2);
+}
+
+__attribute__((noinline)) static int is_even(unsigned n) {
+  if (n == 0)
+    return 1;
+  return is_odd(n - 1);
+}
+
+__attribute__((noinline)) static int is_odd(unsigned n) {
+  if (n == 0)
+    return 0;
+  return is_even(n - 1);
+}
+
+__attribute__((noinline)) static long sum_long(long n, long acc) {
+  if (n == 0)
+    return acc;
+  return sum_long(n - 1, acc + n * 3);
+}
+
+static int total;
+
+__attribute__((noinline)) static void add_all(int n) {
+  if (n == 0)
+    return;
+  total += n;
+  return add_all(n - 1);
+}
+
+__attribute__((noinline)) static int read_ptr(int *p, int extra) {
+  return *p + extra;
+}
+
+__attribute__((noinline)) static int local_addr(int x) {
+  int local = x * 2;
+  return read_ptr(&local, 1);
+}
+
+__attribute__((noinline)) static char low_byte(int x) {
+  return x;
+}
+
+__attribute__((noinline)) static int widen(int x) {
+  return low_byte(x);
+}
+
+__attribute__((noinline)) static int many(int a, int b, int c, int d, int e, int f, int g, int h) {
+  if (a == 0)
+    return b + c + d + e + f + g + h;
+  return many(a - 1, b, c, d, e, f, g, h + 1);
+}
+
+int main(void) {
+  if (count_down(50000, 0) != 100000)
+    return 1;
+  if (!is_even(40000) || is_odd(40000) || !is_odd(30001))
+    return 2;
+  if (sum_long(20000, 0) != 3L * 20000 * 20001 / 2)
+    return 3;
+  add_all(10000);
+  if (total != 10000 * 10001 / 2)
+    return 4;
+  if (local_addr(5) != 11)
+    return 5;
+  if (widen(0x1ff) != -1 || widen(0x17f) != 127)
+    return 6;
+  if (many(30000, 1, 2, 3, 4, 5, 6, 7) != 30028)
+    return 7;
+  return 0;
+}
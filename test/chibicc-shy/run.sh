@@ -40,6 +40,23 @@ run_case c_pointers_arrays.c 0
 run_case c_structs_globals.c 0
 run_case c_calls_varargs.c 0
 run_case c_64bit_casts.c 0
+run_case c_leaf_frameless.c 0
+run_case c_leaf_frameless.c 0 -Wl,--icf
+run_case c_inline_calls.c 0
+run_case c_switch_dispatch.c 0
+run_case c_struct_copy.c 0
+run_case c_64bit_fastpaths.c 0 -llibshy
+run_case c_64bit_fastpaths.c 0 -llibshy -Wl,--gc-sections
+run_case c_peephole.c 0
+run_case c_tail_calls.c 0
+run_case c_loop_opts.c 0
+run_case c_const_div.c 0 -llibshy
+run_case c_opt_levels.c 0 -O0
+run_case c_opt_levels.c 0 -O1
+run_case c_opt_levels.c 0 -Os
+run_case c_opt_levels.c 0
+run_case c_profile_use.c 0 -fprofile-use=test/chibicc-shy/cases/c_profile_use.json
+run_case c_profile_use.c 0 -Wl,--call-graph-profile=test/chibicc-shy/cases/c_profile_use.json
 run_case c_float_ops.c 0 -lfloat
 run_case shyc_impl_methods.shyc 0
 run_case shyc_asm_and_defer.shyc 0
@@ -137,6 +137,10 @@ struct Obj {
   int offset;
   bool is_sret_alias;
   bool is_elided;
+  bool is_addr_taken;
+  char *reg;     // Shy register home in a frameless function
+  char *reg_hi;  // High word register for 64-bit register homes
+  Node *inline_site; // Inlined call whose statement expression owns this local
 
   // Global variable or function
   bool is_function;
@@ -146,11 +150,14 @@ struct Obj {
   // Global variable
   bool is_tentative;
   bool is_tls;
+  bool is_string_literal;
   char *init_data;
   Relocation *rel;
 
   // Function
   bool is_inline;
+  bool is_always_inline;
+  bool is_noinline;
   Obj *params;
   Node *body;
   Obj *locals;
@@ -421,6 +428,10 @@ void add_type(Node *node);
 
 void codegen(Obj *prog, FILE *out);
 void codegen_shy(Obj *prog, FILE *out);
+void peephole_shy(char *text, size_t len, FILE *out);
+void profile_shy_load(char *path);
+bool profile_shy_is_cold(char *name);
+bool profile_shy_is_hot_edge(char *caller, char *callee);
 int align_to(int n, int align);
 
 //
@@ -470,6 +481,16 @@ extern bool opt_target_shy;
 extern bool opt_shy_link_runtime;
 extern bool opt_shy_no_main;
 extern bool opt_shy_emit_source_lines;
+extern bool opt_shy_peephole_stats;
+extern bool opt_shy_frameless;
+extern bool opt_shy_inline;
+extern bool opt_shy_jump_tables;
+extern bool opt_shy_peephole;
+extern bool opt_shy_tail_calls;
+extern bool opt_shy_loop_opts;
+extern bool opt_shy_unroll;
+extern bool opt_shy_strength_reduce;
+extern char *opt_shy_profile_use;
 extern char *opt_shy_mem_hint;
 extern char *opt_shy_stack_hint;
 extern char *base_file;
@@ -30,16 +30,52 @@ struct Rename {
   char *new;
 };
 
+typedef struct {
+  uint32_t lo;
+  uint32_t hi;
+  char *label;
+} SwitchCase;
+
+typedef struct SwitchTable SwitchTable;
+struct SwitchTable {
+  SwitchTable *next;
+  char *name;
+  char **labels;
+  int len;
+};
+
+// A pointer strength-reduced out of a counted loop: `reg` holds
+// `base + i * scale` for the loop counter `i`. See "Loop optimizations".
+typedef struct IvPointer IvPointer;
+struct IvPointer {
+  IvPointer *next;
+  Obj *base;
+  int scale;
+  int32_t step;
+  char *reg;
+  Node **addrs;
+  int naddrs;
+};
+
 static FILE *output_file;
 static Obj *current_fn;
+static bool current_fn_tail_calls;
+static bool current_fn_frameless;
 static int labelseq;
 static bool need_u64_divmod;
 static bool need_u64_mul;
-static bool need_i64_cmp;
+static bool need_copy_words;
+static bool need_zero_words;
+static char *private_prefix;
 
 static char *argreg[] = {"4x", "5x", "6x", "7x", "8x", "9x", "ax", "bx"};
 static int argreg_len = sizeof(argreg) / sizeof(*argreg);
+// Registers the expression generator never uses as scratch when no call is
+// emitted. Frameless leaf functions keep their locals here.
+static char *homereg[] = {"8x", "9x", "ax", "bx", "0x", "ex"};
+static int homereg_len = sizeof(homereg) / sizeof(*homereg);
 static Rename *renames;
+static SwitchTable *switch_tables;
 static char *last_source_filename;
 static int last_source_line;
 
@@ -101,7 +137,7 @@ static char *sanitize(char *s) {
 }
 
 static void rename_private_symbols(Obj *prog) {
-  char *prefix = sanitize(base_file ? base_file : "input");
+  char *prefix = private_prefix = sanitize(base_file ? base_file : "input");
 
   for (Obj *var = prog; var; var = var->next) {
     if (!var->name)
@@ -157,23 +193,62 @@ static int stack_size_of(Type *ty) {
   return align_to(MAX(ty->size, 4), 4);
 }
 
+static int assign_lvar_offset(Obj *fn, Obj *var, int off) {
+  if (var->is_sret_alias || var->is_elided)
+    return off;
+  if ((var == fn->va_area || var == fn->alloca_bottom) &&
+      !node_refs_var(fn->body, var))
+    return off;
+  off = align_to(off, MAX(4, var->align));
+  var->offset = off;
+  return off + stack_size_of(var->ty);
+}
+
+// Locals of an inlined call live only while its statement expression runs,
+// so they are placed above the locals of enclosing inlined calls and share
+// slots with calls that are not nested in each other.
+static void assign_inline_offsets(Obj *fn, Node *node, int off) {
+  for (; node; node = node->next) {
+    int inner = off;
+    if (node->kind == ND_STMT_EXPR) {
+      for (Obj *var = fn->locals; var; var = var->next)
+        if (var->inline_site == node)
+          inner = assign_lvar_offset(fn, var, inner);
+      fn->stack_size = MAX(fn->stack_size, align_to(inner, 4));
+    }
+
+    assign_inline_offsets(fn, node->lhs, inner);
+    assign_inline_offsets(fn, node->rhs, inner);
+    assign_inline_offsets(fn, node->cond, inner);
+    assign_inline_offsets(fn, node->then, inner);
+    assign_inline_offsets(fn, node->els, inner);
+    assign_inline_offsets(fn, node->init, inner);
+    assign_inline_offsets(fn, node->inc, inner);
+    assign_inline_offsets(fn, node->body, inner);
+    assign_inline_offsets(fn, node->args, inner);
+    assign_inline_offsets(fn, node->cas_addr, inner);
+    assign_inline_offsets(fn, node->cas_old, inner);
+    assign_inline_offsets(fn, node->cas_new, inner);
+    assign_inline_offsets(fn, node->atomic_expr, inner);
+  }
+}
+
 static void assign_lvar_offsets(Obj *prog) {
   for (Obj *fn = prog; fn; fn = fn->next) {
     if (!fn->is_function)
       continue;
 
     int off = 0;
+    bool inlined = false;
     for (Obj *var = fn->locals; var; var = var->next) {
-      if (var->is_sret_alias || var->is_elided)
-        continue;
-      if ((var == fn->va_area || var == fn->alloca_bottom) &&
-          !node_refs_var(fn->body, var))
-        continue;
-      off = align_to(off, MAX(4, var->align));
-      var->offset = off;
-      off += stack_size_of(var->ty);
+      if (var->inline_site)
+        inlined = true;
+      else
+        off = assign_lvar_offset(fn, var, off);
     }
     fn->stack_size = align_to(off, 4);
+    if (inlined)
+      assign_inline_offsets(fn, fn->body, fn->stack_size);
   }
 }
 
@@ -241,8 +316,137 @@ static void gen_signed_cmp32_imm(uint32_t imm, bool le) {
   println("setn 2x 0");
 }
 
+// Signed division, remainder and right shift.
+//
+// ShyISA only has unsigned `div` and logical `rs`. Signed operations run on
+// magnitudes: a sign mask (0 or 0xffffffff) is taken from each operand,
+// `(x ^ mask) - mask` makes it non-negative, and the same step restores the
+// sign of the result. Quotients take the sign of both operands and
+// remainders the sign of the dividend, which rounds toward zero as C
+// requires. A right shift instead complements negative values around a
+// logical shift, which rounds toward negative infinity.
+
+static int trailing_zeros(uint64_t v) {
+  int n = 0;
+  while (n < 63 && !(v & 1)) {
+    v >>= 1;
+    n++;
+  }
+  return n;
+}
+
+static void gen_sign_mask(char *mask, char *reg) {
+  println("seta %s %s", mask, reg);
+  println("rsn %s 31", mask);
+  println("muln %s 0xffffffff", mask);
+}
+
+// Negates `reg` if `mask` is all ones.
+static void gen_apply_sign(char *reg, char *mask) {
+  println("xora %s %s", reg, mask);
+  println("suba %s %s", reg, mask);
+}
+
+// 1x %= 3x, unsigned. Clobbers dx.
+static void gen_umod32(void) {
+  println("seta dx 1x");
+  println("diva dx 3x");
+  println("mula dx 3x");
+  println("suba 1x dx");
+}
+
+static bool is_pow2_divisor(uint32_t imm) {
+  return opt_shy_strength_reduce && imm && (imm & (imm - 1)) == 0;
+}
+
+static void gen_umod32_imm(uint32_t imm) {
+  if (is_pow2_divisor(imm)) {
+    println("andn 1x %u", imm - 1);
+    return;
+  }
+  println("seta dx 1x");
+  println("divn dx %u", imm);
+  println("muln dx %u", imm);
+  println("suba 1x dx");
+}
+
+static void gen_udiv32_imm(uint32_t imm) {
+  if (is_pow2_divisor(imm))
+    println("rsn 1x %d", trailing_zeros(imm));
+  else
+    println("divn 1x %u", imm);
+}
+
+// 1x /= 3x or 1x %= 3x, signed. Clobbers 3x, cx and dx.
+static void gen_sdivmod32(bool mod) {
+  gen_sign_mask("cx", "1x");
+  gen_apply_sign("1x", "cx");
+  gen_sign_mask("dx", "3x");
+  gen_apply_sign("3x", "dx");
+  if (mod) {
+    gen_umod32();
+    gen_apply_sign("1x", "cx");
+    return;
+  }
+  println("xora dx cx");
+  println("diva 1x 3x");
+  gen_apply_sign("1x", "dx");
+}
+
+static void gen_sdivmod32_imm(int32_t imm, bool mod) {
+  uint32_t mag = imm < 0 ? -(uint32_t)imm : imm;
+  if (mag == 0) {
+    println("%s 1x 0", mod ? "setn" : "divn");
+    return;
+  }
+  if (mag == 1) {
+    if (mod)
+      println("setn 1x 0");
+    else if (imm < 0) {
+      println("nota 1x");
+      println("addn 1x 1");
+    }
+    return;
+  }
+
+  gen_sign_mask("cx", "1x");
+  gen_apply_sign("1x", "cx");
+  if (mod) {
+    gen_umod32_imm(mag);
+  } else {
+    gen_udiv32_imm(mag);
+    if (imm < 0)
+      println("nota cx");
+  }
+  gen_apply_sign("1x", "cx");
+}
+
+// 1x >>= 3x, arithmetic. Clobbers cx.
+static void gen_sar32(void) {
+  gen_sign_mask("cx", "1x");
+  println("xora 1x cx");
+  println("rsa 1x 3x");
+  println("xora 1x cx");
+}
+
+static void gen_sar32_imm(uint32_t imm) {
+  if (!imm)
+    return;
+  gen_sign_mask("cx", "1x");
+  println("xora 1x cx");
+  println("rsn 1x %u", imm);
+  println("xora 1x cx");
+}
+
 static void gen_expr(Node *node);
+static bool get_imm32(Node *node, uint32_t *val);
 static void gen_stmt(Node *node);
+static Node *tail_call(Node *node);
+static bool gen_unrolled_for(Node *node);
+static IvPointer *reduce_induction_pointers(Node *node);
+static void bump_induction_pointers(IvPointer *outer);
+static void release_induction_pointers(IvPointer *outer);
+static char *induction_reg(Node *node);
 
 static bool asm_uses_addr(Node *node, AsmBinding *binding) {
   char *needle = format("{&%s}", binding->name);
@@ -250,6 +454,8 @@ static bool asm_uses_addr(Node *node, AsmBinding *binding) {
 }
 
 static void gen_var_addr(Obj *var) {
+  if (var->reg)
+    error("internal error: address of register variable %s", var->name);
   if (var->is_local) {
     if (var->is_sret_alias) {
       Obj *retptr = current_fn->params;
@@ -403,6 +609,64 @@ static void store_to_addr_reg(Type *ty, char *addr) {
   }
 }
 
+static bool is_word_int(Type *ty) {
+  return ty->size == 4 && !is_shy_flonum(ty);
+}
+
+// A 32-bit variable living in a register can be read as an operand
+// without going through 1x and the stack.
+// Conversions between 32-bit integer types emit no code.
+static Node *skip_word_casts(Node *node) {
+  while (node->kind == ND_CAST && is_word_int(node->ty) && is_word_int(node->lhs->ty))
+    node = node->lhs;
+  return node;
+}
+
+static char *reg_word(Node *node) {
+  node = skip_word_casts(node);
+  if (induction_reg(node))
+    return induction_reg(node);
+  if (node->kind == ND_VAR && node->var->reg && !node->var->reg_hi &&
+      is_word_int(node->ty))
+    return node->var->reg;
+  return NULL;
+}
+
+// Emits `v = v + imm` and `v = v - imm` on a register-homed 32-bit variable
+// as a single instruction.
+static bool try_gen_reg_update(Obj *var, Node *rhs) {
+  if (!is_word_int(var->ty))
+    return false;
+  rhs = skip_word_casts(rhs);
+  if ((rhs->kind != ND_ADD && rhs->kind != ND_SUB) || !is_word_int(rhs->ty))
+    return false;
+  if (reg_word(rhs->lhs) != var->reg)
+    return false;
+
+  uint32_t imm;
+  if (!get_imm32(rhs->rhs, &imm))
+    return false;
+  println("%s %s %u", rhs->kind == ND_ADD ? "addn" : "subn", var->reg, imm);
+  return true;
+}
+
+// A register pointer, optionally indexed by a register, whose address can
+// be formed in 3x after the value to store is already in 1x.
+static bool is_reg_addr(Node *node) {
+  if (reg_word(node))
+    return true;
+  return node->kind == ND_ADD && reg_word(node->lhs) && reg_word(node->rhs);
+}
+
+static void gen_reg_addr(Node *node) {
+  if (reg_word(node)) {
+    println("seta 3x %s", reg_word(node));
+    return;
+  }
+  println("seta 3x %s", reg_word(node->lhs));
+  println("adda 3x %s", reg_word(node->rhs));
+}
+
 static bool try_gen_simple_assign(Node *node) {
   if (node->lhs->kind != ND_VAR ||
       node->lhs->ty->kind == TY_STRUCT || node->lhs->ty->kind == TY_UNION)
@@ -411,8 +675,18 @@ static bool try_gen_simple_assign(Node *node) {
   Obj *var = node->lhs->var;
   if (var->is_sret_alias)
     return false;
+  if (var->reg && !var->reg_hi && try_gen_reg_update(var, node->rhs)) {
+    println("seta 1x %s", var->reg);
+    return true;
+  }
 
   gen_expr(node->rhs);
+  if (var->reg) {
+    println("seta %s 1x", var->reg);
+    if (var->reg_hi)
+      println("seta %s 2x", var->reg_hi);
+    return true;
+  }
   if (var->is_local) {
     if (var->offset) {
       println("setn 3x %d", var->offset);
@@ -427,23 +701,34 @@ static bool try_gen_simple_assign(Node *node) {
   return true;
 }
 
+// Block copies and zeroing up to these many words are emitted as straight
+// line code. Larger blocks call a helper private to the translation unit.
+#define COPY_INLINE_WORDS 8
+#define ZERO_INLINE_WORDS 16
+
+static char *block_helper(char *name) {
+  return format(".L.shy.%s.%s", private_prefix, name);
+}
+
+// Copies ty->size bytes from the address in 1x to the address in 3x,
+// clobbering cx and dx.
 static void copy_bytes(Type *ty) {
-  int c = count();
   int words = ty->size / 4;
   int tail = ty->size % 4;
 
-  if (words) {
+  if (words > COPY_INLINE_WORDS) {
+    need_copy_words = true;
     println("setn cx %d", words);
-    println(".L.copy.words.%d:", c);
-    println("equn cx 0");
-    println("jmpn .L.copy.words.done.%d", c);
-    println("geta dx 1x");
-    println("puta 3x dx");
-    println("addn 1x 4");
-    println("addn 3x 4");
-    println("subn cx 1");
-    println("ujmpn .L.copy.words.%d", c);
-    println(".L.copy.words.done.%d:", c);
+    println("calln %s", block_helper("__shy_copy_words"));
+  } else {
+    for (int i = 0; i < words; i++) {
+      println("geta dx 1x");
+      println("puta 3x dx");
+      if (i + 1 < words || tail) {
+        println("addn 1x 4");
+        println("addn 3x 4");
+      }
+    }
   }
 
   if (tail & 2) {
@@ -461,6 +746,22 @@ static void copy_bytes(Type *ty) {
   }
 }
 
+// Zeroes words starting at the address in 3x, clobbering cx.
+static void zero_words(int words) {
+  if (words > ZERO_INLINE_WORDS) {
+    need_zero_words = true;
+    println("setn cx %d", words);
+    println("calln %s", block_helper("__shy_zero_words"));
+    return;
+  }
+
+  for (int i = 0; i < words; i++) {
+    println("putn 3x 0");
+    if (i + 1 < words)
+      println("addn 3x 4");
+  }
+}
+
 static void copy_struct_return_to_hidden_buffer(Node *expr) {
   Type *ty = current_fn->ty->return_ty;
   Obj *retptr = current_fn->params;
@@ -505,8 +806,6 @@ static void call_helper(char *name) {
     need_u64_divmod = true;
   if (!strcmp(name, "__shy_u64_mul") || !strcmp(name, "__shy_i64_mul"))
     need_u64_mul = true;
-  if (!strcmp(name, "__shy_i64_lt") || !strcmp(name, "__shy_i64_le"))
-    need_i64_cmp = true;
   println("calln %s", name);
 }
 
@@ -707,6 +1006,226 @@ static void gen_64_shr(bool is_unsigned) {
   println(".L.u64.shr.done.%d:", c);
 }
 
+// Constant operand fast paths for 64-bit values. The value is in 1x/2x.
+
+static void gen_64_shl_imm(uint32_t k) {
+  if (k == 0)
+    return;
+  if (k >= 64) {
+    println("setn 1x 0");
+    println("setn 2x 0");
+  } else if (k >= 32) {
+    println("seta 2x 1x");
+    println("lsn 2x %u", k - 32);
+    println("setn 1x 0");
+  } else {
+    println("seta dx 1x");
+    println("rsn dx %u", 32 - k);
+    println("lsn 2x %u", k);
+    println("ora 2x dx");
+    println("lsn 1x %u", k);
+  }
+}
+
+static void gen_64_shr_imm(uint32_t k, bool is_unsigned) {
+  if (k == 0)
+    return;
+  if (k > 63)
+    k = 63 + is_unsigned;
+
+  // dx holds the words shifted in at the top: zero, or all ones when a
+  // signed value is negative.
+  if (is_unsigned) {
+    println("setn dx 0");
+  } else {
+    println("seta dx 2x");
+    println("rsn dx 31");
+    println("muln dx 0xffffffff");
+  }
+
+  if (k >= 64) {
+    println("seta 1x dx");
+    println("seta 2x dx");
+  } else if (k >= 32) {
+    println("seta 1x 2x");
+    if (k > 32) {
+      println("rsn 1x %u", k - 32);
+      println("seta 2x dx");
+      println("lsn 2x %u", 64 - k);
+      println("ora 1x 2x");
+    }
+    println("seta 2x dx");
+  } else {
+    println("seta 3x 2x");
+    println("lsn 3x %u", 32 - k);
+    println("rsn 1x %u", k);
+    println("ora 1x 3x");
+    println("rsn 2x %u", k);
+    println("lsn dx %u", 32 - k);
+    println("ora 2x dx");
+  }
+}
+
+// Multiplies by a constant below 2^16 without the shift-and-add loop: the
+// low word is split into 16-bit halves whose products fit in 32 bits.
+static void gen_64_mul_imm(uint64_t imm) {
+  if (imm == 0) {
+    println("setn 1x 0");
+    println("setn 2x 0");
+    return;
+  }
+  if ((imm & (imm - 1)) == 0) {
+    gen_64_shl_imm(trailing_zeros(imm));
+    return;
+  }
+  if (imm >= 0x10000) {
+    println("setn 3x %u", (uint32_t)imm);
+    println("setn cx %u", (uint32_t)(imm >> 32));
+    gen_64_mul();
+    return;
+  }
+
+  int c = count();
+  println("muln 2x %u", (uint32_t)imm);
+  println("seta 3x 1x");
+  println("rsn 3x 16");
+  println("muln 3x %u", (uint32_t)imm);
+  println("andn 1x 0xffff");
+  println("muln 1x %u", (uint32_t)imm);
+  println("seta cx 3x");
+  println("rsn cx 16");
+  println("adda 2x cx");
+  println("lsn 3x 16");
+  println("seta dx 1x");
+  println("adda 1x 3x");
+  println("bigequa 1x dx");
+  println("jmpn .L.mul64.imm.%d", c);
+  println("addn 2x 1");
+  println(".L.mul64.imm.%d:", c);
+}
+
+// Signed division by 2^k rounds toward zero, so negative dividends are
+// biased by 2^k - 1 before the arithmetic shift.
+static void gen_64_sdiv_pow2(uint32_t k) {
+  int c = count();
+  uint64_t bias = ((uint64_t)1 << k) - 1;
+  println("seta dx 2x");
+  println("rsn dx 31");
+  println("equn dx 0");
+  println("jmpn .L.sdiv64.pos.%d", c);
+  println("setn 3x %u", (uint32_t)bias);
+  println("setn cx %u", (uint32_t)(bias >> 32));
+  gen_64_add();
+  println(".L.sdiv64.pos.%d:", c);
+  gen_64_shr_imm(k, false);
+}
+
+static void gen_64_umod_pow2(uint32_t k) {
+  if (k >= 32) {
+    if (k == 32)
+      println("setn 2x 0");
+    else
+      println("andn 2x %u", (uint32_t)(((uint64_t)1 << (k - 32)) - 1));
+    return;
+  }
+  println("andn 1x %u", (uint32_t)(((uint64_t)1 << k) - 1));
+  println("setn 2x 0");
+}
+
+// Compares the 64-bit values in 1x/2x and 3x/cx. The high words decide
+// unless they are equal. A signed compare flips both sign bits first so
+// that the unsigned compare instructions order the high words correctly.
+static void gen_64_cmp(bool is_unsigned, bool le) {
+  int c = count();
+  if (!is_unsigned) {
+    println("xorn 2x 0x80000000");
+    println("xorn cx 0x80000000");
+  }
+  println("equa 2x cx");
+  println("jmpn .L.cmp64.low.%d", c);
+  println("smaa 2x cx");
+  println("ujmpn .L.cmp64.end.%d", c);
+  println(".L.cmp64.low.%d:", c);
+  println("%s 1x 3x", le ? "smaequa" : "smaa");
+  println(".L.cmp64.end.%d:", c);
+  set_bool_from_rs();
+}
+
+static void gen_64_cmp_imm(uint64_t imm, bool is_unsigned, bool le) {
+  int c = count();
+  uint32_t hi = imm >> 32;
+  if (!is_unsigned) {
+    println("xorn 2x 0x80000000");
+    hi ^= 0x80000000;
+  }
+  println("equn 2x %u", hi);
+  println("jmpn .L.cmp64.low.%d", c);
+  println("sman 2x %u", hi);
+  println("ujmpn .L.cmp64.end.%d", c);
+  println(".L.cmp64.low.%d:", c);
+  println("%s 1x %u", le ? "smaequn" : "sman", (uint32_t)imm);
+  println(".L.cmp64.end.%d:", c);
+  set_bool_from_rs();
+}
+
+// Narrows the 32-bit value in 1x to `ty`, sign- or zero-extending it back.
+static void cast_to_32(Type *ty) {
+  switch (ty->kind) {
+  case TY_BOOL:
+    println("equn 1x 0");
+    {
+      int c = count();
+      println("setn 1x 1");
+      println("jmpn .L.cast.bool.false.%d", c);
+      println("ujmpn .L.cast.bool.end.%d", c);
+      println(".L.cast.bool.false.%d:", c);
+      println("setn 1x 0");
+      println(".L.cast.bool.end.%d:", c);
+      println("setn 2x 0");
+    }
+    break;
+  case TY_CHAR:
+    println("andn 1x 0xff");
+    if (!ty->is_unsigned) {
+      int c = count();
+      println("bign 1x 127");
+      println("jmpn .L.cast.sign8.%d", c);
+      println("ujmpn .L.cast.end8.%d", c);
+      println(".L.cast.sign8.%d:", c);
+      println("orn 1x 0xffffff00");
+      println(".L.cast.end8.%d:", c);
+    }
+    println("setn 2x 0");
+    break;
+  case TY_SHORT:
+    println("andn 1x 0xffff");
+    if (!ty->is_unsigned) {
+      int c = count();
+      println("bign 1x 32767");
+      println("jmpn .L.cast.sign16.%d", c);
+      println("ujmpn .L.cast.end16.%d", c);
+      println(".L.cast.sign16.%d:", c);
+      println("orn 1x 0xffff0000");
+      println(".L.cast.end16.%d:", c);
+    }
+    println("setn 2x 0");
+    break;
+  default:
+    println("setn 2x 0");
+  }
+}
+
+// Loads and casts leave a char or short value zero- or sign-extended in 1x,
+// so converting it to the same type again emits no code.
+static bool is_extended(Node *node, Type *ty) {
+  Type *from = node->ty;
+  if (from->kind != ty->kind || from->is_unsigned != ty->is_unsigned ||
+      (ty->kind != TY_CHAR && ty->kind != TY_SHORT))
+    return false;
+  return node->kind == ND_DEREF || node->kind == ND_CAST ||
+         (node->kind == ND_MEMBER && !node->member->is_bitfield);
+}
+
 static bool get_imm32(Node *node, uint32_t *val) {
   if (node->kind == ND_NUM && !is_shy_flonum(node->ty) && !vinfo(node->ty).is64) {
     *val = (uint32_t)node->val;
@@ -736,54 +1255,218 @@ static bool get_imm32(Node *node, uint32_t *val) {
   }
 }
 
-static bool try_gen_binary_imm(Node *node) {
-  VInfo lvi = vinfo(node->lhs->ty);
-  VInfo rvi = vinfo(node->rhs->ty);
-  VInfo vi = vinfo(node->ty);
-  uint32_t imm;
-  if (is_shy_flonum(node->lhs->ty) || is_shy_flonum(node->rhs->ty) ||
-      lvi.is64 || rvi.is64 || vi.is64 || !get_imm32(node->rhs, &imm))
-    return false;
-
-  gen_expr(node->lhs);
-
+// lhs: 1x/2x, rhs: 3x/cx. Result: 1x/2x.
+static void gen_binary_64(Node *node) {
   switch (node->kind) {
   case ND_ADD:
-    println("addn 1x %u", imm);
-    return true;
+    gen_64_add();
+    return;
   case ND_SUB:
-    println("subn 1x %u", imm);
-    return true;
+    gen_64_sub();
+    return;
   case ND_MUL:
-    println("muln 1x %u", imm);
-    return true;
+    gen_64_mul();
+    return;
   case ND_DIV:
-    println("divn 1x %u", imm);
-    return true;
+    call_helper_64_64(node->ty->is_unsigned ? "__shy_u64_div" : "__shy_i64_div");
+    return;
   case ND_MOD:
-    println("seta dx 1x");
-    println("divn 1x %u", imm);
-    println("muln 1x %u", imm);
-    println("suba dx 1x");
-    println("seta 1x dx");
-    return true;
+    call_helper_64_64(node->ty->is_unsigned ? "__shy_u64_mod" : "__shy_i64_mod");
+    return;
   case ND_BITAND:
-    println("andn 1x %u", imm);
-    return true;
+    println("anda 1x 3x");
+    println("anda 2x cx");
+    return;
   case ND_BITOR:
-    println("orn 1x %u", imm);
-    return true;
+    println("ora 1x 3x");
+    println("ora 2x cx");
+    return;
   case ND_BITXOR:
-    println("xorn 1x %u", imm);
-    return true;
-  case ND_EQ:
-    println("equn 1x %u", imm);
-    set_bool_from_rs();
-    return true;
-  case ND_NE: {
-    int c = count();
-    println("equn 1x %u", imm);
-    println("setn 1x 1");
+    println("xora 1x 3x");
+    println("xora 2x cx");
+    return;
+  case ND_SHL:
+    gen_64_shl();
+    return;
+  case ND_SHR:
+    gen_64_shr(node->ty->is_unsigned);
+    return;
+  case ND_EQ: {
+    println("xora 1x 3x");
+    println("xora 2x cx");
+    println("ora 1x 2x");
+    println("equn 1x 0");
+    set_bool_from_rs();
+    return;
+  }
+  case ND_NE: {
+    println("xora 1x 3x");
+    println("xora 2x cx");
+    println("ora 1x 2x");
+    println("equn 1x 0");
+    int c = count();
+    println("setn 1x 1");
+    println("jmpn .L.ne.false.%d", c);
+    println("ujmpn .L.ne.end.%d", c);
+    println(".L.ne.false.%d:", c);
+    println("setn 1x 0");
+    println(".L.ne.end.%d:", c);
+    println("setn 2x 0");
+    return;
+  }
+  case ND_LT:
+  case ND_LE:
+    gen_64_cmp(node->lhs->ty->is_unsigned, node->kind == ND_LE);
+    return;
+  default:
+    unsupported(node, "64-bit operator");
+  }
+}
+
+static bool get_imm64(Node *node, uint64_t *val) {
+  if (is_shy_flonum(node->ty) || !vinfo(node->ty).is64)
+    return false;
+  if (node->kind == ND_NUM) {
+    *val = node->val;
+    return true;
+  }
+  if (node->kind != ND_CAST || is_shy_flonum(node->lhs->ty))
+    return false;
+  if (vinfo(node->lhs->ty).is64)
+    return get_imm64(node->lhs, val);
+
+  uint32_t inner;
+  if (!get_imm32(node->lhs, &inner))
+    return false;
+  *val = node->lhs->ty->is_unsigned ? inner : (uint64_t)(int64_t)(int32_t)inner;
+  return true;
+}
+
+static bool try_gen_binary_imm64(Node *node) {
+  VInfo lvi = vinfo(node->lhs->ty);
+  VInfo vi = vinfo(node->ty);
+  if (is_shy_flonum(node->lhs->ty) || is_shy_flonum(node->rhs->ty) ||
+      (!lvi.is64 && !vi.is64))
+    return false;
+
+  uint64_t imm;
+  uint32_t imm32;
+  if (get_imm64(node->rhs, &imm))
+    ;
+  else if (!vinfo(node->rhs->ty).is64 && get_imm32(node->rhs, &imm32))
+    imm = imm32;
+  else
+    return false;
+
+  bool is_unsigned = node->ty->is_unsigned;
+  bool pow2 = opt_shy_strength_reduce && imm && (imm & (imm - 1)) == 0 &&
+              (is_unsigned || imm >> 63 == 0);
+  int k = trailing_zeros(imm);
+
+  gen_expr(node->lhs);
+  if (!lvi.is64)
+    println("setn 2x 0");
+
+  switch (node->kind) {
+  case ND_MUL:
+    gen_64_mul_imm(imm);
+    return true;
+  case ND_DIV:
+    if (!pow2)
+      break;
+    if (is_unsigned)
+      gen_64_shr_imm(k, true);
+    else if (k)
+      gen_64_sdiv_pow2(k);
+    return true;
+  case ND_MOD:
+    if (!pow2)
+      break;
+    if (is_unsigned) {
+      gen_64_umod_pow2(k);
+      return true;
+    }
+    println("seta 4x 1x");
+    println("seta 5x 2x");
+    if (k)
+      gen_64_sdiv_pow2(k);
+    gen_64_shl_imm(k);
+    println("seta 3x 1x");
+    println("seta cx 2x");
+    println("seta 1x 4x");
+    println("seta 2x 5x");
+    gen_64_sub();
+    return true;
+  case ND_SHL:
+    gen_64_shl_imm(imm > 64 ? 64 : imm);
+    return true;
+  case ND_SHR:
+    gen_64_shr_imm(imm > 64 ? 64 : imm, is_unsigned);
+    return true;
+  case ND_LT:
+  case ND_LE:
+    gen_64_cmp_imm(imm, node->lhs->ty->is_unsigned, node->kind == ND_LE);
+    return true;
+  default:
+    break;
+  }
+
+  println("setn 3x %u", (uint32_t)imm);
+  println("setn cx %u", (uint32_t)(imm >> 32));
+  gen_binary_64(node);
+  return true;
+}
+
+static bool try_gen_binary_imm(Node *node) {
+  VInfo lvi = vinfo(node->lhs->ty);
+  VInfo rvi = vinfo(node->rhs->ty);
+  VInfo vi = vinfo(node->ty);
+  uint32_t imm;
+  if (is_shy_flonum(node->lhs->ty) || is_shy_flonum(node->rhs->ty) ||
+      lvi.is64 || rvi.is64 || vi.is64 || !get_imm32(node->rhs, &imm))
+    return false;
+
+  gen_expr(node->lhs);
+
+  switch (node->kind) {
+  case ND_ADD:
+    println("addn 1x %u", imm);
+    return true;
+  case ND_SUB:
+    println("subn 1x %u", imm);
+    return true;
+  case ND_MUL:
+    println("muln 1x %u", imm);
+    return true;
+  case ND_DIV:
+    if (node->ty->is_unsigned)
+      gen_udiv32_imm(imm);
+    else
+      gen_sdivmod32_imm(imm, false);
+    return true;
+  case ND_MOD:
+    if (node->ty->is_unsigned)
+      gen_umod32_imm(imm);
+    else
+      gen_sdivmod32_imm(imm, true);
+    return true;
+  case ND_BITAND:
+    println("andn 1x %u", imm);
+    return true;
+  case ND_BITOR:
+    println("orn 1x %u", imm);
+    return true;
+  case ND_BITXOR:
+    println("xorn 1x %u", imm);
+    return true;
+  case ND_EQ:
+    println("equn 1x %u", imm);
+    set_bool_from_rs();
+    return true;
+  case ND_NE: {
+    int c = count();
+    println("equn 1x %u", imm);
+    println("setn 1x 1");
     println("jmpn .L.ne.false.%d", c);
     println("ujmpn .L.ne.end.%d", c);
     println(".L.ne.false.%d:", c);
@@ -812,25 +1495,62 @@ static bool try_gen_binary_imm(Node *node) {
     println("lsn 1x %u", imm);
     return true;
   case ND_SHR:
-    println("rsn 1x %u", imm);
+    if (node->lhs->ty->is_unsigned)
+      println("rsn 1x %u", imm);
+    else
+      gen_sar32_imm(imm);
     return true;
   default:
     return false;
   }
 }
 
+static bool is_commutative(Node *node) {
+  switch (node->kind) {
+  case ND_ADD:
+  case ND_MUL:
+  case ND_BITAND:
+  case ND_BITOR:
+  case ND_BITXOR:
+  case ND_EQ:
+  case ND_NE:
+    return !is_shy_flonum(node->lhs->ty);
+  default:
+    return false;
+  }
+}
+
 static void gen_binary(Node *node) {
-  if (try_gen_binary_imm(node))
+  char *iv = induction_reg(node);
+  if (iv) {
+    println("seta 1x %s", iv);
+    println("setn 2x 0");
+    return;
+  }
+  if (try_gen_binary_imm(node) || try_gen_binary_imm64(node))
     return;
 
   VInfo lvi = vinfo(node->lhs->ty);
   VInfo rvi = vinfo(node->rhs->ty);
   VInfo vi = vinfo(node->ty);
 
-  gen_expr(node->rhs);
-  push_value(rvi);
-  gen_expr(node->lhs);
-  pop_value(rvi, "3x", "cx");
+  if (reg_word(node->rhs)) {
+    gen_expr(node->lhs);
+    println("seta 3x %s", reg_word(node->rhs));
+  } else if (reg_word(node->lhs) && !rvi.is64) {
+    gen_expr(node->rhs);
+    if (is_commutative(node)) {
+      println("seta 3x %s", reg_word(node->lhs));
+    } else {
+      println("seta 3x 1x");
+      println("seta 1x %s", reg_word(node->lhs));
+    }
+  } else {
+    gen_expr(node->rhs);
+    push_value(rvi);
+    gen_expr(node->lhs);
+    pop_value(rvi, "3x", "cx");
+  }
 
   if (is_shy_flonum(node->lhs->ty) || is_shy_flonum(node->rhs->ty)) {
     char *prefix = node->lhs->ty->kind == TY_FLOAT ? "__shy_f32" : "__shy_f64";
@@ -893,71 +1613,8 @@ static void gen_binary(Node *node) {
       println("setn 2x 0");
     if (!rvi.is64)
       println("setn cx 0");
-
-    switch (node->kind) {
-    case ND_ADD:
-      gen_64_add();
-      return;
-    case ND_SUB:
-      gen_64_sub();
-      return;
-    case ND_MUL:
-      gen_64_mul();
-      return;
-    case ND_DIV:
-      call_helper_64_64(node->ty->is_unsigned ? "__shy_u64_div" : "__shy_i64_div");
-      return;
-    case ND_MOD:
-      call_helper_64_64(node->ty->is_unsigned ? "__shy_u64_mod" : "__shy_i64_mod");
-      return;
-    case ND_BITAND:
-      println("anda 1x 3x");
-      println("anda 2x cx");
-      return;
-    case ND_BITOR:
-      println("ora 1x 3x");
-      println("ora 2x cx");
-      return;
-    case ND_BITXOR:
-      println("xora 1x 3x");
-      println("xora 2x cx");
-      return;
-    case ND_SHL:
-      gen_64_shl();
-      return;
-    case ND_SHR:
-      gen_64_shr(node->ty->is_unsigned);
-      return;
-    case ND_EQ: {
-      println("xora 1x 3x");
-      println("xora 2x cx");
-      println("ora 1x 2x");
-      println("equn 1x 0");
-      set_bool_from_rs();
-      return;
-    }
-    case ND_NE: {
-      println("xora 1x 3x");
-      println("xora 2x cx");
-      println("ora 1x 2x");
-      println("equn 1x 0");
-      int c = count();
-      println("setn 1x 1");
-      println("jmpn .L.ne.false.%d", c);
-      println("ujmpn .L.ne.end.%d", c);
-      println(".L.ne.false.%d:", c);
-      println("setn 1x 0");
-      println(".L.ne.end.%d:", c);
-      println("setn 2x 0");
-      return;
-    }
-    case ND_LT:
-    case ND_LE:
-      call_helper_64_64(node->kind == ND_LT ? "__shy_i64_lt" : "__shy_i64_le");
-      return;
-    default:
-      unsupported(node, "64-bit operator");
-    }
+    gen_binary_64(node);
+    return;
   }
 
   switch (node->kind) {
@@ -971,14 +1628,16 @@ static void gen_binary(Node *node) {
     println("mula 1x 3x");
     return;
   case ND_DIV:
-    println("diva 1x 3x");
+    if (node->ty->is_unsigned)
+      println("diva 1x 3x");
+    else
+      gen_sdivmod32(false);
     return;
   case ND_MOD:
-    println("seta dx 1x");
-    println("diva 1x 3x");
-    println("mula 1x 3x");
-    println("suba dx 1x");
-    println("seta 1x dx");
+    if (node->ty->is_unsigned)
+      gen_umod32();
+    else
+      gen_sdivmod32(true);
     return;
   case ND_BITAND:
     println("anda 1x 3x");
@@ -1025,13 +1684,203 @@ static void gen_binary(Node *node) {
     println("lsa 1x 3x");
     return;
   case ND_SHR:
-    println("rsa 1x 3x");
+    if (node->lhs->ty->is_unsigned)
+      println("rsa 1x 3x");
+    else
+      gen_sar32();
     return;
   default:
     unsupported(node, "binary operator");
   }
 }
 
+static bool is_const_num(Node *node) {
+  while (node->kind == ND_CAST)
+    node = node->lhs;
+  return node->kind == ND_NUM;
+}
+
+// Evaluates `node` for its side effects only. Postfix `++` and `--` are
+// parsed as `(T)((x += 1) - 1)`, and the correction is dropped here.
+static Node *discarded_value(Node *node) {
+  for (;;) {
+    if (node->kind == ND_CAST && !is_shy_flonum(node->ty) &&
+        !is_shy_flonum(node->lhs->ty)) {
+      node = node->lhs;
+      continue;
+    }
+    if ((node->kind == ND_ADD || node->kind == ND_SUB) && is_const_num(node->rhs) &&
+        !is_shy_flonum(node->ty)) {
+      node = node->lhs;
+      continue;
+    }
+    return node;
+  }
+}
+
+static void gen_discard(Node *node) {
+  node = discarded_value(node);
+  if (node->kind == ND_COMMA) {
+    gen_discard(node->lhs);
+    gen_discard(node->rhs);
+    return;
+  }
+  if (node->kind == ND_ASSIGN && node->lhs->kind == ND_VAR && node->lhs->var->reg &&
+      !node->lhs->var->reg_hi && try_gen_reg_update(node->lhs->var, node->rhs))
+    return;
+  gen_expr(node);
+}
+
+// Conditional branches.
+//
+// Conditions of `if`, loops and `?:` jump on the result of one compare
+// instruction instead of materializing a 0/1 value and testing it. Shy
+// compares are unsigned, so signed operands are biased by 0x80000000 first.
+// There is no "not equal" compare; `a != b` tests `a ^ b` for being nonzero.
+
+typedef enum {
+  REL_EQ,
+  REL_NE,
+  REL_LT,
+  REL_LE,
+  REL_GT,
+  REL_GE,
+} Relation;
+
+static Relation negate_rel(Relation rel) {
+  static Relation neg[] = {REL_NE, REL_EQ, REL_GE, REL_GT, REL_LE, REL_LT};
+  return neg[rel];
+}
+
+static Relation swap_rel(Relation rel) {
+  static Relation swapped[] = {REL_EQ, REL_NE, REL_GT, REL_GE, REL_LT, REL_LE};
+  return swapped[rel];
+}
+
+static bool gen_cmp_branch(Node *node, bool when, char *label) {
+  Type *ty = node->lhs->ty;
+  if (is_shy_flonum(ty) || is_shy_flonum(node->rhs->ty) ||
+      vinfo(ty).is64 || vinfo(node->rhs->ty).is64)
+    return false;
+
+  Relation rel = node->kind == ND_EQ ? REL_EQ :
+                 node->kind == ND_NE ? REL_NE :
+                 node->kind == ND_LT ? REL_LT : REL_LE;
+  if (!when)
+    rel = negate_rel(rel);
+
+  Node *lhs = node->lhs;
+  Node *rhs = node->rhs;
+  uint32_t imm;
+  bool has_imm = true;
+  if (!get_imm32(rhs, &imm)) {
+    if (get_imm32(lhs, &imm)) {
+      lhs = node->rhs;
+      rhs = node->lhs;
+      rel = swap_rel(rel);
+    } else {
+      has_imm = false;
+    }
+  }
+
+  // Register variables are compared in place unless the compare sequence
+  // has to rewrite them: `!=` clobbers the left operand and the signed
+  // bias clobbers both.
+  bool bias = rel != REL_EQ && rel != REL_NE && !ty->is_unsigned;
+  char *l = (bias || rel == REL_NE) ? NULL : reg_word(lhs);
+  char *r = has_imm ? NULL : reg_word(rhs);
+
+  if (has_imm || r) {
+    if (!l) {
+      gen_expr(lhs);
+      l = "1x";
+    }
+    if (r && bias) {
+      println("seta 3x %s", r);
+      r = "3x";
+    }
+  } else if (l) {
+    gen_expr(rhs);
+    r = "1x";
+  } else {
+    gen_expr(rhs);
+    push32("1x");
+    gen_expr(lhs);
+    pop32("3x");
+    l = "1x";
+    r = "3x";
+  }
+
+  if (rel == REL_EQ || rel == REL_NE) {
+    if (!has_imm)
+      println("%s %s %s", rel == REL_EQ ? "equa" : "xora", l, r);
+    else if (rel == REL_EQ)
+      println("equn %s %u", l, imm);
+    else if (imm)
+      println("xorn %s %u", l, imm);
+    if (rel == REL_NE)
+      println("bign %s 0", l);
+    println("jmpn %s", label);
+    return true;
+  }
+
+  if (bias) {
+    println("xorn %s 0x80000000", l);
+    if (has_imm)
+      imm ^= 0x80000000;
+    else
+      println("xorn %s 0x80000000", r);
+  }
+
+  static char *insn[] = {NULL, NULL, "sma", "smaequ", "big", "bigequ"};
+  if (has_imm)
+    println("%sn %s %u", insn[rel], l, imm);
+  else
+    println("%sa %s %s", insn[rel], l, r);
+  println("jmpn %s", label);
+  return true;
+}
+
+// Jumps to `label` if `node` evaluates to `when` and falls through
+// otherwise.
+static void gen_branch(Node *node, bool when, char *label) {
+  switch (node->kind) {
+  case ND_NOT:
+    gen_branch(node->lhs, !when, label);
+    return;
+  case ND_LOGAND:
+  case ND_LOGOR: {
+    // `a && b` jumps when false as soon as either operand is false, and
+    // `a || b` jumps when true as soon as either operand is true.
+    if ((node->kind == ND_LOGAND) != when) {
+      gen_branch(node->lhs, when, label);
+      gen_branch(node->rhs, when, label);
+      return;
+    }
+    char *skip = format(".L.branch.%d", count());
+    gen_branch(node->lhs, !when, skip);
+    gen_branch(node->rhs, when, label);
+    println("%s:", skip);
+    return;
+  }
+  case ND_EQ:
+  case ND_NE:
+  case ND_LT:
+  case ND_LE:
+    if (gen_cmp_branch(node, when, label))
+      return;
+    break;
+  default:
+    break;
+  }
+
+  gen_expr(node);
+  if (vinfo(node->ty).is64)
+    println("ora 1x 2x");
+  println("%s 1x 0", when ? "bign" : "equn");
+  println("jmpn %s", label);
+}
+
 static int count_arg_slots(Node *args) {
   int n = 0;
   for (Node *arg = args; arg; arg = arg->next)
@@ -1055,6 +1904,26 @@ static void push_args_reverse(Node *arg) {
   push_value(vi);
 }
 
+// Loads the arguments of a call into the argument registers.
+static void gen_call_args(Node *node) {
+  int slots = count_funcall_slots(node);
+  if (slots > argreg_len)
+    unsupported(node, "function calls with too many register arguments");
+
+  push_args_reverse(node->args);
+  if (node->ret_buffer && returns_by_sret(node->ty)) {
+    VInfo vi = vinfo(pointer_to(node->ty));
+    gen_var_addr(node->ret_buffer);
+    push_value(vi);
+  }
+
+  for (int i = 0; i < slots; i++)
+    pop32(argreg[i]);
+
+  if (node->lhs->kind != ND_VAR)
+    unsupported(node, "indirect function call");
+}
+
 static void gen_expr(Node *node) {
   switch (node->kind) {
   case ND_NULL_EXPR:
@@ -1102,9 +1971,17 @@ static void gen_expr(Node *node) {
     }
     return;
   case ND_VAR:
-    gen_addr(node);
-    load(node->ty);
-    return;
+    if (node->var->reg) {
+      println("seta 1x %s", node->var->reg);
+      if (node->var->reg_hi)
+        println("seta 2x %s", node->var->reg_hi);
+      else
+        println("setn 2x 0");
+      return;
+    }
+    gen_addr(node);
+    load(node->ty);
+    return;
   case ND_MEMBER:
     gen_addr(node);
     if (node->ty->kind == TY_ARRAY)
@@ -1125,6 +2002,12 @@ static void gen_expr(Node *node) {
     }
     if (try_gen_simple_assign(node))
       return;
+    if (node->lhs->kind == ND_DEREF && is_reg_addr(node->lhs->lhs)) {
+      gen_expr(node->rhs);
+      gen_reg_addr(node->lhs->lhs);
+      store_to_addr_reg(node->lhs->ty, "3x");
+      return;
+    }
     gen_addr(node->lhs);
     push32("1x");
     gen_expr(node->rhs);
@@ -1164,58 +2047,26 @@ static void gen_expr(Node *node) {
         println("setn 2x 0");
         println(".L.cast.end.%d:", c);
       }
-    } else if (!vinfo(node->ty).is64) {
-      switch (node->ty->kind) {
-      case TY_BOOL:
-        println("equn 1x 0");
-        {
-          int c = count();
-          println("setn 1x 1");
-          println("jmpn .L.cast.bool.false.%d", c);
-          println("ujmpn .L.cast.bool.end.%d", c);
-          println(".L.cast.bool.false.%d:", c);
-          println("setn 1x 0");
-          println(".L.cast.bool.end.%d:", c);
-          println("setn 2x 0");
-        }
-        break;
-      case TY_CHAR:
-        println("andn 1x 0xff");
-        if (!node->ty->is_unsigned) {
-          int c = count();
-          println("bign 1x 127");
-          println("jmpn .L.cast.sign8.%d", c);
-          println("ujmpn .L.cast.end8.%d", c);
-          println(".L.cast.sign8.%d:", c);
-          println("orn 1x 0xffffff00");
-          println(".L.cast.end8.%d:", c);
-        }
-        println("setn 2x 0");
-        break;
-      case TY_SHORT:
-        println("andn 1x 0xffff");
-        if (!node->ty->is_unsigned) {
-          int c = count();
-          println("bign 1x 32767");
-          println("jmpn .L.cast.sign16.%d", c);
-          println("ujmpn .L.cast.end16.%d", c);
-          println(".L.cast.sign16.%d:", c);
-          println("orn 1x 0xffff0000");
-          println(".L.cast.end16.%d:", c);
-        }
-        println("setn 2x 0");
-        break;
-      default:
-        println("setn 2x 0");
-      }
+    } else if (!vinfo(node->ty).is64 && !is_extended(node->lhs, node->ty)) {
+      cast_to_32(node->ty);
     }
     return;
   case ND_MEMZERO:
-    for (int off = 0; off < node->var->ty->size; off += 4) {
-      println("setn 3x %d", node->var->offset + off);
+    if (node->var->reg) {
+      println("setn %s 0", node->var->reg);
+      if (node->var->reg_hi)
+        println("setn %s 0", node->var->reg_hi);
+      println("setn 1x 0");
+      println("setn 2x 0");
+      return;
+    }
+    if (node->var->offset) {
+      println("setn 3x %d", node->var->offset);
       println("adda 3x fx");
-      println("putn 3x 0");
+    } else {
+      println("seta 3x fx");
     }
+    zero_words(stack_size_of(node->var->ty) / 4);
     println("setn 1x 0");
     println("setn 2x 0");
     return;
@@ -1267,9 +2118,7 @@ static void gen_expr(Node *node) {
   }
   case ND_COND: {
     int c = count();
-    gen_expr(node->cond);
-    cmp_zero(vinfo(node->cond->ty));
-    println("jmpn .L.else.%d", c);
+    gen_branch(node->cond, false, format(".L.else.%d", c));
     gen_expr(node->then);
     println("ujmpn .L.end.%d", c);
     println(".L.else.%d:", c);
@@ -1277,26 +2126,10 @@ static void gen_expr(Node *node) {
     println(".L.end.%d:", c);
     return;
   }
-  case ND_FUNCALL: {
-    int slots = count_funcall_slots(node);
-    if (slots > argreg_len)
-      unsupported(node, "function calls with too many register arguments");
-
-    push_args_reverse(node->args);
-    if (node->ret_buffer && returns_by_sret(node->ty)) {
-      VInfo vi = vinfo(pointer_to(node->ty));
-      gen_var_addr(node->ret_buffer);
-      push_value(vi);
-    }
-
-    for (int i = 0; i < slots; i++)
-      pop32(argreg[i]);
-
-    if (node->lhs->kind != ND_VAR)
-      unsupported(node, "indirect function call");
+  case ND_FUNCALL:
+    gen_call_args(node);
     println("calln %s", node->lhs->var->name);
     return;
-  }
   case ND_EXCH:
     if (node->ty->size != 4)
       unsupported(node, "atomic exchange wider than 32 bits");
@@ -1326,23 +2159,196 @@ static void gen_expr(Node *node) {
     gen_binary(node);
     return;
   case ND_STMT_EXPR:
-    for (Node *n = node->body; n; n = n->next)
-      gen_stmt(n);
+    // The last expression statement yields the value.
+    for (Node *n = node->body; n; n = n->next) {
+      if (!n->next && n->kind == ND_EXPR_STMT)
+        gen_expr(n->lhs);
+      else
+        gen_stmt(n);
+    }
     return;
   default:
     unsupported(node, "expression");
   }
 }
 
+// Switch dispatch.
+//
+// Case values are compared as unsigned 32-bit words. A signed condition is
+// biased by 0x80000000 first so that unsigned order matches signed order.
+// Dense runs of cases dispatch through a table of label addresses; other
+// case lists are split into a binary decision tree. A 64-bit condition
+// takes that path only when every case lies in [0, 0xffffffff], after the
+// high word is checked for zero; otherwise it falls back to a chain of
+// 64-bit range checks.
+
+#define SWITCH_LINEAR_CASES 3
+#define SWITCH_TABLE_MIN_CASES 4
+#define SWITCH_TABLE_DENSITY 3
+
+static int cmp_switch_case(const void *a, const void *b) {
+  uint32_t x = ((SwitchCase *)a)->lo;
+  uint32_t y = ((SwitchCase *)b)->lo;
+  return x < y ? -1 : x > y;
+}
+
+static bool is_dense_switch(SwitchCase *cases, int n) {
+  if (!opt_shy_jump_tables || n < SWITCH_TABLE_MIN_CASES)
+    return false;
+  uint64_t range = (uint64_t)cases[n - 1].hi - cases[0].lo + 1;
+  return range <= (uint64_t)n * SWITCH_TABLE_DENSITY;
+}
+
+static void gen_switch_table(SwitchCase *cases, int n, char *dflt) {
+  uint32_t lo = cases[0].lo;
+  SwitchTable *t = calloc(1, sizeof(SwitchTable));
+  t->name = format("%s.switch.%d", current_fn->name, count());
+  t->len = cases[n - 1].hi - lo + 1;
+  t->labels = calloc(t->len, sizeof(char *));
+  for (int i = 0; i < t->len; i++)
+    t->labels[i] = dflt;
+  for (int i = 0; i < n; i++)
+    for (uint64_t v = cases[i].lo; v <= cases[i].hi; v++)
+      t->labels[v - lo] = cases[i].label;
+  t->next = switch_tables;
+  switch_tables = t;
+
+  println("seta 3x 1x");
+  if (lo)
+    println("subn 3x %u", lo);
+  println("bign 3x %u", (uint32_t)(t->len - 1));
+  println("jmpn %s", dflt);
+  println("lsn 3x 2");
+  println("addn 3x %s", t->name);
+  println("geta 3x 3x");
+  println("ujmpa 3x");
+}
+
+static void gen_switch_tree(SwitchCase *cases, int n, char *dflt) {
+  if (is_dense_switch(cases, n)) {
+    gen_switch_table(cases, n, dflt);
+    return;
+  }
+
+  if (n <= SWITCH_LINEAR_CASES) {
+    for (int i = 0; i < n; i++) {
+      if (cases[i].lo == cases[i].hi) {
+        println("equn 1x %u", cases[i].lo);
+      } else {
+        println("seta 3x 1x");
+        println("subn 3x %u", cases[i].lo);
+        println("smaequn 3x %u", cases[i].hi - cases[i].lo);
+      }
+      println("jmpn %s", cases[i].label);
+    }
+    println("ujmpn %s", dflt);
+    return;
+  }
+
+  int mid = n / 2;
+  int c = count();
+  println("bigequn 1x %u", cases[mid].lo);
+  println("jmpn .L.switch.%d", c);
+  gen_switch_tree(cases, mid, dflt);
+  println(".L.switch.%d:", c);
+  gen_switch_tree(cases + mid, n - mid, dflt);
+}
+
+static bool switch_fits_32(Node *node) {
+  for (Node *c = node->case_next; c; c = c->case_next)
+    if (c->begin < 0 || c->end < 0 || c->begin > 0xffffffffL || c->end > 0xffffffffL)
+      return false;
+  return true;
+}
+
+// Compares the 64-bit value in 2x:1x against each case in turn. Signed values
+// have the sign bit of the high word flipped so that unsigned order matches.
+static void gen_switch_chain64(Node *node, char *dflt) {
+  uint64_t bias = node->cond->ty->is_unsigned ? 0 : 0x8000000000000000UL;
+  if (bias)
+    println("xorn 2x %u", 0x80000000);
+
+  for (Node *c = node->case_next; c; c = c->case_next) {
+    uint64_t lo = (uint64_t)c->begin ^ bias;
+    uint64_t hi = (uint64_t)c->end ^ bias;
+    int n = count();
+
+    // Skip to the next case unless lo <= x.
+    println("sman 2x %u", (uint32_t)(lo >> 32));
+    println("jmpn .L.switch.next.%d", n);
+    println("bign 2x %u", (uint32_t)(lo >> 32));
+    println("jmpn .L.switch.lo.%d", n);
+    println("sman 1x %u", (uint32_t)lo);
+    println("jmpn .L.switch.next.%d", n);
+    println(".L.switch.lo.%d:", n);
+
+    // Then take the case if x <= hi.
+    println("bign 2x %u", (uint32_t)(hi >> 32));
+    println("jmpn .L.switch.next.%d", n);
+    println("sman 2x %u", (uint32_t)(hi >> 32));
+    println("jmpn %s", c->label);
+    println("bign 1x %u", (uint32_t)hi);
+    println("jmpn .L.switch.next.%d", n);
+    println("ujmpn %s", c->label);
+    println(".L.switch.next.%d:", n);
+  }
+  println("ujmpn %s", dflt);
+}
+
+static void gen_switch(Node *node) {
+  gen_expr(node->cond);
+
+  char *dflt = node->default_case ? node->default_case->label : node->brk_label;
+  if (vinfo(node->cond->ty).is64) {
+    if (!switch_fits_32(node)) {
+      gen_switch_chain64(node, dflt);
+      return;
+    }
+    int c = count();
+    println("equn 2x 0");
+    println("jmpn .L.switch.%d", c);
+    println("ujmpn %s", dflt);
+    println(".L.switch.%d:", c);
+  }
+
+  uint32_t bias = 0;
+  if (!node->cond->ty->is_unsigned && node->cond->ty->size <= 4) {
+    bias = 0x80000000;
+    println("xorn 1x %u", bias);
+  }
+
+  int n = 0;
+  for (Node *c = node->case_next; c; c = c->case_next)
+    n++;
+  SwitchCase *cases = calloc(n, sizeof(SwitchCase));
+  SwitchCase *sc = cases;
+  for (Node *c = node->case_next; c; c = c->case_next, sc++)
+    *sc = (SwitchCase){(uint32_t)c->begin ^ bias, (uint32_t)c->end ^ bias, c->label};
+  qsort(cases, n, sizeof(SwitchCase), cmp_switch_case);
+
+  if (n)
+    gen_switch_tree(cases, n, dflt);
+  else
+    println("ujmpn %s", dflt);
+  free(cases);
+}
+
+static void emit_switch_tables(void) {
+  for (SwitchTable *t = switch_tables; t; t = t->next) {
+    println(".section data.rodata.%s", t->name);
+    println(".symbol %s", t->name);
+    for (int i = 0; i < t->len; i++)
+      println("%s(%d) %s", t->name, i * 4, t->labels[i]);
+  }
+}
+
 static void gen_stmt(Node *node) {
   emit_source_line(node->tok);
 
   switch (node->kind) {
   case ND_IF: {
     int c = count();
-    gen_expr(node->cond);
-    cmp_zero(vinfo(node->cond->ty));
-    println("jmpn .L.else.%d", c);
+    gen_branch(node->cond, false, format(".L.else.%d", c));
     gen_stmt(node->then);
     println("ujmpn .L.end.%d", c);
     println(".L.else.%d:", c);
@@ -1352,21 +2358,31 @@ static void gen_stmt(Node *node) {
     return;
   }
   case ND_FOR: {
+    if (gen_unrolled_for(node))
+      return;
     int c = count();
     if (node->init)
       gen_stmt(node->init);
+    IvPointer *outer = reduce_induction_pointers(node);
+    // The condition is tested at the bottom so that each iteration takes
+    // a single branch.
+    if (node->cond)
+      println("ujmpn .L.cond.%d", c);
     println(".L.begin.%d:", c);
-    if (node->cond) {
-      gen_expr(node->cond);
-      cmp_zero(vinfo(node->cond->ty));
-      println("jmpn %s", node->brk_label);
-    }
     gen_stmt(node->then);
     println("%s:", node->cont_label);
-    if (node->inc)
-      gen_expr(node->inc);
-    println("ujmpn .L.begin.%d", c);
+    if (node->inc) {
+      gen_discard(node->inc);
+      bump_induction_pointers(outer);
+    }
+    if (node->cond) {
+      println(".L.cond.%d:", c);
+      gen_branch(node->cond, true, format(".L.begin.%d", c));
+    } else {
+      println("ujmpn .L.begin.%d", c);
+    }
     println("%s:", node->brk_label);
+    release_induction_pointers(outer);
     return;
   }
   case ND_DO: {
@@ -1374,33 +2390,12 @@ static void gen_stmt(Node *node) {
     println(".L.begin.%d:", c);
     gen_stmt(node->then);
     println("%s:", node->cont_label);
-    gen_expr(node->cond);
-    cmp_zero(vinfo(node->cond->ty));
-    println("jmpn %s", node->brk_label);
-    println("ujmpn .L.begin.%d", c);
+    gen_branch(node->cond, true, format(".L.begin.%d", c));
     println("%s:", node->brk_label);
     return;
   }
   case ND_SWITCH:
-    gen_expr(node->cond);
-    if (vinfo(node->cond->ty).is64)
-      println("seta 1x 1x");
-
-    for (Node *n = node->case_next; n; n = n->case_next) {
-      if (n->begin == n->end) {
-        println("equn 1x %u", (uint32_t)n->begin);
-        println("jmpn %s", n->label);
-      } else {
-        println("seta 3x 1x");
-        println("subn 3x %u", (uint32_t)n->begin);
-        println("smaequn 3x %u", (uint32_t)(n->end - n->begin));
-        println("jmpn %s", n->label);
-      }
-    }
-
-    if (node->default_case)
-      println("ujmpn %s", node->default_case->label);
-    println("ujmpn %s", node->brk_label);
+    gen_switch(node);
     gen_stmt(node->then);
     println("%s:", node->brk_label);
     return;
@@ -1419,7 +2414,15 @@ static void gen_stmt(Node *node) {
     println("%s:", node->unique_label);
     gen_stmt(node->lhs);
     return;
-  case ND_RETURN:
+  case ND_RETURN: {
+    Node *call = tail_call(node->lhs);
+    if (call) {
+      gen_call_args(call);
+      println("seta sp fx");
+      println("popa fx");
+      println("ujmpn %s", call->lhs->var->name);
+      return;
+    }
     if (node->lhs) {
       Type *ty = node->lhs->ty;
       if (returns_by_sret(ty))
@@ -1429,8 +2432,9 @@ static void gen_stmt(Node *node) {
     }
     println("ujmpn .L.return.%s", current_fn->name);
     return;
+  }
   case ND_EXPR_STMT:
-    gen_expr(node->lhs);
+    gen_discard(node->lhs);
     return;
   case ND_ASM:
     if (!node->asm_bindings) {
@@ -1494,187 +2498,1474 @@ static void gen_stmt(Node *node) {
   }
 }
 
-static bool has_main(Obj *prog) {
+static bool has_main(Obj *prog) {
+  for (Obj *fn = prog; fn; fn = fn->next)
+    if (fn->is_function && fn->is_definition && !strcmp(fn->name, "main"))
+      return true;
+  return false;
+}
+
+static void copy_init_bytes(Type *ty, char *src, uint8_t *dst, int off) {
+  if (!src)
+    return;
+
+  switch (ty->kind) {
+  case TY_BOOL:
+  case TY_CHAR:
+    dst[off] = src[off];
+    return;
+  case TY_SHORT:
+    for (int i = 0; i < 2; i++)
+      dst[off + i] = src[off + 1 - i];
+    return;
+  case TY_INT:
+  case TY_ENUM:
+  case TY_FLOAT:
+  case TY_PTR:
+    for (int i = 0; i < 4; i++)
+      dst[off + i] = src[off + 3 - i];
+    return;
+  case TY_LONG:
+  case TY_DOUBLE:
+    for (int i = 0; i < 8; i++)
+      dst[off + i] = src[off + 7 - i];
+    return;
+  case TY_ARRAY:
+    for (int i = 0; i < ty->array_len; i++)
+      copy_init_bytes(ty->base, src, dst, off + i * ty->base->size);
+    return;
+  case TY_STRUCT:
+    for (Member *mem = ty->members; mem; mem = mem->next)
+      copy_init_bytes(mem->ty, src, dst, off + mem->offset);
+    return;
+  default:
+    for (int i = 0; i < ty->size; i++)
+      dst[off + i] = src[off + i];
+  }
+}
+
+static void emit_byte_array(char *name, int off, uint8_t *bytes, int len) {
+  fprintf(output_file, "%s(%d) [", name, off);
+  for (int i = 0; i < len; i++) {
+    if (i)
+      fprintf(output_file, ",");
+    fprintf(output_file, "%u", bytes[off + i]);
+  }
+  fprintf(output_file, "]\n");
+}
+
+static void emit_data(Obj *prog) {
+  for (Obj *var = prog; var; var = var->next) {
+    if (var->is_function || !var->is_definition)
+      continue;
+    if (var->is_tls)
+      error_tok(var->tok, "Shy backend does not support TLS");
+
+    // String literals are never written, so the linker may merge them.
+    println(".section data.%s%s", var->is_string_literal ? "rodata." : "", var->name);
+    println(".symbol %s", var->name);
+
+    uint8_t *bytes = calloc(1, var->ty->size);
+    copy_init_bytes(var->ty, var->init_data, bytes, 0);
+    for (int off = 0; off < var->ty->size; off += 32)
+      emit_byte_array(var->name, off, bytes, MIN(32, var->ty->size - off));
+
+    for (Relocation *rel = var->rel; rel; rel = rel->next) {
+      if (rel->offset < 0 || rel->offset + 4 > var->ty->size)
+        error_tok(var->tok, "Shy backend cannot emit out-of-range relocation");
+      if (rel->addend < 0 || rel->addend > UINT32_MAX)
+        error_tok(var->tok, "Shy backend supports only non-negative 32-bit relocation addends");
+
+      if (rel->addend)
+        println("%s(%d) %s(%ld)", var->name, rel->offset, *rel->label, rel->addend);
+      else
+        println("%s(%d) %s", var->name, rel->offset, *rel->label);
+    }
+  }
+}
+
+static void emit_start(Obj *prog) {
+  if (opt_shy_no_main)
+    return;
+
+  if (!has_main(prog))
+    return;
+
+  println(".section text._start");
+  println(".symbol _start");
+  println("setn sp 0x00fff000");
+  println("calln main");
+  println("seta exit 1x");
+}
+
+static bool node_refs_var(Node *node, Obj *var) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_VAR && node->var == var)
+      return true;
+
+    if (node_refs_var(node->lhs, var) || node_refs_var(node->rhs, var) ||
+        node_refs_var(node->cond, var) || node_refs_var(node->then, var) ||
+        node_refs_var(node->els, var) || node_refs_var(node->init, var) ||
+        node_refs_var(node->inc, var) || node_refs_var(node->body, var) ||
+        node_refs_var(node->args, var) || node_refs_var(node->cas_addr, var) ||
+        node_refs_var(node->cas_old, var) || node_refs_var(node->cas_new, var) ||
+        node_refs_var(node->atomic_expr, var))
+      return true;
+  }
+  return false;
+}
+
+static void mark_lvalue(Node *node) {
+  switch (node->kind) {
+  case ND_VAR:
+    node->var->is_addr_taken = true;
+    return;
+  case ND_COMMA:
+    mark_lvalue(node->rhs);
+    return;
+  case ND_MEMBER:
+  case ND_ASSIGN:
+    mark_lvalue(node->lhs);
+    return;
+  default:
+    return;
+  }
+}
+
+// Marks every local whose address escapes into a register, i.e. every
+// variable that reaches gen_addr() rather than a plain load or store.
+static void mark_addr_taken(Node *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case ND_ADDR:
+    case ND_MEMBER:
+      mark_lvalue(node->lhs);
+      break;
+    case ND_ASSIGN:
+      if (node->lhs->kind != ND_VAR)
+        mark_lvalue(node->lhs);
+      break;
+    case ND_FUNCALL:
+      if (node->ret_buffer)
+        node->ret_buffer->is_addr_taken = true;
+      break;
+    case ND_ASM:
+      for (AsmBinding *binding = node->asm_bindings; binding; binding = binding->next)
+        binding->var->is_addr_taken = true;
+      break;
+    default:
+      break;
+    }
+
+    mark_addr_taken(node->lhs);
+    mark_addr_taken(node->rhs);
+    mark_addr_taken(node->cond);
+    mark_addr_taken(node->then);
+    mark_addr_taken(node->els);
+    mark_addr_taken(node->init);
+    mark_addr_taken(node->inc);
+    mark_addr_taken(node->body);
+    mark_addr_taken(node->args);
+  }
+}
+
+// Returns true if generating `node` may emit a `calln`, either for a C call
+// or for a runtime helper. Inline assembly is treated as a call because it
+// may clobber any register.
+static bool node_has_call(Node *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case ND_FUNCALL:
+    case ND_ASM:
+      return true;
+    case ND_DIV:
+    case ND_MOD:
+      if (vinfo(node->ty).is64)
+        return true;
+      break;
+    default:
+      break;
+    }
+    if (node->ty && is_shy_flonum(node->ty))
+      return true;
+
+    if (node_has_call(node->lhs) || node_has_call(node->rhs) ||
+        node_has_call(node->cond) || node_has_call(node->then) ||
+        node_has_call(node->els) || node_has_call(node->init) ||
+        node_has_call(node->inc) || node_has_call(node->body) ||
+        node_has_call(node->args))
+      return true;
+  }
+  return false;
+}
+
+static bool is_reg_candidate(Obj *var) {
+  if (var->is_addr_taken || var->is_sret_alias || var->is_elided)
+    return false;
+
+  switch (var->ty->kind) {
+  case TY_STRUCT:
+  case TY_UNION:
+  case TY_ARRAY:
+  case TY_VLA:
+  case TY_FUNC:
+  case TY_LDOUBLE:
+    return false;
+  default:
+    return var->ty->size == 1 || var->ty->size == 2 ||
+           var->ty->size == 4 || var->ty->size == 8;
+  }
+}
+
+static int homereg_index(char *reg) {
+  for (int i = 0; i < homereg_len; i++)
+    if (!strcmp(homereg[i], reg))
+      return i;
+  return -1;
+}
+
+static char *take_homereg(bool *used) {
+  for (int i = 0; i < homereg_len; i++) {
+    if (!used[i]) {
+      used[i] = true;
+      return homereg[i];
+    }
+  }
+  return NULL;
+}
+
+static void clear_reg_homes(Obj *fn) {
+  for (Obj *var = fn->locals; var; var = var->next) {
+    var->reg = NULL;
+    var->reg_hi = NULL;
+  }
+}
+
+// A leaf function whose locals all fit in home registers runs without a
+// frame: no fx save, no stack allocation and no parameter spill. Parameters
+// already passed in a home register stay where they are.
+static bool assign_reg_homes(Obj *fn) {
+  if (!opt_shy_frameless || returns_by_sret(fn->ty->return_ty) ||
+      node_has_call(fn->body))
+    return false;
+
+  mark_addr_taken(fn->body);
+  for (Obj *var = fn->locals; var; var = var->next)
+    if (node_refs_var(fn->body, var) && !is_reg_candidate(var))
+      return false;
+
+  bool used[sizeof(homereg) / sizeof(*homereg)] = {0};
+  int slot = 0;
+  for (Obj *var = fn->params; var; var = var->next) {
+    bool is64 = vinfo(var->ty).is64;
+    if (slot + (is64 ? 2 : 1) > argreg_len)
+      return false;
+    if (node_refs_var(fn->body, var)) {
+      int lo = homereg_index(argreg[slot]);
+      if (lo >= 0) {
+        used[lo] = true;
+        var->reg = homereg[lo];
+      }
+      int hi = is64 ? homereg_index(argreg[slot + 1]) : -1;
+      if (hi >= 0) {
+        used[hi] = true;
+        var->reg_hi = homereg[hi];
+      }
+    }
+    slot += is64 ? 2 : 1;
+  }
+
+  for (Obj *var = fn->locals; var; var = var->next) {
+    if (!node_refs_var(fn->body, var))
+      continue;
+    if (!var->reg)
+      var->reg = take_homereg(used);
+    if (vinfo(var->ty).is64 && !var->reg_hi)
+      var->reg_hi = take_homereg(used);
+    if (!var->reg || (vinfo(var->ty).is64 && !var->reg_hi)) {
+      clear_reg_homes(fn);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void move_param_to_home(Obj *var, int slot) {
+  if (!var->reg)
+    return;
+  if (strcmp(var->reg, argreg[slot]))
+    println("seta %s %s", var->reg, argreg[slot]);
+  if (var->reg_hi && strcmp(var->reg_hi, argreg[slot + 1]))
+    println("seta %s %s", var->reg_hi, argreg[slot + 1]);
+  if (var->ty->size < 4) {
+    println("seta 1x %s", var->reg);
+    cast_to_32(var->ty);
+    println("seta %s 1x", var->reg);
+  }
+}
+
+// Function inlining.
+//
+// A call to a function defined in this translation unit is replaced with a
+// statement expression holding a copy of the callee body. Parameters become
+// fresh locals of the caller, initialized from the arguments, and `return`
+// becomes an assignment to a result local followed by a jump past the copy.
+// This runs on the AST before stack offsets and register homes are assigned,
+// so a caller that no longer calls anything can still become frameless.
+
+#define INLINE_MAX_DEPTH 4
+#define INLINE_TINY_SIZE 24
+#define INLINE_HINT_SIZE 160
+#define INLINE_SINGLE_CALL_SIZE 200
+#define INLINE_CALLER_LIMIT 2000
+
+typedef struct InlineVar InlineVar;
+struct InlineVar {
+  InlineVar *next;
+  Obj *old;
+  Obj *new;
+  Node *expr;
+};
+
+typedef struct InlineCase InlineCase;
+struct InlineCase {
+  InlineCase *next;
+  Node *old;
+  Node *new;
+};
+
+// A copy of a function body. Without an end label this is a plain copy that
+// keeps labels and `return` statements as they are.
+typedef struct {
+  InlineVar *vars;
+  InlineCase *cases;
+  int seq;
+  Obj *ret_var;
+  char *end_label;
+} InlineCopy;
+
+typedef struct InlineFrame InlineFrame;
+struct InlineFrame {
+  InlineFrame *next;
+  Obj *fn;
+};
+
+typedef struct {
+  Obj *caller;
+  InlineFrame *stack;
+  int depth;
+  int *size;
+  bool allow_loops;
+  bool recursive;
+} InlineCtx;
+
+static HashMap inline_uses;
+static int inlineseq;
+
+static int node_count(Node *node) {
+  int n = 0;
+  for (; node; node = node->next)
+    n += 1 + node_count(node->lhs) + node_count(node->rhs) +
+         node_count(node->cond) + node_count(node->then) +
+         node_count(node->els) + node_count(node->init) +
+         node_count(node->inc) + node_count(node->body) +
+         node_count(node->args);
+  return n;
+}
+
+static int count_returns(Node *node) {
+  int n = 0;
+  for (; node; node = node->next)
+    n += (node->kind == ND_RETURN) + count_returns(node->lhs) +
+         count_returns(node->rhs) + count_returns(node->cond) +
+         count_returns(node->then) + count_returns(node->els) +
+         count_returns(node->init) + count_returns(node->inc) +
+         count_returns(node->body) + count_returns(node->args);
+  return n;
+}
+
+// Counts references to each function, calls and address uses alike.
+static void count_fn_uses(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_VAR && node->var->is_function) {
+      intptr_t n = (intptr_t)hashmap_get(&inline_uses, node->var->name);
+      hashmap_put(&inline_uses, node->var->name, (void *)(n + 1));
+    }
+
+    count_fn_uses(node->lhs);
+    count_fn_uses(node->rhs);
+    count_fn_uses(node->cond);
+    count_fn_uses(node->then);
+    count_fn_uses(node->els);
+    count_fn_uses(node->init);
+    count_fn_uses(node->inc);
+    count_fn_uses(node->body);
+    count_fn_uses(node->args);
+  }
+}
+
+static bool blocks_inlining(Node *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case ND_ASM:
+    case ND_GOTO_EXPR:
+    case ND_LABEL_VAL:
+    case ND_VLA_PTR:
+    case ND_CAS:
+      return true;
+    default:
+      break;
+    }
+
+    if (blocks_inlining(node->lhs) || blocks_inlining(node->rhs) ||
+        blocks_inlining(node->cond) || blocks_inlining(node->then) ||
+        blocks_inlining(node->els) || blocks_inlining(node->init) ||
+        blocks_inlining(node->inc) || blocks_inlining(node->body) ||
+        blocks_inlining(node->args))
+      return true;
+  }
+  return false;
+}
+
+static bool has_loop(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_FOR || node->kind == ND_DO ||
+        (node->kind == ND_LABEL && node->label))
+      return true;
+
+    if (has_loop(node->lhs) || has_loop(node->rhs) || has_loop(node->cond) ||
+        has_loop(node->then) || has_loop(node->els) || has_loop(node->init) ||
+        has_loop(node->inc) || has_loop(node->body) || has_loop(node->args))
+      return true;
+  }
+  return false;
+}
+
+static Obj *lvalue_var(Node *node) {
+  switch (node->kind) {
+  case ND_VAR:
+    return node->var;
+  case ND_COMMA:
+    return lvalue_var(node->rhs);
+  case ND_MEMBER:
+  case ND_ASSIGN:
+    return lvalue_var(node->lhs);
+  default:
+    return NULL;
+  }
+}
+
+static bool var_is_written(Node *node, Obj *var) {
+  for (; node; node = node->next) {
+    if ((node->kind == ND_ASSIGN || node->kind == ND_ADDR) &&
+        lvalue_var(node->lhs) == var)
+      return true;
+
+    if (var_is_written(node->lhs, var) || var_is_written(node->rhs, var) ||
+        var_is_written(node->cond, var) || var_is_written(node->then, var) ||
+        var_is_written(node->els, var) || var_is_written(node->init, var) ||
+        var_is_written(node->inc, var) || var_is_written(node->body, var) ||
+        var_is_written(node->args, var))
+      return true;
+  }
+  return false;
+}
+
+// An argument that can be evaluated at every use of the parameter instead
+// of once at the call: no side effects, and nothing the callee can change.
+static bool is_stable_arg(Node *node) {
+  switch (node->kind) {
+  case ND_NUM:
+    return true;
+  case ND_CAST:
+    return !is_shy_flonum(node->ty) && !is_shy_flonum(node->lhs->ty) &&
+           is_stable_arg(node->lhs);
+  case ND_ADDR:
+    return node->lhs->kind == ND_VAR;
+  case ND_VAR:
+    return node->var->is_local && !node->var->is_addr_taken;
+  default:
+    return false;
+  }
+}
+
+// Whether a parameter of the inlined call can be replaced by its argument.
+static bool substitutes_arg(Node *call, Obj *fn, Obj *param, Node *arg) {
+  if (!is_stable_arg(arg) || var_is_written(fn->body, param))
+    return false;
+  if (arg->ty->kind != param->ty->kind || arg->ty->size != param->ty->size ||
+      arg->ty->is_unsigned != param->ty->is_unsigned)
+    return false;
+
+  Node *n = arg;
+  while (n->kind == ND_CAST)
+    n = n->lhs;
+  return n->kind != ND_VAR || !var_is_written(call->args, n->var);
+}
+
+// A body whose only `return` is its last statement ends in the returned
+// expression instead of a jump to the end label.
+static bool has_tail_return(Node *body) {
+  Node *last = body->body;
+  while (last && last->next)
+    last = last->next;
+  int nret = count_returns(body);
+  return body->kind == ND_BLOCK &&
+         (nret == 0 || (nret == 1 && last && last->kind == ND_RETURN));
+}
+
+// Whether inlining the call needs stack slots in the caller's frame.
+static bool inline_needs_slots(Node *node, Obj *fn) {
+  if (fn->ty->return_ty->kind != TY_VOID && !has_tail_return(fn->body))
+    return true;
+  for (Obj *var = fn->locals; var && var != fn->params; var = var->next)
+    if (var != fn->va_area && var != fn->alloca_bottom)
+      return true;
+
+  Node *arg = node->args;
+  for (Obj *param = fn->params; param; param = param->next, arg = arg->next)
+    if (!substitutes_arg(node, fn, param, arg))
+      return true;
+  return false;
+}
+
+static bool calls_reach(Node *node, Obj *target, HashMap *seen) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_FUNCALL && node->lhs->kind == ND_VAR) {
+      Obj *fn = node->lhs->var;
+      if (fn == target)
+        return true;
+      if (fn->is_function && fn->body && !hashmap_get(seen, fn->name)) {
+        hashmap_put(seen, fn->name, fn);
+        if (calls_reach(fn->body, target, seen))
+          return true;
+      }
+    }
+
+    if (calls_reach(node->lhs, target, seen) ||
+        calls_reach(node->rhs, target, seen) ||
+        calls_reach(node->cond, target, seen) ||
+        calls_reach(node->then, target, seen) ||
+        calls_reach(node->els, target, seen) ||
+        calls_reach(node->init, target, seen) ||
+        calls_reach(node->inc, target, seen) ||
+        calls_reach(node->body, target, seen) ||
+        calls_reach(node->args, target, seen))
+      return true;
+  }
+  return false;
+}
+
+static bool can_inline(Node *node, Obj *fn, InlineCtx *ctx) {
+  if (!fn->is_function || !fn->is_definition || !fn->body || fn->is_noinline)
+    return false;
+  if (opt_shy_no_main && !strcmp(fn->name, "_start"))
+    return false;
+  if (fn->ty->is_variadic || returns_by_sret(fn->ty->return_ty))
+    return false;
+  if (ctx->depth >= INLINE_MAX_DEPTH || fn == ctx->caller)
+    return false;
+  for (InlineFrame *f = ctx->stack; f; f = f->next)
+    if (f->fn == fn)
+      return false;
+
+  Node *arg = node->args;
+  for (Obj *param = fn->params; param; param = param->next, arg = arg->next)
+    if (!arg || param->ty->kind == TY_STRUCT || param->ty->kind == TY_UNION)
+      return false;
+  if (arg)
+    return false;
+
+  for (Obj *var = fn->locals; var; var = var->next)
+    if (var->ty->kind == TY_VLA)
+      return false;
+  if (fn->alloca_bottom && node_refs_var(fn->body, fn->alloca_bottom))
+    return false;
+  if (blocks_inlining(fn->body))
+    return false;
+
+  if (fn->is_always_inline)
+    return true;
+
+  // With a profile, hot call edges get the `inline` size limit and
+  // functions that never ran only take copies that do not grow them.
+  Obj *caller = ctx->stack ? ctx->stack->fn : ctx->caller;
+  bool cold = profile_shy_is_cold(ctx->caller->name);
+  bool hot = profile_shy_is_hot_edge(caller->name, fn->name);
+
+  // Every active level of a recursive caller would pay for the new slots.
+  if (ctx->recursive && inline_needs_slots(node, fn))
+    return false;
+
+  // A loop keeps its locals in registers only in a frameless function, so
+  // loops are copied only into callers that end up frameless.
+  if (!ctx->allow_loops && has_loop(fn->body))
+    return false;
+
+  int size = node_count(fn->body);
+  if (*ctx->size + size > INLINE_CALLER_LIMIT)
+    return false;
+  if (size <= INLINE_TINY_SIZE)
+    return true;
+  if ((fn->is_inline || hot) && !cold && size <= INLINE_HINT_SIZE)
+    return true;
+  return fn->is_static && size <= INLINE_SINGLE_CALL_SIZE &&
+         (intptr_t)hashmap_get(&inline_uses, fn->name) == 1;
+}
+
+static Node *inline_node(NodeKind kind, Token *tok) {
+  Node *node = calloc(1, sizeof(Node));
+  node->kind = kind;
+  node->tok = tok;
+  return node;
+}
+
+static Node *inline_var_node(Obj *var, Token *tok) {
+  Node *node = inline_node(ND_VAR, tok);
+  node->var = var;
+  node->ty = var->ty;
+  return node;
+}
+
+static Node *inline_expr_stmt(Node *expr, Token *tok) {
+  Node *node = inline_node(ND_EXPR_STMT, tok);
+  node->lhs = expr;
+  return node;
+}
+
+static Node *inline_assign_stmt(Obj *var, Node *expr, Token *tok) {
+  Node *node = inline_node(ND_ASSIGN, tok);
+  node->lhs = inline_var_node(var, tok);
+  node->rhs = expr;
+  node->ty = var->ty;
+  return inline_expr_stmt(node, tok);
+}
+
+static InlineVar *inline_var(InlineCopy *cp, Obj *var) {
+  for (InlineVar *v = cp->vars; v; v = v->next)
+    if (v->old == var)
+      return v;
+  return NULL;
+}
+
+static Obj *inline_var_obj(InlineCopy *cp, Obj *var) {
+  InlineVar *v = inline_var(cp, var);
+  return v ? v->new : var;
+}
+
+static char *inline_label(InlineCopy *cp, char *label) {
+  if (!label || !cp->end_label)
+    return label;
+  return format("%s.i%d", label, cp->seq);
+}
+
+static Node *inline_case(InlineCopy *cp, Node *node) {
+  for (InlineCase *c = cp->cases; c; c = c->next)
+    if (c->old == node)
+      return c->new;
+  error_tok(node->tok, "internal error: case label outside of inlined switch");
+}
+
+static Node *inline_copy(Node *node, InlineCopy *cp);
+
+static Node *inline_copy_list(Node *node, InlineCopy *cp) {
+  Node head = {};
+  Node *cur = &head;
+  for (; node; node = node->next)
+    cur = cur->next = inline_copy(node, cp);
+  return head.next;
+}
+
+// `return e` in the callee becomes `{ ret = e; goto end; }`.
+static Node *inline_return(Node *node, InlineCopy *cp) {
+  Node head = {};
+  Node *cur = &head;
+
+  if (node->lhs) {
+    Node *expr = inline_copy(node->lhs, cp);
+    if (cp->ret_var)
+      cur = cur->next = inline_assign_stmt(cp->ret_var, expr, node->tok);
+    else
+      cur = cur->next = inline_expr_stmt(expr, node->tok);
+  }
+
+  cur = cur->next = inline_node(ND_GOTO, node->tok);
+  cur->unique_label = cp->end_label;
+
+  Node *block = inline_node(ND_BLOCK, node->tok);
+  block->body = head.next;
+  return block;
+}
+
+static Node *inline_copy(Node *node, InlineCopy *cp) {
+  if (!node)
+    return NULL;
+  if (node->kind == ND_RETURN && cp->end_label)
+    return inline_return(node, cp);
+
+  if (node->kind == ND_VAR) {
+    InlineVar *v = inline_var(cp, node->var);
+    if (v && v->expr)
+      return inline_copy(v->expr, &(InlineCopy){});
+  }
+
+  Node *copy = calloc(1, sizeof(Node));
+  *copy = *node;
+  copy->next = NULL;
+  copy->lhs = inline_copy(node->lhs, cp);
+  copy->rhs = inline_copy(node->rhs, cp);
+  copy->cond = inline_copy(node->cond, cp);
+  copy->then = inline_copy(node->then, cp);
+  copy->els = inline_copy(node->els, cp);
+  copy->init = inline_copy(node->init, cp);
+  copy->inc = inline_copy(node->inc, cp);
+  copy->body = inline_copy_list(node->body, cp);
+  copy->args = inline_copy_list(node->args, cp);
+  copy->cas_addr = inline_copy(node->cas_addr, cp);
+  copy->cas_old = inline_copy(node->cas_old, cp);
+  copy->cas_new = inline_copy(node->cas_new, cp);
+  copy->atomic_expr = inline_copy(node->atomic_expr, cp);
+  copy->var = inline_var_obj(cp, node->var);
+  copy->ret_buffer = inline_var_obj(cp, node->ret_buffer);
+  copy->atomic_addr = inline_var_obj(cp, node->atomic_addr);
+  copy->brk_label = inline_label(cp, node->brk_label);
+  copy->cont_label = inline_label(cp, node->cont_label);
+  copy->unique_label = inline_label(cp, node->unique_label);
+
+  if (node->kind == ND_CASE) {
+    copy->label = inline_label(cp, node->label);
+    InlineCase *c = calloc(1, sizeof(InlineCase));
+    c->old = node;
+    c->new = copy;
+    c->next = cp->cases;
+    cp->cases = c;
+  }
+
+  if (node->kind == ND_SWITCH) {
+    Node head = {};
+    Node *cur = &head;
+    for (Node *n = node->case_next; n; n = n->case_next)
+      cur = cur->case_next = inline_case(cp, n);
+    cur->case_next = NULL;
+    copy->case_next = head.case_next;
+    if (node->default_case)
+      copy->default_case = inline_case(cp, node->default_case);
+  }
+  return copy;
+}
+
+static Obj *inline_local(Obj *caller, Type *ty, Token *tok) {
+  Obj *var = calloc(1, sizeof(Obj));
+  var->name = "";
+  var->ty = ty;
+  var->tok = tok;
+  var->is_local = true;
+  var->align = ty->align;
+  var->next = caller->locals;
+  caller->locals = var;
+  return var;
+}
+
+static void inline_calls(Node *node, InlineCtx *ctx);
+
+static void inline_call(Node *node, Obj *fn, InlineCtx *ctx) {
+  Obj *caller = ctx->caller;
+  InlineCopy cp = {.seq = ++inlineseq};
+  cp.end_label = format(".L.inline.end.%d", cp.seq);
+
+  for (Obj *var = fn->locals; var; var = var->next) {
+    if (var == fn->va_area || var == fn->alloca_bottom)
+      continue;
+    InlineVar *v = calloc(1, sizeof(InlineVar));
+    v->old = var;
+    v->next = cp.vars;
+    cp.vars = v;
+  }
+
+  // Parameters that the callee only reads take stable arguments directly.
+  Node head = {};
+  Node *cur = &head;
+  Node *arg = node->args;
+  for (Obj *param = fn->params; param; param = param->next, arg = arg->next)
+    if (substitutes_arg(node, fn, param, arg))
+      inline_var(&cp, param)->expr = arg;
+
+  for (InlineVar *v = cp.vars; v; v = v->next) {
+    if (v->expr)
+      continue;
+    v->new = calloc(1, sizeof(Obj));
+    *v->new = *v->old;
+    v->new->offset = 0;
+    v->new->reg = NULL;
+    v->new->reg_hi = NULL;
+    v->new->is_addr_taken = false;
+    v->new->inline_site = node;
+    v->new->next = caller->locals;
+    caller->locals = v->new;
+  }
+
+  arg = node->args;
+  for (Obj *param = fn->params; param; param = param->next) {
+    Node *next = arg->next;
+    arg->next = NULL;
+    InlineVar *v = inline_var(&cp, param);
+    if (!v->expr)
+      cur = cur->next = inline_assign_stmt(v->new, arg, arg->tok);
+    arg = next;
+  }
+
+  Node *body = fn->body;
+  Node *last = body->body;
+  while (last && last->next)
+    last = last->next;
+  bool tail = has_tail_return(body);
+
+  Type *rty = fn->ty->return_ty;
+  if (!tail && rty->kind != TY_VOID) {
+    cp.ret_var = inline_local(caller, rty, node->tok);
+    cp.ret_var->inline_site = node;
+  }
+  if (tail)
+    cp.end_label = format(".L.inline.%d", cp.seq);
+
+  Node stmts = {};
+  Node *end = &stmts;
+  if (tail) {
+    for (Node *n = body->body; n && n->kind != ND_RETURN; n = n->next)
+      end = end->next = inline_copy(n, &cp);
+    if (last && last->kind == ND_RETURN && last->lhs)
+      end = end->next = inline_expr_stmt(inline_copy(last->lhs, &cp), last->tok);
+  } else {
+    end = end->next = inline_copy(body, &cp);
+  }
+
+  InlineFrame frame = {ctx->stack, fn};
+  InlineCtx inner = *ctx;
+  inner.stack = &frame;
+  inner.depth++;
+  mark_addr_taken(stmts.next);
+  *ctx->size += node_count(stmts.next);
+  inline_calls(stmts.next, &inner);
+  cur->next = stmts.next;
+  cur = end;
+
+  if (!tail) {
+    cur = cur->next = inline_node(ND_LABEL, node->tok);
+    cur->unique_label = cp.end_label;
+    cur->lhs = inline_node(ND_BLOCK, node->tok);
+    if (cp.ret_var)
+      cur = cur->next = inline_expr_stmt(inline_var_node(cp.ret_var, node->tok), node->tok);
+  }
+
+  node->kind = ND_STMT_EXPR;
+  node->lhs = NULL;
+  node->args = NULL;
+  node->body = head.next;
+}
+
+static void inline_calls(Node *node, InlineCtx *ctx) {
+  for (; node; node = node->next) {
+    inline_calls(node->lhs, ctx);
+    inline_calls(node->rhs, ctx);
+    inline_calls(node->cond, ctx);
+    inline_calls(node->then, ctx);
+    inline_calls(node->els, ctx);
+    inline_calls(node->init, ctx);
+    inline_calls(node->inc, ctx);
+    inline_calls(node->body, ctx);
+    inline_calls(node->args, ctx);
+
+    if (node->kind == ND_FUNCALL && node->lhs->kind == ND_VAR &&
+        can_inline(node, node->lhs->var, ctx))
+      inline_call(node, node->lhs->var, ctx);
+  }
+}
+
+// Inlines calls in one function. Callees containing loops are copied only
+// if that leaves the caller frameless; otherwise the caller is inlined
+// again from its original body without them.
+static void inline_function(Obj *fn) {
+  Obj *locals = fn->locals;
+  Node *body = fn->body;
+  int size = node_count(body);
+
+  mark_addr_taken(body);
+  fn->body = inline_copy(body, &(InlineCopy){});
+  InlineCtx ctx = {fn, NULL, 0, &size, true};
+  ctx.recursive = calls_reach(body, fn, &(HashMap){});
+  inline_calls(fn->body, &ctx);
+
+  bool frameless = assign_reg_homes(fn);
+  clear_reg_homes(fn);
+  if (frameless)
+    return;
+
+  fn->locals = locals;
+  fn->body = body;
+  size = node_count(body);
+  ctx.allow_loops = false;
+  inline_calls(fn->body, &ctx);
+}
+
+static void keep_function(Obj *fn);
+
+// The translation unit whose functions drop_inlined_functions is marking.
+static Obj *marking_prog;
+
+static bool is_symbol_char(char c) {
+  return isalnum(c) || c == '_' || c == '.' || c == '$';
+}
+
+// Whether `name` occurs in `text` as a whole symbol.
+static bool text_names(char *text, char *name) {
+  int len = strlen(name);
+  for (char *p = strstr(text, name); p; p = strstr(p + 1, name))
+    if ((p == text || !is_symbol_char(p[-1])) && !is_symbol_char(p[len]))
+      return true;
+  return false;
+}
+
+static char *source_name(Obj *fn) {
+  for (Rename *r = renames; r; r = r->next)
+    if (r->new == fn->name)
+      return r->old;
+  return fn->name;
+}
+
+// Inline asm may call or take the address of a function by name.
+static void keep_asm_functions(char *asm_str) {
+  for (Obj *fn = marking_prog; fn; fn = fn->next)
+    if (fn->is_function &&
+        (text_names(asm_str, fn->name) || text_names(asm_str, source_name(fn))))
+      keep_function(fn);
+}
+
+static void keep_referenced_functions(Node *node) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_VAR && node->var->is_function)
+      keep_function(node->var);
+    if (node->kind == ND_ASM)
+      keep_asm_functions(node->asm_str);
+
+    keep_referenced_functions(node->lhs);
+    keep_referenced_functions(node->rhs);
+    keep_referenced_functions(node->cond);
+    keep_referenced_functions(node->then);
+    keep_referenced_functions(node->els);
+    keep_referenced_functions(node->init);
+    keep_referenced_functions(node->inc);
+    keep_referenced_functions(node->body);
+    keep_referenced_functions(node->args);
+  }
+}
+
+static void keep_function(Obj *fn) {
+  if (fn->is_live)
+    return;
+  fn->is_live = true;
+  keep_referenced_functions(fn->body);
+}
+
+// Static functions whose every call was inlined are no longer emitted.
+static void drop_inlined_functions(Obj *prog) {
+  marking_prog = prog;
   for (Obj *fn = prog; fn; fn = fn->next)
-    if (fn->is_function && fn->is_definition && !strcmp(fn->name, "main"))
+    if (fn->is_function && fn->is_static)
+      fn->is_live = false;
+
+  for (Obj *fn = prog; fn; fn = fn->next)
+    if (fn->is_function && !fn->is_static && fn->is_live)
+      keep_referenced_functions(fn->body);
+
+  for (Obj *var = prog; var; var = var->next)
+    for (Relocation *rel = var->rel; rel; rel = rel->next)
+      for (Obj *fn = prog; fn; fn = fn->next)
+        if (fn->is_function && !strcmp(fn->name, *rel->label))
+          keep_function(fn);
+}
+
+static void inline_functions(Obj *prog) {
+  for (Obj *fn = prog; fn; fn = fn->next)
+    if (fn->is_function && fn->is_live)
+      count_fn_uses(fn->body);
+
+  for (Obj *fn = prog; fn; fn = fn->next) {
+    if (!fn->is_function || !fn->is_definition || !fn->is_live)
+      continue;
+    if (opt_shy_no_main && !strcmp(fn->name, "_start"))
+      continue;
+    inline_function(fn);
+  }
+
+  drop_inlined_functions(prog);
+}
+
+// Loop optimizations.
+//
+// Counted loops `for (...; ...; i += step)` get two treatments. A loop with
+// a small constant trip count and a short body is unrolled, with `i`
+// replaced by its value in each copy. In a frameless function, `p[i]`
+// through a register pointer that the loop does not change is strength
+// reduced: a spare home register holds `p + i * size` and is bumped along
+// with `i`, so the access needs no index arithmetic.
+
+#define UNROLL_MAX_TRIP 8
+#define UNROLL_MAX_SIZE 128
+
+static IvPointer *iv_pointers;
+
+// Matches `i += step` on a 32-bit integer in any of the forms the parser
+// produces for `i++`, `i += k` and `i = i - k`.
+static Obj *loop_counter(Node *inc, int32_t *step) {
+  if (!inc)
+    return NULL;
+  inc = discarded_value(inc);
+  if (inc->kind != ND_ASSIGN || inc->lhs->kind != ND_VAR)
+    return NULL;
+
+  Obj *var = inc->lhs->var;
+  if (!is_integer(var->ty) || !is_word_int(var->ty))
+    return NULL;
+  Node *rhs = skip_word_casts(inc->rhs);
+  if ((rhs->kind != ND_ADD && rhs->kind != ND_SUB) || !is_word_int(rhs->ty))
+    return NULL;
+  Node *lhs = skip_word_casts(rhs->lhs);
+  uint32_t imm;
+  if (lhs->kind != ND_VAR || lhs->var != var || !get_imm32(rhs->rhs, &imm))
+    return NULL;
+  *step = rhs->kind == ND_ADD ? imm : -imm;
+  return var;
+}
+
+static bool node_writes_var(Node *node, Obj *var) {
+  for (; node; node = node->next) {
+    if (node->kind == ND_ASSIGN && node->lhs->kind == ND_VAR && node->lhs->var == var)
+      return true;
+    if (node->kind == ND_MEMZERO && node->var == var)
+      return true;
+    if (node->kind == ND_ASM)
+      for (AsmBinding *binding = node->asm_bindings; binding; binding = binding->next)
+        if (binding->var == var)
+          return true;
+
+    if (node_writes_var(node->lhs, var) || node_writes_var(node->rhs, var) ||
+        node_writes_var(node->cond, var) || node_writes_var(node->then, var) ||
+        node_writes_var(node->els, var) || node_writes_var(node->init, var) ||
+        node_writes_var(node->inc, var) || node_writes_var(node->body, var) ||
+        node_writes_var(node->args, var))
       return true;
+  }
   return false;
 }
 
-static void copy_init_bytes(Type *ty, char *src, uint8_t *dst, int off) {
-  if (!src)
-    return;
+// Control flow that a copied loop body cannot keep: jumps (including
+// `break` and `continue`), labels, nested loops and switches.
+static bool has_jumps(Node *node) {
+  for (; node; node = node->next) {
+    switch (node->kind) {
+    case ND_FOR:
+    case ND_DO:
+    case ND_SWITCH:
+    case ND_CASE:
+    case ND_GOTO:
+    case ND_GOTO_EXPR:
+    case ND_LABEL:
+    case ND_LABEL_VAL:
+    case ND_ASM:
+      return true;
+    default:
+      break;
+    }
 
-  switch (ty->kind) {
-  case TY_BOOL:
-  case TY_CHAR:
-    dst[off] = src[off];
-    return;
-  case TY_SHORT:
-    for (int i = 0; i < 2; i++)
-      dst[off + i] = src[off + 1 - i];
-    return;
-  case TY_INT:
-  case TY_ENUM:
-  case TY_FLOAT:
-  case TY_PTR:
-    for (int i = 0; i < 4; i++)
-      dst[off + i] = src[off + 3 - i];
-    return;
-  case TY_LONG:
-  case TY_DOUBLE:
-    for (int i = 0; i < 8; i++)
-      dst[off + i] = src[off + 7 - i];
-    return;
-  case TY_ARRAY:
-    for (int i = 0; i < ty->array_len; i++)
-      copy_init_bytes(ty->base, src, dst, off + i * ty->base->size);
-    return;
-  case TY_STRUCT:
-    for (Member *mem = ty->members; mem; mem = mem->next)
-      copy_init_bytes(mem->ty, src, dst, off + mem->offset);
-    return;
-  default:
-    for (int i = 0; i < ty->size; i++)
-      dst[off + i] = src[off + i];
+    if (has_jumps(node->lhs) || has_jumps(node->rhs) || has_jumps(node->cond) ||
+        has_jumps(node->then) || has_jumps(node->els) || has_jumps(node->init) ||
+        has_jumps(node->inc) || has_jumps(node->body) || has_jumps(node->args))
+      return true;
   }
+  return false;
 }
 
-static void emit_byte_array(char *name, int off, uint8_t *bytes, int len) {
-  fprintf(output_file, "%s(%d) [", name, off);
-  for (int i = 0; i < len; i++) {
-    if (i)
-      fprintf(output_file, ",");
-    fprintf(output_file, "%u", bytes[off + i]);
+// The constant a loop's init statement leaves in `var`.
+static bool initial_value(Node *init, Obj *var, int32_t *val) {
+  while (init) {
+    if (init->kind == ND_BLOCK) {
+      if (!init->body)
+        return false;
+      init = init->body;
+      while (init->next)
+        init = init->next;
+    } else if (init->kind == ND_EXPR_STMT) {
+      init = init->lhs;
+    } else if (init->kind == ND_COMMA) {
+      init = init->rhs;
+    } else {
+      break;
+    }
   }
-  fprintf(output_file, "]\n");
+
+  uint32_t imm;
+  if (!init || init->kind != ND_ASSIGN || init->lhs->kind != ND_VAR ||
+      init->lhs->var != var || !get_imm32(init->rhs, &imm))
+    return false;
+  *val = imm;
+  return true;
 }
 
-static void emit_data(Obj *prog) {
-  for (Obj *var = prog; var; var = var->next) {
-    if (var->is_function || !var->is_definition)
-      continue;
-    if (var->is_tls)
-      error_tok(var->tok, "Shy backend does not support TLS");
+// Number of iterations of `for (i = start; cond; i += step)`, or -1 if it
+// is not a small constant.
+static int trip_count(Node *cond, Obj *var, int32_t start, int32_t step) {
+  if (!cond || step <= 0 ||
+      (cond->kind != ND_LT && cond->kind != ND_LE && cond->kind != ND_NE))
+    return -1;
 
-    println(".section data.%s", var->name);
-    println(".symbol %s", var->name);
+  Node *lhs = skip_word_casts(cond->lhs);
+  uint32_t imm;
+  if (lhs->kind != ND_VAR || lhs->var != var || !is_word_int(cond->lhs->ty) ||
+      !get_imm32(cond->rhs, &imm))
+    return -1;
+
+  // Compare in 64 bits so that the last step cannot wrap around.
+  bool is_unsigned = cond->lhs->ty->is_unsigned;
+  int64_t lo = is_unsigned ? (uint32_t)start : start;
+  int64_t hi = is_unsigned ? imm : (int32_t)imm;
+  int64_t limit = is_unsigned ? UINT32_MAX : INT32_MAX;
+  if (cond->kind == ND_LE)
+    hi++;
+  if (lo >= hi || hi + step - 1 > limit)
+    return -1;
+  if (cond->kind == ND_NE && (hi - lo) % step)
+    return -1;
+
+  int64_t trip = (hi - lo + step - 1) / step;
+  return trip <= UNROLL_MAX_TRIP ? trip : -1;
+}
 
-    uint8_t *bytes = calloc(1, var->ty->size);
-    copy_init_bytes(var->ty, var->init_data, bytes, 0);
-    for (int off = 0; off < var->ty->size; off += 32)
-      emit_byte_array(var->name, off, bytes, MIN(32, var->ty->size - off));
+static Node *loop_counter_value(Obj *var, uint32_t val) {
+  Node *node = inline_node(ND_NUM, var->tok);
+  node->ty = var->ty;
+  node->val = var->ty->is_unsigned ? val : (int32_t)val;
+  return node;
+}
 
-    for (Relocation *rel = var->rel; rel; rel = rel->next) {
-      if (rel->offset < 0 || rel->offset + 4 > var->ty->size)
-        error_tok(var->tok, "Shy backend cannot emit out-of-range relocation");
-      if (rel->addend < 0 || rel->addend > UINT32_MAX)
-        error_tok(var->tok, "Shy backend supports only non-negative 32-bit relocation addends");
+// Folds the 32-bit integer arithmetic that substituting the loop counter
+// made constant.
+static void fold_constants(Node *node) {
+  for (; node; node = node->next) {
+    fold_constants(node->lhs);
+    fold_constants(node->rhs);
+    fold_constants(node->cond);
+    fold_constants(node->then);
+    fold_constants(node->els);
+    fold_constants(node->init);
+    fold_constants(node->inc);
+    fold_constants(node->body);
+    fold_constants(node->args);
+
+    uint32_t l, r;
+    if (!node->lhs || !node->rhs || !node->ty || !is_word_int(node->ty) ||
+        !get_imm32(node->lhs, &l) || !get_imm32(node->rhs, &r))
+      continue;
 
-      if (rel->addend)
-        println("%s(%d) %s(%ld)", var->name, rel->offset, *rel->label, rel->addend);
-      else
-        println("%s(%d) %s", var->name, rel->offset, *rel->label);
+    uint32_t val;
+    switch (node->kind) {
+    case ND_ADD: val = l + r; break;
+    case ND_SUB: val = l - r; break;
+    case ND_MUL: val = l * r; break;
+    case ND_BITAND: val = l & r; break;
+    case ND_BITOR: val = l | r; break;
+    case ND_BITXOR: val = l ^ r; break;
+    default: continue;
     }
+    node->kind = ND_NUM;
+    node->val = node->ty->is_unsigned ? val : (int32_t)val;
+    node->lhs = node->rhs = NULL;
   }
 }
 
-static void emit_start(Obj *prog) {
-  if (opt_shy_no_main)
-    return;
+static bool gen_unrolled_for(Node *node) {
+  if (!opt_shy_unroll || profile_shy_is_cold(current_fn->name))
+    return false;
 
-  if (!has_main(prog))
-    return;
+  int32_t step, start;
+  Obj *var = loop_counter(node->inc, &step);
+  if (!var || var->is_addr_taken || var->is_sret_alias ||
+      !initial_value(node->init, var, &start) || has_jumps(node->then) ||
+      node_writes_var(node->then, var) || node_writes_var(node->cond, var))
+    return false;
 
-  println(".section text._start");
-  println(".symbol _start");
-  println("setn sp 0x00fff000");
-  println("calln main");
-  println("seta exit 1x");
+  int trip = trip_count(node->cond, var, start, step);
+  if (trip < 0 || trip * node_count(node->then) > UNROLL_MAX_SIZE)
+    return false;
+
+  gen_stmt(node->init);
+  for (int i = 0; i < trip; i++) {
+    InlineVar iv = {NULL, var, var, loop_counter_value(var, start + (uint32_t)step * i)};
+    Node *body = inline_copy(node->then, &(InlineCopy){.vars = &iv});
+    fold_constants(body);
+    gen_stmt(body);
+  }
+
+  Node *assign = inline_node(ND_ASSIGN, node->tok);
+  assign->lhs = inline_var_node(var, node->tok);
+  assign->rhs = loop_counter_value(var, start + (uint32_t)step * trip);
+  assign->ty = var->ty;
+  gen_discard(assign);
+  return true;
 }
 
-static bool node_refs_var(Node *node, Obj *var) {
-  for (; node; node = node->next) {
-    if (node->kind == ND_VAR && node->var == var)
-      return true;
+static char *induction_reg(Node *node) {
+  for (IvPointer *ptr = iv_pointers; ptr; ptr = ptr->next)
+    for (int i = 0; i < ptr->naddrs; i++)
+      if (ptr->addrs[i] == node)
+        return ptr->reg;
+  return NULL;
+}
 
-    if (node_refs_var(node->lhs, var) || node_refs_var(node->rhs, var) ||
-        node_refs_var(node->cond, var) || node_refs_var(node->then, var) ||
-        node_refs_var(node->els, var) || node_refs_var(node->init, var) ||
-        node_refs_var(node->inc, var) || node_refs_var(node->body, var) ||
-        node_refs_var(node->args, var) || node_refs_var(node->cas_addr, var) ||
-        node_refs_var(node->cas_old, var) || node_refs_var(node->cas_new, var) ||
-        node_refs_var(node->atomic_expr, var))
-      return true;
+static char *spare_homereg(void) {
+  for (int i = 0; i < homereg_len; i++) {
+    char *reg = homereg[i];
+    bool busy = false;
+    for (Obj *var = current_fn->locals; var && !busy; var = var->next)
+      busy = (var->reg && !strcmp(var->reg, reg)) ||
+             (var->reg_hi && !strcmp(var->reg_hi, reg));
+    for (IvPointer *ptr = iv_pointers; ptr && !busy; ptr = ptr->next)
+      busy = !strcmp(ptr->reg, reg);
+    if (!busy)
+      return reg;
   }
-  return false;
+  return NULL;
 }
 
-static void emit_text(Obj *prog) {
-  emit_start(prog);
+// The scale of `base + i * scale` for the loop counter `i`, or 0.
+static int indexed_scale(Node *node, Obj *var) {
+  if (node->kind != ND_ADD || !node->ty->base || !reg_word(node->lhs) ||
+      skip_word_casts(node->lhs)->kind != ND_VAR)
+    return 0;
+
+  Node *idx = skip_word_casts(node->rhs);
+  uint32_t scale = 1;
+  if (idx->kind == ND_MUL && get_imm32(idx->rhs, &scale))
+    idx = skip_word_casts(idx->lhs);
+  if (idx->kind != ND_VAR || idx->var != var || scale == 0 || scale > 0x10000)
+    return 0;
+  return scale;
+}
 
-  for (Obj *fn = prog; fn; fn = fn->next) {
-    if (!fn->is_function || !fn->is_definition || !fn->is_live)
-      continue;
-    bool bare_start = opt_shy_no_main && !strcmp(fn->name, "_start");
-    println(".section text.%s", fn->name);
-    emit_source_line(fn->tok);
-    println(".symbol %s", fn->name);
-    current_fn = fn;
-
-    if (!bare_start) {
-      println("pusha fx");
-      println("seta fx sp");
-      if (fn->stack_size)
-        println("addn sp %d", fn->stack_size);
-    }
-
-    int slot = 0;
-    for (Obj *var = fn->params; var; var = var->next) {
-      if (bare_start)
-        error_tok(var->tok, "Shy bare _start cannot have parameters");
-      VInfo vi = vinfo(var->ty);
-      if (slot + (vi.is64 ? 2 : 1) > argreg_len)
-        error_tok(var->tok ? var->tok : fn->tok,
-                  "Shy backend supports at most eight argument slots");
-      println("setn 3x %d", var->offset);
-      println("adda 3x fx");
-      if (vi.is64) {
-        println("puta 3x %s", argreg[slot + 1]);
-        println("addn 3x 4");
-        println("puta 3x %s", argreg[slot]);
-        slot += 2;
-      } else {
-        println("puta 3x %s", argreg[slot++]);
+static void collect_indexed(Node *node, Node *loop, Obj *var, IvPointer **list) {
+  for (; node; node = node->next) {
+    int scale = indexed_scale(node, var);
+    Obj *base = scale ? skip_word_casts(node->lhs)->var : NULL;
+    if (base && !node_writes_var(loop, base)) {
+      IvPointer *ptr = *list;
+      while (ptr && (ptr->base != base || ptr->scale != scale))
+        ptr = ptr->next;
+      if (!ptr) {
+        ptr = calloc(1, sizeof(IvPointer));
+        ptr->base = base;
+        ptr->scale = scale;
+        ptr->next = *list;
+        *list = ptr;
       }
+      ptr->addrs = realloc(ptr->addrs, sizeof(Node *) * (ptr->naddrs + 1));
+      ptr->addrs[ptr->naddrs++] = node;
+      continue;
     }
 
-    if (fn->va_area && !bare_start && node_refs_var(fn->body, fn->va_area)) {
-      int vararg_slot = 0;
-      for (int i = slot; i < argreg_len; i++) {
-        println("setn 3x %d", fn->va_area->offset + vararg_slot * 4);
-        println("adda 3x fx");
-        println("puta 3x %s", argreg[i]);
-        vararg_slot++;
-      }
-    }
+    collect_indexed(node->lhs, loop, var, list);
+    collect_indexed(node->rhs, loop, var, list);
+    collect_indexed(node->cond, loop, var, list);
+    collect_indexed(node->then, loop, var, list);
+    collect_indexed(node->els, loop, var, list);
+    collect_indexed(node->init, loop, var, list);
+    collect_indexed(node->inc, loop, var, list);
+    collect_indexed(node->body, loop, var, list);
+    collect_indexed(node->args, loop, var, list);
+  }
+}
 
-    gen_stmt(fn->body);
+// Sets up the strength-reduced pointers of a `for` loop whose init has just
+// been emitted. Returns the pointers of enclosing loops, which become
+// current again once the loop is done.
+static IvPointer *reduce_induction_pointers(Node *node) {
+  IvPointer *outer = iv_pointers;
+  int32_t step;
+  Obj *var = loop_counter(node->inc, &step);
+  if (!opt_shy_loop_opts || !current_fn_frameless || !var || !var->reg ||
+      node_writes_var(node->then, var) || node_writes_var(node->cond, var))
+    return outer;
+
+  IvPointer *found = NULL;
+  collect_indexed(node->then, node, var, &found);
+  while (found) {
+    IvPointer *ptr = found;
+    found = found->next;
+    ptr->reg = spare_homereg();
+    if (!ptr->reg)
+      break;
+    ptr->step = step * ptr->scale;
+    println("seta %s %s", ptr->reg, var->reg);
+    if (ptr->scale != 1)
+      println("muln %s %d", ptr->reg, ptr->scale);
+    println("adda %s %s", ptr->reg, ptr->base->reg);
+    ptr->next = iv_pointers;
+    iv_pointers = ptr;
+  }
+  return outer;
+}
 
-    if (!strcmp(fn->name, "main")) {
-      println("setn 1x 0");
-      println("setn 2x 0");
+static void bump_induction_pointers(IvPointer *outer) {
+  for (IvPointer *ptr = iv_pointers; ptr != outer; ptr = ptr->next)
+    println("addn %s %u", ptr->reg, (uint32_t)ptr->step);
+}
+
+static void release_induction_pointers(IvPointer *outer) {
+  iv_pointers = outer;
+}
+
+// Tail calls.
+//
+// `return f(...)` tears the frame down once the arguments are in registers
+// and jumps to f, which then returns straight to our caller. That is only
+// safe if nothing in the callee can point into the frame being released, so
+// functions that take the address of a local, keep aggregates on the stack,
+// or contain inline assembly or VLAs never tail-call.
+
+static bool can_tail_call_from(Obj *fn) {
+  if (returns_by_sret(fn->ty->return_ty) || blocks_inlining(fn->body))
+    return false;
+
+  mark_addr_taken(fn->body);
+  for (Obj *var = fn->locals; var; var = var->next) {
+    if (!node_refs_var(fn->body, var))
+      continue;
+    if (var->is_addr_taken || var->is_sret_alias)
+      return false;
+    switch (var->ty->kind) {
+    case TY_STRUCT:
+    case TY_UNION:
+    case TY_ARRAY:
+    case TY_VLA:
+      return false;
+    default:
+      break;
     }
+  }
+  return true;
+}
+
+// Whether converting the callee's result to the return type emits no code.
+static bool is_nop_return_cast(Type *from, Type *to) {
+  if (to->kind == TY_VOID)
+    return true;
+  if (is_shy_flonum(from) || is_shy_flonum(to))
+    return from->kind == to->kind;
+  if (from->size != to->size)
+    return false;
+  return from->size >= 4 || (from->kind == to->kind && from->is_unsigned == to->is_unsigned);
+}
+
+// Returns the call if `node`, the value of a return statement, can be
+// emitted as a tail call.
+static Node *tail_call(Node *node) {
+  if (!current_fn_tail_calls || !node)
+    return NULL;
+  if (node->kind == ND_CAST && is_nop_return_cast(node->lhs->ty, node->ty))
+    node = node->lhs;
+  if (node->kind != ND_FUNCALL || node->lhs->kind != ND_VAR ||
+      returns_by_sret(node->ty) || count_funcall_slots(node) > argreg_len)
+    return NULL;
+  for (Node *arg = node->args; arg; arg = arg->next)
+    if (returns_by_sret(arg->ty))
+      return NULL;
+  return node;
+}
+
+static void emit_function(Obj *fn) {
+  bool bare_start = opt_shy_no_main && !strcmp(fn->name, "_start");
+  println(".section text.%s", fn->name);
+  emit_source_line(fn->tok);
+  println(".symbol %s", fn->name);
+  current_fn = fn;
+  bool frameless = !bare_start && assign_reg_homes(fn);
+  current_fn_frameless = frameless;
+  current_fn_tail_calls =
+      opt_shy_tail_calls && !bare_start && !frameless && can_tail_call_from(fn);
+
+  if (!bare_start && !frameless) {
+    println("pusha fx");
+    println("seta fx sp");
+    if (fn->stack_size)
+      println("addn sp %d", fn->stack_size);
+  }
 
-    println(".L.return.%s:", fn->name);
-    if (bare_start) {
-      println("ujmpn .L.return.%s", fn->name);
+  int slot = 0;
+  for (Obj *var = fn->params; var; var = var->next) {
+    if (bare_start)
+      error_tok(var->tok, "Shy bare _start cannot have parameters");
+    VInfo vi = vinfo(var->ty);
+    if (slot + (vi.is64 ? 2 : 1) > argreg_len)
+      error_tok(var->tok ? var->tok : fn->tok,
+                "Shy backend supports at most eight argument slots");
+    if (frameless) {
+      move_param_to_home(var, slot);
+      slot += vi.is64 ? 2 : 1;
       continue;
     }
+    println("setn 3x %d", var->offset);
+    println("adda 3x fx");
+    if (vi.is64) {
+      println("puta 3x %s", argreg[slot + 1]);
+      println("addn 3x 4");
+      println("puta 3x %s", argreg[slot]);
+      slot += 2;
+    } else if (var->ty->size == 1) {
+      println("put8a 3x %s", argreg[slot++]);
+    } else if (var->ty->size == 2) {
+      println("put16a 3x %s", argreg[slot++]);
+    } else {
+      println("puta 3x %s", argreg[slot++]);
+    }
+  }
+
+  if (fn->va_area && !bare_start && !frameless && node_refs_var(fn->body, fn->va_area)) {
+    int vararg_slot = 0;
+    for (int i = slot; i < argreg_len; i++) {
+      println("setn 3x %d", fn->va_area->offset + vararg_slot * 4);
+      println("adda 3x fx");
+      println("puta 3x %s", argreg[i]);
+      vararg_slot++;
+    }
+  }
+
+  gen_stmt(fn->body);
+
+  if (!strcmp(fn->name, "main")) {
+    println("setn 1x 0");
+    println("setn 2x 0");
+  }
+
+  println(".L.return.%s:", fn->name);
+  if (bare_start) {
+    println("ujmpn .L.return.%s", fn->name);
+    return;
+  }
+  if (!frameless) {
     println("seta sp fx");
     println("popa fx");
-    println("ret");
   }
+  println("ret");
+}
+
+// The linker places text sections in input order, so functions the
+// profile never saw run go last to keep the executed ones together.
+static void emit_text(Obj *prog) {
+  emit_start(prog);
+
+  for (int cold = 0; cold < 2; cold++)
+    for (Obj *fn = prog; fn; fn = fn->next)
+      if (fn->is_function && fn->is_definition && fn->is_live &&
+          profile_shy_is_cold(fn->name) == cold)
+        emit_function(fn);
 }
 
 static void emit_u64_divmod_runtime(void) {
@@ -1794,6 +4085,11 @@ static void emit_u64_divmod_runtime(void) {
   println("ora dx cx");
   println("equn dx 0");
   println("jmpn .L.u64.divzero");
+  // Operands that fit in 32 bits use the hardware divide.
+  println("seta dx 2x");
+  println("ora dx cx");
+  println("equn dx 0");
+  println("jmpn .L.u64.small");
   println("setn 4x 0");
   println("setn 5x 0");
   println("setn 6x 0");
@@ -1845,6 +4141,14 @@ static void emit_u64_divmod_runtime(void) {
   println("seta 1x 4x");
   println("seta 2x 5x");
   println("ret");
+  println(".L.u64.small:");
+  println("seta 6x 1x");
+  println("diva 1x 3x");
+  println("seta 4x 1x");
+  println("mula 4x 3x");
+  println("suba 6x 4x");
+  println("setn 7x 0");
+  println("ret");
   println(".L.u64.divzero:");
   println("setn 1x 0xffffffff");
   println("setn 2x 0xffffffff");
@@ -1905,64 +4209,65 @@ static void emit_u64_mul_runtime(void) {
   println("ret");
 }
 
-static void emit_i64_cmp_runtime(void) {
-  if (!need_i64_cmp)
-    return;
-
-  println(".section text.__shy_i64_lt");
-  println(".symbol __shy_i64_lt");
-  println("seta 8x 2x");
-  println("rsn 8x 31");
-  println("seta 9x cx");
-  println("rsn 9x 31");
-  println("equa 8x 9x");
-  println("jmpn .L.i64.lt.same_sign");
-  println("seta 1x 8x");
-  println("setn 2x 0");
-  println("ret");
-  println(".L.i64.lt.same_sign:");
-  println("smaa 2x cx");
-  println("jmpn .L.i64.lt.true");
-  println("biga 2x cx");
-  println("jmpn .L.i64.lt.false");
-  println("smaa 1x 3x");
-  println("jmpn .L.i64.lt.true");
-  println(".L.i64.lt.false:");
-  println("setn 1x 0");
-  println("setn 2x 0");
-  println("ret");
-  println(".L.i64.lt.true:");
-  println("setn 1x 1");
-  println("setn 2x 0");
-  println("ret");
+// Block helpers take the word count in cx and unroll eight words per
+// iteration. They leave the pointers advanced past the block.
+static void emit_block_helpers(void) {
+  if (need_copy_words) {
+    char *name = block_helper("__shy_copy_words");
+    println(".section text.%s", name);
+    println(".symbol %s", name);
+    println(".L.copy.words.loop:");
+    println("sman cx 8");
+    println("jmpn .L.copy.words.tail");
+    for (int i = 0; i < 8; i++) {
+      println("geta dx 1x");
+      println("puta 3x dx");
+      println("addn 1x 4");
+      println("addn 3x 4");
+    }
+    println("subn cx 8");
+    println("ujmpn .L.copy.words.loop");
+    println(".L.copy.words.tail:");
+    println("equn cx 0");
+    println("jmpn .L.copy.words.done");
+    println("geta dx 1x");
+    println("puta 3x dx");
+    println("addn 1x 4");
+    println("addn 3x 4");
+    println("subn cx 1");
+    println("ujmpn .L.copy.words.tail");
+    println(".L.copy.words.done:");
+    println("ret");
+  }
 
-  println(".section text.__shy_i64_le");
-  println(".symbol __shy_i64_le");
-  println("seta 4x 1x");
-  println("seta 5x 2x");
-  println("seta 6x 3x");
-  println("seta 7x cx");
-  println("xora 1x 3x");
-  println("xora 2x cx");
-  println("ora 1x 2x");
-  println("equn 1x 0");
-  println("jmpn .L.i64.le.true");
-  println("seta 1x 4x");
-  println("seta 2x 5x");
-  println("seta 3x 6x");
-  println("seta cx 7x");
-  println("calln __shy_i64_lt");
-  println("ret");
-  println(".L.i64.le.true:");
-  println("setn 1x 1");
-  println("setn 2x 0");
-  println("ret");
+  if (need_zero_words) {
+    char *name = block_helper("__shy_zero_words");
+    println(".section text.%s", name);
+    println(".symbol %s", name);
+    println(".L.zero.words.loop:");
+    println("sman cx 8");
+    println("jmpn .L.zero.words.tail");
+    for (int i = 0; i < 8; i++) {
+      println("putn 3x 0");
+      println("addn 3x 4");
+    }
+    println("subn cx 8");
+    println("ujmpn .L.zero.words.loop");
+    println(".L.zero.words.tail:");
+    println("equn cx 0");
+    println("jmpn .L.zero.words.done");
+    println("putn 3x 0");
+    println("addn 3x 4");
+    println("subn cx 1");
+    println("ujmpn .L.zero.words.tail");
+    println(".L.zero.words.done:");
+    println("ret");
+  }
 }
 
 static void emit_runtime(void) {
   emit_u64_mul_runtime();
   emit_u64_divmod_runtime();
-  emit_i64_cmp_runtime();
 }
 
 void codegen_shy(Obj *prog, FILE *out) {
@@ -1970,8 +4275,21 @@ void codegen_shy(Obj *prog, FILE *out) {
   last_source_filename = NULL;
   last_source_line = 0;
   rename_private_symbols(prog);
+  if (opt_shy_profile_use)
+    profile_shy_load(opt_shy_profile_use);
+  if (opt_shy_inline)
+    inline_functions(prog);
   assign_lvar_offsets(prog);
 
+  // Text is generated first because switch jump tables are data that is
+  // only known once the functions have been emitted.
+  char *text;
+  size_t textlen;
+  output_file = open_memstream(&text, &textlen);
+  emit_text(prog);
+  fclose(output_file);
+  output_file = out;
+
   if (opt_shy_mem_hint)
     println("#![mem(%s)]", opt_shy_mem_hint);
   if (opt_shy_stack_hint)
@@ -1981,10 +4299,19 @@ void codegen_shy(Obj *prog, FILE *out) {
   println("___DATA___");
   fputc('\n', output_file);
   emit_data(prog);
+  emit_switch_tables();
   fputc('\n', output_file);
   println("___CODE___");
   fputc('\n', output_file);
-  emit_text(prog);
+  if (opt_shy_peephole)
+    peephole_shy(text, textlen, output_file);
+  else
+    fwrite(text, 1, textlen, output_file);
+  free(text);
+
+  // Hand-written helpers have their own register conventions, so they
+  // bypass the peephole pass.
+  emit_block_helpers();
   if (opt_shy_link_runtime)
     emit_runtime();
 }
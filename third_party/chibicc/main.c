@@ -11,6 +11,18 @@ bool opt_target_shy;
 bool opt_shy_link_runtime;
 bool opt_shy_no_main;
 bool opt_shy_emit_source_lines;
+bool opt_shy_peephole_stats;
+
+// Shy backend passes, selected by -O. The default is -O2.
+bool opt_shy_frameless = true;
+bool opt_shy_inline = true;
+bool opt_shy_jump_tables = true;
+bool opt_shy_peephole = true;
+bool opt_shy_tail_calls = true;
+bool opt_shy_loop_opts = true;
+bool opt_shy_unroll = true;
+bool opt_shy_strength_reduce = true;
+char *opt_shy_profile_use;
 char *opt_shy_mem_hint;
 char *opt_shy_stack_hint;
 
@@ -30,6 +42,7 @@ static bool opt_shared;
 static char *opt_MF;
 static char *opt_MT;
 static char *opt_o;
+static bool opt_keep_frame_pointer;
 
 static StringArray ld_extra_args;
 static StringArray std_include_paths;
@@ -117,6 +130,30 @@ static char *quote_makefile(char *s) {
   return buf;
 }
 
+// -O0 emits every construct the straightforward way, which keeps the
+// output close to the source for --shy-emit-source-lines. -O1 enables the
+// passes that work within a statement or a function's frame, and -O2 adds
+// inlining, tail calls and loop transformations. -Os is -O2 without loop
+// unrolling.
+static void set_shy_opt_level(char *arg) {
+  char *level = arg + 2;
+  bool size = !strcmp(level, "s") || !strcmp(level, "z");
+  bool o1 = !*level || !strcmp(level, "1") || !strcmp(level, "g");
+  bool o2 = size || !strcmp(level, "2") || !strcmp(level, "3") ||
+            !strcmp(level, "fast");
+  if (!o1 && !o2 && strcmp(level, "0"))
+    error("unknown optimization level: %s", arg);
+
+  opt_shy_frameless = o1 || o2;
+  opt_shy_jump_tables = o1 || o2;
+  opt_shy_peephole = o1 || o2;
+  opt_shy_strength_reduce = o1 || o2;
+  opt_shy_inline = o2;
+  opt_shy_tail_calls = o2;
+  opt_shy_loop_opts = o2;
+  opt_shy_unroll = o2 && !size;
+}
+
 static void parse_args(int argc, char **argv) {
   // Make sure that all command line options that take an argument
   // have an argument.
@@ -294,6 +331,11 @@ static void parse_args(int argc, char **argv) {
       continue;
     }
 
+    if (!strcmp(argv[i], "--shy-peephole-stats")) {
+      opt_shy_peephole_stats = true;
+      continue;
+    }
+
     if (!strcmp(argv[i], "-cc1-input")) {
       base_file = argv[++i];
       continue;
@@ -338,14 +380,27 @@ static void parse_args(int argc, char **argv) {
       exit(0);
     }
 
+    if (!strncmp(argv[i], "-O", 2)) {
+      set_shy_opt_level(argv[i]);
+      continue;
+    }
+
+    if (!strncmp(argv[i], "-fprofile-use=", 14)) {
+      opt_shy_profile_use = argv[i] + 14;
+      continue;
+    }
+
+    if (!strcmp(argv[i], "-fno-omit-frame-pointer")) {
+      opt_keep_frame_pointer = true;
+      continue;
+    }
+
     // These options are ignored for now.
-    if (!strncmp(argv[i], "-O", 2) ||
-        !strncmp(argv[i], "-W", 2) ||
+    if (!strncmp(argv[i], "-W", 2) ||
         !strncmp(argv[i], "-g", 2) ||
         !strncmp(argv[i], "-std=", 5) ||
         !strcmp(argv[i], "-ffreestanding") ||
         !strcmp(argv[i], "-fno-builtin") ||
-        !strcmp(argv[i], "-fno-omit-frame-pointer") ||
         !strcmp(argv[i], "-fno-stack-protector") ||
         !strcmp(argv[i], "-fno-strict-aliasing") ||
         !strcmp(argv[i], "-m64") ||
@@ -362,6 +417,9 @@ static void parse_args(int argc, char **argv) {
   for (int i = 0; i < idirafter.len; i++)
     strarray_push(&include_paths, idirafter.data[i]);
 
+  if (opt_keep_frame_pointer)
+    opt_shy_frameless = false;
+
   if (input_paths.len == 0)
     error("no input files");
 
@@ -456,6 +514,17 @@ static void run_cc1(int argc, char **argv, char *input, char *output) {
 static void print_tokens(Token *tok) {
   FILE *out = open_file(opt_o ? opt_o : "-");
 
+  // The tokenizer consumes ShyC file metadata. Print it back so that the
+  // preprocessed output still describes the same program.
+  if (opt_target_shy) {
+    if (opt_shy_no_main)
+      fprintf(out, "#![no_main]\n");
+    if (opt_shy_mem_hint)
+      fprintf(out, "#![mem(%s)]\n", opt_shy_mem_hint);
+    if (opt_shy_stack_hint)
+      fprintf(out, "#![stack(%s)]\n", opt_shy_stack_hint);
+  }
+
   int line = 1;
   for (; tok->kind != TK_EOF; tok = tok->next) {
     if (line > 1 && tok->at_bol)
@@ -45,6 +45,8 @@ typedef struct {
   bool is_extern;
   bool is_inline;
   bool is_tls;
+  bool is_always_inline;
+  bool is_noinline;
   int align;
 } VarAttr;
 
@@ -714,6 +716,7 @@ static Obj *new_anon_gvar(Type *ty) {
 static Obj *new_string_literal(char *p, Type *ty) {
   Obj *var = new_anon_gvar(ty);
   var->init_data = p;
+  var->is_string_literal = true;
   return var;
 }
 
@@ -736,6 +739,37 @@ static void push_tag_scope(Token *tok, Type *ty) {
   hashmap_put2(&scope->tags, tok->loc, tok->len, ty);
 }
 
+// function-attribute = "__attribute__" "(" "(" attr ("," attr)* ")" ")"
+// attr = "always_inline" | "noinline"
+static Token *function_attribute(Token *tok, VarAttr *attr) {
+  if (!attr)
+    error_tok(tok, "attribute is not allowed in this context");
+  tok = skip(tok->next, "(");
+  tok = skip(tok, "(");
+
+  bool first = true;
+
+  while (!consume(&tok, tok, ")")) {
+    if (!first)
+      tok = skip(tok, ",");
+    first = false;
+
+    if (consume(&tok, tok, "always_inline")) {
+      attr->is_always_inline = true;
+      continue;
+    }
+
+    if (consume(&tok, tok, "noinline")) {
+      attr->is_noinline = true;
+      continue;
+    }
+
+    error_tok(tok, "unknown attribute");
+  }
+
+  return skip(tok, ")");
+}
+
 // declspec = ("void" | "_Bool" | "char" | "short" | "int" | "long"
 //             | "typedef" | "static" | "extern" | "inline"
 //             | "_Thread_local" | "__thread"
@@ -743,7 +777,8 @@ static void push_tag_scope(Token *tok, Type *ty) {
 //             | struct-decl | union-decl | typedef-name
 //             | enum-specifier | typeof-specifier
 //             | "const" | "volatile" | "auto" | "register" | "restrict"
-//             | "__restrict" | "__restrict__" | "_Noreturn")+
+//             | "__restrict" | "__restrict__" | "_Noreturn"
+//             | function-attribute)+
 //
 // The order of typenames in a type-specifier doesn't matter. For
 // example, `int long static` means the same as `static long int`.
@@ -812,6 +847,11 @@ static Type *declspec(Token **rest, Token *tok, VarAttr *attr) {
         consume(&tok, tok, "__restrict__") || consume(&tok, tok, "_Noreturn"))
       continue;
 
+    if (equal(tok, "__attribute__")) {
+      tok = function_attribute(tok, attr);
+      continue;
+    }
+
     if (equal(tok, "_Atomic")) {
       tok = tok->next;
       if (equal(tok , "(")) {
@@ -1903,7 +1943,7 @@ static bool is_typename(Token *tok) {
       "typedef", "enum", "static", "extern", "_Alignas", "signed", "unsigned",
       "const", "volatile", "auto", "register", "restrict", "__restrict",
       "__restrict__", "_Noreturn", "float", "double", "typeof", "inline",
-      "_Thread_local", "__thread", "_Atomic",
+      "_Thread_local", "__thread", "_Atomic", "__attribute__",
     };
 
     for (int i = 0; i < sizeof(kw) / sizeof(*kw); i++)
@@ -2044,8 +2084,8 @@ static Node *stmt(Token **rest, Token *tok) {
       error_tok(tok, "stray case");
 
     Node *node = new_node(ND_CASE, tok);
-    int begin = const_expr(&tok, tok->next);
-    int end;
+    long begin = const_expr(&tok, tok->next);
+    long end;
 
     if (equal(tok, "...")) {
       // [GNU] Case ranges, e.g. "case 1 ... 5:"
@@ -2597,6 +2637,11 @@ static Node *to_assign(Node *binary) {
     return node;
   }
 
+  // On Shy, convert `A op= B` to `A = A op B` if A is a plain variable so
+  // that A does not have its address taken and can live in a register.
+  if (opt_target_shy && binary->lhs->kind == ND_VAR)
+    return new_binary(ND_ASSIGN, new_var_node(binary->lhs->var, tok), binary, tok);
+
   // Convert `A op= B` to ``tmp = &A, *tmp = *tmp op B`.
   Obj *var = new_lvar("", pointer_to(binary->lhs->ty));
 
@@ -2824,6 +2869,22 @@ static Node *shift(Token **rest, Token *tok) {
   }
 }
 
+// Scales an integer by the pointee size for pointer arithmetic. Shy
+// pointers are 32 bits wide, so the offset is computed in 32 bits there
+// instead of as a 64-bit `long` multiply.
+static Node *pointer_offset(Node *idx, int size, Token *tok) {
+  if (!opt_target_shy)
+    return new_binary(ND_MUL, idx, new_long(size, tok), tok);
+
+  if (idx->kind == ND_NUM)
+    return new_num((int32_t)(idx->val * size), tok);
+  if (idx->ty->size == 8)
+    idx = new_cast(idx, ty_int);
+  if (size == 1)
+    return idx;
+  return new_binary(ND_MUL, idx, new_num(size, tok), tok);
+}
+
 // In C, `+` operator is overloaded to perform the pointer arithmetic.
 // If p is a pointer, p+n adds not n but sizeof(*p)*n to the value of p,
 // so that p+n points to the location n elements (not bytes) ahead of p.
@@ -2854,7 +2915,7 @@ static Node *new_add(Node *lhs, Node *rhs, Token *tok) {
   }
 
   // ptr + num
-  rhs = new_binary(ND_MUL, rhs, new_long(lhs->ty->base->size, tok), tok);
+  rhs = pointer_offset(rhs, lhs->ty->base->size, tok);
   return new_binary(ND_ADD, lhs, rhs, tok);
 }
 
@@ -2878,7 +2939,7 @@ static Node *new_sub(Node *lhs, Node *rhs, Token *tok) {
 
   // ptr - num
   if (lhs->ty->base && is_integer(rhs->ty)) {
-    rhs = new_binary(ND_MUL, rhs, new_long(lhs->ty->base->size, tok), tok);
+    rhs = pointer_offset(rhs, lhs->ty->base->size, tok);
     add_type(rhs);
     Node *node = new_binary(ND_SUB, lhs, rhs, tok);
     node->ty = lhs->ty;
@@ -3884,6 +3945,8 @@ static Token *predeclare_function(Token *tok, Type *basety, VarAttr *attr) {
     fn->is_root = !(fn->is_static && fn->is_inline);
   }
 
+  fn->is_always_inline = fn->is_always_inline || attr->is_always_inline;
+  fn->is_noinline = fn->is_noinline || attr->is_noinline;
   register_current_impl_method(orig_name, fn);
 
   if (consume(&tok, tok, ";"))
@@ -3974,6 +4037,8 @@ static Token *function(Token *tok, Type *basety, VarAttr *attr) {
     fn->is_inline = attr->is_inline;
   }
 
+  fn->is_always_inline = fn->is_always_inline || attr->is_always_inline;
+  fn->is_noinline = fn->is_noinline || attr->is_noinline;
   register_current_impl_method(orig_name, fn);
 
   fn->tok = ty->name;
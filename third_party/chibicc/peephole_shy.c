@@ -0,0 +1,621 @@
+#include "chibicc.h"
+
+// Peephole optimizer for the Shy backend.
+//
+// codegen_shy.c emits each expression through a fixed register protocol
+// (results in 1x/2x, operands pushed and popped), which leaves local
+// redundancies in the instruction stream. This pass rewrites the emitted
+// text of a translation unit with a small table of rules, each of which
+// looks at one instruction and a short window around it.
+//
+// The analysis is deliberately local. Labels, calls, returns, jumps and any
+// line the pass does not recognize (for example inline assembly with unusual
+// operands) end a window, and every register is considered live there. The
+// one exception is the liveness query used to delete dead writes, which
+// also follows jumps to labels in the same text for a few steps.
+
+#define PEEPHOLE_WINDOW 32
+#define PEEPHOLE_BRANCH_DEPTH 4
+
+// Registers a caller can observe after `ret`: the return value in 1x/2x and
+// the frame pointer. Every other register may be clobbered by a call. This
+// holds for compiled functions only; runtime helpers with other conventions
+// are emitted after this pass.
+#define RET_LIVE ((1 << 1) | (1 << 2) | (1 << 15))
+#define PEEPHOLE_MAX_PASSES 8
+
+typedef enum {
+  LN_OTHER,     // directive or unrecognized line; ends every window
+  LN_BLANK,     // empty line or comment; ignored by the rules
+  LN_LABEL,
+  LN_INSN,
+} LineKind;
+
+typedef enum {
+  OP_BARRIER,   // calls; every register is live across them
+  OP_ALU_A,     // a1 = a1 op a2
+  OP_ALU_N,     // a1 = a1 op imm
+  OP_NOT,       // a1 = ~a1
+  OP_CMP_A,     // rs = a1 cmp a2
+  OP_CMP_N,     // rs = a1 cmp imm
+  OP_SETA,
+  OP_SETN,
+  OP_LOAD_A,    // a1 = mem[a2]
+  OP_LOAD_N,    // a1 = mem[imm]
+  OP_STORE_A,   // mem[a1] = a2
+  OP_STORE_N,   // mem[a1] = imm
+  OP_PUSHA,
+  OP_PUSHN,
+  OP_POPA,
+  OP_POP,
+  OP_JMPN,      // conditional jump to a label
+  OP_UJMPN,     // unconditional jump to a label
+  OP_END,       // unconditional transfer with no fallthrough: ret, ujmpa
+} OpClass;
+
+typedef struct {
+  char *name;
+  OpClass cls;
+} OpInfo;
+
+static OpInfo ops[] = {
+  {"adda", OP_ALU_A}, {"suba", OP_ALU_A}, {"mula", OP_ALU_A},
+  {"diva", OP_ALU_A}, {"lsa", OP_ALU_A}, {"rsa", OP_ALU_A},
+  {"anda", OP_ALU_A}, {"ora", OP_ALU_A}, {"xora", OP_ALU_A},
+  {"addn", OP_ALU_N}, {"subn", OP_ALU_N}, {"muln", OP_ALU_N},
+  {"divn", OP_ALU_N}, {"lsn", OP_ALU_N}, {"rsn", OP_ALU_N},
+  {"andn", OP_ALU_N}, {"orn", OP_ALU_N}, {"xorn", OP_ALU_N},
+  {"nota", OP_NOT},
+  {"equa", OP_CMP_A}, {"biga", OP_CMP_A}, {"bigequa", OP_CMP_A},
+  {"smaa", OP_CMP_A}, {"smaequa", OP_CMP_A},
+  {"equn", OP_CMP_N}, {"bign", OP_CMP_N}, {"bigequn", OP_CMP_N},
+  {"sman", OP_CMP_N}, {"smaequn", OP_CMP_N},
+  {"seta", OP_SETA}, {"setn", OP_SETN},
+  {"geta", OP_LOAD_A}, {"get8a", OP_LOAD_A}, {"get16a", OP_LOAD_A},
+  {"getn", OP_LOAD_N}, {"get8n", OP_LOAD_N}, {"get16n", OP_LOAD_N},
+  {"puta", OP_STORE_A}, {"put8a", OP_STORE_A}, {"put16a", OP_STORE_A},
+  {"putn", OP_STORE_N}, {"put8n", OP_STORE_N}, {"put16n", OP_STORE_N},
+  {"pusha", OP_PUSHA}, {"pushn", OP_PUSHN}, {"popa", OP_POPA}, {"pop", OP_POP},
+  {"jmpn", OP_JMPN}, {"ujmpn", OP_UJMPN},
+  {"calln", OP_BARRIER}, {"calla", OP_BARRIER},
+  {"ret", OP_END}, {"ujmpa", OP_END},
+};
+
+typedef struct {
+  LineKind kind;
+  char *text;     // NULL once the line has been deleted
+  char *label;
+  char *op;
+  char *arg[2];
+  int nargs;
+  OpClass cls;
+  int reads;      // bitmask of general registers read
+  int writes;     // bitmask of general registers written
+  bool stack;     // reads or writes sp
+} Line;
+
+static Line *lines;
+static int nlines;
+static HashMap labels;
+
+static int gpr(char *s) {
+  if (s[0] && s[1] == 'x' && !s[2]) {
+    if ('0' <= s[0] && s[0] <= '9')
+      return s[0] - '0';
+    if ('a' <= s[0] && s[0] <= 'f')
+      return s[0] - 'a' + 10;
+  }
+  return -1;
+}
+
+// Records a register operand. Returns false if the operand is something the
+// pass cannot track, such as a special register or a numeric address.
+static bool reg_operand(Line *l, char *s, bool read, bool write) {
+  if (!strcmp(s, "sp")) {
+    l->stack = true;
+    return true;
+  }
+  int r = gpr(s);
+  if (r < 0)
+    return false;
+  if (read)
+    l->reads |= 1 << r;
+  if (write)
+    l->writes |= 1 << r;
+  return true;
+}
+
+static bool classify(Line *l) {
+  OpInfo *info = NULL;
+  for (int i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+    if (!strcmp(ops[i].name, l->op)) {
+      info = &ops[i];
+      break;
+    }
+  }
+  if (!info)
+    return false;
+  l->cls = info->cls;
+
+  switch (l->cls) {
+  case OP_BARRIER:
+    return l->nargs == 1;
+  case OP_ALU_A:
+    return l->nargs == 2 && reg_operand(l, l->arg[0], true, true) &&
+           reg_operand(l, l->arg[1], true, false);
+  case OP_ALU_N:
+    return l->nargs == 2 && reg_operand(l, l->arg[0], true, true);
+  case OP_NOT:
+    return l->nargs == 1 && reg_operand(l, l->arg[0], true, true);
+  case OP_CMP_A:
+  case OP_STORE_A:
+    return l->nargs == 2 && reg_operand(l, l->arg[0], true, false) &&
+           reg_operand(l, l->arg[1], true, false);
+  case OP_CMP_N:
+  case OP_STORE_N:
+    return l->nargs == 2 && reg_operand(l, l->arg[0], true, false);
+  case OP_SETA:
+  case OP_LOAD_A:
+    return l->nargs == 2 && reg_operand(l, l->arg[0], false, true) &&
+           reg_operand(l, l->arg[1], true, false);
+  case OP_SETN:
+  case OP_LOAD_N:
+    return l->nargs == 2 && reg_operand(l, l->arg[0], false, true);
+  case OP_PUSHA:
+    l->stack = true;
+    return l->nargs == 1 && reg_operand(l, l->arg[0], true, false);
+  case OP_POPA:
+    l->stack = true;
+    return l->nargs == 1 && reg_operand(l, l->arg[0], false, true);
+  case OP_PUSHN:
+    l->stack = true;
+    return l->nargs == 1;
+  case OP_POP:
+    l->stack = true;
+    return l->nargs == 0;
+  case OP_JMPN:
+  case OP_UJMPN:
+    return l->nargs == 1;
+  case OP_END:
+    if (l->nargs == 0 && !strcmp(l->op, "ret")) {
+      l->reads = RET_LIVE;
+      return true;
+    }
+    return l->nargs == 1 && reg_operand(l, l->arg[0], true, false);
+  }
+  return false;
+}
+
+static void parse_line(Line *l, char *text) {
+  *l = (Line){0};
+  l->text = text;
+
+  char *p = text;
+  while (isspace(*p))
+    p++;
+  if (!*p || !strncmp(p, "//", 2)) {
+    l->kind = LN_BLANK;
+    return;
+  }
+
+  char *end = p + strlen(p);
+  while (p < end && isspace(end[-1]))
+    end--;
+
+  if (end[-1] == ':') {
+    l->kind = LN_LABEL;
+    l->label = strndup(p, end - p - 1);
+    for (char *q = l->label; *q; q++)
+      if (isspace(*q))
+        l->kind = LN_OTHER;
+    return;
+  }
+
+  l->kind = LN_OTHER;
+  if (*p == '.')
+    return;
+
+  char *tok[4];
+  int ntok = 0;
+  while (p < end) {
+    char *start = p;
+    while (p < end && !isspace(*p))
+      p++;
+    if (ntok == 4)
+      return;
+    tok[ntok++] = strndup(start, p - start);
+    while (p < end && isspace(*p))
+      p++;
+  }
+
+  if (ntok > 3)
+    return;
+  l->op = tok[0];
+  l->nargs = ntok - 1;
+  for (int i = 1; i < ntok; i++)
+    l->arg[i - 1] = tok[i];
+  if (classify(l))
+    l->kind = LN_INSN;
+}
+
+static void replace_line(int i, char *text) {
+  parse_line(&lines[i], text);
+}
+
+static void delete_line(int i) {
+  lines[i].text = NULL;
+}
+
+static bool is_insn(int i, OpClass cls) {
+  return lines[i].text && lines[i].kind == LN_INSN && lines[i].cls == cls;
+}
+
+// Returns the index of the next live line that is not blank or a comment,
+// or nlines at the end of the text.
+static int next_line(int i) {
+  for (i++; i < nlines; i++)
+    if (lines[i].text && lines[i].kind != LN_BLANK)
+      return i;
+  return nlines;
+}
+
+static int prev_line(int i) {
+  for (i--; i >= 0; i--)
+    if (lines[i].text && lines[i].kind != LN_BLANK)
+      return i;
+  return -1;
+}
+
+// True if the line ends the straight-line window around an instruction.
+static bool ends_window(int i) {
+  Line *l = &lines[i];
+  if (l->kind != LN_INSN)
+    return true;
+  switch (l->cls) {
+  case OP_BARRIER:
+  case OP_JMPN:
+  case OP_UJMPN:
+  case OP_END:
+    return true;
+  }
+  return false;
+}
+
+// The only effect of these instructions is writing their first operand.
+static bool is_pure_write(Line *l) {
+  switch (l->cls) {
+  case OP_ALU_A:
+  case OP_ALU_N:
+  case OP_NOT:
+  case OP_SETA:
+  case OP_SETN:
+    return !l->stack;
+  }
+  return false;
+}
+
+// True if the registers in `reg` are written before they are read on every
+// path starting at line i. Unconditional jumps are followed and conditional
+// jumps check both successors; labels are transparent because only what
+// runs next matters. Anything the pass cannot see through keeps them live.
+static bool is_dead_at(int i, int reg, int budget, int depth) {
+  for (; i < nlines && budget > 0; i = next_line(i), budget--) {
+    Line *l = &lines[i];
+    if (l->kind == LN_LABEL)
+      continue;
+    if (l->kind != LN_INSN || (l->reads & reg))
+      return false;
+    if ((l->writes & reg) == reg)
+      return true;
+    reg &= ~l->writes;
+
+    if (l->cls == OP_END)
+      return !strcmp(l->op, "ret");
+    if (l->cls == OP_BARRIER)
+      return false;
+    if (l->cls != OP_JMPN && l->cls != OP_UJMPN)
+      continue;
+
+    intptr_t target = (intptr_t)hashmap_get(&labels, l->arg[0]);
+    if (!target)
+      return false;
+    if (l->cls == OP_JMPN &&
+        (depth == PEEPHOLE_BRANCH_DEPTH ||
+         !is_dead_at(target - 1, reg, budget - 1, depth + 1)))
+      return false;
+    if (l->cls == OP_UJMPN)
+      i = target - 1;
+  }
+  return false;
+}
+
+static uint64_t parse_imm(char *s, bool *ok) {
+  char *end;
+  uint64_t val = strtoull(s, &end, 0);
+  *ok = *s && !*end;
+  return val;
+}
+
+//
+// Rules
+//
+
+// `addn R 0`, `muln R 1`, `seta R R` and friends.
+static bool rule_identity(int i) {
+  Line *l = &lines[i];
+  if (l->cls == OP_SETA && !strcmp(l->arg[0], l->arg[1])) {
+    delete_line(i);
+    return true;
+  }
+  if (l->cls != OP_ALU_N || l->stack)
+    return false;
+
+  bool ok;
+  uint64_t val = parse_imm(l->arg[1], &ok);
+  if (!ok)
+    return false;
+
+  char *op = l->op;
+  bool identity = false;
+  if (!strcmp(op, "addn") || !strcmp(op, "subn") || !strcmp(op, "orn") ||
+      !strcmp(op, "xorn") || !strcmp(op, "lsn") || !strcmp(op, "rsn"))
+    identity = val == 0;
+  else if (!strcmp(op, "muln") || !strcmp(op, "divn"))
+    identity = val == 1;
+  else if (!strcmp(op, "andn"))
+    identity = val == 0xffffffff;
+
+  if (identity)
+    delete_line(i);
+  return identity;
+}
+
+// `pusha R ... popa S` with no stack use in between and R unchanged
+// becomes `seta S R`.
+static bool rule_push_pop(int i) {
+  if (!is_insn(i, OP_PUSHA))
+    return false;
+
+  int reg = lines[i].reads;
+  int j = next_line(i);
+  for (int n = 0; j < nlines && n < PEEPHOLE_WINDOW; j = next_line(j), n++) {
+    if (is_insn(j, OP_POPA))
+      break;
+    if (ends_window(j) || lines[j].stack || (lines[j].writes & reg))
+      return false;
+  }
+  if (j == nlines || !is_insn(j, OP_POPA))
+    return false;
+
+  char *src = lines[i].arg[0];
+  char *dst = lines[j].arg[0];
+  delete_line(i);
+  if (!strcmp(src, dst))
+    delete_line(j);
+  else
+    replace_line(j, format("seta %s %s", dst, src));
+  return true;
+}
+
+// `seta A B; seta B A`: the second copy is a no-op.
+static bool rule_copy_back(int i) {
+  if (!is_insn(i, OP_SETA))
+    return false;
+  int j = next_line(i);
+  if (j == nlines || !is_insn(j, OP_SETA))
+    return false;
+  if (strcmp(lines[i].arg[0], lines[j].arg[1]) ||
+      strcmp(lines[i].arg[1], lines[j].arg[0]))
+    return false;
+  delete_line(j);
+  return true;
+}
+
+// `setn R K` when R is already known to hold K.
+static bool rule_redundant_const(int i) {
+  if (!is_insn(i, OP_SETN))
+    return false;
+
+  int reg = lines[i].writes;
+  int j = prev_line(i);
+  for (int n = 0; j >= 0 && n < PEEPHOLE_WINDOW; j = prev_line(j), n++) {
+    if (ends_window(j))
+      return false;
+    if (!(lines[j].writes & reg))
+      continue;
+    if (lines[j].cls != OP_SETN || strcmp(lines[j].arg[1], lines[i].arg[1]))
+      return false;
+    delete_line(i);
+    return true;
+  }
+  return false;
+}
+
+// A pure register write whose value is never read.
+static bool rule_dead_write(int i) {
+  Line *l = &lines[i];
+  if (!is_pure_write(l) || !is_dead_at(next_line(i), l->writes, PEEPHOLE_WINDOW, 0))
+    return false;
+  delete_line(i);
+  return true;
+}
+
+// `seta A B` followed by an instruction that only reads A, after which A is
+// dead: the reader uses B directly.
+static bool rule_copy_forward(int i) {
+  if (!is_insn(i, OP_SETA) || gpr(lines[i].arg[1]) < 0)
+    return false;
+  int j = next_line(i);
+  if (j == nlines || lines[j].kind != LN_INSN)
+    return false;
+
+  Line *l = &lines[j];
+  char *a = lines[i].arg[0];
+  char *b = lines[i].arg[1];
+  int first;
+  switch (l->cls) {
+  case OP_CMP_A:
+  case OP_STORE_A:
+    first = 0;
+    break;
+  case OP_ALU_A:
+  case OP_SETA:
+  case OP_LOAD_A:
+    first = 1;
+    break;
+  default:
+    return false;
+  }
+  if (first && !strcmp(l->arg[0], a) && l->cls == OP_ALU_A)
+    return false;
+  if (!(l->reads & lines[i].writes))
+    return false;
+  if (!(l->writes & lines[i].writes) &&
+      !is_dead_at(next_line(j), lines[i].writes, PEEPHOLE_WINDOW, 0))
+    return false;
+
+  char *arg[2] = {l->arg[0], l->arg[1]};
+  for (int k = first; k < 2; k++)
+    if (!strcmp(arg[k], a))
+      arg[k] = b;
+  delete_line(i);
+  replace_line(j, format("%s %s %s", l->op, arg[0], arg[1]));
+  return true;
+}
+
+// `ujmpn L` directly followed by `L:`.
+static bool rule_jump_to_next(int i) {
+  if (!is_insn(i, OP_UJMPN))
+    return false;
+  for (int j = next_line(i); j < nlines && lines[j].kind == LN_LABEL; j = next_line(j)) {
+    if (!strcmp(lines[j].label, lines[i].arg[0])) {
+      delete_line(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+// A jump to a label whose first instruction is `ujmpn M` jumps to M.
+static bool rule_jump_thread(int i) {
+  if (!is_insn(i, OP_JMPN) && !is_insn(i, OP_UJMPN))
+    return false;
+
+  intptr_t target = (intptr_t)hashmap_get(&labels, lines[i].arg[0]);
+  if (!target)
+    return false;
+
+  int j = target - 1;
+  while (j < nlines && lines[j].kind == LN_LABEL)
+    j = next_line(j);
+  if (j == nlines || !is_insn(j, OP_UJMPN))
+    return false;
+
+  char *dest = lines[j].arg[0];
+  if (!strcmp(dest, lines[i].arg[0]) || !hashmap_get(&labels, dest))
+    return false;
+  replace_line(i, format("%s %s", lines[i].op, dest));
+  return true;
+}
+
+// Instructions after an unconditional transfer and before the next label
+// can never execute.
+static bool rule_unreachable(int i) {
+  if (!is_insn(i, OP_UJMPN) && !is_insn(i, OP_END))
+    return false;
+
+  bool changed = false;
+  for (int j = next_line(i); j < nlines && lines[j].kind == LN_INSN; j = next_line(j)) {
+    delete_line(j);
+    changed = true;
+  }
+  return changed;
+}
+
+typedef struct {
+  char *name;
+  bool (*apply)(int i);
+  int fired;
+} PeepholeRule;
+
+static PeepholeRule rules[] = {
+  {"identity", rule_identity},
+  {"push-pop", rule_push_pop},
+  {"copy-back", rule_copy_back},
+  {"redundant-const", rule_redundant_const},
+  {"dead-write", rule_dead_write},
+  {"copy-forward", rule_copy_forward},
+  {"jump-to-next", rule_jump_to_next},
+  {"jump-thread", rule_jump_thread},
+  {"unreachable", rule_unreachable},
+};
+
+static int count_insns(void) {
+  int n = 0;
+  for (int i = 0; i < nlines; i++)
+    if (lines[i].text && lines[i].kind == LN_INSN)
+      n++;
+  return n;
+}
+
+static void split_lines(char *text, size_t len) {
+  int cap = 1024;
+  lines = calloc(cap, sizeof(Line));
+  nlines = 0;
+
+  char *p = text;
+  char *end = text + len;
+  while (p < end) {
+    char *q = memchr(p, '\n', end - p);
+    if (!q)
+      q = end;
+    if (nlines == cap) {
+      cap *= 2;
+      lines = realloc(lines, sizeof(Line) * cap);
+    }
+    *q = '\0';
+    parse_line(&lines[nlines++], p);
+    p = q + 1;
+  }
+}
+
+// Rewrites the code section text of a translation unit and writes it to
+// `out`. `text` is modified in place.
+void peephole_shy(char *text, size_t len, FILE *out) {
+  split_lines(text, len);
+
+  labels = (HashMap){0};
+  for (int i = 0; i < nlines; i++)
+    if (lines[i].kind == LN_LABEL)
+      hashmap_put(&labels, lines[i].label, (void *)(intptr_t)(i + 1));
+
+  int before = count_insns();
+  int nrules = sizeof(rules) / sizeof(*rules);
+  for (int i = 0; i < nrules; i++)
+    rules[i].fired = 0;
+
+  for (int pass = 0; pass < PEEPHOLE_MAX_PASSES; pass++) {
+    bool changed = false;
+    for (int i = 0; i < nlines; i++) {
+      for (int j = 0; j < nrules && lines[i].text && lines[i].kind == LN_INSN; j++) {
+        if (rules[j].apply(i)) {
+          rules[j].fired++;
+          changed = true;
+        }
+      }
+    }
+    if (!changed)
+      break;
+  }
+
+  for (int i = 0; i < nlines; i++)
+    if (lines[i].text)
+      fprintf(out, "%s\n", lines[i].text);
+
+  if (opt_shy_peephole_stats) {
+    fprintf(stderr, "peephole: %s: %d -> %d instructions\n",
+            base_file ? base_file : "-", before, count_insns());
+    for (int i = 0; i < nrules; i++)
+      fprintf(stderr, "peephole:   %-16s %d\n", rules[i].name, rules[i].fired);
+  }
+}
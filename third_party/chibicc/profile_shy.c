@@ -0,0 +1,213 @@
+#include "chibicc.h"
+
+// Profile feedback for the Shy backend.
+//
+// `shyemu --profile` writes, for every `text.<function>` section of a
+// linked image, how often the function was entered and how many of its
+// instructions ran, plus the number of calls along each caller/callee
+// edge (see emu/src/profile.rs for the format). With -fprofile-use the
+// backend reads that file back: hot call edges are inlined with larger
+// size limits, and functions the training run never entered are kept
+// small and emitted after the others.
+//
+// The profile is keyed by symbol name, so it stays usable as long as the
+// functions keep their names; functions it does not mention are compiled
+// as if there were no profile.
+
+// A call edge is hot if it carries at least 1/PROFILE_HOT_SHARE of all
+// profiled calls.
+#define PROFILE_HOT_SHARE 100
+
+typedef struct {
+  uint64_t entries;
+  uint64_t insns;
+} ProfileFn;
+
+static HashMap profile_fns;
+static HashMap profile_edges;
+static uint64_t profile_total_calls;
+
+static char *profile_path;
+static char *cur;
+
+static void json_skip_ws(void) {
+  while (isspace(*cur))
+    cur++;
+}
+
+static void json_expect(char c) {
+  json_skip_ws();
+  if (*cur != c)
+    error("%s: invalid profile: expected '%c'", profile_path, c);
+  cur++;
+}
+
+static bool json_consume(char c) {
+  json_skip_ws();
+  if (*cur != c)
+    return false;
+  cur++;
+  return true;
+}
+
+static char *json_string(void) {
+  json_expect('"');
+  char *buf = calloc(1, strlen(cur) + 1);
+  int len = 0;
+  while (*cur != '"') {
+    if (!*cur)
+      error("%s: invalid profile: unterminated string", profile_path);
+    if (*cur == '\\' && cur[1])
+      cur++;
+    buf[len++] = *cur++;
+  }
+  cur++;
+  return buf;
+}
+
+static uint64_t json_count(void) {
+  json_skip_ws();
+  if (!isdigit(*cur))
+    error("%s: invalid profile: expected a count", profile_path);
+  return strtoull(cur, &cur, 10);
+}
+
+static void json_skip_value(void) {
+  json_skip_ws();
+  if (*cur == '"') {
+    json_string();
+  } else if (json_consume('{')) {
+    if (json_consume('}'))
+      return;
+    do {
+      json_string();
+      json_expect(':');
+      json_skip_value();
+    } while (json_consume(','));
+    json_expect('}');
+  } else if (json_consume('[')) {
+    if (json_consume(']'))
+      return;
+    do {
+      json_skip_value();
+    } while (json_consume(','));
+    json_expect(']');
+  } else {
+    while (*cur && !strchr(",}] \t\r\n", *cur))
+      cur++;
+  }
+}
+
+static char *edge_key(char *caller, char *callee) {
+  return format("%s %s", caller, callee);
+}
+
+static void read_function(void) {
+  char *name = NULL;
+  ProfileFn *fn = calloc(1, sizeof(ProfileFn));
+
+  json_expect('{');
+  if (!json_consume('}')) {
+    do {
+      char *key = json_string();
+      json_expect(':');
+      if (!strcmp(key, "name"))
+        name = json_string();
+      else if (!strcmp(key, "entries"))
+        fn->entries = json_count();
+      else if (!strcmp(key, "insns"))
+        fn->insns = json_count();
+      else
+        json_skip_value();
+    } while (json_consume(','));
+    json_expect('}');
+  }
+
+  if (!name)
+    error("%s: invalid profile: function without a name", profile_path);
+  hashmap_put(&profile_fns, name, fn);
+}
+
+static void read_edge(void) {
+  char *caller = NULL, *callee = NULL;
+  uint64_t *count = calloc(1, sizeof(uint64_t));
+
+  json_expect('{');
+  if (!json_consume('}')) {
+    do {
+      char *key = json_string();
+      json_expect(':');
+      if (!strcmp(key, "caller"))
+        caller = json_string();
+      else if (!strcmp(key, "callee"))
+        callee = json_string();
+      else if (!strcmp(key, "count"))
+        *count = json_count();
+      else
+        json_skip_value();
+    } while (json_consume(','));
+    json_expect('}');
+  }
+
+  if (!caller || !callee)
+    error("%s: invalid profile: edge without a caller or callee", profile_path);
+  hashmap_put(&profile_edges, edge_key(caller, callee), count);
+  profile_total_calls += *count;
+}
+
+static void read_list(void (*read_item)(void)) {
+  json_expect('[');
+  if (json_consume(']'))
+    return;
+  do {
+    read_item();
+  } while (json_consume(','));
+  json_expect(']');
+}
+
+void profile_shy_load(char *path) {
+  FILE *fp = fopen(path, "r");
+  if (!fp)
+    error("cannot open profile: %s: %s", path, strerror(errno));
+
+  char *buf;
+  size_t buflen;
+  FILE *out = open_memstream(&buf, &buflen);
+  char tmp[4096];
+  for (;;) {
+    int n = fread(tmp, 1, sizeof(tmp), fp);
+    if (n == 0)
+      break;
+    fwrite(tmp, 1, n, out);
+  }
+  fclose(fp);
+  fclose(out);
+
+  profile_path = path;
+  cur = buf;
+  json_expect('{');
+  if (!json_consume('}')) {
+    do {
+      char *key = json_string();
+      json_expect(':');
+      if (!strcmp(key, "functions"))
+        read_list(read_function);
+      else if (!strcmp(key, "edges"))
+        read_list(read_edge);
+      else
+        json_skip_value();
+    } while (json_consume(','));
+    json_expect('}');
+  }
+}
+
+// Whether the profile saw `name` but the training run never entered it.
+bool profile_shy_is_cold(char *name) {
+  ProfileFn *fn = hashmap_get(&profile_fns, name);
+  return fn && fn->entries == 0;
+}
+
+bool profile_shy_is_hot_edge(char *caller, char *callee) {
+  uint64_t *count = hashmap_get(&profile_edges, edge_key(caller, callee));
+  return count && *count && *count * PROFILE_HOT_SHARE >= profile_total_calls;
+}